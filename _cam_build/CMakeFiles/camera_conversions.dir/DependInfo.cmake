@@ -0,0 +1,24 @@
+
+# Consider dependencies only in project.
+set(CMAKE_DEPENDS_IN_PROJECT_ONLY OFF)
+
+# The set of languages for which implicit dependencies are needed:
+set(CMAKE_DEPENDS_LANGUAGES
+  )
+
+# The set of dependency files which are needed:
+set(CMAKE_DEPENDS_DEPENDENCY_FILES
+  "/root/repo/components/esp32-camera/conversions/esp_jpg_decode.c" "CMakeFiles/camera_conversions.dir/root/repo/components/esp32-camera/conversions/esp_jpg_decode.c.o" "gcc" "CMakeFiles/camera_conversions.dir/root/repo/components/esp32-camera/conversions/esp_jpg_decode.c.o.d"
+  "/root/repo/components/esp32-camera/conversions/to_bmp.c" "CMakeFiles/camera_conversions.dir/root/repo/components/esp32-camera/conversions/to_bmp.c.o" "gcc" "CMakeFiles/camera_conversions.dir/root/repo/components/esp32-camera/conversions/to_bmp.c.o.d"
+  "/root/repo/components/esp32-camera/conversions/yuv.c" "CMakeFiles/camera_conversions.dir/root/repo/components/esp32-camera/conversions/yuv.c.o" "gcc" "CMakeFiles/camera_conversions.dir/root/repo/components/esp32-camera/conversions/yuv.c.o.d"
+  "/root/repo/components/esp32-camera/target/tjpgd.c" "CMakeFiles/camera_conversions.dir/root/repo/components/esp32-camera/target/tjpgd.c.o" "gcc" "CMakeFiles/camera_conversions.dir/root/repo/components/esp32-camera/target/tjpgd.c.o.d"
+  "/root/repo/components/esp32-camera/conversions/jpge.cpp" "CMakeFiles/camera_conversions.dir/root/repo/components/esp32-camera/conversions/jpge.cpp.o" "gcc" "CMakeFiles/camera_conversions.dir/root/repo/components/esp32-camera/conversions/jpge.cpp.o.d"
+  "/root/repo/components/esp32-camera/conversions/to_jpg.cpp" "CMakeFiles/camera_conversions.dir/root/repo/components/esp32-camera/conversions/to_jpg.cpp.o" "gcc" "CMakeFiles/camera_conversions.dir/root/repo/components/esp32-camera/conversions/to_jpg.cpp.o.d"
+  )
+
+# Targets to which this target links.
+set(CMAKE_TARGET_LINKED_INFO_FILES
+  )
+
+# Fortran module output directory.
+set(CMAKE_Fortran_TARGET_MODULE_DIR "")
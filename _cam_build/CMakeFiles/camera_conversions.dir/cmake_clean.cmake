@@ -0,0 +1,21 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/camera_conversions.dir/root/repo/components/esp32-camera/conversions/esp_jpg_decode.c.o"
+  "CMakeFiles/camera_conversions.dir/root/repo/components/esp32-camera/conversions/esp_jpg_decode.c.o.d"
+  "CMakeFiles/camera_conversions.dir/root/repo/components/esp32-camera/conversions/jpge.cpp.o"
+  "CMakeFiles/camera_conversions.dir/root/repo/components/esp32-camera/conversions/jpge.cpp.o.d"
+  "CMakeFiles/camera_conversions.dir/root/repo/components/esp32-camera/conversions/to_bmp.c.o"
+  "CMakeFiles/camera_conversions.dir/root/repo/components/esp32-camera/conversions/to_bmp.c.o.d"
+  "CMakeFiles/camera_conversions.dir/root/repo/components/esp32-camera/conversions/to_jpg.cpp.o"
+  "CMakeFiles/camera_conversions.dir/root/repo/components/esp32-camera/conversions/to_jpg.cpp.o.d"
+  "CMakeFiles/camera_conversions.dir/root/repo/components/esp32-camera/conversions/yuv.c.o"
+  "CMakeFiles/camera_conversions.dir/root/repo/components/esp32-camera/conversions/yuv.c.o.d"
+  "CMakeFiles/camera_conversions.dir/root/repo/components/esp32-camera/target/tjpgd.c.o"
+  "CMakeFiles/camera_conversions.dir/root/repo/components/esp32-camera/target/tjpgd.c.o.d"
+  "libcamera_conversions.a"
+  "libcamera_conversions.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang C CXX)
+  include(CMakeFiles/camera_conversions.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
@@ -0,0 +1,22 @@
+
+# Consider dependencies only in project.
+set(CMAKE_DEPENDS_IN_PROJECT_ONLY OFF)
+
+# The set of languages for which implicit dependencies are needed:
+set(CMAKE_DEPENDS_LANGUAGES
+  )
+
+# The set of dependency files which are needed:
+set(CMAKE_DEPENDS_DEPENDENCY_FILES
+  "/root/repo/components/esp32-camera/test/host/mock_i2c.c" "CMakeFiles/camera_sccb.dir/mock_i2c.c.o" "gcc" "CMakeFiles/camera_sccb.dir/mock_i2c.c.o.d"
+  "/root/repo/components/esp32-camera/driver/sccb.c" "CMakeFiles/camera_sccb.dir/root/repo/components/esp32-camera/driver/sccb.c.o" "gcc" "CMakeFiles/camera_sccb.dir/root/repo/components/esp32-camera/driver/sccb.c.o.d"
+  "/root/repo/components/esp32-camera/driver/sccb_shadow.c" "CMakeFiles/camera_sccb.dir/root/repo/components/esp32-camera/driver/sccb_shadow.c.o" "gcc" "CMakeFiles/camera_sccb.dir/root/repo/components/esp32-camera/driver/sccb_shadow.c.o.d"
+  "/root/repo/components/esp32-camera/driver/sensor.c" "CMakeFiles/camera_sccb.dir/root/repo/components/esp32-camera/driver/sensor.c.o" "gcc" "CMakeFiles/camera_sccb.dir/root/repo/components/esp32-camera/driver/sensor.c.o.d"
+  )
+
+# Targets to which this target links.
+set(CMAKE_TARGET_LINKED_INFO_FILES
+  )
+
+# Fortran module output directory.
+set(CMAKE_Fortran_TARGET_MODULE_DIR "")
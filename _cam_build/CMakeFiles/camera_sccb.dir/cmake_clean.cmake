@@ -0,0 +1,17 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/camera_sccb.dir/mock_i2c.c.o"
+  "CMakeFiles/camera_sccb.dir/mock_i2c.c.o.d"
+  "CMakeFiles/camera_sccb.dir/root/repo/components/esp32-camera/driver/sccb.c.o"
+  "CMakeFiles/camera_sccb.dir/root/repo/components/esp32-camera/driver/sccb.c.o.d"
+  "CMakeFiles/camera_sccb.dir/root/repo/components/esp32-camera/driver/sccb_shadow.c.o"
+  "CMakeFiles/camera_sccb.dir/root/repo/components/esp32-camera/driver/sccb_shadow.c.o.d"
+  "CMakeFiles/camera_sccb.dir/root/repo/components/esp32-camera/driver/sensor.c.o"
+  "CMakeFiles/camera_sccb.dir/root/repo/components/esp32-camera/driver/sensor.c.o.d"
+  "libcamera_sccb.a"
+  "libcamera_sccb.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang C)
+  include(CMakeFiles/camera_sccb.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
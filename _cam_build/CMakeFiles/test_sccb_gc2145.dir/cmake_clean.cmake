@@ -0,0 +1,11 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/test_sccb_gc2145.dir/test_sccb.c.o"
+  "CMakeFiles/test_sccb_gc2145.dir/test_sccb.c.o.d"
+  "test_sccb_gc2145"
+  "test_sccb_gc2145.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang C)
+  include(CMakeFiles/test_sccb_gc2145.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
@@ -0,0 +1,11 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/test_sccb_nt99141.dir/test_sccb.c.o"
+  "CMakeFiles/test_sccb_nt99141.dir/test_sccb.c.o.d"
+  "test_sccb_nt99141"
+  "test_sccb_nt99141.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang C)
+  include(CMakeFiles/test_sccb_nt99141.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
@@ -0,0 +1,11 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/test_yuv.dir/test_yuv.c.o"
+  "CMakeFiles/test_yuv.dir/test_yuv.c.o.d"
+  "test_yuv"
+  "test_yuv.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang C)
+  include(CMakeFiles/test_yuv.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
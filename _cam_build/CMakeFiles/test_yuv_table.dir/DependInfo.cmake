@@ -0,0 +1,20 @@
+
+# Consider dependencies only in project.
+set(CMAKE_DEPENDS_IN_PROJECT_ONLY OFF)
+
+# The set of languages for which implicit dependencies are needed:
+set(CMAKE_DEPENDS_LANGUAGES
+  )
+
+# The set of dependency files which are needed:
+set(CMAKE_DEPENDS_DEPENDENCY_FILES
+  "/root/repo/components/esp32-camera/conversions/yuv.c" "CMakeFiles/test_yuv_table.dir/root/repo/components/esp32-camera/conversions/yuv.c.o" "gcc" "CMakeFiles/test_yuv_table.dir/root/repo/components/esp32-camera/conversions/yuv.c.o.d"
+  "/root/repo/components/esp32-camera/test/host/test_yuv.c" "CMakeFiles/test_yuv_table.dir/test_yuv.c.o" "gcc" "CMakeFiles/test_yuv_table.dir/test_yuv.c.o.d"
+  )
+
+# Targets to which this target links.
+set(CMAKE_TARGET_LINKED_INFO_FILES
+  )
+
+# Fortran module output directory.
+set(CMAKE_Fortran_TARGET_MODULE_DIR "")
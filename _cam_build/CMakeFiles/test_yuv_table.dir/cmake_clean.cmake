@@ -0,0 +1,13 @@
+file(REMOVE_RECURSE
+  "CMakeFiles/test_yuv_table.dir/root/repo/components/esp32-camera/conversions/yuv.c.o"
+  "CMakeFiles/test_yuv_table.dir/root/repo/components/esp32-camera/conversions/yuv.c.o.d"
+  "CMakeFiles/test_yuv_table.dir/test_yuv.c.o"
+  "CMakeFiles/test_yuv_table.dir/test_yuv.c.o.d"
+  "test_yuv_table"
+  "test_yuv_table.pdb"
+)
+
+# Per-language clean rules from dependency scanning.
+foreach(lang C)
+  include(CMakeFiles/test_yuv_table.dir/cmake_clean_${lang}.cmake OPTIONAL)
+endforeach()
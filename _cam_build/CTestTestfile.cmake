@@ -0,0 +1,18 @@
+# CMake generated Testfile for 
+# Source directory: /root/repo/components/esp32-camera/test/host
+# Build directory: /root/repo/_cam_build
+# 
+# This file includes the relevant testing commands required for 
+# testing this directory and lists subdirectories to be tested as well.
+add_test(test_yuv "/root/repo/_cam_build/test_yuv")
+set_tests_properties(test_yuv PROPERTIES  _BACKTRACE_TRIPLES "/root/repo/components/esp32-camera/test/host/CMakeLists.txt;95;add_test;/root/repo/components/esp32-camera/test/host/CMakeLists.txt;0;")
+add_test(test_yuv_table "/root/repo/_cam_build/test_yuv_table")
+set_tests_properties(test_yuv_table PROPERTIES  _BACKTRACE_TRIPLES "/root/repo/components/esp32-camera/test/host/CMakeLists.txt;97;add_test;/root/repo/components/esp32-camera/test/host/CMakeLists.txt;0;")
+add_test(test_jpeg "/root/repo/_cam_build/test_jpeg")
+set_tests_properties(test_jpeg PROPERTIES  _BACKTRACE_TRIPLES "/root/repo/components/esp32-camera/test/host/CMakeLists.txt;99;add_test;/root/repo/components/esp32-camera/test/host/CMakeLists.txt;0;")
+add_test(test_sccb_ov5640 "/root/repo/_cam_build/test_sccb_ov5640")
+set_tests_properties(test_sccb_ov5640 PROPERTIES  _BACKTRACE_TRIPLES "/root/repo/components/esp32-camera/test/host/CMakeLists.txt;101;add_test;/root/repo/components/esp32-camera/test/host/CMakeLists.txt;0;")
+add_test(test_sccb_nt99141 "/root/repo/_cam_build/test_sccb_nt99141")
+set_tests_properties(test_sccb_nt99141 PROPERTIES  _BACKTRACE_TRIPLES "/root/repo/components/esp32-camera/test/host/CMakeLists.txt;101;add_test;/root/repo/components/esp32-camera/test/host/CMakeLists.txt;0;")
+add_test(test_sccb_gc2145 "/root/repo/_cam_build/test_sccb_gc2145")
+set_tests_properties(test_sccb_gc2145 PROPERTIES  _BACKTRACE_TRIPLES "/root/repo/components/esp32-camera/test/host/CMakeLists.txt;101;add_test;/root/repo/components/esp32-camera/test/host/CMakeLists.txt;0;")
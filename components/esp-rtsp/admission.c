@@ -0,0 +1,103 @@
+//
+// Admission of RTSP streams by the bandwidth they need, see admission.h
+//
+
+#include <stdint.h>
+#include <esp_log.h>
+
+#include "admission.h"
+#include "rtsp-metrics.h"
+
+#define TAG "admission"
+
+#ifndef RTSP_UPLINK_KBPS
+#define RTSP_UPLINK_KBPS 0 // Capacity of the uplink until it is measured, 0 admits every stream until then
+#endif
+
+#ifndef RTSP_ADMISSION_HEADROOM_PERCENT
+#define RTSP_ADMISSION_HEADROOM_PERCENT 80 // Of the uplink capacity the streams may take together
+#endif
+
+#ifndef RTSP_ADMISSION_MIN_FPS
+#define RTSP_ADMISSION_MIN_FPS 1 // A stream that does not fit at this frame rate is refused
+#endif
+
+// Weight of a new sample in the estimates, 1/4
+#define EWMA(average, sample) ((average) ? ((average) * 3 + (sample)) / 4 : (sample))
+
+static uint32_t capacity_kbps = RTSP_UPLINK_KBPS;
+static bool capacity_set;       // By the application, it is not measured then
+static uint32_t frame_bytes;    // Of a stream, with the RTP headers
+static uint32_t stream_mfps;    // Frames per second of a stream, in thousandths
+
+void admission_sample(uint64_t bytes, uint32_t frames, uint32_t congested, int streams, int64_t elapsed_us) {
+    if (elapsed_us <= 0 || !streams || !frames) {
+        return;
+    }
+
+    frame_bytes = EWMA(frame_bytes, bytes / frames);
+    stream_mfps = EWMA(stream_mfps, (uint64_t)frames * 1000000000 / streams / elapsed_us);
+
+    if (__atomic_load_n(&capacity_set, __ATOMIC_RELAXED)) {
+        return;
+    }
+
+    // What got through while the uplink was full is what it carries. It is only raised to what got
+    // through without trouble, never beyond what was measured, the uplink may have gotten better.
+    uint32_t capacity = __atomic_load_n(&capacity_kbps, __ATOMIC_RELAXED);
+    uint32_t throughput_kbps = bytes * 8000 / elapsed_us;
+    if (congested) {
+        capacity = capacity ? (capacity + throughput_kbps) / 2 : throughput_kbps;
+    } else if (capacity && throughput_kbps > capacity) {
+        capacity = throughput_kbps;
+    }
+    __atomic_store_n(&capacity_kbps, capacity, __ATOMIC_RELAXED);
+    esp_metric_set(&metric_uplink_capacity_kbps, capacity);
+}
+
+bool admission_admit(uint32_t used_kbps, uint32_t stream_kbps, uint32_t *interval_ms, uint32_t *kbps) {
+    uint32_t capacity = __atomic_load_n(&capacity_kbps, __ATOMIC_RELAXED);
+    uint32_t mfps = stream_mfps ? stream_mfps : 1000000 / *interval_ms;
+    uint64_t frame_bits = (uint64_t)frame_bytes * 8;
+    *kbps = stream_kbps ? stream_kbps : frame_bits * mfps / 1000000;
+    if (stream_kbps && mfps) {
+        frame_bits = (uint64_t)stream_kbps * 1000000 / mfps;
+    }
+    if (!capacity || !frame_bits) {
+        esp_metric_add(&metric_admission_admitted, 1);
+        return true;
+    }
+
+    uint32_t budget_kbps = (uint64_t)capacity * RTSP_ADMISSION_HEADROOM_PERCENT / 100;
+    uint32_t free_kbps = budget_kbps > used_kbps ? budget_kbps - used_kbps : 0;
+    if (*kbps <= free_kbps) {
+        esp_metric_add(&metric_admission_admitted, 1);
+        return true;
+    }
+
+    uint32_t fit_mfps = (uint64_t)free_kbps * 1000000 / frame_bits;
+    if (fit_mfps < RTSP_ADMISSION_MIN_FPS * 1000) {
+        ESP_LOGW(TAG, "No room for a stream of %u kbps, %u of %u kbps taken",
+                 (unsigned)*kbps, (unsigned)used_kbps, (unsigned)budget_kbps);
+        esp_metric_add(&metric_admission_refused, 1);
+        return false;
+    }
+
+    uint32_t reduced_ms = 1000000 / fit_mfps + 1;
+    ESP_LOGI(TAG, "Room for a stream of %u of %u kbps, a frame every %u ms",
+             (unsigned)free_kbps, (unsigned)*kbps, (unsigned)reduced_ms);
+    *interval_ms = reduced_ms > *interval_ms ? reduced_ms : *interval_ms;
+    *kbps = free_kbps;
+    esp_metric_add(&metric_admission_reduced, 1);
+    return true;
+}
+
+uint32_t admission_capacity_kbps(void) {
+    return __atomic_load_n(&capacity_kbps, __ATOMIC_RELAXED);
+}
+
+void admission_set_capacity_kbps(uint32_t kbps) {
+    __atomic_store_n(&capacity_set, kbps != 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&capacity_kbps, kbps, __ATOMIC_RELAXED);
+    esp_metric_set(&metric_uplink_capacity_kbps, kbps);
+}
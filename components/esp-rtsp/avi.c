@@ -0,0 +1,323 @@
+//
+// MJPEG in AVI files that survive a power loss, see avi.h
+//
+
+#include <stdbool.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <esp_log.h>
+
+#include "avi.h"
+
+#define TAG "avi"
+
+#define AVIF_HASINDEX 0x10
+
+// The headers up to the JUNK chunk, avih and strh/strf of the one video stream
+#define AVIH_OFFSET 32
+#define STRH_OFFSET 108
+#define STRF_OFFSET 172
+#define JUNK_OFFSET 212
+
+static void put16(uint8_t *p, uint16_t value) {
+    p[0] = value;
+    p[1] = value >> 8;
+}
+
+static void put32(uint8_t *p, uint32_t value) {
+    put16(p, value);
+    put16(p + 2, value >> 16);
+}
+
+static uint32_t get32(const uint8_t *p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static void put_chunk(uint8_t *p, const char *id, uint32_t size) {
+    memcpy(p, id, 4);
+    put32(p + 4, size);
+}
+
+static bool write_all(int fd, const void *data, size_t length) {
+    const uint8_t *p = data;
+    while (length > 0) {
+        ssize_t n = write(fd, p, length);
+        if (n <= 0) {
+            return false;
+        }
+        p += n;
+        length -= n;
+    }
+    return true;
+}
+
+static bool read_at(int fd, uint32_t offset, void *data, size_t length) {
+    return lseek(fd, offset, SEEK_SET) == offset && read(fd, data, length) == length;
+}
+
+static bool write_at(int fd, uint32_t offset, const void *data, size_t length) {
+    return lseek(fd, offset, SEEK_SET) == offset && write_all(fd, data, length);
+}
+
+// The headers up to the 'movi' list, header_size bytes with the list header at the end
+static void init_header(uint8_t *header, size_t header_size, uint16_t width, uint16_t height) {
+    memset(header, 0, header_size);
+    put_chunk(header, "RIFF", header_size - 8);
+    memcpy(header + 8, "AVI ", 4);
+    put_chunk(header + 12, "LIST", JUNK_OFFSET - 20);
+    memcpy(header + 20, "hdrl", 4);
+
+    put_chunk(header + AVIH_OFFSET - 8, "avih", 56);
+    put32(header + AVIH_OFFSET + 24, 1);      // Streams
+    put32(header + AVIH_OFFSET + 32, width);
+    put32(header + AVIH_OFFSET + 36, height);
+
+    put_chunk(header + STRH_OFFSET - 20, "LIST", JUNK_OFFSET - (STRH_OFFSET - 12));
+    memcpy(header + STRH_OFFSET - 12, "strl", 4);
+    put_chunk(header + STRH_OFFSET - 8, "strh", 56);
+    memcpy(header + STRH_OFFSET, "vids", 4);
+    memcpy(header + STRH_OFFSET + 4, "MJPG", 4);
+    put32(header + STRH_OFFSET + 24, 1000000); // Rate, the scale is the time of a frame in us
+    put32(header + STRH_OFFSET + 40, UINT32_MAX); // Default quality
+    put16(header + STRH_OFFSET + 52, width);
+    put16(header + STRH_OFFSET + 54, height);
+
+    put_chunk(header + STRF_OFFSET - 8, "strf", 40);
+    put32(header + STRF_OFFSET, 40);
+    put32(header + STRF_OFFSET + 4, width);
+    put32(header + STRF_OFFSET + 8, height);
+    put16(header + STRF_OFFSET + 12, 1);  // Planes
+    put16(header + STRF_OFFSET + 14, 24); // Bits per pixel
+    memcpy(header + STRF_OFFSET + 16, "MJPG", 4);
+    put32(header + STRF_OFFSET + 20, (uint32_t)width * height * 3);
+
+    put_chunk(header + JUNK_OFFSET, "JUNK", header_size - 12 - JUNK_OFFSET - 8);
+    put_chunk(header + header_size - 12, "LIST", 4);
+    memcpy(header + header_size - 4, "movi", 4);
+}
+
+// The sizes and the frame count in the headers, for a file that ends at end
+static void set_sizes(uint8_t *header, size_t header_size, uint32_t end, uint32_t movi_end, uint32_t frames,
+                      uint32_t us_per_frame, uint32_t max_frame, bool indexed) {
+    put32(header + 4, end - 8);
+    put32(header + header_size - 8, movi_end - (header_size - 4));
+
+    if (us_per_frame) {
+        put32(header + AVIH_OFFSET, us_per_frame);
+        put32(header + STRH_OFFSET + 20, us_per_frame);
+    }
+    if (max_frame) {
+        put32(header + AVIH_OFFSET + 28, max_frame);
+        put32(header + STRH_OFFSET + 36, max_frame);
+    }
+    put32(header + AVIH_OFFSET + 12, indexed ? AVIF_HASINDEX : 0);
+    put32(header + AVIH_OFFSET + 16, frames);
+    put32(header + STRH_OFFSET + 32, frames);
+}
+
+void avi_chunk_header(uint8_t *out, uint32_t size) {
+    put_chunk(out, AVI_FRAME_ID, size);
+}
+
+void avi_index_path(const char *path, char *out, size_t size) {
+    const char *dot = strrchr(path, '.');
+    size_t length = dot && !strchr(dot, '/') ? (size_t)(dot - path) : strlen(path);
+    snprintf(out, size, "%.*s.idx", (int)length, path);
+}
+
+esp_err_t avi_open(avi_file_t *avi, const char *path, size_t cluster_size, uint16_t width, uint16_t height) {
+    if (cluster_size < AVI_HEADER_MIN_SIZE || (cluster_size & (cluster_size - 1))) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    char index_path[sizeof(avi->path) + 4];
+    avi_index_path(path, index_path, sizeof(index_path));
+
+    memset(avi, 0, sizeof(avi_file_t));
+    snprintf(avi->path, sizeof(avi->path), "%s", path);
+    avi->cluster_size = cluster_size;
+    avi->header = malloc(cluster_size);
+    avi->fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    avi->index_fd = open(index_path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (!avi->header || avi->fd < 0 || avi->index_fd < 0) {
+        ESP_LOGE(TAG, "Unable to create %s: errno %d", path, errno);
+        esp_err_t err = avi->header ? ESP_FAIL : ESP_ERR_NO_MEM;
+        if (avi->fd >= 0) {
+            close(avi->fd);
+            unlink(path);
+        }
+        if (avi->index_fd >= 0) {
+            close(avi->index_fd);
+            unlink(index_path);
+        }
+        free(avi->header);
+        return err;
+    }
+
+    init_header(avi->header, cluster_size, width, height);
+    avi->end = avi->movi_end = cluster_size;
+    if (!write_all(avi->fd, avi->header, cluster_size)) {
+        avi_close(avi, NULL, 0);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+esp_err_t avi_write(avi_file_t *avi, const void *data, size_t length, const avi_index_entry_t *entries, size_t count) {
+    if (!write_all(avi->fd, data, length)) {
+        ESP_LOGE(TAG, "Write failed: errno %d", errno);
+        return ESP_FAIL;
+    }
+    avi->end += length;
+
+    if (count && !write_all(avi->index_fd, entries, count * sizeof(avi_index_entry_t))) {
+        ESP_LOGE(TAG, "Index write failed: errno %d", errno);
+        return ESP_FAIL;
+    }
+    for (size_t i = 0; i < count; i++) {
+        if (entries[i].size > avi->max_frame) {
+            avi->max_frame = entries[i].size;
+        }
+    }
+    if (count) {
+        const avi_index_entry_t *last = &entries[count - 1];
+        avi->movi_end = avi->cluster_size - 4 + last->offset + AVI_CHUNK_HEADER_SIZE + ((last->size + 1) & ~1u);
+        avi->frames += count;
+    }
+    return ESP_OK;
+}
+
+esp_err_t avi_sync(avi_file_t *avi) {
+    // The frames and their entries are on the card before the header counts them
+    if (fsync(avi->fd) != 0 || fsync(avi->index_fd) != 0) {
+        return ESP_FAIL;
+    }
+    set_sizes(avi->header, avi->cluster_size, avi->movi_end, avi->movi_end, avi->frames,
+              avi->us_per_frame, avi->max_frame, false);
+    bool ok = write_at(avi->fd, 0, avi->header, avi->cluster_size) && fsync(avi->fd) == 0;
+    return ok && lseek(avi->fd, avi->end, SEEK_SET) == avi->end ? ESP_OK : ESP_FAIL;
+}
+
+// Appends idx1 at movi_end with the first frames entries of the index file, returns the end of the file
+static uint32_t write_index(int fd, int index_fd, uint32_t movi_end, uint32_t frames, void *scratch,
+                            size_t scratch_size) {
+    uint8_t chunk[AVI_CHUNK_HEADER_SIZE];
+    put_chunk(chunk, "idx1", frames * sizeof(avi_index_entry_t));
+    if (!write_at(fd, movi_end, chunk, sizeof(chunk)) || lseek(index_fd, 0, SEEK_SET) != 0) {
+        return 0;
+    }
+
+    size_t remaining = frames * sizeof(avi_index_entry_t);
+    while (remaining > 0) {
+        size_t length = remaining < scratch_size ? remaining : scratch_size;
+        if (read(index_fd, scratch, length) != length || !write_all(fd, scratch, length)) {
+            return 0;
+        }
+        remaining -= length;
+    }
+    return movi_end + sizeof(chunk) + frames * sizeof(avi_index_entry_t);
+}
+
+esp_err_t avi_close(avi_file_t *avi, void *scratch, size_t scratch_size) {
+    uint32_t end = 0;
+    if (scratch && avi->frames) {
+        end = write_index(avi->fd, avi->index_fd, avi->movi_end, avi->frames, scratch, scratch_size);
+    }
+    if (end) {
+        set_sizes(avi->header, avi->cluster_size, end, avi->movi_end, avi->frames,
+                  avi->us_per_frame, avi->max_frame, true);
+        if (!write_at(avi->fd, 0, avi->header, avi->cluster_size) || ftruncate(avi->fd, end) != 0) {
+            end = 0;
+        }
+    }
+    close(avi->fd);
+    close(avi->index_fd);
+    free(avi->header);
+    avi->header = NULL;
+
+    // Without the index in the AVI the index file stays for avi_recover()
+    char index_path[sizeof(avi->path) + 4];
+    avi_index_path(avi->path, index_path, sizeof(index_path));
+    if (end) {
+        unlink(index_path);
+    } else if (!avi->frames) {
+        unlink(index_path);
+        unlink(avi->path);
+    }
+    return end || !avi->frames ? ESP_OK : ESP_FAIL;
+}
+
+// The offset of the 'movi' list, after the headers and the padding
+static uint32_t find_movi(int fd, uint32_t length) {
+    uint8_t chunk[12];
+    uint32_t position = 12;
+    while (position + sizeof(chunk) <= length && read_at(fd, position, chunk, sizeof(chunk))) {
+        if (memcmp(chunk, "LIST", 4) == 0 && memcmp(chunk + 8, "movi", 4) == 0) {
+            return position;
+        }
+        position += AVI_CHUNK_HEADER_SIZE + ((get32(chunk + 4) + 1) & ~1u);
+    }
+    return 0;
+}
+
+esp_err_t avi_recover(const char *path, void *scratch, size_t scratch_size) {
+    char index_path[128];
+    avi_index_path(path, index_path, sizeof(index_path));
+
+    struct stat st;
+    int fd = open(path, O_RDWR);
+    int index_fd = open(index_path, O_RDONLY);
+    uint32_t movi = fd >= 0 && fstat(fd, &st) == 0 ? find_movi(fd, st.st_size) : 0;
+    uint8_t *header = movi ? malloc(movi + 12) : NULL;
+    esp_err_t err = ESP_FAIL;
+    if (!header || index_fd < 0 || !read_at(fd, 0, header, movi + 12) || memcmp(header, "RIFF", 4) != 0) {
+        goto done;
+    }
+
+    // What the last sync wrote, the frames after it may not all be on the card
+    uint32_t movi_end = get32(header + 4) + 8;
+    uint32_t frames = get32(header + AVIH_OFFSET + 16);
+    if (get32(header + AVIH_OFFSET + 12) & AVIF_HASINDEX) {
+        err = ESP_OK; // Closed after all, only the index file was left
+        goto done;
+    }
+    if (fstat(index_fd, &st) != 0 || frames > st.st_size / sizeof(avi_index_entry_t)) {
+        goto done;
+    }
+    if (!frames) {
+        close(fd);
+        fd = -1;
+        unlink(path);
+        err = ESP_OK;
+        goto done;
+    }
+
+    uint32_t end = write_index(fd, index_fd, movi_end, frames, scratch, scratch_size);
+    if (end) {
+        set_sizes(header, movi + 12, end, movi_end, frames, 0, 0, true);
+        if (write_at(fd, 0, header, movi + 12) && ftruncate(fd, end) == 0) {
+            ESP_LOGI(TAG, "Recovered %u frames of %s", (unsigned)frames, path);
+            err = ESP_OK;
+        }
+    }
+
+    done:
+    free(header);
+    if (fd >= 0) {
+        close(fd);
+    }
+    if (index_fd >= 0) {
+        close(index_fd);
+    }
+    if (err == ESP_OK) {
+        unlink(index_path);
+    } else {
+        ESP_LOGW(TAG, "Unable to recover %s", path);
+    }
+    return err;
+}
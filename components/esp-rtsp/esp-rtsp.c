@@ -10,24 +10,59 @@
 #include "esp-rtsp.h"
 #include "esp-rtsp-priv.h"
 #include "esp-rtsp-common.h"
+#include "frames.h"
+#include "rtsp-metrics.h"
+#include "timeshift.h"
+#include "admission.h"
 
 #define TAG "rtsp-server"
 
+#ifndef RTSP_TIMESHIFT_SIZE
+#ifdef CONFIG_SPIRAM
+#define RTSP_TIMESHIFT_SIZE (4 * 1024 * 1024) // PSRAM for replay with PLAY ranges, halved until it fits
+#else
+#define RTSP_TIMESHIFT_SIZE 0
+#endif
+#endif
+
+#define TIMESHIFT_MIN_SIZE (512 * 1024)
+
 static void rtsp_server_task(void *pvParameters) {
     rtsp_server_main();
     vTaskDelete(NULL);
 }
 
+static void http_server_task(void *pvParameters) {
+    http_server_main(HTTP_PORT);
+    vTaskDelete(NULL);
+}
+
 esp_err_t esp_rtsp_server_start(esp_rtsp_server_handle_t *handle) {
     if (!handle) {
         return ESP_ERR_INVALID_ARG;
     }
 
+    rtsp_metrics_init();
+    esp_err_t err = frames_init();
+    if (err != ESP_OK) {
+        return err;
+    }
+
     esp_rtsp_server_t *server = calloc(1, sizeof(esp_rtsp_server_t));
     if (!server) {
         return ESP_ERR_NO_MEM;
     }
 
+    // Left running by esp_rtsp_server_stop(), the players that read from it are not stopped either.
+    // It buffers from when the camera is up, see frames_set_ready().
+    size_t timeshift_size = RTSP_TIMESHIFT_SIZE;
+    while (!timeshift_running() && timeshift_size >= TIMESHIFT_MIN_SIZE && timeshift_start(timeshift_size) != ESP_OK) {
+        timeshift_size /= 2;
+    }
+    if (RTSP_TIMESHIFT_SIZE && !timeshift_running()) {
+        ESP_LOGW(TAG, "No room for a time-shift buffer, PLAY ranges start live");
+    }
+
     BaseType_t result = xTaskCreate(rtsp_server_task, "rtsp_tcp_server", SERVER_STACKSIZE, NULL, SERVER_PRIORITY, &server->server_taskhandle);
     if (result != pdPASS) {
         ESP_LOGE(TAG, "Failed to create rtsp server task: %d", result);
@@ -35,6 +70,14 @@ esp_err_t esp_rtsp_server_start(esp_rtsp_server_handle_t *handle) {
         return ESP_FAIL;
     }
 
+    if (HTTP_PORT) {
+        result = xTaskCreate(http_server_task, "http_tcp_server", HTTP_SERVER_STACKSIZE, NULL, SERVER_PRIORITY, &server->http_taskhandle);
+        if (result != pdPASS) {
+            ESP_LOGW(TAG, "Failed to create http server task: %d", result);
+            server->http_taskhandle = NULL;
+        }
+    }
+
     server->running = true;
     *handle = server;
 
@@ -50,10 +93,37 @@ esp_err_t esp_rtsp_server_stop(esp_rtsp_server_handle_t handle) {
 
     if (server->running) {
         vTaskDelete(server->server_taskhandle);
+        if (server->http_taskhandle) {
+            vTaskDelete(server->http_taskhandle);
+        }
         server->running = false;
     }
 
     free(server);
 
     return ESP_OK;
-}
\ No newline at end of file
+}
+
+esp_err_t esp_rtsp_server_set_motion_callback(esp_rtsp_server_handle_t handle, esp_motion_cb_t cb, void *arg) {
+    if (!handle) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    frames_set_motion_callback(cb, arg);
+    return ESP_OK;
+}
+
+void esp_rtsp_server_set_source_ready(bool ready) {
+    frames_set_ready(ready);
+}
+
+void esp_rtsp_server_set_uplink_capacity(uint32_t kbps) {
+    admission_set_capacity_kbps(kbps);
+}
+
+esp_err_t esp_rtsp_server_register_source(esp_rtsp_server_handle_t handle, const char *path, esp_media_source_t *source) {
+    if (!handle) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    return rtsp_server_register_source(path, source);
+}
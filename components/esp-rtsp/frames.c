@@ -0,0 +1,278 @@
+//
+// Frames of the camera shared between the streams, see frames.h
+//
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include "esp-trace.h"
+#include "esp-media-source.h"
+#include "frames.h"
+#include "rtsp-metrics.h"
+
+#define TAG "frames"
+
+#ifndef RTSP_KEEP_LATEST_FRAME
+#define RTSP_KEEP_LATEST_FRAME 1 // Keep the most recent frame for snapshots, needs a fb_count of 2 or more
+#endif
+
+// More than the driver has frame buffers, streams only hold frames it handed out
+#define FRAMES_MAX 4
+
+#define CAMERA_READY_WAIT_MS 1000 // How long a stream of the camera source waits for it before it looks whether to stop
+
+static shared_frame_t frames[FRAMES_MAX];
+static shared_frame_t *latest;
+static uint32_t last_seq;
+static bool capturing;
+static SemaphoreHandle_t lock;
+static volatile bool ready = true; // esp_camera_fb_get() asserts before esp_camera_init() is done
+
+static esp_motion_t *motion;        // While motion_users is above 0
+static int motion_users;
+static esp_motion_cb_t motion_cb;
+static void *motion_cb_arg;
+static SemaphoreHandle_t motion_lock; // Held while the detector compares a frame
+
+esp_err_t frames_init(void) {
+    if (!lock) {
+        lock = xSemaphoreCreateMutex();
+    }
+    if (!motion_lock) {
+        motion_lock = xSemaphoreCreateMutex();
+    }
+    return lock && motion_lock ? ESP_OK : ESP_ERR_NO_MEM;
+}
+
+void frames_set_ready(bool is_ready) {
+    ready = is_ready;
+}
+
+bool frames_wait_ready(uint32_t timeout_ms) {
+    for (uint32_t waited_ms = 0; !ready && waited_ms < timeout_ms; waited_ms += 10) {
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    return ready;
+}
+
+// Called with the lock held
+static void release(shared_frame_t *frame) {
+    if (!frame || --frame->refs > 0) {
+        return;
+    }
+    esp_camera_fb_return(frame->fb);
+    frame->fb = NULL;
+    if (frame == latest) {
+        latest = NULL;
+    }
+}
+
+esp_err_t frames_motion_enable(const esp_motion_config_t *config) {
+    esp_motion_config_t defaults = ESP_MOTION_CONFIG_DEFAULT();
+    esp_err_t err = ESP_OK;
+    xSemaphoreTake(motion_lock, portMAX_DELAY);
+    if (!motion || config) {
+        esp_motion_t *created;
+        err = esp_motion_create(config ? config : &defaults, &created);
+        if (err == ESP_OK) {
+            esp_motion_set_callback(created, motion_cb, motion_cb_arg);
+            esp_motion_delete(motion);
+            motion = created;
+        }
+    }
+    if (err == ESP_OK) {
+        motion_users++;
+    }
+    xSemaphoreGive(motion_lock);
+    return err;
+}
+
+void frames_motion_disable(void) {
+    xSemaphoreTake(motion_lock, portMAX_DELAY);
+    if (motion_users > 0 && --motion_users == 0) {
+        esp_motion_delete(motion);
+        motion = NULL;
+    }
+    xSemaphoreGive(motion_lock);
+}
+
+void frames_set_motion_callback(esp_motion_cb_t cb, void *arg) {
+    xSemaphoreTake(motion_lock, portMAX_DELAY);
+    motion_cb = cb;
+    motion_cb_arg = arg;
+    if (motion) {
+        esp_motion_set_callback(motion, cb, arg);
+    }
+    xSemaphoreGive(motion_lock);
+}
+
+// Once per frame captured, frames the detector cannot compare count as motion
+static bool detect_motion(const camera_fb_t *fb) {
+    bool moved = true;
+    xSemaphoreTake(motion_lock, portMAX_DELAY);
+    if (motion && fb->format == PIXFORMAT_JPEG) {
+        int64_t timestamp_us = (int64_t)fb->timestamp.tv_sec * 1000000 + fb->timestamp.tv_usec;
+        esp_motion_process(motion, fb->buf, fb->len, timestamp_us, NULL);
+        moved = esp_motion_active(motion);
+    }
+    xSemaphoreGive(motion_lock);
+    return moved;
+}
+
+// Called with the lock held
+static shared_frame_t *publish(camera_fb_t *fb, bool moved) {
+    shared_frame_t *frame = NULL;
+    for (int i = 0; i < FRAMES_MAX && !frame; i++) {
+        if (!frames[i].fb) {
+            frame = &frames[i];
+        }
+    }
+    if (!frame) {
+        ESP_LOGW(TAG, "More frames out than the driver has buffers");
+        esp_metric_add(&metric_drop_no_buffer, 1);
+        esp_camera_fb_return(fb);
+        return NULL;
+    }
+
+    frame->fb = fb;
+    frame->seq = ++last_seq;
+    frame->captured_us = esp_timer_get_time();
+    frame->motion = moved;
+    frame->refs = RTSP_KEEP_LATEST_FRAME ? 1 : 0;
+
+    shared_frame_t *previous = latest;
+    latest = frame;
+    if (RTSP_KEEP_LATEST_FRAME) {
+        release(previous);
+    }
+    return frame;
+}
+
+shared_frame_t *frames_get(uint32_t *seq) {
+    for (;;) {
+        if (!ready) {
+            return NULL;
+        }
+        xSemaphoreTake(lock, portMAX_DELAY);
+        // A stream that just started wants the next frame, not one captured before it asked
+        if (!*seq) {
+            *seq = last_seq;
+        }
+        if (latest && latest->seq != *seq) {
+            shared_frame_t *frame = latest;
+            frame->refs++;
+            *seq = frame->seq;
+            xSemaphoreGive(lock);
+            return frame;
+        }
+        if (!capturing) {
+            break;
+        }
+        xSemaphoreGive(lock);
+        vTaskDelay(1); // Another stream is capturing the next frame
+    }
+    capturing = true;
+    xSemaphoreGive(lock);
+
+    int64_t start = esp_timer_get_time();
+    ESP_TRACE(CAPTURE_BEGIN, 0, 0);
+    camera_fb_t *fb = esp_camera_fb_get();
+    ESP_TRACE(CAPTURE_END, last_seq + 1, fb ? fb->len : 0); // Only the capturing stream counts up last_seq
+    if (fb) {
+        esp_metric_observe(&metric_capture_us, esp_timer_get_time() - start);
+    } else {
+        esp_metric_add(&metric_drop_capture, 1);
+    }
+    bool moved = fb && detect_motion(fb);
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    capturing = false;
+    shared_frame_t *frame = fb ? publish(fb, moved) : NULL;
+    if (frame) {
+        frame->refs++;
+        *seq = frame->seq;
+    }
+    xSemaphoreGive(lock);
+    return frame;
+}
+
+shared_frame_t *frames_latest(int64_t max_age_us) {
+    xSemaphoreTake(lock, portMAX_DELAY);
+    shared_frame_t *frame = latest;
+    if (frame && esp_timer_get_time() - frame->captured_us <= max_age_us) {
+        frame->refs++;
+    } else {
+        frame = NULL;
+    }
+    xSemaphoreGive(lock);
+    return frame;
+}
+
+void frames_return(shared_frame_t *frame) {
+    if (!frame) {
+        return;
+    }
+    xSemaphoreTake(lock, portMAX_DELAY);
+    release(frame);
+    xSemaphoreGive(lock);
+}
+
+// The camera as a media source, a stream of it is the seq of the last frame it got
+
+static esp_err_t camera_start(esp_media_source_t *source, void **stream) {
+    uint32_t *seq = calloc(1, sizeof(uint32_t));
+    if (!seq) {
+        return ESP_ERR_NO_MEM;
+    }
+    *stream = seq;
+    return ESP_OK;
+}
+
+static esp_err_t camera_next_frame(esp_media_source_t *source, void *stream, esp_media_frame_t *media) {
+    if (!frames_wait_ready(CAMERA_READY_WAIT_MS)) {
+        return ESP_ERR_TIMEOUT;
+    }
+    shared_frame_t *frame = frames_get(stream);
+    if (!frame) {
+        return ESP_FAIL;
+    }
+    camera_fb_t *fb = frame->fb;
+    *media = (esp_media_frame_t) {
+            .buf = fb->buf,
+            .len = fb->len,
+            .width = fb->width,
+            .height = fb->height,
+            .format = fb->format,
+            .timestamp_us = (int64_t) fb->timestamp.tv_sec * 1000000 + fb->timestamp.tv_usec,
+            .seq = frame->seq,
+            .handle = frame,
+    };
+    return ESP_OK;
+}
+
+static void camera_release(esp_media_source_t *source, void *stream, esp_media_frame_t *media) {
+    frames_return(media->handle);
+}
+
+static void camera_stop(esp_media_source_t *source, void *stream) {
+    free(stream);
+}
+
+esp_media_source_t *esp_media_source_camera(void) {
+    static esp_media_source_t camera = {
+            .start = camera_start,
+            .next_frame = camera_next_frame,
+            .release = camera_release,
+            .stop = camera_stop,
+    };
+    return &camera;
+}
+
+void frames_source_continue(void *stream, uint32_t seq) {
+    *(uint32_t *)stream = seq;
+}
@@ -0,0 +1,303 @@
+//
+// MJPEG over HTTP for browsers and home automation, from the frames the RTSP
+// streams capture.
+//
+//   GET /stream        multipart/x-mixed-replace, a JPEG part per frame
+//   GET /snapshot.jpg  the most recent frame, without waiting for the camera
+//   GET /metrics       the metrics registry as text, see esp-metrics.h
+//   GET /trace         the records of the event trace since the last one, see esp-trace.h
+//
+// JPEG frames are sent straight from the frame buffer, frames of sensors
+// without JPEG output are encoded into the socket while they are sent.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_log.h"
+
+#include "lwip/sockets.h"
+#include "esp-rtsp-common.h"
+#include "esp-trace.h"
+#include "frames.h"
+#include "rtsp-metrics.h"
+
+#include "esp_camera.h"
+#include "img_converters.h"
+
+#define TAG "http-server"
+
+#ifndef HTTP_MAX_STREAMS
+#define HTTP_MAX_STREAMS 2
+#endif
+
+#ifndef HTTP_SNAPSHOT_MAX_AGE_MS
+#define HTTP_SNAPSHOT_MAX_AGE_MS 1000 // An older frame is not served as a snapshot, the camera takes a new one
+#endif
+
+#ifndef HTTP_SOURCE_WAIT_MS
+#define HTTP_SOURCE_WAIT_MS 10000 // How long a request waits for the camera to come up before answering 503
+#endif
+
+#ifndef HTTP_JPEG_QUALITY
+#define HTTP_JPEG_QUALITY 80 // Frames of sensors without JPEG output are encoded at this quality
+#endif
+
+#ifndef HTTP_METRICS_TEXT_SIZE
+#define HTTP_METRICS_TEXT_SIZE 4096
+#endif
+
+#ifndef HTTP_TRACE_DUMP_SIZE
+#define HTTP_TRACE_DUMP_SIZE 4096 // Records beyond this are sent with the next dump
+#endif
+
+#define HTTP_SEND_TIMEOUT_S 5 // A client this far behind lets go of its frame, the camera needs it back
+#define HTTP_STREAM_STACKSIZE (6 * 1024)
+
+#define PART_BOUNDARY "123456789000000000000987654321"
+
+static const char *stream_header =
+        "HTTP/1.1 200 OK\r\n"
+        "Content-Type: multipart/x-mixed-replace;boundary=" PART_BOUNDARY "\r\n"
+        "Cache-Control: no-cache\r\n"
+        "Connection: close\r\n"
+        "\r\n";
+
+static volatile int active_streams;
+
+static bool send_all(int sock, const void *data, size_t length) {
+    const uint8_t *p = data;
+    while (length) {
+        ssize_t sent = send(sock, p, length, 0);
+        if (sent <= 0) {
+            return false;
+        }
+        p += sent;
+        length -= sent;
+    }
+    return true;
+}
+
+typedef struct {
+    int sock;
+    bool failed;
+} socket_out_t;
+
+// Once a send failed or timed out nothing more goes to the socket, the short write also stops
+// the encoder so a stalled client gives the frame back after one HTTP_SEND_TIMEOUT_S
+static size_t socket_jpeg_out(void *arg, size_t index, const void *data, size_t len) {
+    socket_out_t *out = arg;
+    if (!data || out->failed) {
+        return 0;
+    }
+    out->failed = !send_all(out->sock, data, len);
+    return out->failed ? 0 : len;
+}
+
+// The JPEG of a frame after the headers, with its Content-Length when it is known up front
+static bool send_frame(int sock, camera_fb_t *fb, const char *headers) {
+    char header[256];
+    bool jpeg = fb->format == PIXFORMAT_JPEG;
+    int length = jpeg ? snprintf(header, sizeof(header), "%sContent-Length: %u\r\n\r\n", headers, (unsigned)fb->len)
+                      : snprintf(header, sizeof(header), "%s\r\n", headers);
+    if (!send_all(sock, header, length)) {
+        return false;
+    }
+    if (jpeg) {
+        return send_all(sock, fb->buf, fb->len);
+    }
+    socket_out_t out = {.sock = sock};
+    return fmt2jpg_cb(fb->buf, fb->len, fb->width, fb->height, fb->format, HTTP_JPEG_QUALITY, socket_jpeg_out, &out) && !out.failed;
+}
+
+static void close_socket(int sock) {
+    shutdown(sock, SHUT_RDWR);
+    close(sock);
+}
+
+static void send_status(int sock, const char *status) {
+    char response[128];
+    int length = snprintf(response, sizeof(response),
+                          "HTTP/1.1 %s\r\n"
+                          "Content-Length: 0\r\n"
+                          "Connection: close\r\n"
+                          "\r\n",
+                          status);
+    send_all(sock, response, length);
+}
+
+static void http_stream_task(void *pvParameters) {
+    int sock = (int)(intptr_t)pvParameters;
+    uint32_t frame_seq = 0;
+
+    bool ok = frames_wait_ready(HTTP_SOURCE_WAIT_MS);
+    if (ok) {
+        ok = send_all(sock, stream_header, strlen(stream_header));
+    } else {
+        send_status(sock, "503 Service Unavailable");
+    }
+    while (ok) {
+        shared_frame_t *frame = frames_get(&frame_seq);
+        if (!frame) {
+            ESP_LOGE(TAG, "Camera Capture Failed");
+            break;
+        }
+        ok = send_frame(sock, frame->fb,
+                        "--" PART_BOUNDARY "\r\n"
+                        "Content-Type: image/jpeg\r\n")
+             && send_all(sock, "\r\n", 2);
+        ESP_TRACE(HTTP_FRAME, frame_seq, frame->fb->len);
+        frames_return(frame);
+        esp_metric_add(ok ? &metric_http_frames : &metric_drop_send, 1);
+    }
+
+    ESP_LOGI(TAG, "Stream closed");
+    close_socket(sock);
+    __atomic_sub_fetch(&active_streams, 1, __ATOMIC_RELAXED);
+    vTaskDelete(NULL);
+}
+
+static void handle_snapshot(int sock) {
+    shared_frame_t *frame = frames_latest(HTTP_SNAPSHOT_MAX_AGE_MS * 1000LL);
+    if (!frame && frames_wait_ready(HTTP_SOURCE_WAIT_MS)) {
+        uint32_t frame_seq = 0;
+        frame = frames_get(&frame_seq);
+    }
+    if (!frame) {
+        send_status(sock, "503 Service Unavailable");
+        return;
+    }
+    send_frame(sock, frame->fb,
+               "HTTP/1.1 200 OK\r\n"
+               "Content-Type: image/jpeg\r\n"
+               "Cache-Control: no-cache\r\n"
+               "Connection: close\r\n");
+    frames_return(frame);
+}
+
+static void handle_metrics(int sock) {
+    char *text = malloc(HTTP_METRICS_TEXT_SIZE);
+    if (!text) {
+        send_status(sock, "503 Service Unavailable");
+        return;
+    }
+    size_t length = esp_metrics_format(text, HTTP_METRICS_TEXT_SIZE, NULL);
+
+    char header[128];
+    int header_length = snprintf(header, sizeof(header),
+                                 "HTTP/1.1 200 OK\r\n"
+                                 "Content-Type: text/plain; version=0.0.4\r\n"
+                                 "Content-Length: %u\r\n"
+                                 "Connection: close\r\n"
+                                 "\r\n",
+                                 (unsigned)length);
+    if (send_all(sock, header, header_length)) {
+        send_all(sock, text, length);
+    }
+    free(text);
+}
+
+#if CONFIG_ESP_TRACE_ENABLED
+static void handle_trace(int sock) {
+    uint8_t *dump = malloc(HTTP_TRACE_DUMP_SIZE);
+    if (!dump) {
+        send_status(sock, "503 Service Unavailable");
+        return;
+    }
+    size_t length = esp_trace_drain(dump, HTTP_TRACE_DUMP_SIZE);
+
+    char header[128];
+    int header_length = snprintf(header, sizeof(header),
+                                 "HTTP/1.1 200 OK\r\n"
+                                 "Content-Type: application/octet-stream\r\n"
+                                 "Content-Length: %u\r\n"
+                                 "Connection: close\r\n"
+                                 "\r\n",
+                                 (unsigned)length);
+    if (send_all(sock, header, header_length)) {
+        send_all(sock, dump, length);
+    }
+    free(dump);
+}
+#endif
+
+// Reads the request line and skips the headers, false when there is no complete request
+static bool read_request(int sock, char *method, size_t method_size, char *path, size_t path_size) {
+    char request[512];
+    size_t length = 0;
+    while (length < sizeof(request) - 1) {
+        int n = recv(sock, request + length, sizeof(request) - 1 - length, 0);
+        if (n <= 0) {
+            return false;
+        }
+        length += n;
+        request[length] = 0;
+        if (strstr(request, "\r\n\r\n")) {
+            break;
+        }
+    }
+
+    char format[32];
+    snprintf(format, sizeof(format), "%%%us %%%us", (unsigned)method_size - 1, (unsigned)path_size - 1);
+    return sscanf(request, format, method, path) == 2;
+}
+
+static void http_server_accept(int listen_sock) {
+    struct sockaddr_storage source_addr;
+    socklen_t addr_len = sizeof(source_addr);
+    int sock = accept(listen_sock, (struct sockaddr *)&source_addr, &addr_len);
+    if (sock < 0) {
+        ESP_LOGE(TAG, "Unable to accept connection: errno %d", errno);
+        return;
+    }
+
+    struct timeval to = { .tv_sec = 3 };
+    setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &to, sizeof(to));
+    to.tv_sec = HTTP_SEND_TIMEOUT_S;
+    setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, &to, sizeof(to));
+
+    ESP_TRACE(HTTP_REQUEST, sock, 0);
+    char method[8], path[64];
+    if (!read_request(sock, method, sizeof(method), path, sizeof(path))) {
+        send_status(sock, "400 Bad Request");
+    } else if (strcmp(method, "GET") != 0) {
+        send_status(sock, "405 Method Not Allowed");
+    } else if (strcmp(path, "/snapshot.jpg") == 0) {
+        ESP_LOGI(TAG, "Snapshot");
+        handle_snapshot(sock);
+    } else if (strcmp(path, "/metrics") == 0) {
+        handle_metrics(sock);
+#if CONFIG_ESP_TRACE_ENABLED
+    } else if (strcmp(path, "/trace") == 0) {
+        handle_trace(sock);
+#endif
+    } else if (strcmp(path, "/stream") == 0) {
+        if (__atomic_add_fetch(&active_streams, 1, __ATOMIC_RELAXED) > HTTP_MAX_STREAMS) {
+            __atomic_sub_fetch(&active_streams, 1, __ATOMIC_RELAXED);
+            ESP_LOGW(TAG, "No free streams");
+            send_status(sock, "503 Service Unavailable");
+        } else if (xTaskCreate(http_stream_task, "http_stream", HTTP_STREAM_STACKSIZE, (void *)(intptr_t)sock, 5, NULL) != pdPASS) {
+            __atomic_sub_fetch(&active_streams, 1, __ATOMIC_RELAXED);
+            send_status(sock, "500 Internal Server Error");
+        } else {
+            ESP_LOGI(TAG, "Stream started");
+            return; // The stream task owns the socket
+        }
+    } else {
+        send_status(sock, "404 Not Found");
+    }
+    close_socket(sock);
+}
+
+esp_err_t http_server_main(int port) {
+    int listen_sock = esp_rtsp_create_listening_socket(port);
+    if (listen_sock < 0) {
+        return ESP_FAIL;
+    }
+
+    while (1) {
+        http_server_accept(listen_sock);
+    }
+}
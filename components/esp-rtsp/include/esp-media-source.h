@@ -0,0 +1,71 @@
+//
+// Sources of the media the RTSP server streams, registered per URL path.
+//
+// A source hands out the frames a stream sends, JPEG or a format of the
+// camera that the stream encodes to JPEG. Every stream that plays a source
+// has its own state with it, from start() until stop(), so several streams
+// of the same or of different sources play at the same time. next_frame()
+// waits for a frame newer than the last one the stream got, release() gives
+// it back once it is sent.
+//
+// Built in are the camera, a clip of JPEG frames in memory or in a file, a
+// test pattern and a feed that the application pushes frames into, e.g. the
+// output of an encoder. The camera plays on every path that has no source of
+// its own.
+//
+
+#ifndef ESPCAM_ESP_MEDIA_SOURCE_H
+#define ESPCAM_ESP_MEDIA_SOURCE_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <esp_err.h>
+
+#include "esp_camera.h"
+
+typedef struct {
+    const uint8_t *buf;
+    size_t len;
+    uint16_t width;
+    uint16_t height;
+    pixformat_t format;
+    int64_t timestamp_us;   // In the esp_timer_get_time() domain
+    uint32_t seq;           // Counts up
+    void *handle;           // Of the source, for release()
+} esp_media_frame_t;
+
+typedef struct esp_media_source esp_media_source_t;
+
+struct esp_media_source {
+    // The media description of the SDP from the m= line on, returns its length. NULL for a video
+    // stream of RTP/JPEG, payload type 26, the packetizer of the server.
+    size_t (*describe)(esp_media_source_t *source, char *sdp, size_t size);
+    esp_err_t (*start)(esp_media_source_t *source, void **stream);
+    // Waits for the next frame, a failure is logged and the stream asks again at its next frame
+    esp_err_t (*next_frame)(esp_media_source_t *source, void *stream, esp_media_frame_t *frame);
+    void (*release)(esp_media_source_t *source, void *stream, esp_media_frame_t *frame);
+    void (*stop)(esp_media_source_t *source, void *stream);
+    void *ctx;
+};
+
+// The frames the RTSP and HTTP streams share, see esp_rtsp_server_set_source_ready()
+esp_media_source_t *esp_media_source_camera(void);
+
+// Loops through the JPEG images of data one after the other, e.g. an .mjpeg file, at fps. The data is
+// not copied, it stays where it is, in flash or PSRAM.
+esp_err_t esp_media_source_clip_create(const uint8_t *data, size_t length, uint32_t fps, esp_media_source_t **source);
+
+// The same for the clip in a file, which is read into PSRAM
+esp_err_t esp_media_source_clip_load(const char *path, uint32_t fps, esp_media_source_t **source);
+
+// Color bars with a bar moving across them, YUV422 frames the streams encode, at fps
+esp_err_t esp_media_source_pattern_create(uint16_t width, uint16_t height, uint32_t fps, esp_media_source_t **source);
+
+// The frames pushed into it, every stream gets the latest one
+esp_err_t esp_media_source_feed_create(esp_media_source_t **source);
+
+// Copies a frame into the feed, the streams send the copy while the next one is pushed
+esp_err_t esp_media_source_feed_push(esp_media_source_t *source, const uint8_t *buf, size_t len,
+                                     uint16_t width, uint16_t height, pixformat_t format);
+
+#endif //ESPCAM_ESP_MEDIA_SOURCE_H
@@ -0,0 +1,76 @@
+//
+// Registry of counters, gauges and latency histograms of the camera stream,
+// readable as text over RTSP GET_PARAMETER and http://<ip>/metrics.
+//
+// Updating a metric is a relaxed atomic add, no lock is taken on the paths
+// that send frames. A metric is registered the first time it is updated, or
+// up front with esp_metrics_register() to show up at 0. The text has a line
+// per value in the Prometheus exposition format.
+//
+
+#ifndef ESPCAM_ESP_METRICS_H
+#define ESPCAM_ESP_METRICS_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <esp_err.h>
+
+#define ESP_METRICS_MAX 48
+#define ESP_METRICS_MAX_WRITERS 4
+
+// Histogram buckets hold observations up to ESP_METRICS_BUCKET_BASE << i, the last one the rest
+#define ESP_METRICS_BUCKETS 13
+#define ESP_METRICS_BUCKET_BASE 50
+
+typedef enum {
+    ESP_METRICS_COUNTER,
+    ESP_METRICS_GAUGE,
+    ESP_METRICS_HISTOGRAM,
+} esp_metrics_type_t;
+
+typedef struct {
+    const char *name;   // May carry labels, e.g. frame_drops_total{cause="send"}, except for a histogram
+    esp_metrics_type_t type;
+    uint64_t value;     // Total of a counter, value of a gauge, sum of the observations of a histogram
+    uint32_t buckets[ESP_METRICS_BUCKETS];
+    bool registered;
+} esp_metric_t;
+
+#define ESP_METRIC_COUNTER_INIT(metric_name)   { .name = metric_name, .type = ESP_METRICS_COUNTER }
+#define ESP_METRIC_GAUGE_INIT(metric_name)     { .name = metric_name, .type = ESP_METRICS_GAUGE }
+#define ESP_METRIC_HISTOGRAM_INIT(metric_name) { .name = metric_name, .type = ESP_METRICS_HISTOGRAM }
+
+// Writes lines of metrics that are not in the registry, like those of each session.
+// Returns the bytes written, lines that do not fit entirely are left out.
+typedef size_t (*esp_metrics_writer_t)(char *buffer, size_t size);
+
+void esp_metrics_register(esp_metric_t *metric);
+esp_err_t esp_metrics_register_writer(esp_metrics_writer_t writer);
+
+static inline void esp_metric_add(esp_metric_t *metric, uint64_t n) {
+    if (!__atomic_load_n(&metric->registered, __ATOMIC_RELAXED)) {
+        esp_metrics_register(metric);
+    }
+    __atomic_add_fetch(&metric->value, n, __ATOMIC_RELAXED);
+}
+
+static inline void esp_metric_set(esp_metric_t *metric, uint64_t value) {
+    if (!__atomic_load_n(&metric->registered, __ATOMIC_RELAXED)) {
+        esp_metrics_register(metric);
+    }
+    __atomic_store_n(&metric->value, value, __ATOMIC_RELAXED);
+}
+
+void esp_metric_observe(esp_metric_t *metric, uint64_t value);
+
+// For writers: appends a line at length when it fits in full. Returns the new length, or length
+// when it does not fit.
+size_t esp_metrics_printf(char *buffer, size_t size, size_t length, const char *format, ...)
+        __attribute__((format(printf, 4, 5)));
+
+// The lines of the metrics, then those of the writers, that start with prefix, all of them for NULL.
+// Returns the length of the text, which is cut at the last line that fits.
+size_t esp_metrics_format(char *buffer, size_t size, const char *prefix);
+
+#endif //ESPCAM_ESP_METRICS_H
@@ -0,0 +1,61 @@
+//
+// Motion detection on the JPEG frames of the camera, in the compressed domain.
+//
+// Every frame is reduced to the mean luminance of its MCUs, taken from the DC
+// coefficients without decoding the picture, and compared against a running
+// background. The picture is divided into zones, each with its own threshold
+// for the share of changed MCUs that counts as motion.
+//
+
+#ifndef ESPCAM_ESP_MOTION_H
+#define ESPCAM_ESP_MOTION_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <esp_err.h>
+
+#define ESP_MOTION_ZONES_X 4
+#define ESP_MOTION_ZONES_Y 3
+#define ESP_MOTION_ZONES (ESP_MOTION_ZONES_X * ESP_MOTION_ZONES_Y)
+
+typedef struct {
+    uint8_t cell_threshold;                   // Luminance difference of an MCU from the background that is a change
+    uint8_t zone_threshold[ESP_MOTION_ZONES]; // Percentage of changed MCUs that is motion in a zone, 0 ignores the zone
+    uint8_t background_shift;                 // The background follows every frame by 1 / 2^shift of the difference
+    uint32_t hold_ms;                         // Motion lasts until this long after the last frame with motion
+} esp_motion_config_t;
+
+#define ESP_MOTION_CONFIG_DEFAULT() {                       \
+    .cell_threshold = 16,                                   \
+    .zone_threshold = { [0 ... ESP_MOTION_ZONES - 1] = 4 }, \
+    .background_shift = 4,                                  \
+    .hold_ms = 5000                                         \
+}
+
+typedef struct {
+    bool active;          // Motion started, or ended hold_ms after the last frame with motion
+    uint32_t zones;       // Bit per zone with motion in the frame, row by row from the top left
+    uint8_t level;        // Highest percentage of changed MCUs in a zone
+    int64_t timestamp_us; // Capture time of the frame
+} esp_motion_event_t;
+
+typedef void (*esp_motion_cb_t)(const esp_motion_event_t *event, void *arg);
+
+typedef struct esp_motion esp_motion_t;
+
+esp_err_t esp_motion_create(const esp_motion_config_t *config, esp_motion_t **motion);
+void esp_motion_delete(esp_motion_t *motion);
+
+// Called with an event whenever motion starts or ends, from the task calling esp_motion_process()
+void esp_motion_set_callback(esp_motion_t *motion, esp_motion_cb_t cb, void *arg);
+
+// Compares a JPEG frame against the background. A frame that cannot be parsed counts as
+// motion, so whatever the detector throttles errs on the side of sending it. The first
+// frame starts the background and counts as motion too.
+esp_err_t esp_motion_process(esp_motion_t *motion, const uint8_t *jpeg, size_t length, int64_t timestamp_us,
+                             esp_motion_event_t *result);
+
+bool esp_motion_active(const esp_motion_t *motion);
+
+#endif //ESPCAM_ESP_MOTION_H
@@ -0,0 +1,78 @@
+//
+// Recording of the camera to MJPEG AVI files on an SD card or SPIFFS.
+//
+// The recorder takes the frames the RTSP and HTTP streams share, it copies a
+// frame into a staging buffer and returns it right away, so it holds up
+// neither the streams nor the camera. A frame that does not fit because the
+// card is behind is left out of the recording, not waited for.
+//
+// There are two staging buffers, in PSRAM when there is any: one fills while
+// a writer task writes the other. Writes are whole clusters at cluster
+// aligned offsets, only the last write of a file is shorter. The index of a
+// file is written as the frames are and the header is brought up to date
+// every sync_interval_ms, a power loss costs the frames in the staging
+// buffers and since the last sync. esp_recorder_create() finishes the files
+// a power loss left behind.
+//
+// Files are named recNNNNN.avi, counting up from the highest number in the
+// directory. Only JPEG frames are recorded.
+//
+
+#ifndef ESPCAM_ESP_RECORDER_H
+#define ESPCAM_ESP_RECORDER_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <esp_err.h>
+
+#include "esp-motion.h"
+
+typedef struct {
+    const char *directory;              // Where the files go, e.g. the mount point of the card
+    size_t cluster_size;                // Of the file system, a power of two of at least 512
+    size_t buffer_size;                 // Of each staging buffer, a multiple of cluster_size and a few frames large
+    uint32_t sync_interval_ms;          // The header and the index on the card are brought up to date this often
+    uint32_t max_file_bytes;            // A new file is started after this
+    // Record while there is motion, NULL to only record when started. There is one detector for the
+    // recorder and the RTSP streams, it runs with this config from here on.
+    const esp_motion_config_t *motion;
+} esp_recorder_config_t;
+
+#define ESP_RECORDER_CONFIG_DEFAULT() {   \
+    .directory = "/sdcard",               \
+    .cluster_size = 32 * 1024,            \
+    .buffer_size = 256 * 1024,            \
+    .sync_interval_ms = 2000,             \
+    .max_file_bytes = 512 * 1024 * 1024,  \
+    .motion = NULL                        \
+}
+
+typedef struct {
+    uint32_t files;
+    uint64_t frames;
+    uint64_t bytes;         // Written to the card
+    uint32_t dropped;       // Frames that did not fit in the staging buffers
+    uint32_t writes;
+    uint64_t write_us;      // Total time spent in writes
+    uint32_t max_write_us;
+    uint32_t syncs;
+} esp_recorder_stats_t;
+
+typedef struct esp_recorder esp_recorder_t;
+
+esp_err_t esp_recorder_create(const esp_recorder_config_t *config, esp_recorder_t **recorder);
+
+// Finishes the file being recorded
+void esp_recorder_delete(esp_recorder_t *recorder);
+
+// Records until esp_recorder_stop(), whether there is motion or not. Also starts over after a write failed.
+esp_err_t esp_recorder_start(esp_recorder_t *recorder);
+esp_err_t esp_recorder_stop(esp_recorder_t *recorder);
+
+// Whether a file is being recorded
+bool esp_recorder_recording(const esp_recorder_t *recorder);
+
+void esp_recorder_get_stats(const esp_recorder_t *recorder, esp_recorder_stats_t *stats);
+
+#endif //ESPCAM_ESP_RECORDER_H
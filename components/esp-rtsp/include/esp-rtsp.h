@@ -5,9 +5,51 @@
 #ifndef ESPCAM_ESP_RTSP_H
 #define ESPCAM_ESP_RTSP_H
 
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "esp-motion.h"
+#include "esp-timeline.h"
+#include "esp-metrics.h"
+#include "esp-media-source.h"
+
 typedef void* esp_rtsp_server_handle_t;
 
+// Also serves MJPEG on http://<ip>:HTTP_PORT/stream and the latest frame on /snapshot.jpg,
+// from the same frame buffers the RTSP streams send
+//
+// With PSRAM the last seconds of frames are kept in a time-shift buffer of RTSP_TIMESHIFT_SIZE bytes.
+// PLAY with Range: npt=-<seconds>- or clock=<UTC time>- sends them from there, faster than real time
+// and with their original timestamps, until it caught up with live. PAUSE stops a stream, PLAY without
+// a range resumes it after the last frame it sent.
+//
+// A stream plays in two tasks, one takes and encodes its frames on RTSP_CAPTURE_CORE, the other sends
+// them on RTSP_NETWORK_CORE. The pipeline_* metrics show in front of which one the frames wait.
+
 esp_err_t esp_rtsp_server_start(esp_rtsp_server_handle_t *handle);
 esp_err_t esp_rtsp_server_stop(esp_rtsp_server_handle_t handle);
 
+// While streams of the camera play, its JPEG frames are watched for motion, once per frame however
+// many streams there are, and the streams send fewer of them while nothing moves. The callback gets
+// the start and the end of motion, also while the recorder watches for it.
+esp_err_t esp_rtsp_server_set_motion_callback(esp_rtsp_server_handle_t handle, esp_motion_cb_t cb, void *arg);
+
+// Whether the camera is up. While it is not, DESCRIBE waits for it, up to RTSP_SOURCE_WAIT_MS before
+// answering 503, and /stream and /snapshot.jpg up to HTTP_SOURCE_WAIT_MS, so the server can start
+// listening as soon as the network is up. Nothing reads from the camera before, the time-shift buffer
+// and the recorder start once it is. Call it with false before esp_rtsp_server_start() when the
+// camera comes up later, the server starts out ready.
+void esp_rtsp_server_set_source_ready(bool ready);
+
+// A stream is admitted at SETUP when it fits in the uplink next to the streams that play, at a lower
+// frame rate when only that fits, otherwise the client gets 453 Not Enough Bandwidth. The capacity of
+// the uplink is measured from what the streams get through while it is full. Setting it, e.g. from a
+// site survey, stops the measuring, 0 goes back to it.
+void esp_rtsp_server_set_uplink_capacity(uint32_t kbps);
+
+// Streams rtsp://<ip>/<path> from source, and <path>/ and what follows it. The camera plays on the paths
+// without a source. A path registered again gets the new source from its next SETUP on, streams that
+// already play go on with the one they have, so a source stays around as long as the server.
+esp_err_t esp_rtsp_server_register_source(esp_rtsp_server_handle_t handle, const char *path, esp_media_source_t *source);
+
 #endif //ESPCAM_ESP_RTSP_H
\ No newline at end of file
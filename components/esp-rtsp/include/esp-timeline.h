@@ -0,0 +1,36 @@
+//
+// Timeline of the boot, when each stage of bringing up the camera stream
+// first happened, in microseconds since the start of the application.
+//
+// Any task marks the stages it completes. Only the first mark of a stage is
+// kept, so the timeline shows how long it took until the first frame was
+// captured and the first RTP packet left, and not the frames after it.
+//
+
+#ifndef ESPCAM_ESP_TIMELINE_H
+#define ESPCAM_ESP_TIMELINE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define ESP_TIMELINE_MAX_EVENTS 16
+
+// Stages marked by the RTSP server
+#define ESP_TIMELINE_RTSP_LISTENING "rtsp listening"
+#define ESP_TIMELINE_FIRST_DESCRIBE "first describe"
+#define ESP_TIMELINE_FIRST_FRAME    "first frame"
+#define ESP_TIMELINE_FIRST_RTP      "first rtp packet"
+
+// event must stay valid, a string literal. Marks beyond ESP_TIMELINE_MAX_EVENTS are dropped.
+void esp_timeline_mark(const char *event);
+
+// Time of the first mark of event, -1 when it was not marked
+int64_t esp_timeline_get(const char *event);
+
+// Logs the marks in the order they happened, with the time since the previous one
+void esp_timeline_log(void);
+
+// Forgets all marks
+void esp_timeline_reset(void);
+
+#endif //ESPCAM_ESP_TIMELINE_H
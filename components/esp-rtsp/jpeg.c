@@ -8,6 +8,8 @@
  * Original source: https://github.com/bnbe-club/rtsp-video-streamer-diy-14/blob/master/diy-e14/src/CStreamer.cpp
  */
 
+#include <assert.h>
+#include <string.h>
 #include <esp_log.h>
 #include <esp_err.h>
 
@@ -15,76 +17,127 @@
 
 #define TAG "esp-rtsp-jpeg"
 
+#define JPEG_SOF0 0xC0
 #define JPEG_SOI 0xD8
 #define JPEG_EOI 0xD9
 #define JPEG_SOS 0xDA
 #define JPEG_DQT 0xDB
+#define JPEG_DRI 0xDD
 
 static int find_jpeg_marker(char *buffer, size_t len, uint8_t marker, char **marker_start);
-static int block_length(const char *blockptr, size_t len);
 
-esp_err_t esp_rtsp_jpeg_decode(char *buffer, size_t length, esp_rtsp_jpeg_data_t *rtsp_jpeg_data) {
+esp_err_t esp_rtsp_jpeg_parse_headers(char *buffer, size_t length, esp_rtsp_jpeg_data_t *rtsp_jpeg_data) {
     assert(rtsp_jpeg_data != NULL);
+    memset(rtsp_jpeg_data, 0, sizeof(esp_rtsp_jpeg_data_t));
 
-    if (length < 4) {
-        ESP_LOGE(TAG, "Invalid length: %d", length);
-        return ESP_FAIL;
+    if (length < 2) {
+        return ESP_ERR_INVALID_SIZE;
     }
 
     // Check magic
-    if ((uint8_t)buffer[0] != 0xFF && (uint8_t)buffer[1] != JPEG_SOI) {
+    if ((uint8_t)buffer[0] != 0xFF || (uint8_t)buffer[1] != JPEG_SOI) {
         ESP_LOGE(TAG, "Probably not a JPEG");
         return ESP_FAIL;
     }
 
-    char *marker;
-    size_t remaining;
-    if (find_jpeg_marker(buffer, length, JPEG_DQT, &marker) < 0) {
-        ESP_LOGE(TAG, "Failed to find marker 0x%02x", JPEG_DQT);
-        return ESP_FAIL;
+    size_t position = 2;
+    while (position + 4 <= length) {
+        uint8_t *current = (uint8_t *)buffer + position;
+
+        if (current[0] != 0xFF || current[1] == 0xFF) {
+            // Not a marker or a fill byte before one
+            position += 1;
+            continue;
+        }
+
+        uint8_t typecode = current[1];
+        if (typecode == JPEG_EOI) {
+            ESP_LOGE(TAG, "Failed to find marker 0x%02x", JPEG_SOS);
+            return ESP_FAIL;
+        }
+        if (typecode == 0x01 || (typecode >= 0xD0 && typecode <= 0xD7)) { // tem, restart markers
+            position += 2;
+            continue;
+        }
+
+        size_t segment_length = 2 + (current[2] << 8 | current[3]);
+        if (position + segment_length > length) {
+            return ESP_ERR_INVALID_SIZE;
+        }
+
+        switch (typecode) {
+            case JPEG_DQT:
+                // One or more 8 bit tables, each a table id and 64 values. The table pointers
+                // point 5 bytes before the values, where they are for a segment with one table.
+                for (uint8_t *table = current + 4; table + 65 <= current + segment_length; table += 65) {
+                    if ((table[0] & 0x0F) == 0) {
+                        rtsp_jpeg_data->quant_table_0 = (char *)table - 4;
+                    } else if ((table[0] & 0x0F) == 1) {
+                        rtsp_jpeg_data->quant_table_1 = (char *)table - 4;
+                    }
+                }
+                break;
+
+            case JPEG_DRI:
+                if (segment_length >= 6) {
+                    rtsp_jpeg_data->restart_interval = current[4] << 8 | current[5];
+                }
+                break;
+
+            case JPEG_SOF0:
+                // Sampling factors of the luma component, 2x1 is type 0 (4:2:2) and 2x2 type 1 (4:2:0)
+                if (segment_length >= 12) {
+                    rtsp_jpeg_data->type = current[11] == 0x22 ? 1 : 0;
+                    rtsp_jpeg_data->height = current[5] << 8 | current[6];
+                    rtsp_jpeg_data->width = current[7] << 8 | current[8];
+                }
+                break;
+
+            case JPEG_SOS:
+                if (!rtsp_jpeg_data->quant_table_0 || !rtsp_jpeg_data->quant_table_1) {
+                    ESP_LOGE(TAG, "Failed to find marker 0x%02x", JPEG_DQT);
+                    return ESP_FAIL;
+                }
+                rtsp_jpeg_data->jpeg_data_start = (char *)current + segment_length; // Don't include the SOS header
+                return ESP_OK;
+
+            default:
+                break;
+        }
+
+        position += segment_length;
     }
-    rtsp_jpeg_data->quant_table_0 = marker;
 
-    remaining = length - (marker-buffer);
-    char *next = marker + block_length(marker, remaining);
-    if (find_jpeg_marker(next, length - (next-buffer), JPEG_DQT, &marker) < 0) {
-        ESP_LOGE(TAG, "Failed to find marker 0x%02x", JPEG_DQT);
+    return ESP_ERR_INVALID_SIZE;
+}
+
+esp_err_t esp_rtsp_jpeg_decode(char *buffer, size_t length, esp_rtsp_jpeg_data_t *rtsp_jpeg_data) {
+    assert(rtsp_jpeg_data != NULL);
+
+    if (length < 4) {
+        ESP_LOGE(TAG, "Invalid length: %d", length);
         return ESP_FAIL;
     }
-    rtsp_jpeg_data->quant_table_1 = marker;
 
-    remaining = length - (marker-buffer);
-    next = marker + block_length(marker, remaining);
-    if (find_jpeg_marker(next, length - (next-buffer), JPEG_SOS, &marker) < 0) {
-        ESP_LOGE(TAG, "Failed to find marker 0x%02x", JPEG_SOS);
+    esp_err_t err = esp_rtsp_jpeg_parse_headers(buffer, length, rtsp_jpeg_data);
+    if (err == ESP_ERR_INVALID_SIZE) {
+        ESP_LOGE(TAG, "Truncated JPEG headers");
+    }
+    if (err != ESP_OK) {
         return ESP_FAIL;
     }
-    rtsp_jpeg_data->jpeg_data_start = marker + block_length(marker, remaining); // Don't include the SOS header
 
-    remaining = length - (marker-buffer);
-    next = marker + block_length(marker, remaining);
+    char *marker;
+    char *next = rtsp_jpeg_data->jpeg_data_start;
     if (find_jpeg_marker(next, length - (next-buffer), JPEG_EOI, &marker) < 0) {
         ESP_LOGE(TAG, "Failed to find marker 0x%02x", JPEG_EOI);
         return ESP_FAIL;
     }
     rtsp_jpeg_data->jpeg_data_length = marker - rtsp_jpeg_data->jpeg_data_start;
 
-//    ESP_LOGD(TAG, "JPEG: Q1 : %d, Q2 : %d, SOS: %d, LEN: %d",
-//             rtsp_jpeg_data->quant_table_0 - buffer,
-//             rtsp_jpeg_data->quant_table_1 - buffer,
-//             rtsp_jpeg_data->jpeg_data_start - buffer,
-//             rtsp_jpeg_data->jpeg_data_length);
-
     return ESP_OK;
 }
 
-static int block_length(const char *blockptr, size_t len) {
-    assert(len > 4);
-    assert((uint8_t)blockptr[0] == 0xff);
-
-    return 2 + (blockptr[2] << 8 | blockptr[3]);
-}
-
 static int find_jpeg_marker(char *buffer, size_t len, uint8_t marker, char **marker_start) {
     long position = 0;
     while(position < len - 1) {
@@ -113,30 +166,24 @@ static int find_jpeg_marker(char *buffer, size_t len, uint8_t marker, char **mar
         switch(typecode) {
             case 0xd8:   // start of image
             case 0xd9:   // end of image
+            case 0xd0 ... 0xd7: // restart markers
+            case 0x01:   // tem
                 skip_len = 2;
                 break;
 
-            case 0xe0:   // app0
-            case 0xdb:   // dqt
-            case 0xc4:   // dht
-            case 0xc0:   // sof0
-            case 0xda:   // sos
+            default:
             {
-                /* If we are not interested in these blocks, try to fast forward
-                 * by moving the position up.
+                /* All other segments (app0..app15, dqt, dht, sof, sos, dri, com)
+                 * carry a length, fast forward by moving the position up.
                  */
-                if (len - position >= 2) {
+                if (len - position >= 4) {
                     // We need to be sure the length bytes are available in the buffer
-                    skip_len = (current[2] << 8 | current[3]) + 2;
+                    skip_len = ((uint8_t)current[2] << 8 | (uint8_t)current[3]) + 2;
                 } else {
                     skip_len = 2;
                 }
                 break;
             }
-            default:
-                skip_len = 2;
-                ESP_LOGE(TAG, "Unexpected jpeg typecode 0x%x\n", typecode);
-                break;
         }
 
         position += skip_len;
@@ -0,0 +1,197 @@
+//
+// A clip of JPEG frames as a media source, see esp-media-source.h
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
+
+#include "esp-media-source.h"
+#include "rtp-udp.h"
+
+#define TAG "media-clip"
+
+typedef struct {
+    uint32_t offset;
+    uint32_t length;
+    uint16_t width;
+    uint16_t height;
+} clip_frame_t;
+
+typedef struct {
+    esp_media_source_t source;
+    const uint8_t *data;
+    clip_frame_t *frames;
+    uint32_t count;
+    uint32_t fps;
+} clip_t;
+
+// The clip plays in real time from when the stream started, a stream that asks for fewer frames than
+// the clip has skips some
+typedef struct {
+    int64_t started_us;
+    uint32_t seq;           // Frames since the start, the last one the stream got
+} clip_stream_t;
+
+static bool is_start(const uint8_t *data, size_t length, size_t position) {
+    return position + 3 <= length && data[position] == 0xFF && data[position + 1] == 0xD8 && data[position + 2] == 0xFF;
+}
+
+// The images start with SOI, which the entropy coded data cannot contain, each ends where the next starts
+static uint32_t index_frames(const uint8_t *data, size_t length, clip_frame_t *frames) {
+    uint32_t count = 0;
+    for (size_t position = 0; position < length; position++) {
+        if (!is_start(data, length, position)) {
+            continue;
+        }
+        if (frames) {
+            if (count) {
+                frames[count - 1].length = position - frames[count - 1].offset;
+            }
+            frames[count].offset = position;
+            frames[count].length = length - position;
+        }
+        count++;
+        position += 2;
+    }
+    return count;
+}
+
+static size_t clip_describe(esp_media_source_t *source, char *sdp, size_t size) {
+    clip_t *clip = source->ctx;
+    return snprintf(sdp, size,
+                    "m=video 0 RTP/AVP 26\r\n"
+                    "c=IN IP4 0.0.0.0\r\n"
+                    "a=framerate:%u\r\n",
+                    (unsigned)clip->fps);
+}
+
+static esp_err_t clip_start(esp_media_source_t *source, void **stream) {
+    clip_stream_t *clip_stream = calloc(1, sizeof(clip_stream_t));
+    if (!clip_stream) {
+        return ESP_ERR_NO_MEM;
+    }
+    *stream = clip_stream;
+    return ESP_OK;
+}
+
+static esp_err_t clip_next_frame(esp_media_source_t *source, void *stream, esp_media_frame_t *media) {
+    clip_t *clip = source->ctx;
+    clip_stream_t *clip_stream = stream;
+
+    int64_t now_us = esp_timer_get_time();
+    if (!clip_stream->started_us) {
+        clip_stream->started_us = now_us;
+    }
+    uint32_t seq = (now_us - clip_stream->started_us) * clip->fps / 1000000 + 1;
+    if (seq <= clip_stream->seq) {
+        seq = clip_stream->seq + 1;
+        int64_t due_us = clip_stream->started_us + (int64_t)(seq - 1) * 1000000 / clip->fps;
+        if (due_us - now_us >= 1000) {
+            vTaskDelay(pdMS_TO_TICKS((due_us - now_us) / 1000));
+        }
+        now_us = esp_timer_get_time();
+    }
+    clip_stream->seq = seq;
+
+    clip_frame_t *frame = &clip->frames[(seq - 1) % clip->count];
+    *media = (esp_media_frame_t) {
+            .buf = clip->data + frame->offset,
+            .len = frame->length,
+            .width = frame->width,
+            .height = frame->height,
+            .format = PIXFORMAT_JPEG,
+            .timestamp_us = now_us,
+            .seq = seq,
+    };
+    return ESP_OK;
+}
+
+static void clip_release(esp_media_source_t *source, void *stream, esp_media_frame_t *media) {
+}
+
+static void clip_stop(esp_media_source_t *source, void *stream) {
+    free(stream);
+}
+
+esp_err_t esp_media_source_clip_create(const uint8_t *data, size_t length, uint32_t fps, esp_media_source_t **source) {
+    if (!data || !fps || !source) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    uint32_t count = index_frames(data, length, NULL);
+    if (!count) {
+        ESP_LOGE(TAG, "No JPEG frames in the clip");
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    clip_t *clip = calloc(1, sizeof(clip_t));
+    clip_frame_t *frames = calloc(count, sizeof(clip_frame_t));
+    if (!clip || !frames) {
+        free(clip);
+        free(frames);
+        return ESP_ERR_NO_MEM;
+    }
+    index_frames(data, length, frames);
+    for (uint32_t i = 0; i < count; i++) {
+        esp_rtsp_jpeg_data_t jpeg_data;
+        if (esp_rtsp_jpeg_parse_headers((char *)data + frames[i].offset, frames[i].length, &jpeg_data) != ESP_OK) {
+            ESP_LOGE(TAG, "Frame %u of the clip is not a JPEG", (unsigned)i);
+            free(frames);
+            free(clip);
+            return ESP_ERR_INVALID_ARG;
+        }
+        frames[i].width = jpeg_data.width;
+        frames[i].height = jpeg_data.height;
+    }
+
+    clip->data = data;
+    clip->frames = frames;
+    clip->count = count;
+    clip->fps = fps;
+    clip->source = (esp_media_source_t) {
+            .describe = clip_describe,
+            .start = clip_start,
+            .next_frame = clip_next_frame,
+            .release = clip_release,
+            .stop = clip_stop,
+            .ctx = clip,
+    };
+    *source = &clip->source;
+    return ESP_OK;
+}
+
+esp_err_t esp_media_source_clip_load(const char *path, uint32_t fps, esp_media_source_t **source) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        ESP_LOGE(TAG, "Failed to open %s", path);
+        return ESP_ERR_NOT_FOUND;
+    }
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    uint8_t *data = length > 0 ? heap_caps_malloc(length, MALLOC_CAP_SPIRAM) : NULL;
+    if (!data) {
+        fclose(file);
+        return length > 0 ? ESP_ERR_NO_MEM : ESP_ERR_INVALID_SIZE;
+    }
+    size_t read = fread(data, 1, length, file);
+    fclose(file);
+    if (read != (size_t)length) {
+        ESP_LOGE(TAG, "Failed to read %s", path);
+        free(data);
+        return ESP_FAIL;
+    }
+
+    esp_err_t err = esp_media_source_clip_create(data, length, fps, source);
+    if (err != ESP_OK) {
+        free(data);
+        return err;
+    }
+    return ESP_OK;
+}
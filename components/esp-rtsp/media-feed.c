@@ -0,0 +1,135 @@
+//
+// Frames the application pushes as a media source, see esp-media-source.h
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
+
+#include "esp-media-source.h"
+
+#define TAG "media-feed"
+
+#define FEED_WAIT_MS 1000   // How long a stream waits for a frame before it looks whether to stop
+
+// A copy of a pushed frame, freed when the feed and the streams that sent it let go of it
+typedef struct {
+    esp_media_frame_t media;
+    int refs;
+    uint8_t data[];
+} feed_frame_t;
+
+typedef struct {
+    esp_media_source_t source;
+    SemaphoreHandle_t lock;
+    feed_frame_t *latest;
+    uint32_t seq;
+} feed_t;
+
+// Called with the lock held
+static void release(feed_frame_t *frame) {
+    if (frame && --frame->refs == 0) {
+        free(frame);
+    }
+}
+
+static esp_err_t feed_start(esp_media_source_t *source, void **stream) {
+    uint32_t *seq = calloc(1, sizeof(uint32_t));
+    if (!seq) {
+        return ESP_ERR_NO_MEM;
+    }
+    *stream = seq;
+    return ESP_OK;
+}
+
+static esp_err_t feed_next_frame(esp_media_source_t *source, void *stream, esp_media_frame_t *media) {
+    feed_t *feed = source->ctx;
+    uint32_t *seq = stream;
+    int64_t started_us = esp_timer_get_time();
+    while (esp_timer_get_time() - started_us < FEED_WAIT_MS * 1000LL) {
+        xSemaphoreTake(feed->lock, portMAX_DELAY);
+        feed_frame_t *frame = feed->latest;
+        if (frame && frame->media.seq != *seq) {
+            frame->refs++;
+            *seq = frame->media.seq;
+            *media = frame->media;
+            xSemaphoreGive(feed->lock);
+            return ESP_OK;
+        }
+        xSemaphoreGive(feed->lock);
+        vTaskDelay(1);
+    }
+    return ESP_ERR_TIMEOUT;
+}
+
+static void feed_release(esp_media_source_t *source, void *stream, esp_media_frame_t *media) {
+    feed_t *feed = source->ctx;
+    xSemaphoreTake(feed->lock, portMAX_DELAY);
+    release(media->handle);
+    xSemaphoreGive(feed->lock);
+}
+
+static void feed_stop(esp_media_source_t *source, void *stream) {
+    free(stream);
+}
+
+esp_err_t esp_media_source_feed_create(esp_media_source_t **source) {
+    if (!source) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    feed_t *feed = calloc(1, sizeof(feed_t));
+    if (!feed) {
+        return ESP_ERR_NO_MEM;
+    }
+    if (!(feed->lock = xSemaphoreCreateMutex())) {
+        free(feed);
+        return ESP_ERR_NO_MEM;
+    }
+    feed->source = (esp_media_source_t) {
+            .start = feed_start,
+            .next_frame = feed_next_frame,
+            .release = feed_release,
+            .stop = feed_stop,
+            .ctx = feed,
+    };
+    *source = &feed->source;
+    return ESP_OK;
+}
+
+esp_err_t esp_media_source_feed_push(esp_media_source_t *source, const uint8_t *buf, size_t len,
+                                     uint16_t width, uint16_t height, pixformat_t format) {
+    if (!source || !buf || !len) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    feed_t *feed = source->ctx;
+
+    feed_frame_t *frame = heap_caps_malloc(sizeof(feed_frame_t) + len, MALLOC_CAP_SPIRAM);
+    if (!frame && !(frame = malloc(sizeof(feed_frame_t) + len))) {
+        ESP_LOGW(TAG, "No room for a frame of %u bytes", (unsigned)len);
+        return ESP_ERR_NO_MEM;
+    }
+    memcpy(frame->data, buf, len);
+    frame->refs = 1;
+    frame->media = (esp_media_frame_t) {
+            .buf = frame->data,
+            .len = len,
+            .width = width,
+            .height = height,
+            .format = format,
+            .timestamp_us = esp_timer_get_time(),
+            .handle = frame,
+    };
+
+    xSemaphoreTake(feed->lock, portMAX_DELAY);
+    frame->media.seq = ++feed->seq;
+    feed_frame_t *previous = feed->latest;
+    feed->latest = frame;
+    release(previous);
+    xSemaphoreGive(feed->lock);
+    return ESP_OK;
+}
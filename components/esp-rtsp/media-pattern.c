@@ -0,0 +1,168 @@
+//
+// A test pattern as a media source, see esp-media-source.h
+//
+
+#include <stdio.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
+
+#include "esp-media-source.h"
+
+#define TAG "media-pattern"
+
+#define PATTERN_CROSSING_S 4    // How long the moving bar takes across the frame
+#define PATTERN_FRAMES 4        // A stream has frames out until it sent them, see pipeline.h
+
+// Y, U and V of the bars, 75% white, yellow, cyan, green, magenta, red, blue and black
+static const uint8_t bars[8][3] = {
+        { 180, 128, 128 }, { 162, 44, 142 }, { 131, 156, 44 }, { 112, 72, 58 },
+        { 84, 184, 198 }, { 65, 100, 212 }, { 35, 212, 114 }, { 16, 128, 128 },
+};
+
+typedef struct {
+    esp_media_source_t source;
+    uint16_t width;         // Even, two pixels share U and V
+    uint16_t height;
+    uint32_t fps;
+} pattern_t;
+
+typedef struct {
+    uint8_t *buf;
+    bool out;               // Until it is released, by the send stage of the stream
+} pattern_frame_t;
+
+// Every stream draws its own frames, in real time from when it started
+typedef struct {
+    pattern_frame_t frames[PATTERN_FRAMES];     // Allocated as they are needed
+    int64_t started_us;
+    uint32_t seq;
+} pattern_stream_t;
+
+static void draw(const pattern_t *pattern, uint8_t *frame, uint32_t seq) {
+    uint32_t bar_width = pattern->width / 16;
+    uint32_t bar_x = (uint64_t)seq * pattern->width / (pattern->fps * PATTERN_CROSSING_S) % pattern->width;
+    uint8_t *row = frame;
+    for (uint32_t x = 0; x < pattern->width; x += 2) {
+        bool moving = x + 2 > bar_x && x < bar_x + bar_width;
+        const uint8_t *yuv = moving ? (const uint8_t[3]) { 235, 128, 128 } : bars[x * 8 / pattern->width];
+        row[x * 2] = yuv[0];
+        row[x * 2 + 1] = yuv[1];
+        row[x * 2 + 2] = yuv[0];
+        row[x * 2 + 3] = yuv[2];
+    }
+    for (uint32_t y = 1; y < pattern->height; y++) {
+        memcpy(frame + y * pattern->width * 2, row, pattern->width * 2);
+    }
+}
+
+static size_t pattern_describe(esp_media_source_t *source, char *sdp, size_t size) {
+    pattern_t *pattern = source->ctx;
+    return snprintf(sdp, size,
+                    "m=video 0 RTP/AVP 26\r\n"
+                    "c=IN IP4 0.0.0.0\r\n"
+                    "a=framerate:%u\r\n",
+                    (unsigned)pattern->fps);
+}
+
+static esp_err_t pattern_start(esp_media_source_t *source, void **stream) {
+    pattern_stream_t *pattern_stream = calloc(1, sizeof(pattern_stream_t));
+    if (!pattern_stream) {
+        return ESP_ERR_NO_MEM;
+    }
+    *stream = pattern_stream;
+    return ESP_OK;
+}
+
+// A frame the stream does not have out, in PSRAM when there is
+static pattern_frame_t *pattern_frame(const pattern_t *pattern, pattern_stream_t *pattern_stream) {
+    size_t size = pattern->width * pattern->height * 2;
+    for (int i = 0; i < PATTERN_FRAMES; i++) {
+        pattern_frame_t *frame = &pattern_stream->frames[i];
+        if (__atomic_load_n(&frame->out, __ATOMIC_ACQUIRE)) {
+            continue;
+        }
+        if (!frame->buf && !(frame->buf = heap_caps_malloc(size, MALLOC_CAP_SPIRAM)) && !(frame->buf = malloc(size))) {
+            return NULL;
+        }
+        return frame;
+    }
+    return NULL;
+}
+
+static esp_err_t pattern_next_frame(esp_media_source_t *source, void *stream, esp_media_frame_t *media) {
+    pattern_t *pattern = source->ctx;
+    pattern_stream_t *pattern_stream = stream;
+
+    int64_t now_us = esp_timer_get_time();
+    if (!pattern_stream->started_us) {
+        pattern_stream->started_us = now_us;
+    }
+    uint32_t seq = (now_us - pattern_stream->started_us) * pattern->fps / 1000000 + 1;
+    if (seq <= pattern_stream->seq) {
+        seq = pattern_stream->seq + 1;
+        int64_t due_us = pattern_stream->started_us + (int64_t)(seq - 1) * 1000000 / pattern->fps;
+        if (due_us - now_us >= 1000) {
+            vTaskDelay(pdMS_TO_TICKS((due_us - now_us) / 1000));
+        }
+        now_us = esp_timer_get_time();
+    }
+    pattern_stream->seq = seq;
+
+    pattern_frame_t *frame = pattern_frame(pattern, pattern_stream);
+    if (!frame) {
+        return ESP_ERR_NO_MEM;
+    }
+    frame->out = true;
+    draw(pattern, frame->buf, seq);
+    *media = (esp_media_frame_t) {
+            .buf = frame->buf,
+            .len = pattern->width * pattern->height * 2,
+            .width = pattern->width,
+            .height = pattern->height,
+            .format = PIXFORMAT_YUV422,
+            .timestamp_us = now_us,
+            .seq = seq,
+            .handle = frame,
+    };
+    return ESP_OK;
+}
+
+static void pattern_release(esp_media_source_t *source, void *stream, esp_media_frame_t *media) {
+    __atomic_store_n(&((pattern_frame_t *)media->handle)->out, false, __ATOMIC_RELEASE);
+}
+
+static void pattern_stop(esp_media_source_t *source, void *stream) {
+    pattern_stream_t *pattern_stream = stream;
+    for (int i = 0; i < PATTERN_FRAMES; i++) {
+        free(pattern_stream->frames[i].buf);
+    }
+    free(pattern_stream);
+}
+
+esp_err_t esp_media_source_pattern_create(uint16_t width, uint16_t height, uint32_t fps, esp_media_source_t **source) {
+    if (width < 16 || width % 2 || !height || !fps || !source) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    pattern_t *pattern = calloc(1, sizeof(pattern_t));
+    if (!pattern) {
+        return ESP_ERR_NO_MEM;
+    }
+    pattern->width = width;
+    pattern->height = height;
+    pattern->fps = fps;
+    pattern->source = (esp_media_source_t) {
+            .describe = pattern_describe,
+            .start = pattern_start,
+            .next_frame = pattern_next_frame,
+            .release = pattern_release,
+            .stop = pattern_stop,
+            .ctx = pattern,
+    };
+    *source = &pattern->source;
+    return ESP_OK;
+}
@@ -0,0 +1,161 @@
+//
+// Metrics registry, see esp-metrics.h
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+
+#include "esp-metrics.h"
+
+static esp_metric_t *registry[ESP_METRICS_MAX];
+static unsigned registered;
+static esp_metrics_writer_t writers[ESP_METRICS_MAX_WRITERS];
+static unsigned writer_count;
+
+void esp_metrics_register(esp_metric_t *metric) {
+    if (__atomic_exchange_n(&metric->registered, true, __ATOMIC_ACQ_REL)) {
+        return;
+    }
+    unsigned slot = __atomic_fetch_add(&registered, 1, __ATOMIC_RELAXED);
+    if (slot < ESP_METRICS_MAX) {
+        __atomic_store_n(&registry[slot], metric, __ATOMIC_RELEASE);
+    }
+}
+
+esp_err_t esp_metrics_register_writer(esp_metrics_writer_t writer) {
+    unsigned slot = __atomic_fetch_add(&writer_count, 1, __ATOMIC_RELAXED);
+    if (slot >= ESP_METRICS_MAX_WRITERS) {
+        return ESP_ERR_NO_MEM;
+    }
+    __atomic_store_n(&writers[slot], writer, __ATOMIC_RELEASE);
+    return ESP_OK;
+}
+
+void esp_metric_observe(esp_metric_t *metric, uint64_t value) {
+    if (!__atomic_load_n(&metric->registered, __ATOMIC_RELAXED)) {
+        esp_metrics_register(metric);
+    }
+    size_t bucket = 0;
+    for (uint64_t bound = ESP_METRICS_BUCKET_BASE; bucket < ESP_METRICS_BUCKETS - 1 && value > bound; bound <<= 1) {
+        bucket++;
+    }
+    __atomic_add_fetch(&metric->buckets[bucket], 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&metric->value, value, __ATOMIC_RELAXED);
+}
+
+size_t esp_metrics_printf(char *buffer, size_t size, size_t length, const char *format, ...) {
+    if (length >= size) {
+        return length;
+    }
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(buffer + length, size - length, format, args);
+    va_end(args);
+    if (n < 0 || (size_t)n >= size - length) {
+        buffer[length] = 0;
+        return length;
+    }
+    return length + n;
+}
+
+typedef struct {
+    char *buffer;
+    size_t size;
+    size_t length;
+    bool full;
+} text_t;
+
+// Appends a line when it fits in full, the text ends at the first one that does not
+static void append(text_t *text, const char *format, ...) __attribute__((format(printf, 2, 3)));
+static void append(text_t *text, const char *format, ...) {
+    if (text->full) {
+        return;
+    }
+    va_list args;
+    va_start(args, format);
+    int n = vsnprintf(text->buffer + text->length, text->size - text->length, format, args);
+    va_end(args);
+    if (n < 0 || (size_t)n >= text->size - text->length) {
+        text->buffer[text->length] = 0;
+        text->full = true;
+        return;
+    }
+    text->length += n;
+}
+
+static void append_histogram(text_t *text, const esp_metric_t *metric) {
+    uint64_t count = 0;
+    uint64_t bound = ESP_METRICS_BUCKET_BASE;
+    for (size_t i = 0; i < ESP_METRICS_BUCKETS; i++, bound <<= 1) {
+        count += __atomic_load_n(&metric->buckets[i], __ATOMIC_RELAXED);
+        if (i < ESP_METRICS_BUCKETS - 1) {
+            append(text, "%s_bucket{le=\"%llu\"} %llu\n", metric->name, (unsigned long long)bound, (unsigned long long)count);
+        } else {
+            append(text, "%s_bucket{le=\"+Inf\"} %llu\n", metric->name, (unsigned long long)count);
+        }
+    }
+    append(text, "%s_sum %llu\n", metric->name, (unsigned long long)__atomic_load_n(&metric->value, __ATOMIC_RELAXED));
+    append(text, "%s_count %llu\n", metric->name, (unsigned long long)count);
+}
+
+// Drops the lines that do not start with prefix, returns the length of the rest
+static size_t keep_lines(char *lines, size_t length, const char *prefix) {
+    size_t kept = 0;
+    size_t prefix_length = strlen(prefix);
+    for (size_t start = 0; start < length;) {
+        char *end = memchr(lines + start, '\n', length - start);
+        size_t line_length = end ? (size_t)(end - (lines + start)) + 1 : length - start;
+        if (strncmp(lines + start, prefix, prefix_length) == 0) {
+            memmove(lines + kept, lines + start, line_length);
+            kept += line_length;
+        }
+        start += line_length;
+    }
+    lines[kept] = 0;
+    return kept;
+}
+
+// Whether a line of the metric can start with prefix
+static bool related(const char *name, const char *prefix) {
+    size_t n = strlen(name), p = strlen(prefix);
+    return strncmp(name, prefix, n < p ? n : p) == 0;
+}
+
+size_t esp_metrics_format(char *buffer, size_t size, const char *prefix) {
+    if (!buffer || !size) {
+        return 0;
+    }
+    text_t text = { .buffer = buffer, .size = size };
+    buffer[0] = 0;
+
+    unsigned count = __atomic_load_n(&registered, __ATOMIC_RELAXED);
+    for (unsigned i = 0; i < count && i < ESP_METRICS_MAX; i++) {
+        // A metric that is being registered is not published yet
+        const esp_metric_t *metric = __atomic_load_n(&registry[i], __ATOMIC_ACQUIRE);
+        if (!metric || (prefix && !related(metric->name, prefix))) {
+            continue;
+        }
+        size_t start = text.length;
+        if (metric->type == ESP_METRICS_HISTOGRAM) {
+            append_histogram(&text, metric);
+        } else {
+            append(&text, "%s %llu\n", metric->name, (unsigned long long)__atomic_load_n(&metric->value, __ATOMIC_RELAXED));
+        }
+        if (prefix) {
+            // A prefix may pick single lines of a histogram, like its _count
+            text.length = start + keep_lines(text.buffer + start, text.length - start, prefix);
+        }
+    }
+
+    unsigned n = __atomic_load_n(&writer_count, __ATOMIC_RELAXED);
+    for (unsigned i = 0; i < n && i < ESP_METRICS_MAX_WRITERS && !text.full; i++) {
+        esp_metrics_writer_t writer = __atomic_load_n(&writers[i], __ATOMIC_ACQUIRE);
+        if (!writer) {
+            continue;
+        }
+        size_t length = writer(text.buffer + text.length, text.size - text.length);
+        text.length += prefix ? keep_lines(text.buffer + text.length, length, prefix) : length;
+    }
+    return text.length;
+}
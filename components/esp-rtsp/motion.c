@@ -0,0 +1,203 @@
+//
+// Motion detection on the DC coefficients of JPEG frames, see esp-motion.h
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <esp_err.h>
+#include <esp_log.h>
+
+#include "esp_jpg_decode.h"
+#include "esp-motion.h"
+
+#define TAG "esp-motion"
+
+#define BACKGROUND_FRACTION_BITS 8
+
+struct esp_motion {
+    esp_motion_config_t config;
+    esp_motion_cb_t cb;
+    void *arg;
+
+    void *work;             // Decoder workspace, JPG_DECODER_WORK_SIZE
+    uint8_t *map;           // Luminance of the MCUs of the current frame
+    uint16_t *background;   // Running average of the map, BACKGROUND_FRACTION_BITS fractional bits
+    size_t map_size;
+    uint16_t cols;
+    uint16_t rows;
+
+    bool active;
+    int64_t last_motion_us;
+};
+
+esp_err_t esp_motion_create(const esp_motion_config_t *config, esp_motion_t **motion) {
+    if (!config || !motion || config->background_shift > 15) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_motion_t *m = calloc(1, sizeof(esp_motion_t));
+    if (!m) {
+        return ESP_ERR_NO_MEM;
+    }
+    m->work = malloc(JPG_DECODER_WORK_SIZE);
+    if (!m->work) {
+        free(m);
+        return ESP_ERR_NO_MEM;
+    }
+    m->config = *config;
+
+    *motion = m;
+    return ESP_OK;
+}
+
+void esp_motion_delete(esp_motion_t *motion) {
+    if (!motion) {
+        return;
+    }
+    free(motion->background);
+    free(motion->map);
+    free(motion->work);
+    free(motion);
+}
+
+void esp_motion_set_callback(esp_motion_t *motion, esp_motion_cb_t cb, void *arg) {
+    motion->cb = cb;
+    motion->arg = arg;
+}
+
+bool esp_motion_active(const esp_motion_t *motion) {
+    return motion->active;
+}
+
+// Grows the maps for a frame of cols by rows MCUs, the background starts over from the frame
+static esp_err_t reset_background(esp_motion_t *motion, uint16_t cols, uint16_t rows) {
+    size_t size = (size_t)cols * rows;
+    if (size > motion->map_size) {
+        free(motion->map);
+        free(motion->background);
+        motion->map = malloc(size);
+        motion->background = malloc(size * sizeof(uint16_t));
+        motion->map_size = motion->map && motion->background ? size : 0;
+        if (!motion->map_size) {
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    motion->cols = cols;
+    motion->rows = rows;
+    return ESP_OK;
+}
+
+static esp_err_t luma_map(esp_motion_t *motion, const uint8_t *jpeg, size_t length, bool *reset) {
+    jpg_decoder_t *decoder;
+    uint16_t cols, rows;
+    esp_err_t err = esp_jpg_decoder_open(motion->work, JPG_DECODER_WORK_SIZE, jpeg, length, &decoder, NULL, NULL);
+    if (err == ESP_OK) {
+        err = esp_jpg_decoder_luma_map(decoder, motion->map, motion->map_size, &cols, &rows);
+    }
+    if (err != ESP_OK && err != ESP_ERR_INVALID_SIZE) {
+        return err;
+    }
+
+    // A new resolution: the map was too small, or it is laid out differently
+    *reset = err == ESP_ERR_INVALID_SIZE || cols != motion->cols || rows != motion->rows;
+    if (err == ESP_ERR_INVALID_SIZE) {
+        err = reset_background(motion, cols, rows);
+        if (err == ESP_OK) {
+            err = esp_jpg_decoder_open(motion->work, JPG_DECODER_WORK_SIZE, jpeg, length, &decoder, NULL, NULL);
+        }
+        if (err == ESP_OK) {
+            err = esp_jpg_decoder_luma_map(decoder, motion->map, motion->map_size, NULL, NULL);
+        }
+    } else if (*reset) {
+        err = reset_background(motion, cols, rows);
+    }
+    return err;
+}
+
+// Counts changed MCUs per zone, after taking out the change of the whole picture so a
+// cloud or the auto exposure of the sensor does not count as motion
+static void compare(esp_motion_t *motion, esp_motion_event_t *result) {
+    const int fraction = BACKGROUND_FRACTION_BITS;
+    size_t count = (size_t)motion->cols * motion->rows;
+    int32_t total = 0;
+    for (size_t i = 0; i < count; i++) {
+        total += (motion->map[i] << fraction) - motion->background[i];
+    }
+    int32_t global = total / (int32_t)count;
+
+    uint32_t changed[ESP_MOTION_ZONES] = { 0 }, cells[ESP_MOTION_ZONES] = { 0 };
+    int32_t threshold = motion->config.cell_threshold << fraction;
+    for (uint16_t row = 0; row < motion->rows; row++) {
+        const uint8_t *map = motion->map + row * motion->cols;
+        uint16_t *background = motion->background + row * motion->cols;
+        size_t zone_row = row * ESP_MOTION_ZONES_Y / motion->rows * ESP_MOTION_ZONES_X;
+        for (uint16_t col = 0; col < motion->cols; col++) {
+            size_t zone = zone_row + col * ESP_MOTION_ZONES_X / motion->cols;
+            int32_t diff = (map[col] << fraction) - background[col];
+            int32_t change = diff - global;
+            cells[zone]++;
+            changed[zone] += change > threshold || change < -threshold;
+            background[col] += diff >> motion->config.background_shift;
+        }
+    }
+
+    result->zones = 0;
+    result->level = 0;
+    for (size_t zone = 0; zone < ESP_MOTION_ZONES; zone++) {
+        if (!cells[zone]) {
+            continue;
+        }
+        uint8_t level = changed[zone] * 100 / cells[zone];
+        if (motion->config.zone_threshold[zone] && level >= motion->config.zone_threshold[zone]) {
+            result->zones |= 1u << zone;
+            if (level > result->level) {
+                result->level = level;
+            }
+        }
+    }
+}
+
+esp_err_t esp_motion_process(esp_motion_t *motion, const uint8_t *jpeg, size_t length, int64_t timestamp_us,
+                             esp_motion_event_t *result) {
+    if (!motion || !jpeg) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    esp_motion_event_t event = {
+            .timestamp_us = timestamp_us,
+    };
+    bool reset = false;
+    esp_err_t err = luma_map(motion, jpeg, length, &reset);
+    if (err != ESP_OK) {
+        ESP_LOGD(TAG, "Frame of %u bytes not parsed: %s", length, esp_err_to_name(err));
+        event.zones = (1u << ESP_MOTION_ZONES) - 1;
+        event.level = 100;
+        motion->cols = motion->rows = 0; // Start over with the next frame
+    } else if (reset) {
+        size_t count = (size_t)motion->cols * motion->rows;
+        for (size_t i = 0; i < count; i++) {
+            motion->background[i] = motion->map[i] << BACKGROUND_FRACTION_BITS;
+        }
+        event.zones = (1u << ESP_MOTION_ZONES) - 1;
+        event.level = 100;
+    } else {
+        compare(motion, &event);
+    }
+
+    bool was_active = motion->active;
+    if (event.zones) {
+        motion->last_motion_us = timestamp_us;
+        motion->active = true;
+    } else if (motion->active && timestamp_us - motion->last_motion_us >= (int64_t)motion->config.hold_ms * 1000) {
+        motion->active = false;
+    }
+    event.active = motion->active;
+
+    if (motion->active != was_active && motion->cb) {
+        motion->cb(&event, motion->arg);
+    }
+    if (result) {
+        *result = event;
+    }
+    return err;
+}
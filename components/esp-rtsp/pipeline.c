@@ -0,0 +1,231 @@
+//
+// Stages of a stream as tasks of their own, see pipeline.h
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include "pipeline.h"
+#include "esp-metrics.h"
+
+#define TAG "pipeline"
+
+#define PIPELINE_MAX 8
+#define PIPELINE_MAX_ITEMS 8   // A power of two, a queue has room for all items
+#define PIPELINE_POLL_MS 50    // How often a stage that waits for an item looks whether to stop
+
+// Single producer, single consumer. The producer only writes head, the consumer only tail, the
+// semaphore wakes the consumer, it checks head again as gives of a binary semaphore add up to one.
+typedef struct {
+    void *slots[PIPELINE_MAX_ITEMS];
+    uint32_t head;
+    uint32_t tail;
+    SemaphoreHandle_t ready;
+} queue_t;
+
+typedef struct {
+    pipeline_stage_t config;
+    pipeline_t *pipeline;
+    queue_t *in;
+    queue_t *out;
+    char task_name[16];
+
+    // Written by the stage only
+    uint64_t items;
+    uint64_t waiting_sum;  // Items in the queue when the stage took one, itself included
+    uint64_t wait_us;      // For an item
+    uint64_t busy_us;
+} stage_t;
+
+struct pipeline {
+    char name[16];
+    void *arg;
+    size_t stage_count;
+    stage_t stages[PIPELINE_MAX_STAGES];
+    queue_t queues[PIPELINE_MAX_STAGES];    // queues[i] is in front of stages[i]
+    volatile bool stop;
+    volatile int running;
+};
+
+static pipeline_t *pipelines[PIPELINE_MAX];
+static SemaphoreHandle_t lock;
+
+static void queue_push(queue_t *queue, void *item) {
+    uint32_t head = queue->head;
+    queue->slots[head % PIPELINE_MAX_ITEMS] = item;
+    __atomic_store_n(&queue->head, head + 1, __ATOMIC_RELEASE);
+    xSemaphoreGive(queue->ready);
+}
+
+// NULL when nothing came within wait, *waiting the items that were in the queue
+static void *queue_pop(queue_t *queue, TickType_t wait, uint32_t *waiting) {
+    uint32_t tail = queue->tail;
+    for (;;) {
+        uint32_t head = __atomic_load_n(&queue->head, __ATOMIC_ACQUIRE);
+        if (head != tail) {
+            void *item = queue->slots[tail % PIPELINE_MAX_ITEMS];
+            __atomic_store_n(&queue->tail, tail + 1, __ATOMIC_RELEASE);
+            *waiting = head - tail;
+            return item;
+        }
+        if (xSemaphoreTake(queue->ready, wait) != pdTRUE) {
+            return NULL;
+        }
+    }
+}
+
+static void stage_task(void *arg) {
+    stage_t *stage = arg;
+    pipeline_t *pipeline = stage->pipeline;
+
+    while (!pipeline->stop) {
+        int64_t start_us = esp_timer_get_time();
+        uint32_t waiting;
+        void *item = queue_pop(stage->in, pdMS_TO_TICKS(PIPELINE_POLL_MS), &waiting);
+        int64_t taken_us = esp_timer_get_time();
+        __atomic_add_fetch(&stage->wait_us, taken_us - start_us, __ATOMIC_RELAXED);
+        if (!item) {
+            continue;
+        }
+
+        stage->config.work(item, pipeline->arg);
+
+        __atomic_add_fetch(&stage->busy_us, esp_timer_get_time() - taken_us, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&stage->waiting_sum, waiting, __ATOMIC_RELAXED);
+        __atomic_add_fetch(&stage->items, 1, __ATOMIC_RELAXED);
+        queue_push(stage->out, item);
+    }
+
+    __atomic_sub_fetch(&pipeline->running, 1, __ATOMIC_RELAXED);
+    vTaskDelete(NULL);
+}
+
+static void pipeline_free(pipeline_t *pipeline) {
+    for (size_t i = 0; i < pipeline->stage_count; i++) {
+        if (pipeline->queues[i].ready) {
+            vSemaphoreDelete(pipeline->queues[i].ready);
+        }
+    }
+    free(pipeline);
+}
+
+esp_err_t pipeline_create(const char *name, const pipeline_stage_t *stages, size_t stage_count,
+                          void *const *items, size_t item_count, void *arg, pipeline_t **out) {
+    if (!stage_count || stage_count > PIPELINE_MAX_STAGES || !item_count || item_count > PIPELINE_MAX_ITEMS) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (!lock && !(lock = xSemaphoreCreateMutex())) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    pipeline_t *pipeline = calloc(1, sizeof(pipeline_t));
+    if (!pipeline) {
+        return ESP_ERR_NO_MEM;
+    }
+    snprintf(pipeline->name, sizeof(pipeline->name), "%s", name);
+    pipeline->arg = arg;
+    pipeline->stage_count = stage_count;
+    for (size_t i = 0; i < stage_count; i++) {
+        if (!(pipeline->queues[i].ready = xSemaphoreCreateBinary())) {
+            pipeline_free(pipeline);
+            return ESP_ERR_NO_MEM;
+        }
+        stage_t *stage = &pipeline->stages[i];
+        stage->config = stages[i];
+        stage->pipeline = pipeline;
+        stage->in = &pipeline->queues[i];
+        stage->out = &pipeline->queues[(i + 1) % stage_count];
+        snprintf(stage->task_name, sizeof(stage->task_name), "%s_%s", name, stages[i].name);
+    }
+    for (size_t i = 0; i < item_count; i++) {
+        queue_push(&pipeline->queues[0], items[i]);
+    }
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    int slot = 0;
+    while (slot < PIPELINE_MAX && pipelines[slot]) {
+        slot++;
+    }
+    if (slot == PIPELINE_MAX) {
+        xSemaphoreGive(lock);
+        pipeline_free(pipeline);
+        return ESP_ERR_NO_MEM;
+    }
+    pipelines[slot] = pipeline;
+    xSemaphoreGive(lock);
+
+    *out = pipeline;
+    for (size_t i = 0; i < stage_count; i++) {
+        stage_t *stage = &pipeline->stages[i];
+        __atomic_add_fetch(&pipeline->running, 1, __ATOMIC_RELAXED);
+        if (xTaskCreatePinnedToCore(stage_task, stage->task_name, stage->config.stack_size, stage,
+                                    stage->config.priority, NULL, stage->config.core) != pdPASS) {
+            ESP_LOGE(TAG, "Failed to create the task of stage %s", stage->task_name);
+            __atomic_sub_fetch(&pipeline->running, 1, __ATOMIC_RELAXED);
+            pipeline_delete(pipeline);
+            *out = NULL;
+            return ESP_FAIL;
+        }
+    }
+    return ESP_OK;
+}
+
+void pipeline_delete(pipeline_t *pipeline) {
+    if (!pipeline) {
+        return;
+    }
+    pipeline->stop = true;
+    while (__atomic_load_n(&pipeline->running, __ATOMIC_RELAXED) > 0) {
+        vTaskDelay(1);
+    }
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    for (int i = 0; i < PIPELINE_MAX; i++) {
+        if (pipelines[i] == pipeline) {
+            pipelines[i] = NULL;
+        }
+    }
+    xSemaphoreGive(lock);
+    pipeline_free(pipeline);
+}
+
+bool pipeline_stopping(const pipeline_t *pipeline) {
+    return pipeline->stop;
+}
+
+size_t pipeline_write_metrics(char *buffer, size_t size) {
+    size_t length = 0;
+    if (!lock) {
+        return length;
+    }
+
+    xSemaphoreTake(lock, portMAX_DELAY);
+    for (int i = 0; i < PIPELINE_MAX; i++) {
+        pipeline_t *pipeline = pipelines[i];
+        for (size_t s = 0; pipeline && s < pipeline->stage_count; s++) {
+            stage_t *stage = &pipeline->stages[s];
+            const char *name = stage->config.name;
+            length = esp_metrics_printf(buffer, size, length,
+                                        "pipeline_items_total{pipeline=\"%s\",stage=\"%s\"} %llu\n"
+                                        "pipeline_queue_items_sum{pipeline=\"%s\",stage=\"%s\"} %llu\n"
+                                        "pipeline_wait_us_total{pipeline=\"%s\",stage=\"%s\"} %llu\n"
+                                        "pipeline_busy_us_total{pipeline=\"%s\",stage=\"%s\"} %llu\n",
+                                        pipeline->name, name,
+                                        (unsigned long long)__atomic_load_n(&stage->items, __ATOMIC_RELAXED),
+                                        pipeline->name, name,
+                                        (unsigned long long)__atomic_load_n(&stage->waiting_sum, __ATOMIC_RELAXED),
+                                        pipeline->name, name,
+                                        (unsigned long long)__atomic_load_n(&stage->wait_us, __ATOMIC_RELAXED),
+                                        pipeline->name, name,
+                                        (unsigned long long)__atomic_load_n(&stage->busy_us, __ATOMIC_RELAXED));
+        }
+    }
+    xSemaphoreGive(lock);
+    return length;
+}
@@ -0,0 +1,33 @@
+//
+// Admission of RTSP streams by the bandwidth they need.
+//
+// The bytes per frame and the frames per second of a stream are estimated
+// from what the streams send, the capacity of the uplink from how much they
+// got through while lwIP ran out of buffers, or it is set. A new stream is
+// admitted when it fits next to the others. When it only fits at a lower
+// frame rate it gets that rate, so the streams that are already playing keep
+// theirs, when not even RTSP_ADMISSION_MIN_FPS fits it is refused.
+//
+
+#ifndef ESPCAM_ADMISSION_H
+#define ESPCAM_ADMISSION_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// What the streams sent in elapsed_us, congested counts the sends that found the uplink full
+void admission_sample(uint64_t bytes, uint32_t frames, uint32_t congested, int streams, int64_t elapsed_us);
+
+// Whether a new stream fits while the others take used_kbps. stream_kbps is what a stream that plays
+// at its full frame rate takes, 0 when there is none and it is estimated from the frames sent.
+// *interval_ms is its least delta between frames, left alone unless it only fits at a lower rate,
+// *kbps what it is expected to take.
+bool admission_admit(uint32_t used_kbps, uint32_t stream_kbps, uint32_t *interval_ms, uint32_t *kbps);
+
+// 0 while the capacity is not known, every stream is admitted then
+uint32_t admission_capacity_kbps(void);
+
+// A capacity that is set is not measured, 0 goes back to measuring it
+void admission_set_capacity_kbps(uint32_t kbps);
+
+#endif //ESPCAM_ADMISSION_H
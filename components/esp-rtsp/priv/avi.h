@@ -0,0 +1,71 @@
+//
+// MJPEG in AVI files that survive a power loss.
+//
+// The headers take up the first cluster of the file, padded with a JUNK
+// chunk, so the frames start at a cluster boundary and writes of whole
+// clusters stay aligned. The idx1 entries go to an index file next to the
+// AVI as the frames are written, the idx1 chunk is only assembled from it
+// when the file is closed. Every sync rewrites the header cluster with the
+// frames that are on the card so far, a file that was cut short plays up to
+// the last sync and avi_recover() adds the index to it.
+//
+
+#ifndef ESPCAM_AVI_H
+#define ESPCAM_AVI_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <esp_err.h>
+
+#define AVI_HEADER_MIN_SIZE 512 // The cluster size has to fit the headers
+#define AVI_CHUNK_HEADER_SIZE 8
+#define AVI_FRAME_ID "00dc"         // Chunk of a compressed frame of the first stream
+#define AVI_INDEX_KEYFRAME 0x10     // Flag of an index entry, every JPEG is one
+
+// An entry of idx1, as it is in the file
+typedef struct {
+    char id[4];
+    uint32_t flags;
+    uint32_t offset; // Of the chunk header, from the 'movi' fourcc
+    uint32_t size;   // Of the chunk data
+} avi_index_entry_t;
+
+typedef struct {
+    char path[96];
+    int fd;
+    int index_fd;
+    uint8_t *header;      // The first cluster, rewritten on every sync
+    size_t cluster_size;
+    uint32_t end;         // File offset after the last byte written
+    uint32_t movi_end;    // File offset after the last complete frame
+    uint32_t frames;      // Complete frames, their entries are in the index file
+    uint32_t max_frame;
+    uint32_t us_per_frame;
+} avi_file_t;
+
+// Offset of the chunk at file offset position, for its index entry
+#define AVI_MOVI_OFFSET(avi, position) ((position) - ((avi)->cluster_size - 4))
+
+esp_err_t avi_open(avi_file_t *avi, const char *path, size_t cluster_size, uint16_t width, uint16_t height);
+
+// Appends data, which ends the frames of the entries
+esp_err_t avi_write(avi_file_t *avi, const void *data, size_t length, const avi_index_entry_t *entries, size_t count);
+
+// Makes the frames written so far survive a power loss
+esp_err_t avi_sync(avi_file_t *avi);
+
+// Adds the index and the final header, scratch is for copying the index. Without scratch the
+// file is left for avi_recover(), a file without frames is removed.
+esp_err_t avi_close(avi_file_t *avi, void *scratch, size_t scratch_size);
+
+// Finishes a file that was not closed, from its index file, and removes the index file.
+// A file without frames is removed too.
+esp_err_t avi_recover(const char *path, void *scratch, size_t scratch_size);
+
+// The header of the chunk of a frame of size bytes, the data is padded to an even size
+void avi_chunk_header(uint8_t *out, uint32_t size);
+
+// The path of the index file of the AVI at path, the extension replaced with .idx
+void avi_index_path(const char *path, char *out, size_t size);
+
+#endif //ESPCAM_AVI_H
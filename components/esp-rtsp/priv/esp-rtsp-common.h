@@ -9,8 +9,11 @@
 #include <esp_timer.h> 
 #include <esp_netif.h>
 
+#include "esp-media-source.h"
+
 
 #define URL_MAX_LENGTH 1024
+#define BODY_MAX_LENGTH 256
 
 typedef enum {
     OPTIONS,
@@ -18,9 +21,20 @@ typedef enum {
     SETUP,
     PLAY,
     TEARDOWN,
+    GET_PARAMETER,
+    PAUSE,
     UNSUPPORTED
 } rtsp_request_type_t;
 
+// Where PLAY starts, only ranges that are open ended
+typedef enum {
+    RANGE_NONE,     // Without a Range header
+    RANGE_LIVE,     // npt=now-, or any npt from 0 on
+    RANGE_NPT,      // npt=-<seconds>-, range_us before now
+    RANGE_CLOCK,    // clock=<UTC time>-, range_us since the epoch
+    RANGE_INVALID,  // Not one of these, PLAY answers 457 and the connection goes on
+} rtsp_range_type_t;
+
 typedef struct {
     rtsp_request_type_t request_type;
     char url[URL_MAX_LENGTH + 1];
@@ -28,6 +42,10 @@ typedef struct {
     int cseq;
     int dst_rtp_port;
     int dst_rtcp_port;
+    int content_length;
+    rtsp_range_type_t range_type;
+    int64_t range_us;
+    char body[BODY_MAX_LENGTH + 1]; // As far as it came with the headers
 } rtsp_req_t;
 
 typedef void* rtsp_parser_handle_t;
@@ -46,6 +64,11 @@ rtsp_req_t *parser_get_request(rtsp_parser_handle_t handle);
 int parser_free(rtsp_parser_handle_t handle);
 
 esp_err_t rtsp_server_main();
+esp_err_t rtsp_server_register_source(const char *path, esp_media_source_t *source);
+int esp_rtsp_create_listening_socket(int port);
+size_t rtsp_server_write_metrics(char *buffer, size_t size);
+
+esp_err_t http_server_main(int port);
 
  
  
@@ -8,9 +8,16 @@
 #define SERVER_STACKSIZE (16 * 1024)
 #define SERVER_PRIORITY 2
 
+#ifndef HTTP_PORT
+#define HTTP_PORT 80 // MJPEG and snapshots over HTTP, 0 for none
+#endif
+
+#define HTTP_SERVER_STACKSIZE (4 * 1024)
+
 typedef struct {
     bool running;
     TaskHandle_t server_taskhandle;
+    TaskHandle_t http_taskhandle;
 } esp_rtsp_server_t;
 
 
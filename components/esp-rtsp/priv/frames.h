@@ -0,0 +1,71 @@
+//
+// Frames of the camera shared between the RTSP and HTTP streams.
+//
+// A stream asks for a frame newer than the last one it got. When another
+// stream is already capturing, it waits for that frame instead of taking a
+// frame buffer of its own, so all streams send from the same buffers and the
+// camera is read once per frame however many clients there are. A frame goes
+// back to the driver when the last stream returns it.
+//
+// The most recent frame is kept for snapshots, RTSP_KEEP_LATEST_FRAME. That
+// holds on to one frame buffer of the driver, so it needs a fb_count of two
+// or more.
+//
+// While the RTSP streams or the recorder watch for motion, one detector sees
+// every JPEG frame right after it was captured, on the task that captured it,
+// and the frame carries the outcome to all of them. That costs about 2 ms per
+// XGA frame of 100 KB on the host, once per frame however many streams there
+// are.
+//
+
+#ifndef ESPCAM_FRAMES_H
+#define ESPCAM_FRAMES_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <esp_err.h>
+
+#include "esp_camera.h"
+#include "esp-motion.h"
+
+typedef struct {
+    camera_fb_t *fb;     // NULL while the slot is free
+    uint32_t seq;        // Counts the frames captured, starting at 1
+    int64_t captured_us;
+    bool motion;         // Something moved, or the frame was not compared, see frames_motion_enable()
+    int refs;
+} shared_frame_t;
+
+esp_err_t frames_init(void);
+
+// Whether the camera is up, see esp_rtsp_server_set_source_ready(). It starts out ready.
+void frames_set_ready(bool ready);
+
+// Waits up to timeout_ms for the camera to be up, false when it is not
+bool frames_wait_ready(uint32_t timeout_ms);
+
+// A frame newer than *seq, which is updated to it. A stream starts with *seq at 0, it
+// then gets the next frame captured. NULL when the capture failed or the camera is not up,
+// it is never read before.
+shared_frame_t *frames_get(uint32_t *seq);
+
+// The most recent frame without waiting for the camera, NULL when there is none younger
+// than max_age_us
+shared_frame_t *frames_latest(int64_t max_age_us);
+
+void frames_return(shared_frame_t *frame);
+
+// Runs the motion detector on the frames captured from now on. A config replaces the one it runs
+// with, NULL keeps that or starts with ESP_MOTION_CONFIG_DEFAULT(). Every enable needs a disable,
+// the detector stops after the last one.
+esp_err_t frames_motion_enable(const esp_motion_config_t *config);
+void frames_motion_disable(void);
+
+// Gets the start and end of motion, once however many streams watch it
+void frames_set_motion_callback(esp_motion_cb_t cb, void *arg);
+
+// A stream of the camera source, see esp_media_source_camera(), goes on with the frames after seq,
+// e.g. after it replayed up to there
+void frames_source_continue(void *stream, uint32_t seq);
+
+#endif //ESPCAM_FRAMES_H
@@ -0,0 +1,55 @@
+//
+// Stages of a stream as tasks of their own, connected by bounded queues.
+//
+// The stages form a ring: an item goes from each stage to the next through a
+// single producer, single consumer queue, and from the last stage back to the
+// first, which starts out with all of them. The items are references the
+// caller owns, e.g. to frames, so nothing is allocated or copied per item. With
+// two items one stage works on the next frame while the stage after it works
+// on the current one, more items let a stage get further ahead.
+//
+// A stage can be pinned to a core and has its own priority, e.g. capture and
+// encode on core 1 and the network on core 0 with the Wi-Fi stack. How full
+// the queue in front of each stage is on average shows where the bottleneck
+// is: items pile up in front of the slowest stage.
+//
+
+#ifndef ESPCAM_PIPELINE_H
+#define ESPCAM_PIPELINE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <esp_err.h>
+#include <freertos/FreeRTOS.h>
+
+#define PIPELINE_MAX_STAGES 4
+
+// Works on an item, which then goes to the next stage
+typedef void (*pipeline_work_t)(void *item, void *arg);
+
+typedef struct {
+    const char *name;       // Of the task and in the metrics
+    pipeline_work_t work;
+    BaseType_t core;        // tskNO_AFFINITY for either core
+    UBaseType_t priority;
+    uint32_t stack_size;
+} pipeline_stage_t;
+
+typedef struct pipeline pipeline_t;
+
+// The stages run until pipeline_delete(), the items start in the queue of the first stage.
+// *pipeline is set before the stages start, for work that asks pipeline_stopping().
+esp_err_t pipeline_create(const char *name, const pipeline_stage_t *stages, size_t stage_count,
+                          void *const *items, size_t item_count, void *arg, pipeline_t **pipeline);
+
+// Waits for the stages to finish the items they work on, the items are the caller's again
+void pipeline_delete(pipeline_t *pipeline);
+
+// Whether the pipeline is being deleted, for work that waits, e.g. for a frame worth sending
+bool pipeline_stopping(const pipeline_t *pipeline);
+
+// For the metrics registry, a line per stage of every pipeline
+size_t pipeline_write_metrics(char *buffer, size_t size);
+
+#endif //ESPCAM_PIPELINE_H
@@ -5,6 +5,19 @@
 #ifndef ESPCAM_RTP_UDP_H
 #define ESPCAM_RTP_UDP_H
 
+#define MAX_PAYLOAD_SIZE 1472 // This is based on MTU 1500 minus udp headers
+
+typedef struct {
+    uint32_t frames;
+    uint32_t packets;
+    uint64_t bytes_sent;
+    uint64_t bytes_copied; // Bytes memcpy'd while building packets
+    uint64_t parse_us;     // Locating quant tables and scan data in the frame
+    uint64_t packetize_us; // Building packets, excluding the time in sendto
+    uint64_t send_us;
+    uint64_t first_packet_us; // From the start of a frame until its first packet is sent
+} esp_rtp_stats_t;
+
 typedef struct {
     int initialized;
 
@@ -18,8 +31,14 @@ typedef struct {
     uint16_t dst_rtp_port;
     uint16_t dst_rtcp_port;
 
-    uint32_t timestamp;
+    uint32_t ssrc;
+    uint32_t timestamp; // Random offset of the 90 kHz media clock
     uint32_t sequence_number;
+
+    uint32_t packets; // Sent in this session
+    uint64_t bytes;
+
+    uint8_t payload[MAX_PAYLOAD_SIZE];
 } esp_rtp_session_t;
 
 typedef void* esp_rtp_session_handle_t;
@@ -34,7 +53,7 @@ typedef struct {
 
 typedef struct {
     uint8_t type_specific;
-    uint16_t fragment_offset;
+    uint32_t fragment_offset; // 24 bits on the wire
     uint8_t type;
     uint8_t q;
     uint16_t width;
@@ -46,9 +65,15 @@ typedef struct {
     size_t jpeg_data_length;
     char *quant_table_0;
     char *quant_table_1;
+    uint8_t type;              // RFC 2435 type from the SOF0 sampling factors, 0 for 4:2:2 and 1 for 4:2:0
+    uint16_t restart_interval; // From DRI, 0 without restart markers
+    uint16_t width;            // From SOF0
+    uint16_t height;
 } esp_rtsp_jpeg_data_t;
 
 esp_err_t esp_rtsp_jpeg_decode(char *buffer, size_t length, esp_rtsp_jpeg_data_t *rtsp_jpeg_data);
+// Parses up to the SOS segment only, returns ESP_ERR_INVALID_SIZE when the buffer ends before it
+esp_err_t esp_rtsp_jpeg_parse_headers(char *buffer, size_t length, esp_rtsp_jpeg_data_t *rtsp_jpeg_data);
 
 typedef struct {
     uint8_t mbz;
@@ -64,10 +89,46 @@ typedef struct {
     .length = 128             \
 }
 
+// One frame being packetized into the payload buffer of its session
+typedef struct {
+    esp_rtp_session_t *session;
+    esp_rtp_header_t rtp_header;
+    esp_rtp_jpeg_header_t jpeg_header;
+    uint16_t restart_interval;
+    int has_quant;
+    char quant_tables[128];
+    size_t length;    // Bytes in session->payload
+    int in_scan;      // Headers parsed, the payload holds a packet
+    uint8_t tail[2];  // Last bytes written, the EOI marker at the end of the frame
+    size_t tail_length;
+    esp_err_t err;
+    int packets;
+    uint64_t bytes_copied;
+    int64_t parse_us;
+    int64_t packetize_us;
+    int64_t send_us;
+    int64_t start_us;
+    int64_t first_packet_us;
+} esp_rtp_jpeg_stream_t;
+
 esp_err_t esp_rtp_init(esp_rtp_session_handle_t *rtp_session, int dst_rtp_port, int dst_rtcp_port, char *dst_addr_string);
 esp_err_t esp_rtp_teardown(esp_rtp_session_handle_t rtp_session);
-esp_err_t esp_rtp_send_jpeg(esp_rtp_session_handle_t rtp_session, uint8_t *frame, size_t frame_length, uint8_t q, uint16_t width, uint16_t height);
+// timestamp_us is the capture time of the frame on the esp_timer clock
+esp_err_t esp_rtp_send_jpeg(esp_rtp_session_handle_t rtp_session, uint8_t *frame, size_t frame_length, uint8_t q, uint16_t width, uint16_t height, int64_t timestamp_us);
+
+// Sends a JPEG frame while it is being produced, e.g. by a software encoder writing to
+// esp_rtp_jpeg_stream_write() from its output callback. A packet leaves as soon as it is
+// full, so neither a frame sized buffer nor waiting for the whole frame is needed. The
+// session can not send other frames until esp_rtp_jpeg_stream_end().
+esp_err_t esp_rtp_jpeg_stream_begin(esp_rtp_session_handle_t rtp_session, esp_rtp_jpeg_stream_t *stream, uint8_t q, uint16_t width, uint16_t height, int64_t timestamp_us);
+esp_err_t esp_rtp_jpeg_stream_write(esp_rtp_jpeg_stream_t *stream, const uint8_t *data, size_t length);
+esp_err_t esp_rtp_jpeg_stream_end(esp_rtp_jpeg_stream_t *stream);
+
 int esp_rtp_get_src_rtp_port(esp_rtp_session_handle_t rtp_session);
 int esp_rtp_get_src_rtcp_port(esp_rtp_session_handle_t rtp_session);
 
+// Totals over all sessions since start or the last reset
+void esp_rtp_get_stats(esp_rtp_stats_t *stats);
+void esp_rtp_reset_stats(void);
+
 #endif //ESPCAM_RTP_UDP_H
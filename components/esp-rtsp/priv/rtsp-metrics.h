@@ -0,0 +1,45 @@
+//
+// Metrics of the camera stream, in the registry of esp-metrics.h
+//
+
+#ifndef ESPCAM_RTSP_METRICS_H
+#define ESPCAM_RTSP_METRICS_H
+
+#include "esp-metrics.h"
+
+// Latency of the stages of a frame in microseconds
+extern esp_metric_t metric_capture_us;
+extern esp_metric_t metric_parse_us;
+extern esp_metric_t metric_packetize_us;
+extern esp_metric_t metric_send_us;
+
+extern esp_metric_t metric_rtp_frames;
+extern esp_metric_t metric_rtp_packets;
+extern esp_metric_t metric_rtp_bytes;
+extern esp_metric_t metric_rtp_enomem_retries;
+extern esp_metric_t metric_http_frames;
+
+extern esp_metric_t metric_record_frames;
+extern esp_metric_t metric_record_bytes;
+extern esp_metric_t metric_record_write_us;
+
+extern esp_metric_t metric_timeshift_frames;
+extern esp_metric_t metric_timeshift_replayed;
+
+extern esp_metric_t metric_uplink_capacity_kbps;
+extern esp_metric_t metric_admission_admitted;
+extern esp_metric_t metric_admission_reduced;   // At a lower frame rate
+extern esp_metric_t metric_admission_refused;
+
+// Frames that were not sent, by cause
+extern esp_metric_t metric_drop_capture;     // The camera did not deliver
+extern esp_metric_t metric_drop_no_buffer;   // More frames out than the driver has buffers
+extern esp_metric_t metric_drop_motion;      // Left out while nothing moves
+extern esp_metric_t metric_drop_send;        // Failed to send
+extern esp_metric_t metric_drop_record;      // No room in the staging buffers of the recorder
+extern esp_metric_t metric_drop_timeshift;   // Too large for the time-shift buffer
+
+// Registers the metrics above, and the heap, PSRAM and task lines
+void rtsp_metrics_init(void);
+
+#endif //ESPCAM_RTSP_METRICS_H
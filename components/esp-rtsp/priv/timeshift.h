@@ -0,0 +1,49 @@
+//
+// Time-shift buffer of the last seconds of JPEG frames, for replay.
+//
+// A task takes the frames the streams share and copies them into a ring of
+// bytes in PSRAM, with an index of their sequence numbers and timestamps. The
+// oldest frames make room for new ones. Readers copy a frame out without
+// holding up the writer and check afterwards that it was not overwritten
+// meanwhile, a reader that fell behind the ring continues at the oldest frame.
+//
+
+#ifndef ESPCAM_TIMESHIFT_H
+#define ESPCAM_TIMESHIFT_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <esp_err.h>
+
+typedef struct {
+    uint32_t seq;          // Of the shared frame, see frames.h
+    uint32_t position;     // Of the first byte in the ring, counts up and wraps
+    uint32_t length;
+    uint16_t width;
+    uint16_t height;
+    int64_t timestamp_us;  // Of the camera frame buffer
+} timeshift_frame_t;
+
+typedef struct {
+    uint32_t seq;              // The next frame read is the first buffered one from here
+    uint8_t *buffer;           // Grows to the largest frame read
+    size_t size;
+    timeshift_frame_t frame;   // The frame in buffer
+} timeshift_reader_t;
+
+// Starts buffering into a ring of size bytes, a power of two
+esp_err_t timeshift_start(size_t size);
+void timeshift_stop(void);
+bool timeshift_running(void);
+
+// The first frame buffered at or after timestamp_us, the oldest frame when it is older than
+// that. False when there is no such frame, a reader then plays live.
+bool timeshift_find(int64_t timestamp_us, timeshift_frame_t *frame);
+
+// Reads the first buffered frame from reader->seq on and moves reader->seq past it.
+// ESP_ERR_NOT_FOUND when the reader caught up with the newest frame.
+esp_err_t timeshift_read(timeshift_reader_t *reader);
+void timeshift_reader_free(timeshift_reader_t *reader);
+
+#endif //ESPCAM_TIMESHIFT_H
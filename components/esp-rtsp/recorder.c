@@ -0,0 +1,479 @@
+//
+// Recording of the camera to MJPEG AVI files, see esp-recorder.h
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <dirent.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/queue.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
+
+#include "esp-recorder.h"
+#include "esp-trace.h"
+#include "avi.h"
+#include "frames.h"
+#include "rtsp-metrics.h"
+
+#define TAG "esp-recorder"
+
+#define RECORDER_CAPTURE_STACKSIZE (6 * 1024) // The motion detector decodes on the stack of the task that captures
+#define RECORDER_WRITER_STACKSIZE (4 * 1024)
+#define RECORDER_PRIORITY 4
+#define RECORDER_IDLE_MS 100
+
+// Frames of at least this size on average, a staging buffer has index entries for this many
+#define RECORDER_MIN_FRAME_SIZE 1024
+
+typedef struct {
+    uint8_t *data;
+    size_t length;
+    uint32_t offset;           // Of data in the file
+    avi_index_entry_t *entries;
+    size_t count;              // Frames that end in data
+    uint32_t us_per_frame;
+    int64_t started_us;        // When the first frame was staged
+} staging_t;
+
+typedef enum {
+    WRITE_OPEN,
+    WRITE_DATA,
+    WRITE_CLOSE,
+    WRITE_EXIT,
+} write_type_t;
+
+typedef struct {
+    write_type_t type;
+    staging_t *staging;
+    uint32_t number;
+    uint16_t width;
+    uint16_t height;
+} write_request_t;
+
+struct esp_recorder {
+    esp_recorder_config_t config;
+    bool motion;            // Records while there is motion, see frames_motion_enable()
+    size_t entries_max;
+
+    staging_t staging[2];
+    QueueHandle_t free_queue;   // Staging buffers the writer is done with
+    QueueHandle_t write_queue;  // write_request_t for the writer
+
+    // The capture task
+    staging_t *current;
+    uint32_t number;
+    uint32_t offset;            // File offset of the next frame
+    uint32_t frames;
+    int64_t first_us;
+    int64_t last_us;
+    bool oversize_logged;
+    volatile bool recording;
+
+    // The writer task
+    avi_file_t avi;
+    bool open;
+    int64_t synced_us;
+
+    volatile bool manual;
+    volatile bool failed;       // A write failed, recording stops until esp_recorder_start()
+    volatile bool stop;
+    volatile int running;       // Tasks that did not end yet
+
+    esp_recorder_stats_t stats;
+};
+
+static void *staging_alloc(size_t size) {
+    void *buffer = heap_caps_malloc(size, MALLOC_CAP_SPIRAM);
+    return buffer ? buffer : malloc(size);
+}
+
+static uint32_t entry_end(const esp_recorder_t *recorder, const avi_index_entry_t *entry) {
+    return recorder->config.cluster_size - 4 + entry->offset + AVI_CHUNK_HEADER_SIZE + ((entry->size + 1) & ~1u);
+}
+
+// Hands the whole clusters of the current buffer to the writer, or everything when it is the
+// last of the file. The rest moves to the other buffer, false when the writer still has that.
+static bool hand_off(esp_recorder_t *recorder, bool last) {
+    staging_t *staging = recorder->current;
+    size_t length = last ? staging->length : staging->length & ~(recorder->config.cluster_size - 1);
+    if (!length && !last) {
+        return true;
+    }
+
+    staging_t *next;
+    if (xQueueReceive(recorder->free_queue, &next, last ? portMAX_DELAY : 0) != pdTRUE) {
+        return false;
+    }
+
+    uint32_t end = staging->offset + length;
+    size_t count = 0;
+    while (count < staging->count && entry_end(recorder, &staging->entries[count]) <= end) {
+        count++;
+    }
+    next->offset = end;
+    next->length = staging->length - length;
+    memcpy(next->data, staging->data + length, next->length);
+    next->count = staging->count - count;
+    memcpy(next->entries, staging->entries + count, next->count * sizeof(avi_index_entry_t));
+    next->started_us = next->count ? staging->started_us : 0;
+
+    staging->length = length;
+    staging->count = count;
+    if (recorder->frames > 1) {
+        staging->us_per_frame = (recorder->last_us - recorder->first_us) / (recorder->frames - 1);
+    }
+    write_request_t request = {
+            .type = last ? WRITE_CLOSE : WRITE_DATA,
+            .staging = staging,
+    };
+    xQueueSend(recorder->write_queue, &request, portMAX_DELAY);
+    recorder->current = next;
+    return true;
+}
+
+static void open_file(esp_recorder_t *recorder, uint16_t width, uint16_t height) {
+    write_request_t request = {
+            .type = WRITE_OPEN,
+            .number = ++recorder->number,
+            .width = width,
+            .height = height,
+    };
+    xQueueSend(recorder->write_queue, &request, portMAX_DELAY);
+
+    recorder->current->offset = recorder->offset = recorder->config.cluster_size;
+    recorder->frames = 0;
+    recorder->recording = true;
+}
+
+static void close_file(esp_recorder_t *recorder) {
+    hand_off(recorder, true);
+    recorder->recording = false;
+}
+
+// Copies a frame into the current buffer, false when there is no room for it
+static bool stage_frame(esp_recorder_t *recorder, const camera_fb_t *fb, int64_t timestamp_us) {
+    uint32_t size = fb->len;
+    size_t chunk = AVI_CHUNK_HEADER_SIZE + ((size + 1) & ~1u);
+
+    staging_t *staging = recorder->current;
+    if (staging->length + chunk > recorder->config.buffer_size || staging->count == recorder->entries_max) {
+        hand_off(recorder, false);
+        staging = recorder->current;
+    }
+    if (staging->length + chunk > recorder->config.buffer_size || staging->count == recorder->entries_max) {
+        if (chunk > recorder->config.buffer_size - recorder->config.cluster_size && !recorder->oversize_logged) {
+            recorder->oversize_logged = true;
+            ESP_LOGW(TAG, "A frame of %u bytes does not fit in the staging buffers", (unsigned)size);
+        }
+        return false;
+    }
+
+    uint8_t *p = staging->data + staging->length;
+    avi_chunk_header(p, size);
+    memcpy(p + AVI_CHUNK_HEADER_SIZE, fb->buf, size);
+    if (size & 1) {
+        p[AVI_CHUNK_HEADER_SIZE + size] = 0;
+    }
+
+    avi_index_entry_t *entry = &staging->entries[staging->count++];
+    memcpy(entry->id, AVI_FRAME_ID, 4);
+    entry->flags = AVI_INDEX_KEYFRAME;
+    entry->offset = recorder->offset - (recorder->config.cluster_size - 4);
+    entry->size = size;
+
+    if (!staging->started_us) {
+        staging->started_us = timestamp_us;
+    }
+    if (!recorder->frames++) {
+        recorder->first_us = timestamp_us;
+    }
+    recorder->last_us = timestamp_us;
+    staging->length += chunk;
+    recorder->offset += chunk;
+    return true;
+}
+
+static void capture_task(void *arg) {
+    esp_recorder_t *recorder = arg;
+    uint32_t frame_seq = 0;
+
+    while (!recorder->stop) {
+        if (recorder->failed || (!recorder->manual && !recorder->motion)) {
+            if (recorder->recording) {
+                close_file(recorder);
+            }
+            frame_seq = 0;
+            vTaskDelay(pdMS_TO_TICKS(RECORDER_IDLE_MS));
+            continue;
+        }
+
+        shared_frame_t *frame = frames_get(&frame_seq);
+        if (!frame) {
+            vTaskDelay(pdMS_TO_TICKS(RECORDER_IDLE_MS));
+            continue;
+        }
+        camera_fb_t *fb = frame->fb;
+        int64_t timestamp_us = (int64_t)fb->timestamp.tv_sec * 1000000 + fb->timestamp.tv_usec;
+
+        bool record = recorder->manual || (recorder->motion && frame->motion);
+        if (record && fb->format == PIXFORMAT_JPEG) {
+            if (!recorder->recording) {
+                open_file(recorder, fb->width, fb->height);
+            }
+            if (stage_frame(recorder, fb, timestamp_us)) {
+                __atomic_add_fetch(&recorder->stats.frames, 1, __ATOMIC_RELAXED);
+                esp_metric_add(&metric_record_frames, 1);
+            } else {
+                __atomic_add_fetch(&recorder->stats.dropped, 1, __ATOMIC_RELAXED);
+                esp_metric_add(&metric_drop_record, 1);
+            }
+        }
+        frames_return(frame);
+
+        // The next frame may not fit, start the next file before
+        if (recorder->recording && (!record || recorder->offset + recorder->config.buffer_size > recorder->config.max_file_bytes)) {
+            close_file(recorder);
+        } else if (recorder->recording && recorder->current->started_us
+                   && timestamp_us - recorder->current->started_us >= recorder->config.sync_interval_ms * 1000LL) {
+            hand_off(recorder, false);
+        }
+    }
+
+    if (recorder->recording) {
+        close_file(recorder);
+    }
+    __atomic_sub_fetch(&recorder->running, 1, __ATOMIC_RELAXED);
+    vTaskDelete(NULL);
+}
+
+static void write_staging(esp_recorder_t *recorder, staging_t *staging, bool last) {
+    if (!recorder->open) {
+        return;
+    }
+
+    int64_t start = esp_timer_get_time();
+    esp_err_t err = avi_write(&recorder->avi, staging->data, staging->length, staging->entries, staging->count);
+    uint32_t us = esp_timer_get_time() - start;
+    ESP_TRACE(RECORD_WRITE, staging->length, us);
+    esp_metric_observe(&metric_record_write_us, us);
+    esp_metric_add(&metric_record_bytes, staging->length);
+    __atomic_add_fetch(&recorder->stats.writes, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&recorder->stats.bytes, staging->length, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&recorder->stats.write_us, us, __ATOMIC_RELAXED);
+    if (us > recorder->stats.max_write_us) {
+        recorder->stats.max_write_us = us;
+    }
+
+    if (staging->us_per_frame) {
+        recorder->avi.us_per_frame = staging->us_per_frame;
+    }
+    if (err == ESP_OK && !last && start - recorder->synced_us >= recorder->config.sync_interval_ms * 1000LL) {
+        err = avi_sync(&recorder->avi);
+        recorder->synced_us = start;
+        __atomic_add_fetch(&recorder->stats.syncs, 1, __ATOMIC_RELAXED);
+    }
+    if (err != ESP_OK) {
+        ESP_LOGE(TAG, "Writing %s failed, recording stops", recorder->avi.path);
+        recorder->failed = true;
+    }
+
+    if (last) {
+        // The buffer is written, it copies the index now
+        if (avi_close(&recorder->avi, staging->data, recorder->config.buffer_size) != ESP_OK) {
+            recorder->failed = true;
+        }
+        recorder->open = false;
+        ESP_LOGI(TAG, "Recorded %u frames to %s", (unsigned)recorder->avi.frames, recorder->avi.path);
+    }
+}
+
+static void writer_task(void *arg) {
+    esp_recorder_t *recorder = arg;
+    write_request_t request;
+
+    while (xQueueReceive(recorder->write_queue, &request, portMAX_DELAY) == pdTRUE && request.type != WRITE_EXIT) {
+        if (request.type == WRITE_OPEN) {
+            char path[sizeof(recorder->avi.path)];
+            snprintf(path, sizeof(path), "%s/rec%05u.avi", recorder->config.directory, (unsigned)request.number);
+            recorder->open = avi_open(&recorder->avi, path, recorder->config.cluster_size,
+                                      request.width, request.height) == ESP_OK;
+            recorder->synced_us = esp_timer_get_time();
+            if (recorder->open) {
+                __atomic_add_fetch(&recorder->stats.files, 1, __ATOMIC_RELAXED);
+            } else {
+                recorder->failed = true;
+            }
+            continue;
+        }
+
+        staging_t *staging = request.staging;
+        write_staging(recorder, staging, request.type == WRITE_CLOSE);
+        staging->length = 0;
+        staging->count = 0;
+        staging->started_us = 0;
+        staging->us_per_frame = 0;
+        xQueueSend(recorder->free_queue, &staging, portMAX_DELAY);
+    }
+
+    __atomic_sub_fetch(&recorder->running, 1, __ATOMIC_RELAXED);
+    vTaskDelete(NULL);
+}
+
+// Finishes the files a power loss left, and continues the numbering after the highest file
+static void scan_directory(esp_recorder_t *recorder) {
+    DIR *dir = opendir(recorder->config.directory);
+    if (!dir) {
+        ESP_LOGW(TAG, "Unable to open %s", recorder->config.directory);
+        return;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        unsigned number;
+        char extension[4] = { 0 };
+        // FAT without long file names has them in upper case
+        if (strncasecmp(entry->d_name, "rec", 3) != 0 || sscanf(entry->d_name + 3, "%5u.%3s", &number, extension) != 2) {
+            continue;
+        }
+        if (number > recorder->number) {
+            recorder->number = number;
+        }
+        if (strcasecmp(extension, "idx") == 0) {
+            char path[sizeof(recorder->avi.path)];
+            snprintf(path, sizeof(path), "%s/rec%05u.avi", recorder->config.directory, number);
+            avi_recover(path, recorder->staging[0].data, recorder->config.buffer_size);
+        }
+    }
+    closedir(dir);
+}
+
+static void free_recorder(esp_recorder_t *recorder) {
+    for (int i = 0; i < 2; i++) {
+        free(recorder->staging[i].data);
+        free(recorder->staging[i].entries);
+    }
+    if (recorder->free_queue) {
+        vQueueDelete(recorder->free_queue);
+    }
+    if (recorder->write_queue) {
+        vQueueDelete(recorder->write_queue);
+    }
+    if (recorder->motion) {
+        frames_motion_disable();
+    }
+    free(recorder);
+}
+
+esp_err_t esp_recorder_create(const esp_recorder_config_t *config, esp_recorder_t **recorder) {
+    if (!config || !recorder || !config->directory || config->cluster_size < AVI_HEADER_MIN_SIZE
+        || (config->cluster_size & (config->cluster_size - 1)) || config->buffer_size < 2 * config->cluster_size
+        || config->buffer_size % config->cluster_size) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    rtsp_metrics_init();
+    esp_err_t err = frames_init();
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    esp_recorder_t *r = calloc(1, sizeof(esp_recorder_t));
+    if (!r) {
+        return ESP_ERR_NO_MEM;
+    }
+    r->config = *config;
+    r->entries_max = config->buffer_size / RECORDER_MIN_FRAME_SIZE;
+    for (int i = 0; i < 2; i++) {
+        r->staging[i].data = staging_alloc(config->buffer_size);
+        r->staging[i].entries = malloc(r->entries_max * sizeof(avi_index_entry_t));
+        if (!r->staging[i].data || !r->staging[i].entries) {
+            free_recorder(r);
+            return ESP_ERR_NO_MEM;
+        }
+    }
+    if (config->motion && frames_motion_enable(config->motion) != ESP_OK) {
+        free_recorder(r);
+        return ESP_ERR_NO_MEM;
+    }
+    r->motion = config->motion != NULL;
+    r->config.motion = NULL; // The detector has a copy, the caller's may be gone
+
+    r->free_queue = xQueueCreate(2, sizeof(staging_t *));
+    r->write_queue = xQueueCreate(4, sizeof(write_request_t));
+    if (!r->free_queue || !r->write_queue) {
+        free_recorder(r);
+        return ESP_ERR_NO_MEM;
+    }
+
+    scan_directory(r);
+    r->current = &r->staging[0];
+    staging_t *other = &r->staging[1];
+    xQueueSend(r->free_queue, &other, 0);
+
+    r->running = 2;
+    if (xTaskCreate(writer_task, "recorder_write", RECORDER_WRITER_STACKSIZE, r, RECORDER_PRIORITY, NULL) != pdPASS) {
+        free_recorder(r);
+        return ESP_FAIL;
+    }
+    if (xTaskCreate(capture_task, "recorder", RECORDER_CAPTURE_STACKSIZE, r, RECORDER_PRIORITY, NULL) != pdPASS) {
+        write_request_t request = { .type = WRITE_EXIT };
+        xQueueSend(r->write_queue, &request, portMAX_DELAY);
+        while (__atomic_load_n(&r->running, __ATOMIC_RELAXED) > 1) {
+            vTaskDelay(pdMS_TO_TICKS(10));
+        }
+        free_recorder(r);
+        return ESP_FAIL;
+    }
+
+    ESP_LOGI(TAG, "Recording to %s from rec%05u.avi", config->directory, (unsigned)r->number + 1);
+    *recorder = r;
+    return ESP_OK;
+}
+
+void esp_recorder_delete(esp_recorder_t *recorder) {
+    if (!recorder) {
+        return;
+    }
+
+    // The capture task closes the file, the writer finishes it before it gets to the exit
+    recorder->stop = true;
+    while (__atomic_load_n(&recorder->running, __ATOMIC_RELAXED) > 1) {
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    write_request_t request = { .type = WRITE_EXIT };
+    xQueueSend(recorder->write_queue, &request, portMAX_DELAY);
+    while (__atomic_load_n(&recorder->running, __ATOMIC_RELAXED) > 0) {
+        vTaskDelay(pdMS_TO_TICKS(10));
+    }
+    free_recorder(recorder);
+}
+
+esp_err_t esp_recorder_start(esp_recorder_t *recorder) {
+    if (!recorder) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    recorder->failed = false;
+    recorder->manual = true;
+    return ESP_OK;
+}
+
+esp_err_t esp_recorder_stop(esp_recorder_t *recorder) {
+    if (!recorder) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    recorder->manual = false;
+    return ESP_OK;
+}
+
+bool esp_recorder_recording(const esp_recorder_t *recorder) {
+    return recorder->recording;
+}
+
+void esp_recorder_get_stats(const esp_recorder_t *recorder, esp_recorder_stats_t *stats) {
+    *stats = recorder->stats;
+}
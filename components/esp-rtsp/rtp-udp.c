@@ -2,19 +2,36 @@
 // Created by Hugo Trippaers on 19/05/2021.
 //
 
+#include <stdbool.h>
+#include <string.h>
+#include <assert.h>
+#include <esp_err.h>
 #include <esp_log.h>
+#include <esp_timer.h>
 #include <lwip/sockets.h>
 
+#include "esp-trace.h"
 #include "rtp-udp.h"
+#include "rtsp-metrics.h"
 
 #define TAG "rtp-udp"
 
-#define MAX_PAYLOAD_SIZE 1472 // This is based on MTU 1500 minus udp headers
-
 #define RTP_PAYLOAD_JPEG 26
+#define RTP_CLOCK_RATE 90000
+
+#define RTP_HEADER_SIZE 12
+#define RTP_JPEG_HEADER_SIZE 8
+#define RTP_QUANT_HEADER_SIZE (4 + 128)
+
+#define RTP_RESTART_HEADER_SIZE 4
 
 #define TYPE_BASELINE_DCT_SEQUENTIAL 0
 #define TYPE_0_SPECIFIC_PROGRESSIVE 0
+#define TYPE_RESTART_MARKERS 64 // Added to the type when the scan has restart markers
+
+static esp_rtp_stats_t stats;
+
+#define STATS_ADD(field, value) __atomic_add_fetch(&stats.field, (value), __ATOMIC_RELAXED)
 
 static int socket_bind_udp(int port) {
     int sockfd = socket(AF_INET, SOCK_DGRAM, 0);
@@ -82,9 +99,9 @@ static int serialize_jpeg_header(esp_rtp_jpeg_header_t header, uint8_t *buffer,
     uint32_t *fragment_offset = (uint32_t *) &buffer[0];
     *fragment_offset = PP_HTONL(header.fragment_offset);
 
-    buffer[0] = header.type;
+    buffer[0] = header.type_specific;
 
-    buffer[4] = header.type_specific;
+    buffer[4] = header.type;
     buffer[5] = header.q;
     buffer[6] = header.width / 8;
     buffer[7] = header.height / 8;
@@ -92,6 +109,19 @@ static int serialize_jpeg_header(esp_rtp_jpeg_header_t header, uint8_t *buffer,
     return 8;
 }
 
+// Restart intervals are not aligned to packets, so every packet has F and L set and the count at 0x3FFF
+static int serialize_restart_header(uint16_t restart_interval, uint8_t *buffer, size_t length) {
+    assert(buffer != NULL);
+    assert(length >= 4);
+
+    buffer[0] = restart_interval >> 8;
+    buffer[1] = restart_interval & 0xFF;
+    buffer[2] = 0xFF;
+    buffer[3] = 0xFF;
+
+    return RTP_RESTART_HEADER_SIZE;
+}
+
 static int serialize_quant_tables(esp_rtp_quant_t quant, uint8_t *buffer, size_t length) {
     assert(buffer != NULL);
 
@@ -150,7 +180,8 @@ esp_err_t esp_rtp_init(esp_rtp_session_handle_t *rtp_session, int dst_rtp_port,
 
     memcpy(session->dst_addr, dst_addr_string, sizeof(session->dst_addr));
 
-    session->timestamp = esp_random() >> 16;
+    session->ssrc = esp_random();
+    session->timestamp = esp_random();
     session->sequence_number = 0;
     session->initialized = true;
 
@@ -177,8 +208,150 @@ esp_err_t esp_rtp_teardown(esp_rtp_session_handle_t rtp_session) {
     return ESP_OK;
 }
 
-esp_err_t esp_rtp_send_jpeg(esp_rtp_session_handle_t rtp_session, uint8_t *frame, size_t frame_length, uint8_t q, uint16_t width, uint16_t height) {
-    if (!rtp_session) {
+// Headers of the next packet, the fragment offset is where its data starts in the scan
+static void packet_begin(esp_rtp_jpeg_stream_t *stream) {
+    uint8_t *offset = stream->session->payload;
+    size_t payload_remaining = MAX_PAYLOAD_SIZE;
+
+    stream->rtp_header.sequence_number = stream->session->sequence_number++; // Increase sequence per packet
+
+    int include_quant = stream->has_quant && stream->jpeg_header.fragment_offset == 0;
+    if (include_quant) {
+        stream->jpeg_header.q |= 1 << 7;
+    } else {
+        stream->jpeg_header.q &= 0x7F;
+    }
+
+    int n = serialize_header(stream->rtp_header, offset, payload_remaining);
+    payload_remaining -= n;
+    offset += n;
+
+    n = serialize_jpeg_header(stream->jpeg_header, offset, payload_remaining);
+    payload_remaining -= n;
+    offset += n;
+
+    if (stream->restart_interval) {
+        n = serialize_restart_header(stream->restart_interval, offset, payload_remaining);
+        payload_remaining -= n;
+        offset += n;
+    }
+
+    if (include_quant) {
+        esp_rtp_quant_t quant = RTP_QUANT_DEFAULT();
+        memcpy(quant.table0, stream->quant_tables, 64);
+        memcpy(quant.table1, stream->quant_tables + 64, 64);
+
+        n = serialize_quant_tables(quant, offset, payload_remaining);
+        payload_remaining -= n;
+        offset += n;
+        stream->bytes_copied += 2 * quant.length;
+    }
+
+    stream->length = MAX_PAYLOAD_SIZE - payload_remaining;
+}
+
+static esp_err_t packet_send(esp_rtp_jpeg_stream_t *stream, int last_packet) {
+    esp_rtp_session_t *session = stream->session;
+    if (last_packet) {
+        session->payload[1] |= 1 << 7; // marker
+    }
+
+    const struct sockaddr_in client = {
+            .sin_family = AF_INET,
+            .sin_addr.s_addr = inet_addr(session->dst_addr),
+            .sin_port = htons(session->dst_rtp_port)
+    };
+
+    int64_t send_start = esp_timer_get_time();
+    if (stream->packets == 0) {
+        stream->first_packet_us = send_start - stream->start_us;
+    }
+    int retries = 5;  // ENOMEM might occur if the buffer in LWIP is full
+    size_t size = stream->length;
+    do {
+        ssize_t sent = sendto(session->rtp_socket, session->payload, size, 0,
+                              (const struct sockaddr *) &client, sizeof(client));
+
+        if (sent < 0 && errno != ENOMEM) {
+            ESP_LOGE(TAG, "Failed to sent RTP package: %d", errno);
+            return ESP_FAIL;
+        }
+
+        if (sent == size) {
+            ESP_TRACE(RTP_PACKET, stream->rtp_header.sequence_number, size);
+            STATS_ADD(bytes_sent, size);
+            esp_metric_add(&metric_rtp_bytes, size);
+            session->packets++;
+            session->bytes += size;
+            break;
+        }
+        esp_metric_add(&metric_rtp_enomem_retries, 1);
+        ESP_TRACE(RTP_ENOMEM, stream->rtp_header.sequence_number, retries - 1);
+
+        // We might need to take some time to clear the transmit buffers
+        esp_rom_delay_us(250);
+        retries--;
+    } while (retries > 0);
+    stream->send_us += esp_timer_get_time() - send_start;
+    stream->packets++;
+
+    return ESP_OK;
+}
+
+// Adds scan data to the packets. A full packet is only sent once more data follows,
+// the last one goes out with the marker set from esp_rtp_jpeg_stream_end().
+static esp_err_t packetize(esp_rtp_jpeg_stream_t *stream, const uint8_t *data, size_t length) {
+    while (length > 0) {
+        if (stream->length == MAX_PAYLOAD_SIZE) {
+            esp_err_t err = packet_send(stream, 0);
+            if (err != ESP_OK) {
+                return err;
+            }
+            packet_begin(stream);
+        }
+
+        size_t n = MAX_PAYLOAD_SIZE - stream->length;
+        if (n > length) {
+            n = length;
+        }
+        memcpy(stream->session->payload + stream->length, data, n);
+        stream->length += n;
+        stream->jpeg_header.fragment_offset += n;
+        stream->bytes_copied += n;
+        data += n;
+        length -= n;
+    }
+    return ESP_OK;
+}
+
+static void stream_set_headers(esp_rtp_jpeg_stream_t *stream, const esp_rtsp_jpeg_data_t *jpeg_data) {
+    stream->restart_interval = jpeg_data->restart_interval;
+    stream->jpeg_header.type = jpeg_data->type | (jpeg_data->restart_interval ? TYPE_RESTART_MARKERS : 0);
+    stream->has_quant = jpeg_data->quant_table_0 && jpeg_data->quant_table_1;
+    if (stream->has_quant) {
+        memcpy(stream->quant_tables, jpeg_data->quant_table_0 + 5, 64);
+        memcpy(stream->quant_tables + 64, jpeg_data->quant_table_1 + 5, 64);
+    }
+}
+
+static void stream_add_stats(const esp_rtp_jpeg_stream_t *stream) {
+    STATS_ADD(frames, 1);
+    STATS_ADD(packets, stream->packets);
+    STATS_ADD(bytes_copied, stream->bytes_copied);
+    STATS_ADD(parse_us, stream->parse_us);
+    STATS_ADD(packetize_us, stream->packetize_us);
+    STATS_ADD(send_us, stream->send_us);
+    STATS_ADD(first_packet_us, stream->first_packet_us);
+
+    esp_metric_add(&metric_rtp_frames, 1);
+    esp_metric_add(&metric_rtp_packets, stream->packets);
+    esp_metric_observe(&metric_parse_us, stream->parse_us);
+    esp_metric_observe(&metric_packetize_us, stream->packetize_us);
+    esp_metric_observe(&metric_send_us, stream->send_us);
+}
+
+esp_err_t esp_rtp_jpeg_stream_begin(esp_rtp_session_handle_t rtp_session, esp_rtp_jpeg_stream_t *stream, uint8_t q, uint16_t width, uint16_t height, int64_t timestamp_us) {
+    if (!rtp_session || !stream) {
         return ESP_ERR_INVALID_ARG;
     }
     esp_rtp_session_t *session = rtp_session;
@@ -187,14 +360,11 @@ esp_err_t esp_rtp_send_jpeg(esp_rtp_session_handle_t rtp_session, uint8_t *frame
         return ESP_FAIL;
     }
 
-    esp_rtsp_jpeg_data_t jpeg_data;
-
-    if (esp_rtsp_jpeg_decode((char *)frame, frame_length, &jpeg_data) != ESP_OK) {
-        ESP_LOGE(TAG, "Failed to parse jpeg data");
-        return ESP_FAIL;
-    }
+    memset(stream, 0, sizeof(esp_rtp_jpeg_stream_t));
+    stream->session = session;
+    stream->start_us = esp_timer_get_time();
 
-    esp_rtp_jpeg_header_t rtp_jpeg_header = {
+    stream->jpeg_header = (esp_rtp_jpeg_header_t) {
             .height = height,
             .width = width,
             .q = q,
@@ -203,100 +373,141 @@ esp_err_t esp_rtp_send_jpeg(esp_rtp_session_handle_t rtp_session, uint8_t *frame
             .fragment_offset = 0,
     };
 
-    esp_rtp_header_t rtp_header = {
+    stream->rtp_header = (esp_rtp_header_t) {
             .payload_type = RTP_PAYLOAD_JPEG,
-            .ssrc = esp_random(),
-            .timestamp = session->timestamp++, // Increase timestamp per frame
+            .ssrc = session->ssrc,
+            .timestamp = session->timestamp + (uint32_t)(timestamp_us * RTP_CLOCK_RATE / 1000000),
             .sequence_number = 0,
             .marker = 0
     };
 
-    while (rtp_jpeg_header.fragment_offset < jpeg_data.jpeg_data_length) {
-        static uint8_t payload[MAX_PAYLOAD_SIZE];
-        uint8_t *offset = payload;
-        size_t payload_remaining = MAX_PAYLOAD_SIZE;
+    return ESP_OK;
+}
 
-        rtp_header.sequence_number = session->sequence_number++; // Increase sequence per packet
+esp_err_t esp_rtp_jpeg_stream_write(esp_rtp_jpeg_stream_t *stream, const uint8_t *data, size_t length) {
+    if (!stream || !stream->session) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (stream->err != ESP_OK) {
+        return stream->err;
+    }
 
-        int include_quant = jpeg_data.quant_table_0 && jpeg_data.quant_table_1 && rtp_jpeg_header.fragment_offset == 0;
-        if (include_quant) {
-            rtp_jpeg_header.q |= 1 << 7;
-        } else {
-            rtp_jpeg_header.q &= 0b0111111;
+    int64_t start = esp_timer_get_time();
+    int64_t send_us = stream->send_us;
+    uint8_t *payload = stream->session->payload;
+
+    // The headers are collected in the payload buffer until the SOS segment is complete
+    if (!stream->in_scan) {
+        size_t n = MAX_PAYLOAD_SIZE - stream->length;
+        if (n > length) {
+            n = length;
+        }
+        memcpy(payload + stream->length, data, n);
+        stream->length += n;
+
+        esp_rtsp_jpeg_data_t jpeg_data;
+        esp_err_t err = esp_rtsp_jpeg_parse_headers((char *)payload, stream->length, &jpeg_data);
+        if (err == ESP_ERR_INVALID_SIZE && stream->length < MAX_PAYLOAD_SIZE) {
+            stream->parse_us += esp_timer_get_time() - start;
+            return ESP_OK;
+        }
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "Failed to parse jpeg headers");
+            stream->err = ESP_FAIL;
+            return stream->err;
         }
 
-        int last_packet = (jpeg_data.jpeg_data_length - rtp_jpeg_header.fragment_offset + 20) < payload_remaining;
-        rtp_header.marker = last_packet;
+        size_t header_length = (uint8_t *)jpeg_data.jpeg_data_start - payload;
+        size_t consumed = header_length - (stream->length - n);
+        stream_set_headers(stream, &jpeg_data);
+        stream->in_scan = 1;
+        packet_begin(stream);
+        data += consumed;
+        length -= consumed;
+        stream->parse_us += esp_timer_get_time() - start;
+        start = esp_timer_get_time();
+    }
 
-//        ESP_LOGD(TAG, "Serializing RTP/AVP packet, offset=%d, quant=%d, last=%d, timestamp=%ud, sequence=%ud",
-//                 rtp_jpeg_header.fragment_offset, include_quant, last_packet,
-//                 session->timestamp, session->sequence_number);
+    // Hold back the last two bytes, they are not scan data when they turn out to be the EOI
+    esp_err_t err = ESP_OK;
+    if (length >= 2) {
+        err = packetize(stream, stream->tail, stream->tail_length);
+        if (err == ESP_OK) {
+            err = packetize(stream, data, length - 2);
+        }
+        stream->tail[0] = data[length - 2];
+        stream->tail[1] = data[length - 1];
+        stream->tail_length = 2;
+    } else if (length == 1) {
+        if (stream->tail_length == 2) {
+            err = packetize(stream, stream->tail, 1);
+            stream->tail[0] = stream->tail[1];
+            stream->tail[1] = data[0];
+        } else {
+            stream->tail[stream->tail_length++] = data[0];
+        }
+    }
 
-        int n = serialize_header(rtp_header, offset, payload_remaining);
-        if (n < 0) {
-            return ESP_FAIL;
-        };
-        payload_remaining -= n;
-        offset += n;
+    stream->packetize_us += (esp_timer_get_time() - start) - (stream->send_us - send_us);
+    stream->err = err;
+    return err;
+}
 
-        n = serialize_jpeg_header(rtp_jpeg_header, offset, payload_remaining);
-        if (n < 0) {
-            return ESP_FAIL;
-        };
-        payload_remaining -= n;
-        offset += n;
+esp_err_t esp_rtp_jpeg_stream_end(esp_rtp_jpeg_stream_t *stream) {
+    if (!stream || !stream->session) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (stream->err != ESP_OK) {
+        return stream->err;
+    }
+    if (!stream->in_scan) {
+        ESP_LOGE(TAG, "Failed to parse jpeg headers");
+        return ESP_FAIL;
+    }
 
-        if (include_quant) {
-            esp_rtp_quant_t quant = RTP_QUANT_DEFAULT();
-            memcpy(quant.table0, jpeg_data.quant_table_0 + 5, 64);
-            memcpy(quant.table1, jpeg_data.quant_table_1 + 5, 64);
-
-            n = serialize_quant_tables(quant, offset, payload_remaining);
-            if (n < 0) {
-                return ESP_FAIL;
-            };
-            payload_remaining -= n;
-            offset += n;
-        }
+    if (stream->tail_length != 2 || stream->tail[0] != 0xFF || stream->tail[1] != 0xD9) {
+        ESP_LOGW(TAG, "Frame does not end with EOI");
+        stream->err = packetize(stream, stream->tail, stream->tail_length);
+    }
+    if (stream->err == ESP_OK) {
+        stream->err = packet_send(stream, 1);
+    }
+    if (stream->err == ESP_OK) {
+        stream_add_stats(stream);
+    }
+    return stream->err;
+}
 
-        if (last_packet) {
-            size_t remaining_bytes =  jpeg_data.jpeg_data_length - rtp_jpeg_header.fragment_offset;
-            memcpy(offset, jpeg_data.jpeg_data_start + rtp_jpeg_header.fragment_offset, remaining_bytes);
-            payload_remaining -= remaining_bytes;
-            rtp_jpeg_header.fragment_offset += remaining_bytes;
-        } else {
-            memcpy(offset, jpeg_data.jpeg_data_start + rtp_jpeg_header.fragment_offset, payload_remaining);
-            rtp_jpeg_header.fragment_offset += payload_remaining;
-            payload_remaining = 0;
-        }
+esp_err_t esp_rtp_send_jpeg(esp_rtp_session_handle_t rtp_session, uint8_t *frame, size_t frame_length, uint8_t q, uint16_t width, uint16_t height, int64_t timestamp_us) {
+    esp_rtp_jpeg_stream_t stream;
+    esp_err_t err = esp_rtp_jpeg_stream_begin(rtp_session, &stream, q, width, height, timestamp_us);
+    if (err != ESP_OK) {
+        return err;
+    }
 
-        const struct sockaddr_in client = {
-                .sin_family = AF_INET,
-                .sin_addr.s_addr = inet_addr(session->dst_addr),
-                .sin_port = htons(session->dst_rtp_port)
-        };
-
-        int retries = 5;  // ENOMEM might occur if the buffer in LWIP is full
-        size_t size = MAX_PAYLOAD_SIZE - payload_remaining;
-        do {
-            ssize_t sent = sendto(session->rtp_socket, payload, size, 0,
-                                  (const struct sockaddr *) &client, sizeof(client));
-
-            if (sent < 0 && errno != ENOMEM) {
-                ESP_LOGE(TAG, "Failed to sent RTP package: %d", errno);
-                return ESP_FAIL;
-            }
-            
-            if (sent == size) {
-                break;
-            }
+    esp_rtsp_jpeg_data_t jpeg_data;
 
-            // We might need to take some time to clear the transmit buffers
-            esp_rom_delay_us(250);
-            retries--;
-        } while (retries > 0);
+    int64_t start = esp_timer_get_time();
+    if (esp_rtsp_jpeg_decode((char *)frame, frame_length, &jpeg_data) != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to parse jpeg data");
+        return ESP_FAIL;
+    }
+    int64_t parsed = esp_timer_get_time();
+    stream.parse_us = parsed - start;
+
+    stream_set_headers(&stream, &jpeg_data);
+    stream.in_scan = 1;
+    packet_begin(&stream);
+    err = packetize(&stream, (uint8_t *)jpeg_data.jpeg_data_start, jpeg_data.jpeg_data_length);
+    if (err == ESP_OK) {
+        err = packet_send(&stream, 1);
+    }
+    if (err != ESP_OK) {
+        return err;
     }
 
+    stream.packetize_us = (esp_timer_get_time() - parsed) - stream.send_us;
+    stream_add_stats(&stream);
     return ESP_OK;
 }
 
@@ -324,4 +535,19 @@ int esp_rtp_get_src_rtcp_port(esp_rtp_session_handle_t rtp_session) {
     }
 
     return session->src_rtcp_port;
-}
\ No newline at end of file
+}
+
+void esp_rtp_get_stats(esp_rtp_stats_t *out) {
+    out->frames = __atomic_load_n(&stats.frames, __ATOMIC_RELAXED);
+    out->packets = __atomic_load_n(&stats.packets, __ATOMIC_RELAXED);
+    out->bytes_sent = __atomic_load_n(&stats.bytes_sent, __ATOMIC_RELAXED);
+    out->bytes_copied = __atomic_load_n(&stats.bytes_copied, __ATOMIC_RELAXED);
+    out->parse_us = __atomic_load_n(&stats.parse_us, __ATOMIC_RELAXED);
+    out->packetize_us = __atomic_load_n(&stats.packetize_us, __ATOMIC_RELAXED);
+    out->send_us = __atomic_load_n(&stats.send_us, __ATOMIC_RELAXED);
+    out->first_packet_us = __atomic_load_n(&stats.first_packet_us, __ATOMIC_RELAXED);
+}
+
+void esp_rtp_reset_stats(void) {
+    memset(&stats, 0, sizeof(stats));
+}
@@ -0,0 +1,100 @@
+//
+// Metrics of the camera stream, see rtsp-metrics.h
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_heap_caps.h>
+
+#include "rtsp-metrics.h"
+#include "esp-rtsp-common.h"
+#include "pipeline.h"
+
+esp_metric_t metric_capture_us = ESP_METRIC_HISTOGRAM_INIT("camera_capture_us");
+esp_metric_t metric_parse_us = ESP_METRIC_HISTOGRAM_INIT("rtp_parse_us");
+esp_metric_t metric_packetize_us = ESP_METRIC_HISTOGRAM_INIT("rtp_packetize_us");
+esp_metric_t metric_send_us = ESP_METRIC_HISTOGRAM_INIT("rtp_send_us");
+
+esp_metric_t metric_rtp_frames = ESP_METRIC_COUNTER_INIT("rtp_frames_total");
+esp_metric_t metric_rtp_packets = ESP_METRIC_COUNTER_INIT("rtp_packets_total");
+esp_metric_t metric_rtp_bytes = ESP_METRIC_COUNTER_INIT("rtp_bytes_total");
+esp_metric_t metric_rtp_enomem_retries = ESP_METRIC_COUNTER_INIT("rtp_enomem_retries_total");
+esp_metric_t metric_http_frames = ESP_METRIC_COUNTER_INIT("http_frames_total");
+
+esp_metric_t metric_record_frames = ESP_METRIC_COUNTER_INIT("record_frames_total");
+esp_metric_t metric_record_bytes = ESP_METRIC_COUNTER_INIT("record_bytes_total");
+esp_metric_t metric_record_write_us = ESP_METRIC_HISTOGRAM_INIT("record_write_us");
+
+esp_metric_t metric_timeshift_frames = ESP_METRIC_COUNTER_INIT("timeshift_frames_total");
+esp_metric_t metric_timeshift_replayed = ESP_METRIC_COUNTER_INIT("timeshift_replayed_frames_total");
+
+esp_metric_t metric_uplink_capacity_kbps = ESP_METRIC_GAUGE_INIT("uplink_capacity_kbps");
+esp_metric_t metric_admission_admitted = ESP_METRIC_COUNTER_INIT("rtsp_admissions_total{result=\"admitted\"}");
+esp_metric_t metric_admission_reduced = ESP_METRIC_COUNTER_INIT("rtsp_admissions_total{result=\"reduced\"}");
+esp_metric_t metric_admission_refused = ESP_METRIC_COUNTER_INIT("rtsp_admissions_total{result=\"refused\"}");
+
+esp_metric_t metric_drop_capture = ESP_METRIC_COUNTER_INIT("frame_drops_total{cause=\"capture\"}");
+esp_metric_t metric_drop_no_buffer = ESP_METRIC_COUNTER_INIT("frame_drops_total{cause=\"no_buffer\"}");
+esp_metric_t metric_drop_motion = ESP_METRIC_COUNTER_INIT("frame_drops_total{cause=\"motion\"}");
+esp_metric_t metric_drop_send = ESP_METRIC_COUNTER_INIT("frame_drops_total{cause=\"send\"}");
+esp_metric_t metric_drop_record = ESP_METRIC_COUNTER_INIT("frame_drops_total{cause=\"record\"}");
+esp_metric_t metric_drop_timeshift = ESP_METRIC_COUNTER_INIT("frame_drops_total{cause=\"timeshift\"}");
+
+static esp_metric_t *const metrics[] = {
+        &metric_capture_us, &metric_parse_us, &metric_packetize_us, &metric_send_us,
+        &metric_rtp_frames, &metric_rtp_packets, &metric_rtp_bytes, &metric_rtp_enomem_retries,
+        &metric_http_frames,
+        &metric_record_frames, &metric_record_bytes, &metric_record_write_us,
+        &metric_timeshift_frames, &metric_timeshift_replayed,
+        &metric_uplink_capacity_kbps, &metric_admission_admitted, &metric_admission_reduced, &metric_admission_refused,
+        &metric_drop_capture, &metric_drop_no_buffer, &metric_drop_motion, &metric_drop_send, &metric_drop_record,
+        &metric_drop_timeshift,
+};
+
+// Free memory now and at its lowest since boot, and what the tasks used of the CPU and their stacks
+static size_t write_system(char *buffer, size_t size) {
+    size_t length = 0;
+    length = esp_metrics_printf(buffer, size, length, "heap_free_bytes %u\n",
+                                (unsigned)heap_caps_get_free_size(MALLOC_CAP_INTERNAL));
+    length = esp_metrics_printf(buffer, size, length, "heap_min_free_bytes %u\n",
+                                (unsigned)heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL));
+    length = esp_metrics_printf(buffer, size, length, "psram_free_bytes %u\n",
+                                (unsigned)heap_caps_get_free_size(MALLOC_CAP_SPIRAM));
+    length = esp_metrics_printf(buffer, size, length, "psram_min_free_bytes %u\n",
+                                (unsigned)heap_caps_get_minimum_free_size(MALLOC_CAP_SPIRAM));
+
+#if configUSE_TRACE_FACILITY && configGENERATE_RUN_TIME_STATS
+    UBaseType_t count = uxTaskGetNumberOfTasks() + 2; // Room for tasks created meanwhile
+    TaskStatus_t *tasks = malloc(count * sizeof(TaskStatus_t));
+    if (!tasks) {
+        return length;
+    }
+    count = uxTaskGetSystemState(tasks, count, NULL);
+    for (UBaseType_t i = 0; i < count; i++) {
+        length = esp_metrics_printf(buffer, size, length,
+                                    "task_runtime_total{task=\"%s\"} %u\n"
+                                    "task_stack_free_bytes{task=\"%s\"} %u\n",
+                                    tasks[i].pcTaskName, (unsigned)tasks[i].ulRunTimeCounter,
+                                    tasks[i].pcTaskName, (unsigned)tasks[i].usStackHighWaterMark);
+    }
+    free(tasks);
+#endif
+    return length;
+}
+
+void rtsp_metrics_init(void) {
+    static bool initialized;
+    if (initialized) {
+        return;
+    }
+    initialized = true;
+
+    for (size_t i = 0; i < sizeof(metrics) / sizeof(metrics[0]); i++) {
+        esp_metrics_register(metrics[i]);
+    }
+    esp_metrics_register_writer(rtsp_server_write_metrics);
+    esp_metrics_register_writer(write_system);
+    esp_metrics_register_writer(pipeline_write_metrics);
+}
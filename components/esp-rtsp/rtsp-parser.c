@@ -1,8 +1,12 @@
 //
 // Created by Hugo Trippaers on 21/05/2021.
 //
+#include <stdlib.h>
+#include <stdio.h>
 #include <string.h>
+#include <strings.h>
 #include <limits.h>
+#include <math.h>
 #include <stdbool.h>
 
 #include "esp_log.h"
@@ -34,7 +38,7 @@ typedef struct {
     rtsp_req_t *request;
 } rtsp_parser_state_t;
 
-inline int min(int a, int b) { return (a < b) ? a : b; }
+static inline int min(int a, int b) { return (a < b) ? a : b; }
 
 static bool valid_header_name_char(char c) {
     if (c > 127) return false;
@@ -58,6 +62,59 @@ static int safe_atoi(char *value) {
     return (int)lv;
 }
 
+// Days since 1970-01-01 of a date of the proleptic Gregorian calendar
+static int64_t days_from_civil(int year, int month, int day) {
+    year -= month <= 2;
+    int64_t era = (year >= 0 ? year : year - 399) / 400;
+    int64_t year_of_era = year - era * 400;
+    int64_t day_of_year = (153 * (month + (month > 2 ? -3 : 9)) + 2) / 5 + day - 1;
+    int64_t day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 + day_of_year;
+    return era * 146097 + day_of_era - 719468;
+}
+
+// The start of an open ended range, npt=now-, npt=<seconds>- or clock=YYYYMMDDThhmmss[.fraction]Z-.
+// A negative npt is the time before now, positive ones are live as that is where a live stream starts.
+static bool parse_range(const char *value, rtsp_req_t *request) {
+    char *end;
+    if (strncmp(value, "npt=", 4) == 0) {
+        value += 4;
+        if (strncmp(value, "now-", 4) == 0) {
+            request->range_type = RANGE_LIVE;
+            return true;
+        }
+        // Neither inf nor nan, nor a time too far back for range_us
+        double seconds = strtod(value, &end);
+        if (end == value || *end != '-' || !isfinite(seconds) || seconds < -(double)(INT64_MAX / 1000000)) {
+            return false;
+        }
+        request->range_type = seconds < 0 ? RANGE_NPT : RANGE_LIVE;
+        request->range_us = seconds < 0 ? (int64_t)(-seconds * 1000000) : 0;
+        return true;
+    }
+
+    if (strncmp(value, "clock=", 6) == 0) {
+        int year, month, day, hour, minute, second, length = 0;
+        if (sscanf(value + 6, "%4d%2d%2dT%2d%2d%2d%n", &year, &month, &day, &hour, &minute, &second, &length) != 6
+                || length != 15) {
+            return false;
+        }
+        end = (char *)value + 6 + length;
+        double fraction = 0;
+        if (*end == '.') {
+            fraction = strtod(end, &end);
+        }
+        if (*end != 'Z' || end[1] != '-' || !(fraction < 1) || month < 1 || month > 12 || day < 1 || day > 31
+                || hour > 23 || minute > 59 || second > 60) {
+            return false;
+        }
+        int64_t seconds = days_from_civil(year, month, day) * 86400 + hour * 3600 + minute * 60 + second;
+        request->range_type = RANGE_CLOCK;
+        request->range_us = seconds * 1000000 + (int64_t)(fraction * 1000000);
+        return true;
+    }
+    return false;
+}
+
 int rtsp_parser_init(rtsp_parser_handle_t *handle) {
     rtsp_parser_state_t *state = calloc(1, sizeof(rtsp_parser_state_t));
     if (!state) {
@@ -101,8 +158,6 @@ int parse_request(rtsp_parser_handle_t handle, const char *buffer, const size_t
     for (int i = 0; i < len; i++) {
         char current = buffer[i];
         state->intermediate[state->intermediate_len + 1] = 0x0; // workaround
-        ESP_LOGD(TAG, "Parsing '%c' at %d in state %d", current, position, state->state);
-        ESP_LOGD(TAG, "Intermediate: %s (%d bytes)", state->intermediate, state->intermediate_len);
 
         if (state->intermediate_len >= 1023) {
             ESP_LOGE(TAG, "Parse failed, no space in intermediate buffer");
@@ -128,6 +183,10 @@ int parse_request(rtsp_parser_handle_t handle, const char *buffer, const size_t
                         request->request_type = PLAY;
                     } else if (strncmp(state->intermediate, "TEARDOWN", min(state->intermediate_len,8)) == 0) {
                         request->request_type = TEARDOWN;
+                    } else if (strncmp(state->intermediate, "GET_PARAMETER", min(state->intermediate_len,13)) == 0) {
+                        request->request_type = GET_PARAMETER;
+                    } else if (strncmp(state->intermediate, "PAUSE", min(state->intermediate_len,5)) == 0) {
+                        request->request_type = PAUSE;
                     } else {
                         request->request_type = UNSUPPORTED;
                     }
@@ -189,6 +248,11 @@ int parse_request(rtsp_parser_handle_t handle, const char *buffer, const size_t
                 if (current == '\r' || current == '\n') {
                     ESP_LOGD(TAG, "Setting parse_complete");
                     state->parse_complete = true;
+
+                    // The body, e.g. of GET_PARAMETER, as far as it was read with the headers
+                    size_t body_length = min(min(len - i - 1, request->content_length), BODY_MAX_LENGTH);
+                    memcpy(request->body, buffer + i + 1, body_length);
+                    request->body[body_length] = 0x0;
                     return len;
                 }
             case RTSP_PARSER_PARSE_HEADER:
@@ -232,6 +296,17 @@ int parse_request(rtsp_parser_handle_t handle, const char *buffer, const size_t
                             return i;
                         }
                         request->cseq = (int)lv;
+                    } else if (strcasecmp(header, "content-length") == 0) {
+                        request->content_length = safe_atoi(value);
+                        if (request->content_length < 0) {
+                            state->error = 400;
+                            return i;
+                        }
+                    } else if (strcasecmp(header, "range") == 0) {
+                        if (!parse_range(value, request)) {
+                            ESP_LOGW(TAG, "Unsupported range: %s", value);
+                            request->range_type = RANGE_INVALID;
+                        }
                     } else if (strcasecmp(header, "transport") == 0) {
                         char *saveptr;
 
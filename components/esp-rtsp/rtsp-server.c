@@ -2,27 +2,141 @@
 // Created by Hugo Trippaers on 17/05/2021.
 //
 #include <sys/param.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/time.h>
+#include <stdlib.h>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
 #include "esp_log.h"
+#include "esp_heap_caps.h"
 
 #include "lwip/err.h"
 #include "lwip/sockets.h"
 #include "esp-rtsp-common.h"
+#include "esp-timeline.h"
+#include "esp-trace.h"
+#include "frames.h"
 #include "rtp-udp.h"
+#include "rtsp-metrics.h"
+#include "timeshift.h"
+#include "admission.h"
+#include "pipeline.h"
+#include "esp-media-source.h"
 
 #include "esp_camera.h"
+#include "img_converters.h"
 // #include "esp_h264_enc.h"
 // #include "esp_h264_types.h"
 // #include "esp_h264_version.h"
 
 #define TAG "rtsp-server"
 
-#define PORT 554  // IANA default for RTSP
+#ifndef RTSP_PORT
+#define RTSP_PORT 554  // IANA default for RTSP
+#endif
+
+#ifndef RTSP_FRAME_INTERVAL_MS
+#define RTSP_FRAME_INTERVAL_MS 200 // Least delta between frames, longer while the send stage holds all RTSP_PIPELINE_ITEMS frames
+#endif
+
+#ifndef RTSP_SOFTWARE_JPEG_QUALITY
+#define RTSP_SOFTWARE_JPEG_QUALITY 80 // Frames of sensors without JPEG output are encoded at this quality
+#endif
+
+#ifndef RTSP_SOFTWARE_JPEG_TARGET_SIZE
+#define RTSP_SOFTWARE_JPEG_TARGET_SIZE 0 // Bytes per software encoded frame for fixed bandwidth links, 0 for a fixed quality
+#endif
+
+#ifndef RTSP_MOTION_IDLE_INTERVAL_MS
+#define RTSP_MOTION_IDLE_INTERVAL_MS 1000 // Delta between JPEG frames sent while nothing moves, 0 sends every frame
+#endif
+
+#ifndef RTSP_METRICS_TEXT_SIZE
+#define RTSP_METRICS_TEXT_SIZE 4096 // The metrics of a GET_PARAMETER response
+#endif
+
+#ifndef RTSP_SOURCE_WAIT_MS
+#define RTSP_SOURCE_WAIT_MS 10000 // How long DESCRIBE waits for the camera to come up before answering 503
+#endif
+
+#ifndef RTSP_TIMESHIFT_SPEED
+#define RTSP_TIMESHIFT_SPEED 4 // How much faster than real time the time-shift buffer is replayed
+#endif
+
+#ifndef RTSP_MAX_SOURCES
+#define RTSP_MAX_SOURCES 8 // Paths with a media source of their own, the others play the camera
+#endif
+
+#define SOURCE_PATH_MAX_LENGTH 32
+
+#ifndef RTSP_MAX_CLIENTS
+#define RTSP_MAX_CLIENTS 5 // Connections, how many of them stream is up to the admission by bandwidth
+#endif
+
+// How often what the streams send is measured for the admission of new ones
+#define ADMISSION_SAMPLE_MS 1000
+
+#ifndef RTSP_CAPTURE_CORE
+#define RTSP_CAPTURE_CORE 1 // Core of the stage that takes and encodes the frames of a stream, the one of the camera
+#endif
+
+#ifndef RTSP_NETWORK_CORE
+#define RTSP_NETWORK_CORE 0 // Core of the stage that sends them, the one of the Wi-Fi and lwIP tasks
+#endif
+
+#ifndef RTSP_PIPELINE_ITEMS
+#define RTSP_PIPELINE_ITEMS 2 // Frames of a stream between its stages, each can hold a frame buffer of the camera
+#endif
+
+// Room for the software JPEG encoder, which runs in the capture stage, or the send stage when
+// there is no memory for a JPEG copy of the frame
+#define RTP_PLAYER_STACKSIZE (6 * 1024)
+
+#if portNUM_PROCESSORS > 1
+#define STAGE_CORE(core) (core)
+#else
+#define STAGE_CORE(core) tskNO_AFFINITY
+#endif
 
 #define KEEPALIVE_IDLE              5
 #define KEEPALIVE_INTERVAL          5
 #define KEEPALIVE_COUNT             3
 
-#define MAX_CLIENTS 3
+#define MAX_CLIENTS RTSP_MAX_CLIENTS
+
+// A frame on its way from the capture stage to the send stage: the frame of the source, or a JPEG
+// of its own when it was replayed or encoded
+typedef struct {
+    esp_media_frame_t media;
+    bool held;              // The media frame, until it is released to the source
+    uint8_t *jpeg;          // Grows to the largest frame, in PSRAM when there is
+    size_t length;          // Of the JPEG, 0 when the frame is sent
+    size_t size;
+    uint16_t width;
+    uint16_t height;
+    int64_t timestamp_us;
+    uint32_t seq;
+    bool replayed;
+} stream_frame_t;
+
+// What the stages of a stream keep between frames
+typedef struct {
+    pipeline_t *pipeline;   // While the stream plays
+    esp_media_source_t *source;
+    void *stream;           // Of the source
+    stream_frame_t items[RTSP_PIPELINE_ITEMS];
+    uint32_t frame_seq;     // Of the last frame replayed
+    timeshift_reader_t reader;
+    bool replaying;
+    int64_t replay_first_us;    // Timestamp of the first frame replayed
+    int64_t replay_started_us;
+    int64_t next_us;        // When the next live frame is due
+    int64_t taken_us;       // Timestamp of the last frame that went to the send stage
+    jpg_rate_control_t encode_rate;     // Of the capture stage
+    jpg_rate_control_t stream_rate;     // Of the send stage, when it encodes
+} player_t;
 
 typedef struct {
     int connection_active;
@@ -30,24 +144,47 @@ typedef struct {
     char client_addr_string[128];
     rtsp_parser_handle_t parser;
     esp_rtp_session_handle_t rtp_session;
-    TaskHandle_t rtp_player_task;
+    esp_media_source_t *source; // Of the path of the SETUP
+    player_t player;
+    bool motion;          // Watches for motion, see frames_motion_enable()
+    uint32_t replay_seq;  // The player starts with the time-shift buffer from this frame, 0 is live
+    int64_t last_sent_us; // Timestamp of the last frame the player sent
+    bool paused;          // PLAY without a range resumes after last_sent_us
+    uint32_t interval_ms; // Least delta between frames, longer when admitted at a lower frame rate
+    uint32_t kbps;        // What the stream takes, as admitted until it was measured
+    uint64_t sampled_bytes;
+    int samples;
+    uint32_t packets; // Sent in the RTP session, kept here as the session goes away on teardown
+    uint64_t bytes;
 } esp_rtsp_server_connection_t;
 
 esp_rtsp_server_connection_t connections[MAX_CLIENTS];
 
-static int esp_rtsp_handle_error(esp_rtsp_server_connection_t *, int);
+typedef struct {
+    char path[SOURCE_PATH_MAX_LENGTH];
+    esp_media_source_t *source;
+} source_path_t;
+
+// Published by counting up source_count once the path is in place, a path is never removed
+static source_path_t source_paths[RTSP_MAX_SOURCES];
+static int source_count;
+
+static bool boot_timeline_done; // The first RTP packet has left
+
+static int esp_rtsp_handle_error(esp_rtsp_server_connection_t *, int, int);
+static void stop_player(esp_rtsp_server_connection_t *);
 
 static void handle_options(esp_rtsp_server_connection_t *connection, rtsp_req_t *request) {
     char buffer[2048];
     size_t msgsize = snprintf(buffer, 2048,
                               "RTSP/1.0 200 OK\r\n"
                               "cSeq: %d\r\n"
-                              "Public: OPTIONS, DESCRIBE, SETUP, TEARDOWN, PLAY, PAUSE\r\n"
+                              "Public: OPTIONS, DESCRIBE, SETUP, TEARDOWN, PLAY, PAUSE, GET_PARAMETER\r\n"
                               "Server: ESP32 Cam Server\r\n"
                               "\r\n",
                               request->cseq);
     size_t sent = send(connection->socket, buffer, msgsize, 0);
-    ESP_LOGI(TAG, "RTSP (options) >: %s", buffer);
+    ESP_LOGD(TAG, "RTSP (options) >: %s", buffer);
     if (sent != msgsize) {
         ESP_LOGW(TAG, "Mismatch between msgsize and sent bytes: %d vs %d", msgsize, sent);
     }
@@ -61,7 +198,83 @@ char const * date_header() {
 }
 
 
+esp_err_t rtsp_server_register_source(const char *path, esp_media_source_t *source) {
+    if (!path || path[0] != '/' || strlen(path) >= SOURCE_PATH_MAX_LENGTH || !source) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    int count = __atomic_load_n(&source_count, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < count; i++) {
+        if (strcmp(source_paths[i].path, path) == 0) {
+            __atomic_store_n(&source_paths[i].source, source, __ATOMIC_RELEASE);
+            return ESP_OK;
+        }
+    }
+    if (count == RTSP_MAX_SOURCES) {
+        return ESP_ERR_NO_MEM;
+    }
+    strcpy(source_paths[count].path, path);
+    source_paths[count].source = source;
+    __atomic_store_n(&source_count, count + 1, __ATOMIC_RELEASE);
+    return ESP_OK;
+}
+
+// The source of the longest path the path of the url starts with, /cam matches /cam and /cam/1
+// but not /camera. The camera plays on the others.
+static esp_media_source_t *source_for(const char *url) {
+    const char *path = strstr(url, "://");
+    path = path ? strchr(path + 3, '/') : url;
+    if (!path) {
+        path = "/";
+    }
+
+    esp_media_source_t *source = esp_media_source_camera();
+    size_t matched = 0;
+    int count = __atomic_load_n(&source_count, __ATOMIC_ACQUIRE);
+    for (int i = 0; i < count; i++) {
+        size_t length = strlen(source_paths[i].path);
+        if (length > matched && strncmp(path, source_paths[i].path, length) == 0
+                && (path[length] == 0 || path[length] == '/' || source_paths[i].path[length - 1] == '/')) {
+            source = __atomic_load_n(&source_paths[i].source, __ATOMIC_ACQUIRE);
+            matched = length;
+        }
+    }
+    return source;
+}
+
+// The streams that play keep what they take, a new one gets what is left of the uplink. It is
+// expected to take what the streams that were measured at the full frame rate take.
+static bool admit(esp_rtsp_server_connection_t *connection) {
+    uint32_t used_kbps = 0;
+    uint32_t measured_kbps = 0;
+    int measured = 0;
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        esp_rtsp_server_connection_t *other = &connections[i];
+        if (other == connection || !other->connection_active || !other->rtp_session) {
+            continue;
+        }
+        used_kbps += other->kbps;
+        if (other->player.pipeline && other->samples > 1 && other->interval_ms == RTSP_FRAME_INTERVAL_MS) {
+            measured_kbps += other->kbps;
+            measured++;
+        }
+    }
+
+    connection->interval_ms = RTSP_FRAME_INTERVAL_MS;
+    connection->sampled_bytes = 0;
+    connection->samples = 0;
+    return admission_admit(used_kbps, measured ? measured_kbps / measured : 0, &connection->interval_ms, &connection->kbps);
+}
+
 static void handle_setup(esp_rtsp_server_connection_t *connection, rtsp_req_t *request) {
+    stop_player(connection);
+    connection->source = source_for(request->url);
+    if (!admit(connection)) {
+        esp_rtsp_handle_error(connection, request->cseq, 453);
+        return;
+    }
+    __atomic_store_n(&connection->packets, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&connection->bytes, 0, __ATOMIC_RELAXED);
+
     int err = esp_rtp_init(&connection->rtp_session, request->dst_rtp_port, request->dst_rtcp_port, connection->client_addr_string);
     if (err < 0) {
         ESP_LOGW(TAG, "Failed to initialize the rtp connection");
@@ -82,13 +295,29 @@ static void handle_setup(esp_rtsp_server_connection_t *connection, rtsp_req_t *r
                               esp_rtp_get_src_rtp_port(connection->rtp_session),
                               esp_rtp_get_src_rtcp_port(connection->rtp_session));
     size_t sent = send(connection->socket, buffer, msgsize, 0);
-    ESP_LOGI(TAG, "RTSP (setup) >: %s", buffer);
+    ESP_LOGD(TAG, "RTSP (setup) >: %s", buffer);
     if (sent != msgsize) {
         ESP_LOGW(TAG, "Mismatch between msgsize and sent bytes: %d vs %d", msgsize, sent);
     }
 }
 
 static void handle_describe(esp_rtsp_server_connection_t *connection, rtsp_req_t *request) {
+    esp_timeline_mark(ESP_TIMELINE_FIRST_DESCRIBE);
+    esp_media_source_t *source = source_for(request->url);
+    if (source == esp_media_source_camera() && !frames_wait_ready(RTSP_SOURCE_WAIT_MS)) {
+        static char unavailable[256];
+        size_t msgsize = snprintf(unavailable, sizeof(unavailable),
+                                  "RTSP/1.0 503 Service Unavailable\r\n"
+                                  "cSeq: %d\r\n"
+                                  "Retry-After: 1\r\n"
+                                  "Server: ESP32 Cam Server\r\n"
+                                  "\r\n",
+                                  request->cseq);
+        send(connection->socket, unavailable, msgsize, 0);
+        ESP_LOGW(TAG, "RTSP (describe) >: camera not ready");
+        return;
+    }
+
     static char sdp[2048];
     esp_netif_t *netif = esp_netif_get_handle_from_ifkey("WIFI_STA_DEF");
     if (netif == NULL) {
@@ -104,11 +333,17 @@ static void handle_describe(esp_rtsp_server_connection_t *connection, rtsp_req_t
                                "v=0\r\n"
                                "o=- %d 1 IN IP4 %s\r\n"
                                "s=\r\n"
-                               "t=0 0\r\n"
-                               "m=video 0 RTP/AVP 26\r\n"
-                               "c=IN IP4 0.0.0.0\r\n",
+                               "t=0 0\r\n",
                                12348765,
                                my_ip);
+    if (source->describe) {
+        sdp_size += source->describe(source, sdp + sdp_size, sizeof(sdp) - sdp_size);
+        sdp_size = MIN(sdp_size, sizeof(sdp) - 1);
+    } else {
+        sdp_size += snprintf(sdp + sdp_size, sizeof(sdp) - sdp_size,
+                             "m=video 0 RTP/AVP 26\r\n"
+                             "c=IN IP4 0.0.0.0\r\n");
+    }
 
     static char buffer[2048];
     size_t msgsize = snprintf(buffer, 2048,
@@ -125,62 +360,378 @@ static void handle_describe(esp_rtsp_server_connection_t *connection, rtsp_req_t
 
     // Send header
     size_t sent = send(connection->socket, buffer, msgsize, 0);
-    ESP_LOGI(TAG, "RTSP (describe header) >: %s", buffer);
+    ESP_LOGD(TAG, "RTSP (describe header) >: %s", buffer);
     if (sent != msgsize) {
         ESP_LOGW(TAG, "Mismatch between msgsize and sent bytes: %d vs %d", msgsize, sent);
     }
 
     // Send body
     sent = send(connection->socket, sdp, sdp_size, 0);
-    ESP_LOGI(TAG, "RTSP (describe body) >: %s", sdp);
+    ESP_LOGD(TAG, "RTSP (describe body) >: %s", sdp);
     if (sent != sdp_size) {
         ESP_LOGW(TAG, "Mismatch between sdp_size and sent bytes: %d vs %d", sdp_size, sent);
     }
 }
 
-void temporary_player_task(void *pvParameters) {
-    if (!pvParameters) {
-        ESP_LOGE("rtp_server", "Invalid arguments");
-        vTaskDelete(NULL);
+static size_t rtp_jpeg_out(void *arg, size_t index, const void *data, size_t len) {
+    if (!data) {
+        return 0; // End of the image, esp_rtp_jpeg_stream_end() sends the last packet
+    }
+    return esp_rtp_jpeg_stream_write(arg, data, len) == ESP_OK ? len : 0;
+}
+
+// Frames that are not JPEG yet are encoded straight into the RTP packets, every packet
+// leaves as soon as the encoder has filled it and no frame sized JPEG buffer is needed
+static esp_err_t send_encoded_frame(esp_rtp_session_t *session, const esp_media_frame_t *fb, jpg_rate_control_t *jpeg_rate, int64_t timestamp_us) {
+    esp_rtp_jpeg_stream_t stream;
+    esp_err_t err = esp_rtp_jpeg_stream_begin(session, &stream, RTSP_SOFTWARE_JPEG_QUALITY, fb->width, fb->height, timestamp_us);
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    bool encoded = jpeg_rate->target_size
+            ? fmt2jpg_rate_cb((uint8_t *)fb->buf, fb->len, fb->width, fb->height, fb->format, jpeg_rate, rtp_jpeg_out, &stream)
+            : fmt2jpg_cb((uint8_t *)fb->buf, fb->len, fb->width, fb->height, fb->format, RTSP_SOFTWARE_JPEG_QUALITY, rtp_jpeg_out, &stream);
+    if (!encoded) {
+        ESP_LOGE(TAG, "JPEG encoding failed");
+        return ESP_FAIL;
+    }
+    return esp_rtp_jpeg_stream_end(&stream);
+}
+
+// The camera frames say whether something moved, see frames.h, while nothing moves only one
+// every RTSP_MOTION_IDLE_INTERVAL_MS is sent
+static bool motion_wants_frame(const esp_rtsp_server_connection_t *connection, const esp_media_frame_t *fb, int64_t last_sent_us) {
+    if (!connection->motion || connection->player.source != esp_media_source_camera()) {
+        return true;
+    }
+    const shared_frame_t *frame = fb->handle;
+    return frame->motion || fb->timestamp_us - last_sent_us >= RTSP_MOTION_IDLE_INTERVAL_MS * 1000LL;
+}
+
+// Grows the JPEG buffer of an item, in PSRAM only: without it the send stage encodes frames that
+// are not JPEG into the packets, no frame sized buffer is taken from the internal memory
+static bool stream_frame_reserve(stream_frame_t *item, size_t size) {
+    uint8_t *jpeg = heap_caps_malloc(size, MALLOC_CAP_SPIRAM);
+    if (!jpeg) {
+        return false;
+    }
+    if (item->length) {
+        memcpy(jpeg, item->jpeg, item->length);
+    }
+    free(item->jpeg);
+    item->jpeg = jpeg;
+    item->size = size;
+    return true;
+}
+
+static size_t jpeg_buffer_out(void *arg, size_t index, const void *data, size_t len) {
+    stream_frame_t *item = arg;
+    if (!data) {
+        return 0;
+    }
+    if (item->length + len > item->size && !stream_frame_reserve(item, 2 * (item->length + len))) {
+        return 0;
+    }
+    memcpy(item->jpeg + item->length, data, len);
+    item->length += len;
+    return len;
+}
+
+// Encodes the frame of an item into its JPEG buffer, false when there is no memory for it
+static bool encode_frame(player_t *player, stream_frame_t *item) {
+    esp_media_frame_t *fb = &item->media;
+    item->length = 0;
+    bool encoded = player->encode_rate.target_size
+            ? fmt2jpg_rate_cb((uint8_t *)fb->buf, fb->len, fb->width, fb->height, fb->format, &player->encode_rate, jpeg_buffer_out, item)
+            : fmt2jpg_cb((uint8_t *)fb->buf, fb->len, fb->width, fb->height, fb->format, RTSP_SOFTWARE_JPEG_QUALITY, jpeg_buffer_out, item);
+    if (!encoded) {
+        item->length = 0;
+    }
+    return encoded;
+}
+
+// The next frame of the time-shift buffer from connection->replay_seq on, RTSP_TIMESHIFT_SPEED times
+// faster than it was captured and with the timestamps of the camera. False when the replay caught
+// up, the live frames continue after the last frame replayed.
+static bool replay_frame(esp_rtsp_server_connection_t *connection, stream_frame_t *item) {
+    player_t *player = &connection->player;
+    timeshift_reader_t *reader = &player->reader;
+
+    // The reader copies into the buffer of the item
+    reader->buffer = item->jpeg;
+    reader->size = item->size;
+    esp_err_t err = timeshift_read(reader);
+    item->jpeg = reader->buffer;
+    item->size = reader->size;
+    reader->buffer = NULL;
+    reader->size = 0;
+    if (err != ESP_OK) {
+        player->replaying = false;
+        if (player->frame_seq) {
+            frames_source_continue(player->stream, player->frame_seq);
+        }
+        return false;
+    }
+
+    timeshift_frame_t *frame = &reader->frame;
+    if (!player->replay_started_us) {
+        player->replay_started_us = esp_timer_get_time();
+        player->replay_first_us = frame->timestamp_us;
+    }
+    int64_t wait_us = player->replay_started_us + (frame->timestamp_us - player->replay_first_us) / RTSP_TIMESHIFT_SPEED
+            - esp_timer_get_time();
+    if (wait_us >= 1000) {
+        vTaskDelay(pdMS_TO_TICKS(wait_us / 1000));
+    }
+
+    item->length = frame->length;
+    item->width = frame->width;
+    item->height = frame->height;
+    item->timestamp_us = frame->timestamp_us;
+    item->seq = frame->seq;
+    item->replayed = true;
+    player->frame_seq = frame->seq;
+    player->taken_us = frame->timestamp_us;
+    return true;
+}
+
+// Capture stage: the next frame worth sending, from the time-shift buffer until it caught up, then
+// from the source. Frames that are not JPEG are encoded here, next to the camera, and released to
+// the source right away. The stage waits for a free item while the send stage is behind, which paces
+// the stream to what the network takes.
+static void capture_frame(void *item, void *arg) {
+    esp_rtsp_server_connection_t *connection = arg;
+    player_t *player = &connection->player;
+    stream_frame_t *out = item;
+
+    if (player->replaying && replay_frame(connection, out)) {
         return;
     }
 
-    esp_rtp_session_t *session = pvParameters;
+    while (!pipeline_stopping(player->pipeline)) {
+        int64_t start_us = esp_timer_get_time();
+        if (player->next_us - start_us >= 1000) {
+            vTaskDelay(pdMS_TO_TICKS((player->next_us - start_us) / 1000));
+            start_us = esp_timer_get_time();
+        }
+        player->next_us = start_us + connection->interval_ms * 1000LL;
 
-    int rate = 200; // delta ms between frames
+        esp_media_frame_t *fb = &out->media;
+        esp_err_t err = player->source->next_frame(player->source, player->stream, fb);
+        if (err == ESP_ERR_TIMEOUT) {
+            continue;
+        }
+        if (err != ESP_OK) {
+            ESP_LOGE(TAG, "No frame from the source: %s", esp_err_to_name(err));
+            continue;
+        }
 
-    for (;;) {
-        long timestamp_start = esp_timer_get_time();
-        camera_fb_t *fb = esp_camera_fb_get();
-        if (!fb) {
-            ESP_LOGE(TAG, "Camera Capture Failed");
-            goto done;
+        if (!boot_timeline_done) {
+            esp_timeline_mark(ESP_TIMELINE_FIRST_FRAME);
         }
 
-        esp_rtp_send_jpeg(session, fb->buf, fb->len, 10, fb->width, fb->height);
+        if (!motion_wants_frame(connection, fb, player->taken_us)) {
+            esp_metric_add(&metric_drop_motion, 1);
+            player->source->release(player->source, player->stream, fb);
+            continue;
+        }
 
-        //return the frame buffer back to the driver for reuse
-        esp_camera_fb_return(fb);
+        player->taken_us = fb->timestamp_us;
+        out->held = true;
+        out->width = fb->width;
+        out->height = fb->height;
+        out->timestamp_us = fb->timestamp_us;
+        out->seq = fb->seq;
+        out->replayed = false;
+        if (fb->format != PIXFORMAT_JPEG && encode_frame(player, out)) {
+            player->source->release(player->source, player->stream, fb);
+            out->held = false;
+        }
+        return;
+    }
+}
 
-        done:
-        {
-            long timestamp_end = esp_timer_get_time();
+// Send stage: packetizes a frame into the RTP session and sends it, next to the network stack
+static void send_frame(void *item, void *arg) {
+    esp_rtsp_server_connection_t *connection = arg;
+    esp_rtp_session_t *session = connection->rtp_session;
+    stream_frame_t *frame = item;
+    if (!frame->held && !frame->length) {
+        return; // The stream stopped while the capture stage waited for a frame
+    }
 
-            long delta_ms = (timestamp_end - timestamp_start) / 1000;
-            if (delta_ms >= rate) {
-                rate += 50;
-            } else {
-                 vTaskDelay(pdMS_TO_TICKS(rate - delta_ms));
-            }
+    uint32_t packets = session->packets;
+    ESP_TRACE(SEND_BEGIN, connection->socket, frame->seq);
+    esp_err_t err;
+    if (frame->length) {
+        err = esp_rtp_send_jpeg(session, frame->jpeg, frame->length, 10, frame->width, frame->height, frame->timestamp_us);
+    } else if (frame->media.format == PIXFORMAT_JPEG) {
+        esp_media_frame_t *fb = &frame->media;
+        err = esp_rtp_send_jpeg(session, (uint8_t *)fb->buf, fb->len, 10, fb->width, fb->height, frame->timestamp_us);
+    } else {
+        err = send_encoded_frame(session, &frame->media, &connection->player.stream_rate, frame->timestamp_us);
+    }
+    ESP_TRACE(SEND_END, connection->socket, session->packets - packets);
+    connection->last_sent_us = frame->timestamp_us;
+    __atomic_store_n(&connection->packets, session->packets, __ATOMIC_RELAXED);
+    __atomic_store_n(&connection->bytes, session->bytes, __ATOMIC_RELAXED);
+    if (err != ESP_OK) {
+        esp_metric_add(&metric_drop_send, 1);
+    }
+
+    if (frame->replayed) {
+        esp_metric_add(&metric_timeshift_replayed, 1);
+    } else if (!boot_timeline_done && err == ESP_OK) {
+        boot_timeline_done = true;
+        esp_timeline_mark(ESP_TIMELINE_FIRST_RTP);
+        esp_timeline_log();
+    }
+
+    // The camera gets the frame buffer back for reuse once the other streams are done with it
+    if (frame->held) {
+        connection->player.source->release(connection->player.source, connection->player.stream, &frame->media);
+        frame->held = false;
+    }
+    frame->length = 0;
+}
+
+// A stream plays in a pipeline of two stages, capture and encode on the core of the camera, send on
+// the core of the network stack, so one frame is encoded while the one before it is sent
+static esp_err_t start_player(esp_rtsp_server_connection_t *connection) {
+    static const pipeline_stage_t stages[] = {
+            { "capture", capture_frame, STAGE_CORE(RTSP_CAPTURE_CORE), 5, RTP_PLAYER_STACKSIZE },
+            { "send", send_frame, STAGE_CORE(RTSP_NETWORK_CORE), 6, RTP_PLAYER_STACKSIZE },
+    };
+
+    player_t *player = &connection->player;
+    player->source = connection->source ? connection->source : esp_media_source_camera();
+    esp_err_t err = player->source->start(player->source, &player->stream);
+    if (err != ESP_OK) {
+        return err;
+    }
+    player->frame_seq = 0;
+    player->replaying = connection->replay_seq != 0;
+    player->reader = (timeshift_reader_t) { .seq = connection->replay_seq };
+    player->replay_started_us = 0;
+    player->next_us = 0;
+    player->taken_us = 0;
+    player->encode_rate = (jpg_rate_control_t) {
+            .target_size = RTSP_SOFTWARE_JPEG_TARGET_SIZE,
+            .quality = RTSP_SOFTWARE_JPEG_QUALITY,
+    };
+    player->stream_rate = player->encode_rate;
+
+    void *items[RTSP_PIPELINE_ITEMS];
+    for (int i = 0; i < RTSP_PIPELINE_ITEMS; i++) {
+        items[i] = &player->items[i];
+    }
+    char name[16];
+    snprintf(name, sizeof(name), "rtsp%d", (int)(connection - connections));
+    err = pipeline_create(name, stages, sizeof(stages) / sizeof(stages[0]), items, RTSP_PIPELINE_ITEMS,
+                          connection, &player->pipeline);
+    if (err != ESP_OK) {
+        player->source->stop(player->source, player->stream);
+    }
+    return err;
+}
+
+// The stages finish the frames they work on, then the frames the stream still holds go back to the
+// source, e.g. to the other streams and the camera
+static void stop_player(esp_rtsp_server_connection_t *connection) {
+    player_t *player = &connection->player;
+    if (!player->pipeline) {
+        return;
+    }
+    pipeline_delete(player->pipeline);
+    player->pipeline = NULL;
+
+    for (int i = 0; i < RTSP_PIPELINE_ITEMS; i++) {
+        stream_frame_t *item = &player->items[i];
+        if (item->held) {
+            player->source->release(player->source, player->stream, &item->media);
         }
+        free(item->jpeg);
+        *item = (stream_frame_t) { 0 };
+    }
+    player->source->stop(player->source, player->stream);
+    player->stream = NULL;
+}
+
+// The UTC time in us minus esp_timer_get_time(), for clock ranges
+static int64_t wall_clock_offset_us(void) {
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    return (int64_t)now.tv_sec * 1000000 + now.tv_usec - esp_timer_get_time();
+}
+
+// Where PLAY starts, in the time-shift buffer or live, and the Range header that tells the client.
+// Without a range a paused stream resumes after the last frame it sent.
+static uint32_t play_start(esp_rtsp_server_connection_t *connection, const rtsp_req_t *request, char *range, size_t size) {
+    int64_t now_us = esp_timer_get_time();
+    int64_t start_us;
+    switch (request->range_type) {
+        case RANGE_NPT:
+            start_us = now_us - request->range_us;
+            break;
+        case RANGE_CLOCK:
+            start_us = request->range_us - wall_clock_offset_us();
+            break;
+        case RANGE_NONE:
+            start_us = connection->paused ? connection->last_sent_us + 1 : now_us;
+            break;
+        default:
+            start_us = now_us;
+    }
+
+    timeshift_frame_t frame;
+    // The time-shift buffer has the frames of the camera only
+    bool camera = !connection->source || connection->source == esp_media_source_camera();
+    if (!camera || start_us >= now_us || !timeshift_find(start_us, &frame)) {
+        snprintf(range, size, "npt=now-");
+        return 0;
+    }
+
+    if (request->range_type == RANGE_CLOCK) {
+        int64_t clock_us = frame.timestamp_us + wall_clock_offset_us();
+        time_t seconds = clock_us / 1000000;
+        struct tm tm;
+        gmtime_r(&seconds, &tm);
+        size_t length = strftime(range, size, "clock=%Y%m%dT%H%M%S", &tm);
+        snprintf(range + length, size - length, ".%03dZ-", (int)(clock_us % 1000000 / 1000));
+    } else {
+        snprintf(range, size, "npt=-%.3f-", (now_us - frame.timestamp_us) / 1e6);
     }
+    return frame.seq;
 }
 
 static void handle_play(esp_rtsp_server_connection_t *connection, rtsp_req_t *request) {
-    BaseType_t result = xTaskCreate(temporary_player_task, "rtp_server", 2024, connection->rtp_session, 6, &connection->rtp_player_task);
-    if (result != pdPASS) {
-        ESP_LOGE(TAG, "Failed to create rtp server task: %d", result);
-        send(connection->socket, "RTSP/1.0 500 Internal Server Error\r\n\r\n", 38, 0);
+    if (!connection->rtp_session) {
+        // Nothing to send to before SETUP
+        esp_rtsp_handle_error(connection, request->cseq, 455);
+        return;
+    }
+    if (request->range_type == RANGE_INVALID) {
+        // What is playing goes on as it was
+        esp_rtsp_handle_error(connection, request->cseq, 457);
+        return;
+    }
+
+    if (RTSP_MOTION_IDLE_INTERVAL_MS && !connection->motion) {
+        connection->motion = frames_motion_enable(NULL) == ESP_OK;
+        if (!connection->motion) {
+            ESP_LOGW(TAG, "No motion detector, sending every frame");
+        }
+    }
+
+    stop_player(connection);
+    char range[48];
+    connection->replay_seq = play_start(connection, request, range, sizeof(range));
+    connection->paused = false;
+    esp_err_t result = start_player(connection);
+    if (result != ESP_OK) {
+        ESP_LOGE(TAG, "Failed to start the stream: %s", esp_err_to_name(result));
+        esp_rtsp_handle_error(connection, request->cseq, 500);
         return;
     }
 
@@ -190,34 +741,113 @@ static void handle_play(esp_rtsp_server_connection_t *connection, rtsp_req_t *re
                               "cSeq: %d\r\n"
                               "Session: %d\r\n"
                               "Server: ESP32 Cam Server\r\n"
-                              "Range: npt=0.000-\r\n"
+                              "Range: %s\r\n"
                               "\r\n",
                               request->cseq,
-                              12348765);
+                              12348765,
+                              range);
 
     size_t sent = send(connection->socket, buffer, msgsize, 0);
-    ESP_LOGI(TAG, "RTSP (play) >: %s", buffer);
+    ESP_LOGD(TAG, "RTSP (play) >: %s", buffer);
+    if (sent != msgsize) {
+        ESP_LOGW(TAG, "Mismatch between msgsize and sent bytes: %d vs %d", msgsize, sent);
+    }
+}
+
+// The player stops after the frame it is sending, a PLAY without a range continues after it from
+// the time-shift buffer, or live when there is none
+static void handle_pause(esp_rtsp_server_connection_t *connection, rtsp_req_t *request) {
+    if (!connection->player.pipeline) {
+        esp_rtsp_handle_error(connection, request->cseq, 455);
+        return;
+    }
+    stop_player(connection);
+    connection->paused = true;
+
+    char buffer[256];
+    size_t msgsize = snprintf(buffer, sizeof(buffer),
+                              "RTSP/1.0 200 OK\r\n"
+                              "cSeq: %d\r\n"
+                              "Session: %d\r\n"
+                              "Server: ESP32 Cam Server\r\n"
+                              "\r\n",
+                              request->cseq,
+                              12348765);
+    size_t sent = send(connection->socket, buffer, msgsize, 0);
+    ESP_LOGD(TAG, "RTSP (pause) >: %s", buffer);
     if (sent != msgsize) {
         ESP_LOGW(TAG, "Mismatch between msgsize and sent bytes: %d vs %d", msgsize, sent);
     }
 }
 
+// An empty GET_PARAMETER keeps the session alive. One with parameter names in its body, a name
+// per line, gets the metrics whose names start with them, "metrics" for all of them.
+static void handle_get_parameter(esp_rtsp_server_connection_t *connection, rtsp_req_t *request) {
+    static char body[RTSP_METRICS_TEXT_SIZE];
+    size_t length = 0;
+    char *saveptr;
+    for (char *name = strtok_r(request->body, " \t\r\n", &saveptr); name; name = strtok_r(NULL, " \t\r\n", &saveptr)) {
+        length += esp_metrics_format(body + length, sizeof(body) - length, strcmp(name, "metrics") == 0 ? NULL : name);
+    }
+
+    char buffer[256];
+    size_t msgsize = snprintf(buffer, sizeof(buffer),
+                              "RTSP/1.0 200 OK\r\n"
+                              "cSeq: %d\r\n"
+                              "Session: %d\r\n"
+                              "Server: ESP32 Cam Server\r\n"
+                              "Content-Type: text/parameters\r\n"
+                              "Content-Length: %d\r\n"
+                              "\r\n",
+                              request->cseq,
+                              12348765,
+                              (int) length);
+    send(connection->socket, buffer, msgsize, 0);
+    if (length) {
+        send(connection->socket, body, length, 0);
+    }
+    ESP_LOGD(TAG, "RTSP (get_parameter) >: %s%s", buffer, body);
+}
+
+size_t rtsp_server_write_metrics(char *buffer, size_t size) {
+    size_t length = 0;
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        esp_rtsp_server_connection_t *connection = &connections[i];
+        if (!connection->connection_active) {
+            continue;
+        }
+        length = esp_metrics_printf(buffer, size, length,
+                                    "rtsp_session_packets_total{session=\"%d\",client=\"%s\"} %u\n"
+                                    "rtsp_session_bytes_total{session=\"%d\",client=\"%s\"} %llu\n"
+                                    "rtsp_session_kbps{session=\"%d\",client=\"%s\"} %u\n",
+                                    i, connection->client_addr_string,
+                                    (unsigned) __atomic_load_n(&connection->packets, __ATOMIC_RELAXED),
+                                    i, connection->client_addr_string,
+                                    (unsigned long long) __atomic_load_n(&connection->bytes, __ATOMIC_RELAXED),
+                                    i, connection->client_addr_string,
+                                    (unsigned) connection->kbps);
+    }
+    return length;
+}
+
 static void handle_teardown(esp_rtsp_server_connection_t *connection, rtsp_req_t *request) {
     if (!connection->connection_active) {
-        esp_rtsp_handle_error(connection, 400);
+        esp_rtsp_handle_error(connection, request->cseq, 400);
         return;
     }
 
-    if (connection->rtp_player_task) {
-        vTaskDelete(connection->rtp_player_task);
-        connection->rtp_player_task = NULL;
-    }
+    stop_player(connection);
 
     if (connection->rtp_session) {
         esp_rtp_teardown(connection->rtp_session);
         connection->rtp_session = NULL;
     }
 
+    if (connection->motion) {
+        frames_motion_disable();
+        connection->motion = false;
+    }
+
     static char buffer[2048];
     size_t msgsize = snprintf(buffer, 2048,
                               "RTSP/1.0 200 OK\r\n"
@@ -227,7 +857,7 @@ static void handle_teardown(esp_rtsp_server_connection_t *connection, rtsp_req_t
                               request->cseq);
 
     size_t sent = send(connection->socket, buffer, msgsize, 0);
-    ESP_LOGI(TAG, "RTSP (teardown) >: %s", buffer);
+    ESP_LOGD(TAG, "RTSP (teardown) >: %s", buffer);
     if (sent != msgsize) {
         ESP_LOGW(TAG, "Mismatch between msgsize and sent bytes: %d vs %d", msgsize, sent);
     }
@@ -247,14 +877,16 @@ static int rtsp_server_connection_close(esp_rtsp_server_connection_t *connection
         }
     }
 
-    if (connection->rtp_player_task) {
-        vTaskDelete(connection->rtp_player_task);
-    }
+    stop_player(connection);
 
     if (connection->rtp_session) {
         esp_rtp_teardown(connection->rtp_session);
     }
 
+    if (connection->motion) {
+        frames_motion_disable();
+    }
+
     connection->connection_active = false;
     shutdown(connection->socket, 0);
     close(connection->socket);
@@ -289,7 +921,7 @@ static int esp_rtsp_server_read_block(esp_rtsp_server_connection_t *connection)
 
     buffer[n] = 0x0;
 
-    ESP_LOGI(TAG, "RTSP < (%d bytes): %s", n, buffer);
+    ESP_LOGD(TAG, "RTSP < (%d bytes): %s", n, buffer);
 
     if (parse_request(connection->parser, buffer, n) < 0) {
         ESP_LOGE(TAG, "Error parsing request");
@@ -305,6 +937,7 @@ static int esp_rtsp_handle_request(esp_rtsp_server_connection_t *connection, rts
         return -1;
     }
 
+    ESP_TRACE(RTSP_REQUEST, request->request_type, request->cseq);
     switch (request->request_type) {
         case OPTIONS:
             handle_options(connection, request);
@@ -318,47 +951,62 @@ static int esp_rtsp_handle_request(esp_rtsp_server_connection_t *connection, rts
         case PLAY:
             handle_play(connection, request);
             break;
+        case PAUSE:
+            handle_pause(connection, request);
+            break;
         case TEARDOWN:
             handle_teardown(connection, request);
             break;
+        case GET_PARAMETER:
+            handle_get_parameter(connection, request);
+            break;
         default:
-            esp_rtsp_handle_error(connection, 405);
+            esp_rtsp_handle_error(connection, request->cseq, 405);
     }
 
     return 0;
 }
 
-static int esp_rtsp_handle_error(esp_rtsp_server_connection_t *connection, int error) {
+static const char *error_reason(int error) {
+    switch (error) {
+        case 405: return "Method Not Allowed";
+        case 453: return "Not Enough Bandwidth";
+        case 455: return "Method Not Valid in This State";
+        case 457: return "Invalid Range";
+        case 461: return "Unsupported Transport";
+        case 500: return "Internal Server Error";
+        default: return "Bad Request";
+    }
+}
+
+// The cSeq of the request goes back with the error so the client can match them up
+static int esp_rtsp_handle_error(esp_rtsp_server_connection_t *connection, int cseq, int error) {
     if (!connection->connection_active) {
     return -1;
     }
 
-    int sock = connection->socket;
+    ESP_TRACE(RTSP_ERROR, error, 0);
 
-    if (error == 461) {
-        ESP_LOGI(TAG, "RTSP >: %s", "RTSP/1.0 461 Unsupported Transport\r\n\r\n");
-        send(sock, "RTSP/1.0 461 Unsupported Transport\r\n\r\n", 38, 0);
-        return 0;
+    if (error != 405 && error != 453 && error != 455 && error != 457 && error != 461 && error != 500) {
+        error = 400;
     }
 
-    if (error == 405) {
-        static char buffer[2048];
-        size_t msgsize = snprintf(buffer, 2048,
-                                  "RTSP/1.0 405 Method Not Allowed\r\n"
-                                  "Server: ESP32 Cam Server\r\n"
-                                  "Allow: OPTIONS, DESCRIBE, SETUP, TEARDOWN, PLAY, PAUSE\r\n"
-                                  "\r\n");
-        size_t sent = send(connection->socket, buffer, msgsize, 0);
-        ESP_LOGI(TAG, "RTSP >: %s", buffer);
-        if (sent != msgsize) {
-            ESP_LOGW(TAG, "Mismatch between msgsize and sent bytes: %d vs %d", msgsize, sent);
-        }
-        return 0;
+    char buffer[256];
+    size_t msgsize = snprintf(buffer, sizeof(buffer),
+                              "RTSP/1.0 %d %s\r\n"
+                              "cSeq: %d\r\n"
+                              "%s"
+                              "\r\n",
+                              error,
+                              error_reason(error),
+                              cseq,
+                              error == 405 ? "Server: ESP32 Cam Server\r\n"
+                                             "Allow: OPTIONS, DESCRIBE, SETUP, TEARDOWN, PLAY, PAUSE, GET_PARAMETER\r\n" : "");
+    size_t sent = send(connection->socket, buffer, msgsize, 0);
+    ESP_LOGD(TAG, "RTSP >: %s", buffer);
+    if (sent != msgsize) {
+        ESP_LOGW(TAG, "Mismatch between msgsize and sent bytes: %d vs %d", msgsize, sent);
     }
-
-    ESP_LOGI(TAG, "RTSP >: %s", "RTSP/1.0 400 Bad Request\r\n\r\n");
-    send(sock, "RTSP/1.0 400 Bad Request\r\n\r\n", 28, 0);
-
     return 0;
 }
 
@@ -387,7 +1035,7 @@ static int esp_rtsp_handle_read(esp_rtsp_server_connection_t *connection) {
 
     int error = parser_get_error(connection->parser);
     if (error) {
-        esp_rtsp_handle_error(connection, error);
+        esp_rtsp_handle_error(connection, parser_get_request(connection->parser)->cseq, error);
         ESP_LOGD(TAG, "Closing connection after bad request error");
         rtsp_server_connection_close(connection);
         return 0;
@@ -410,7 +1058,7 @@ static int esp_rtsp_handle_read(esp_rtsp_server_connection_t *connection) {
 }
 
 
-static int esp_rtsp_create_listening_socket(int port) {
+int esp_rtsp_create_listening_socket(int port) {
     int listen_sock = socket(AF_INET6, SOCK_STREAM, 0);
     if (listen_sock < 0) {
         ESP_LOGE(TAG, "Unable to create socket: errno %d", errno);
@@ -421,7 +1069,7 @@ static int esp_rtsp_create_listening_socket(int port) {
     struct sockaddr_in6 serv_addr = {
             .sin6_family  = PF_INET6,
             .sin6_addr    = inaddr_any,
-            .sin6_port    = htons(PORT)
+            .sin6_port    = htons(port)
     };
 
     int opt = 1;
@@ -519,11 +1167,50 @@ static esp_err_t rtsp_server_accept(int listen_sock) {
     return ESP_OK;
 }
 
+// What each stream and all of them sent since the last sample, for the admission of new streams.
+// The first sample of a stream covers only part of the interval, it keeps what it was admitted with.
+static void sample_streams(void) {
+    static int64_t last_us;
+    static uint64_t last_bytes, last_frames, last_congested;
+    int64_t now_us = esp_timer_get_time();
+    int64_t elapsed_us = now_us - last_us;
+    if (elapsed_us < ADMISSION_SAMPLE_MS * 1000LL) {
+        return;
+    }
+
+    int streams = 0;
+    for (int i = 0; i < MAX_CLIENTS; i++) {
+        esp_rtsp_server_connection_t *connection = &connections[i];
+        if (!connection->connection_active || !connection->player.pipeline) {
+            continue;
+        }
+        uint64_t bytes = __atomic_load_n(&connection->bytes, __ATOMIC_RELAXED);
+        if (connection->samples++ > 0) {
+            connection->kbps = (bytes - connection->sampled_bytes) * 8000 / elapsed_us;
+        }
+        connection->sampled_bytes = bytes;
+        streams++;
+    }
+
+    uint64_t bytes = __atomic_load_n(&metric_rtp_bytes.value, __ATOMIC_RELAXED);
+    uint64_t frames = __atomic_load_n(&metric_rtp_frames.value, __ATOMIC_RELAXED);
+    uint64_t congested = __atomic_load_n(&metric_rtp_enomem_retries.value, __ATOMIC_RELAXED)
+            + __atomic_load_n(&metric_drop_send.value, __ATOMIC_RELAXED);
+    if (last_us) {
+        admission_sample(bytes - last_bytes, frames - last_frames, congested - last_congested, streams, elapsed_us);
+    }
+    last_us = now_us;
+    last_bytes = bytes;
+    last_frames = frames;
+    last_congested = congested;
+}
+
 esp_err_t rtsp_server_main() {
-    int listen_sock = esp_rtsp_create_listening_socket(554);
+    int listen_sock = esp_rtsp_create_listening_socket(RTSP_PORT);
     if (listen_sock < 0) {
         return ESP_FAIL;
     }
+    esp_timeline_mark(ESP_TIMELINE_RTSP_LISTENING);
 
     while (1) {
         int sock_max = listen_sock;
@@ -542,7 +1229,9 @@ esp_err_t rtsp_server_main() {
         }
 
         ESP_LOGD(TAG, "Entering select");
-        int n = select(sock_max + 1, &read_set, NULL, NULL, NULL);
+        struct timeval timeout = { .tv_sec = ADMISSION_SAMPLE_MS / 1000 };
+        int n = select(sock_max + 1, &read_set, NULL, NULL, &timeout);
+        sample_streams();
         if (n < 0) {
             if (errno == EINTR) {
                 ESP_LOGW(TAG, "select interrupted");
@@ -0,0 +1,174 @@
+//
+// Loopback streaming benchmark for esp-rtsp.
+//
+// Runs the server against the synthetic camera and connects 1..N RTSP clients
+// over loopback. For every client count it reports what the clients received
+// and where the server spent its time per frame.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <getopt.h>
+#include <pthread.h>
+
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "esp-rtsp.h"
+#include "rtp-udp.h"
+#include "rtsp-client.h"
+#include "synthetic-camera.h"
+
+typedef struct {
+    int index;
+    int duration_ms;
+    int ok;
+    uint64_t packets;
+    uint64_t bytes;
+    uint64_t frames;
+} bench_client_t;
+
+static void *client_thread(void *arg) {
+    bench_client_t *bench = arg;
+    rtsp_client_t client;
+
+    if (rtsp_client_connect(&client, "127.0.0.1", RTSP_PORT, "/mjpeg/1") != 0 ||
+        rtsp_client_request(&client, "OPTIONS", NULL) != 200 ||
+        rtsp_client_request(&client, "DESCRIBE", NULL) != 200 ||
+        rtsp_client_setup(&client) != 200 ||
+        rtsp_client_play(&client) != 200) {
+        fprintf(stderr, "client %d: RTSP handshake failed\n", bench->index);
+        rtsp_client_close(&client);
+        return NULL;
+    }
+
+    uint8_t packet[2048];
+    int64_t end = esp_timer_get_time() + (int64_t)bench->duration_ms * 1000;
+    while (esp_timer_get_time() < end) {
+        int n = rtsp_client_receive(&client, packet, sizeof(packet), 100);
+        if (n < 12) {
+            continue;
+        }
+        bench->packets++;
+        bench->bytes += n;
+        if (packet[1] & 0x80) {
+            bench->frames++;
+        }
+    }
+
+    bench->ok = rtsp_client_teardown(&client) == 200;
+    rtsp_client_close(&client);
+    return NULL;
+}
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "usage: %s [-c max_clients] [-t seconds] [-s frame_bytes] [-f camera_fps] [-j file.jpg] [-y]\n"
+            "  -c  run rounds with 1..max_clients clients (default 3)\n"
+            "  -t  duration of every round in seconds (default 5)\n"
+            "  -s  size of the generated JPEG frames in bytes (default 65536)\n"
+            "  -f  synthetic camera frame rate, 0 is unlimited (default 0)\n"
+            "  -j  stream this JPEG file instead of a generated frame\n"
+            "  -y  stream YUV422 frames, encoded to JPEG in software while they are sent\n",
+            name);
+}
+
+int main(int argc, char **argv) {
+    int max_clients = 3;
+    int duration_s = 5;
+    synthetic_camera_config_t config = SYNTHETIC_CAMERA_DEFAULT();
+
+    int opt;
+    while ((opt = getopt(argc, argv, "c:t:s:f:j:yh")) != -1) {
+        switch (opt) {
+            case 'c': max_clients = atoi(optarg); break;
+            case 't': duration_s = atoi(optarg); break;
+            case 's': config.frame_size = strtoul(optarg, NULL, 10); break;
+            case 'f': config.fps = atoi(optarg); break;
+            case 'j': config.jpeg_path = optarg; break;
+            case 'y': config.pixformat = PIXFORMAT_YUV422; break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    esp_log_level_set("*", ESP_LOG_ERROR);
+
+    if (synthetic_camera_init(&config) != ESP_OK) {
+        return 1;
+    }
+
+    size_t frame_length;
+    synthetic_camera_frame(&frame_length);
+
+    esp_rtsp_server_handle_t server;
+    if (esp_rtsp_server_start(&server) != ESP_OK) {
+        return 1;
+    }
+    vTaskDelay(pdMS_TO_TICKS(100)); // Let the server start listening
+
+    printf("frame: %zu bytes, camera: %u fps, server frame interval: %d ms, round: %d s\n",
+           frame_length, (unsigned) config.fps, RTSP_FRAME_INTERVAL_MS, duration_s);
+    printf("%7s %9s %10s %9s %13s %11s %9s %12s %9s %12s\n",
+           "clients", "frames/s", "packets/s", "Mbit/s", "copied/frame",
+           "capture us", "parse us", "packetize us", "send us", "1st pkt us");
+
+    int failed = 0;
+    for (int clients = 1; clients <= max_clients; clients++) {
+        vTaskDelay(pdMS_TO_TICKS(200)); // Let the server close the previous connections
+
+        bench_client_t bench[clients];
+        pthread_t threads[clients];
+
+        esp_rtp_reset_stats();
+        synthetic_camera_reset_stats();
+
+        int64_t start = esp_timer_get_time();
+        for (int i = 0; i < clients; i++) {
+            bench[i] = (bench_client_t) {
+                    .index = i,
+                    .duration_ms = duration_s * 1000
+            };
+            pthread_create(&threads[i], NULL, client_thread, &bench[i]);
+        }
+
+        uint64_t packets = 0, bytes = 0, frames = 0;
+        for (int i = 0; i < clients; i++) {
+            pthread_join(threads[i], NULL);
+            packets += bench[i].packets;
+            bytes += bench[i].bytes;
+            frames += bench[i].frames;
+            failed |= !bench[i].ok;
+        }
+        double elapsed = (esp_timer_get_time() - start) / 1e6;
+
+        esp_rtp_stats_t stats;
+        esp_rtp_get_stats(&stats);
+        synthetic_camera_stats_t camera;
+        synthetic_camera_get_stats(&camera);
+
+        double sent = stats.frames ? stats.frames : 1;
+        printf("%7d %9.1f %10.0f %9.2f %13.0f %11.1f %9.1f %12.1f %9.1f %12.1f\n",
+               clients,
+               frames / elapsed,
+               packets / elapsed,
+               bytes * 8 / elapsed / 1e6,
+               stats.bytes_copied / sent,
+               camera.frames ? (double) camera.capture_us / camera.frames : 0.0,
+               stats.parse_us / sent,
+               stats.packetize_us / sent,
+               stats.send_us / sent,
+               stats.first_packet_us / sent);
+    }
+
+    esp_rtsp_server_stop(server);
+    synthetic_camera_deinit();
+    return failed;
+}
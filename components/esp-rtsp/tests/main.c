@@ -0,0 +1,1457 @@
+//
+// Host tests for esp-rtsp, runs the server against the synthetic camera
+// over loopback.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "esp_err.h"
+#include "esp_log.h"
+#include "lwip/sockets.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "esp-rtsp.h"
+#include "esp-motion.h"
+#include "esp-metrics.h"
+#include "esp-trace.h"
+#include "esp-recorder.h"
+#include "esp-rtsp-common.h"
+#include "rtp-udp.h"
+#include "frames.h"
+#include "timeshift.h"
+#include "rtsp-metrics.h"
+#include "admission.h"
+#include "pipeline.h"
+#include "rtsp-client.h"
+#include "img_converters.h"
+#include "rtp-jpeg-receiver.h"
+#include "synthetic-camera.h"
+
+static int failures;
+
+#define CHECK(cond) do {                                                    \
+        if (!(cond)) {                                                      \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++;                                                     \
+            return;                                                         \
+        }                                                                   \
+    } while(0)
+
+#define RUN(test) do {                                                      \
+        int before = failures;                                              \
+        test();                                                             \
+        printf("%s %s\n", failures == before ? "PASS" : "FAIL", #test);     \
+    } while(0)
+
+static rtsp_req_t *parse(const char *text, int *error) {
+    rtsp_parser_handle_t parser;
+    if (rtsp_parser_init(&parser) != PARSER_OK) {
+        return NULL;
+    }
+
+    parse_request(parser, text, strlen(text));
+    *error = parser_get_error(parser);
+    rtsp_req_t *request = parser_is_complete(parser) || *error ? parser_get_request(parser) : NULL;
+    if (!request) {
+        free(parser_get_request(parser));
+    }
+    parser_free(parser);
+    return request;
+}
+
+static void test_parse_options(void) {
+    int error;
+    rtsp_req_t *request = parse("OPTIONS rtsp://127.0.0.1/mjpeg/1 RTSP/1.0\r\n"
+                                "CSeq: 2\r\n"
+                                "User-Agent: test\r\n"
+                                "\r\n", &error);
+    CHECK(request != NULL);
+    CHECK(error == 0);
+    CHECK(request->request_type == OPTIONS);
+    CHECK(request->cseq == 2);
+    CHECK(strcmp(request->url, "rtsp://127.0.0.1/mjpeg/1") == 0);
+    free(request);
+}
+
+static void test_parse_setup_transport(void) {
+    int error;
+    rtsp_req_t *request = parse("SETUP rtsp://127.0.0.1/mjpeg/1 RTSP/1.0\r\n"
+                                "CSeq: 3\r\n"
+                                "Transport: RTP/AVP;unicast;client_port=50000-50001\r\n"
+                                "\r\n", &error);
+    CHECK(request != NULL);
+    CHECK(error == 0);
+    CHECK(request->request_type == SETUP);
+    CHECK(request->dst_rtp_port == 50000);
+    CHECK(request->dst_rtcp_port == 50001);
+    free(request);
+}
+
+static void test_parse_range(void) {
+    int error;
+    rtsp_req_t *request = parse("PLAY rtsp://127.0.0.1/mjpeg/1 RTSP/1.0\r\n"
+                                "CSeq: 4\r\n"
+                                "Range: npt=-2.5-\r\n"
+                                "\r\n", &error);
+    CHECK(request != NULL);
+    CHECK(error == 0);
+    CHECK(request->range_type == RANGE_NPT);
+    CHECK(request->range_us == 2500000);
+    free(request);
+
+    // Where clients that do not time-shift start
+    request = parse("PLAY rtsp://127.0.0.1/mjpeg/1 RTSP/1.0\r\nCSeq: 4\r\nRange: npt=0.000-\r\n\r\n", &error);
+    CHECK(request != NULL);
+    CHECK(request->range_type == RANGE_LIVE);
+    free(request);
+
+    request = parse("PLAY rtsp://127.0.0.1/mjpeg/1 RTSP/1.0\r\nCSeq: 4\r\nRange: clock=19961108T142300.25Z-\r\n\r\n", &error);
+    CHECK(request != NULL);
+    CHECK(request->range_type == RANGE_CLOCK);
+    CHECK(request->range_us == 847462980250000LL);
+    free(request);
+
+    // Left to PLAY to refuse, the request itself is fine
+    const char *invalid[] = {"smpte=0:10:00-", "npt=-inf-", "npt=1e999-", "npt=-1e300-", "clock=19961108T142300.9e999Z-"};
+    for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+        char text[128];
+        snprintf(text, sizeof(text), "PLAY rtsp://127.0.0.1/mjpeg/1 RTSP/1.0\r\nCSeq: 4\r\nRange: %s\r\n\r\n", invalid[i]);
+        request = parse(text, &error);
+        CHECK(request != NULL);
+        CHECK(error == 0);
+        CHECK(request->range_type == RANGE_INVALID);
+        free(request);
+    }
+
+    request = parse("PAUSE rtsp://127.0.0.1/mjpeg/1 RTSP/1.0\r\nCSeq: 5\r\n\r\n", &error);
+    CHECK(request != NULL);
+    CHECK(request->request_type == PAUSE);
+    free(request);
+}
+
+static void test_parse_invalid_method(void) {
+    int error;
+    rtsp_req_t *request = parse("get / HTTP/1.1\r\n\r\n", &error);
+    CHECK(error == 400);
+    free(request);
+}
+
+static void test_jpeg_decode(void) {
+    size_t length;
+    const uint8_t *frame = synthetic_camera_frame(&length);
+    CHECK(frame != NULL);
+
+    esp_rtsp_jpeg_data_t jpeg_data;
+    CHECK(esp_rtsp_jpeg_decode((char *)frame, length, &jpeg_data) == ESP_OK);
+    CHECK((uint8_t)jpeg_data.quant_table_0[1] == 0xDB);
+    CHECK((uint8_t)jpeg_data.quant_table_1[1] == 0xDB);
+    CHECK(jpeg_data.quant_table_0[4] == 0);
+    CHECK(jpeg_data.quant_table_1[4] == 1);
+    CHECK((uint8_t *)jpeg_data.jpeg_data_start + jpeg_data.jpeg_data_length == frame + length - 2);
+}
+
+// Only the RTP socket of the client is used, no RTSP session is set up
+static int bind_rtp_client(rtsp_client_t *client) {
+    *client = (rtsp_client_t) { .socket = -1, .rtp_socket = -1, .rtcp_socket = -1 };
+    for (uint16_t port = 51000; client->rtp_socket < 0 && port < 52000; port += 2) {
+        client->rtp_socket = socket(AF_INET, SOCK_DGRAM, 0);
+        struct sockaddr_in addr = { .sin_family = AF_INET, .sin_port = htons(port) };
+        if (bind(client->rtp_socket, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+            close(client->rtp_socket);
+            client->rtp_socket = -1;
+        } else {
+            client->rtp_port = port;
+        }
+    }
+    return client->rtp_socket >= 0 ? 0 : -1;
+}
+
+// Frames smaller than a single packet must still fit the packet with the quant tables
+static void test_send_small_frame(void) {
+    synthetic_camera_config_t config = SYNTHETIC_CAMERA_DEFAULT();
+    config.frame_size = 1200;
+    CHECK(synthetic_camera_init(&config) == ESP_OK);
+
+    size_t length;
+    const uint8_t *frame = synthetic_camera_frame(&length);
+    esp_rtsp_jpeg_data_t jpeg_data;
+    CHECK(esp_rtsp_jpeg_decode((char *)frame, length, &jpeg_data) == ESP_OK);
+
+    rtsp_client_t client;
+    CHECK(bind_rtp_client(&client) == 0);
+
+    esp_rtp_session_handle_t session;
+    CHECK(esp_rtp_init(&session, client.rtp_port, client.rtp_port + 1, "127.0.0.1") == ESP_OK);
+    CHECK(esp_rtp_send_jpeg(session, (uint8_t *)frame, length, 10, config.width, config.height, 0) == ESP_OK);
+
+    uint8_t packet[2048];
+    int n = rtsp_client_receive(&client, packet, sizeof(packet), 1000);
+    esp_rtp_teardown(session);
+    rtsp_client_close(&client);
+
+    CHECK(n == (int)(12 + 8 + 4 + 128 + jpeg_data.jpeg_data_length));
+    CHECK(packet[1] & 0x80); // marker
+    CHECK(packet[17] & 0x80); // in band quant tables
+}
+
+#define MAX_TEST_PACKETS 128
+
+// Sends a frame and keeps the packets, so they can be fed to the receiver in any order
+static int capture_packets(rtsp_client_t *client, esp_rtp_session_handle_t session, const uint8_t *frame,
+                           size_t length, int64_t timestamp_us, uint8_t (*packets)[2048], int *lengths) {
+    if (esp_rtp_send_jpeg(session, (uint8_t *)frame, length, 10, 1024, 768, timestamp_us) != ESP_OK) {
+        return -1;
+    }
+    for (int count = 0; count < MAX_TEST_PACKETS; count++) {
+        lengths[count] = rtsp_client_receive(client, packets[count], sizeof(packets[count]), 1000);
+        if (lengths[count] <= 0) {
+            return -1;
+        }
+        if (packets[count][1] & 0x80) {
+            return count + 1;
+        }
+    }
+    return -1;
+}
+
+static void test_receiver_reassembly(void) {
+    synthetic_camera_config_t config = SYNTHETIC_CAMERA_DEFAULT();
+    config.frame_size = 100 * 1024;
+    CHECK(synthetic_camera_init(&config) == ESP_OK);
+
+    size_t length;
+    const uint8_t *frame = synthetic_camera_frame(&length);
+    esp_rtsp_jpeg_data_t sent;
+    CHECK(esp_rtsp_jpeg_decode((char *)frame, length, &sent) == ESP_OK);
+
+    rtsp_client_t client;
+    CHECK(bind_rtp_client(&client) == 0);
+    esp_rtp_session_handle_t session;
+    CHECK(esp_rtp_init(&session, client.rtp_port, client.rtp_port + 1, "127.0.0.1") == ESP_OK);
+
+    static uint8_t packets[MAX_TEST_PACKETS][2048];
+    static int lengths[MAX_TEST_PACKETS];
+    rtp_jpeg_receiver_t receiver;
+    rtp_jpeg_receiver_init(&receiver);
+
+    // A complete frame, rebuilt with the quant tables from the first packet
+    int count = capture_packets(&client, session, frame, length, 0, packets, lengths);
+    CHECK(count > 1);
+    int completed = 0;
+    for (int i = 0; i < count; i++) {
+        completed += rtp_jpeg_receiver_packet(&receiver, packets[i], lengths[i], 1000 * i) == 1;
+    }
+    CHECK(completed == 1);
+
+    size_t received_length;
+    const uint8_t *received = rtp_jpeg_receiver_frame(&receiver, &received_length);
+    esp_rtsp_jpeg_data_t rebuilt;
+    CHECK(received != NULL);
+    CHECK(esp_rtsp_jpeg_decode((char *)received, received_length, &rebuilt) == ESP_OK);
+    CHECK(rebuilt.jpeg_data_length == sent.jpeg_data_length);
+    CHECK(memcmp(rebuilt.jpeg_data_start, sent.jpeg_data_start, sent.jpeg_data_length) == 0);
+    CHECK(memcmp(rebuilt.quant_table_0 + 5, sent.quant_table_0 + 5, 64) == 0);
+    CHECK(memcmp(rebuilt.quant_table_1 + 5, sent.quant_table_1 + 5, 64) == 0);
+
+    // Losing a packet in the middle leaves the frame incomplete
+    count = capture_packets(&client, session, frame, length, 100000, packets, lengths);
+    CHECK(count > 2);
+    for (int i = 0; i < count; i++) {
+        if (i != count / 2) {
+            CHECK(rtp_jpeg_receiver_packet(&receiver, packets[i], lengths[i], 100000 + 1000 * i) == 0);
+        }
+    }
+
+    // Reordering within a frame is fine, the RTP clock runs with the arrival time
+    count = capture_packets(&client, session, frame, length, 200000, packets, lengths);
+    CHECK(count > 2);
+    completed = 0;
+    for (int i = count - 2; i >= 0; i--) {
+        completed += rtp_jpeg_receiver_packet(&receiver, packets[i], lengths[i], 200000) == 1;
+    }
+    completed += rtp_jpeg_receiver_packet(&receiver, packets[count - 1], lengths[count - 1], 200000) == 1;
+    CHECK(completed == 1);
+
+    CHECK(receiver.stats.frames_complete == 2);
+    CHECK(receiver.stats.frames_incomplete == 1);
+    CHECK(receiver.stats.lost == 1);
+    CHECK(receiver.stats.malformed == 0);
+    CHECK(receiver.stats.drift_min_us >= 0 && receiver.stats.drift_max_us < 100000);
+
+    rtp_jpeg_receiver_free(&receiver);
+    esp_rtp_teardown(session);
+    rtsp_client_close(&client);
+}
+
+static void test_stream_loopback(void) {
+    synthetic_camera_config_t config = SYNTHETIC_CAMERA_DEFAULT();
+    config.frame_size = 100 * 1024; // Fragment offsets beyond 16 bits
+    CHECK(synthetic_camera_init(&config) == ESP_OK);
+
+    size_t length;
+    const uint8_t *frame = synthetic_camera_frame(&length);
+    esp_rtsp_jpeg_data_t jpeg_data;
+    CHECK(esp_rtsp_jpeg_decode((char *)frame, length, &jpeg_data) == ESP_OK);
+
+    rtsp_client_t client;
+    CHECK(rtsp_client_connect(&client, "127.0.0.1", RTSP_PORT, "/mjpeg/1") == 0);
+    CHECK(rtsp_client_request(&client, "OPTIONS", NULL) == 200);
+    CHECK(strstr(client.response, "PLAY") != NULL);
+    CHECK(rtsp_client_request(&client, "DESCRIBE", "Accept: application/sdp\r\n") == 200);
+    CHECK(strstr(client.response, "m=video 0 RTP/AVP 26") != NULL);
+    CHECK(rtsp_client_setup(&client) == 200);
+    CHECK(client.server_rtp_port != 0);
+    CHECK(rtsp_client_play(&client) == 200);
+
+    // Skip to the start of a frame, then collect it in full
+    uint8_t packet[2048];
+    size_t received = 0;
+    uint32_t expected_offset = 0;
+    int started = 0;
+    int complete = 0;
+    for (int i = 0; i < 1000 && !complete; i++) {
+        int n = rtsp_client_receive(&client, packet, sizeof(packet), 2000);
+        CHECK(n > 20);
+        CHECK((packet[1] & 0x7F) == 26);
+
+        uint32_t offset = packet[13] << 16 | packet[14] << 8 | packet[15];
+        if (!started && offset != 0) {
+            continue;
+        }
+        started = 1;
+
+        CHECK(offset == expected_offset);
+        size_t header = 12 + 8;
+        if (offset == 0) {
+            CHECK(packet[17] & 0x80);
+            CHECK((packet[22] << 8 | packet[23]) == 128);
+            header += 4 + 128;
+        }
+        received += n - header;
+        expected_offset += n - header;
+        complete = packet[1] & 0x80;
+    }
+    CHECK(complete);
+    CHECK(received == jpeg_data.jpeg_data_length);
+
+    CHECK(rtsp_client_teardown(&client) == 200);
+    rtsp_client_close(&client);
+}
+
+// A YUV422 frame of the synthetic camera, encoded in software
+static uint8_t *encode_yuv_frame(uint16_t width, uint16_t height, int strips, size_t *length) {
+    synthetic_camera_config_t config = SYNTHETIC_CAMERA_DEFAULT();
+    config.width = width;
+    config.height = height;
+    config.pixformat = PIXFORMAT_YUV422;
+    if (synthetic_camera_init(&config) != ESP_OK) {
+        return NULL;
+    }
+    size_t yuv_length;
+    uint8_t *yuv = (uint8_t *)synthetic_camera_frame(&yuv_length);
+    uint8_t *jpeg = NULL;
+    if (!fmt2jpg_strips(yuv, yuv_length, width, height, PIXFORMAT_YUV422, 80, strips, &jpeg, length)) {
+        return NULL;
+    }
+    return jpeg;
+}
+
+// Feeds the packets of the RTP socket to the receiver until it completes a frame
+static int receive_frame(rtsp_client_t *client, rtp_jpeg_receiver_t *receiver, uint8_t *first_packet) {
+    uint8_t packet[2048];
+    for (int i = 0; i < 1000; i++) {
+        int n = rtsp_client_receive(client, packet, sizeof(packet), 2000);
+        if (n <= 0) {
+            return -1;
+        }
+        if (first_packet && (packet[13] | packet[14] | packet[15]) == 0) {
+            memcpy(first_packet, packet, n);
+        }
+        if (rtp_jpeg_receiver_packet(receiver, packet, n, 0) == 1) {
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static void test_jpeg_decode_restart(void) {
+    size_t length;
+    uint8_t *jpeg = encode_yuv_frame(320, 240, 2, &length);
+    CHECK(jpeg != NULL);
+
+    esp_rtsp_jpeg_data_t jpeg_data;
+    esp_err_t err = esp_rtsp_jpeg_decode((char *)jpeg, length, &jpeg_data);
+    free(jpeg);
+    CHECK(err == ESP_OK);
+    CHECK(jpeg_data.type == 0); // YUV422 is encoded as H2V1
+    CHECK(jpeg_data.restart_interval == 320 / 16 * 240 / 8 / 2);
+
+    // Headers cut short are not mistaken for a frame
+    jpeg = encode_yuv_frame(320, 240, 1, &length);
+    CHECK(jpeg != NULL);
+    err = esp_rtsp_jpeg_decode((char *)jpeg, 100, &jpeg_data);
+    CHECK(esp_rtsp_jpeg_decode((char *)jpeg, length, &jpeg_data) == ESP_OK);
+    free(jpeg);
+    CHECK(err == ESP_FAIL);
+    CHECK(jpeg_data.restart_interval == 0);
+}
+
+// Restart markers are signalled with type 64 and a restart header in every packet
+static void test_send_restart_frame(void) {
+    size_t length;
+    uint8_t *jpeg = encode_yuv_frame(320, 240, 2, &length);
+    CHECK(jpeg != NULL);
+    esp_rtsp_jpeg_data_t sent;
+    CHECK(esp_rtsp_jpeg_decode((char *)jpeg, length, &sent) == ESP_OK);
+
+    rtsp_client_t client;
+    CHECK(bind_rtp_client(&client) == 0);
+    esp_rtp_session_handle_t session;
+    CHECK(esp_rtp_init(&session, client.rtp_port, client.rtp_port + 1, "127.0.0.1") == ESP_OK);
+    CHECK(esp_rtp_send_jpeg(session, jpeg, length, 80, 320, 240, 0) == ESP_OK);
+
+    rtp_jpeg_receiver_t receiver;
+    rtp_jpeg_receiver_init(&receiver);
+    uint8_t first[2048];
+    int err = receive_frame(&client, &receiver, first);
+    esp_rtp_teardown(session);
+    rtsp_client_close(&client);
+
+    esp_rtsp_jpeg_data_t rebuilt = { 0 };
+    size_t received_length;
+    const uint8_t *received = err ? NULL : rtp_jpeg_receiver_frame(&receiver, &received_length);
+    if (received) {
+        err = esp_rtsp_jpeg_decode((char *)received, received_length, &rebuilt);
+    }
+    int same_scan = received && rebuilt.jpeg_data_length == sent.jpeg_data_length &&
+                    memcmp(rebuilt.jpeg_data_start, sent.jpeg_data_start, sent.jpeg_data_length) == 0;
+    rtp_jpeg_receiver_free(&receiver);
+    free(jpeg);
+
+    CHECK(received != NULL && err == ESP_OK);
+    CHECK(first[16] == 64);
+    CHECK((first[20] << 8 | first[21]) == sent.restart_interval);
+    CHECK(first[22] == 0xFF && first[23] == 0xFF);
+    CHECK((first[26] << 8 | first[27]) == 128); // Quant header after the restart header
+    CHECK(rebuilt.restart_interval == sent.restart_interval);
+    CHECK(same_scan);
+}
+
+typedef struct {
+    esp_rtp_jpeg_stream_t *stream;
+    size_t chunk;
+} chunked_out_t;
+
+// Hands the encoder output over in small pieces, so headers and EOI are split as well
+static size_t chunked_out(void *arg, size_t index, const void *data, size_t len) {
+    chunked_out_t *out = arg;
+    if (!data) {
+        return 0;
+    }
+    for (size_t offset = 0; offset < len; offset += out->chunk) {
+        size_t length = len - offset < out->chunk ? len - offset : out->chunk;
+        if (esp_rtp_jpeg_stream_write(out->stream, (const uint8_t *)data + offset, length) != ESP_OK) {
+            return 0;
+        }
+    }
+    return len;
+}
+
+// Encoding straight into the packets sends the same scan as encoding to a buffer first
+static void test_stream_encoded(void) {
+    size_t length;
+    uint8_t *jpeg = encode_yuv_frame(320, 240, 1, &length);
+    CHECK(jpeg != NULL);
+    esp_rtsp_jpeg_data_t expected;
+    CHECK(esp_rtsp_jpeg_decode((char *)jpeg, length, &expected) == ESP_OK);
+    size_t yuv_length;
+    uint8_t *yuv = (uint8_t *)synthetic_camera_frame(&yuv_length);
+
+    rtsp_client_t client;
+    CHECK(bind_rtp_client(&client) == 0);
+    esp_rtp_session_handle_t session;
+    CHECK(esp_rtp_init(&session, client.rtp_port, client.rtp_port + 1, "127.0.0.1") == ESP_OK);
+    rtp_jpeg_receiver_t receiver;
+    rtp_jpeg_receiver_init(&receiver);
+
+    static const size_t chunks[] = { 1, 7, 4096 };
+    int matched = 0;
+    for (size_t i = 0; i < sizeof(chunks) / sizeof(chunks[0]); i++) {
+        esp_rtp_jpeg_stream_t stream;
+        chunked_out_t out = { .stream = &stream, .chunk = chunks[i] };
+        if (esp_rtp_jpeg_stream_begin(session, &stream, 80, 320, 240, 100000 * i) != ESP_OK ||
+            !fmt2jpg_cb(yuv, yuv_length, 320, 240, PIXFORMAT_YUV422, 80, chunked_out, &out) ||
+            esp_rtp_jpeg_stream_end(&stream) != ESP_OK ||
+            receive_frame(&client, &receiver, NULL) != 0) {
+            break;
+        }
+
+        size_t received_length;
+        const uint8_t *received = rtp_jpeg_receiver_frame(&receiver, &received_length);
+        esp_rtsp_jpeg_data_t rebuilt;
+        if (esp_rtsp_jpeg_decode((char *)received, received_length, &rebuilt) == ESP_OK &&
+            rebuilt.jpeg_data_length == expected.jpeg_data_length &&
+            memcmp(rebuilt.jpeg_data_start, expected.jpeg_data_start, expected.jpeg_data_length) == 0 &&
+            memcmp(rebuilt.quant_table_0 + 5, expected.quant_table_0 + 5, 64) == 0 &&
+            memcmp(rebuilt.quant_table_1 + 5, expected.quant_table_1 + 5, 64) == 0) {
+            matched++;
+        }
+    }
+
+    rtp_jpeg_receiver_free(&receiver);
+    esp_rtp_teardown(session);
+    rtsp_client_close(&client);
+    free(jpeg);
+    CHECK(matched == sizeof(chunks) / sizeof(chunks[0]));
+}
+
+// The server encodes frames of a camera without a JPEG mode while it sends them
+static void test_stream_yuv_loopback(void) {
+    synthetic_camera_config_t config = SYNTHETIC_CAMERA_DEFAULT();
+    config.width = 640;
+    config.height = 480;
+    config.pixformat = PIXFORMAT_YUV422;
+    CHECK(synthetic_camera_init(&config) == ESP_OK);
+
+    rtsp_client_t client;
+    CHECK(rtsp_client_connect(&client, "127.0.0.1", RTSP_PORT, "/mjpeg/1") == 0);
+    CHECK(rtsp_client_request(&client, "DESCRIBE", "Accept: application/sdp\r\n") == 200);
+    CHECK(rtsp_client_setup(&client) == 200);
+    CHECK(rtsp_client_play(&client) == 200);
+
+    rtp_jpeg_receiver_t receiver;
+    rtp_jpeg_receiver_init(&receiver);
+    int err = receive_frame(&client, &receiver, NULL);
+    size_t received_length = 0;
+    const uint8_t *received = err ? NULL : rtp_jpeg_receiver_frame(&receiver, &received_length);
+    uint8_t *rgb = malloc(640 * 480 * 3);
+    int decoded = received && fmt2rgb888(received, received_length, PIXFORMAT_JPEG, rgb);
+    int width = receiver.width, height = receiver.height;
+    free(rgb);
+    rtp_jpeg_receiver_free(&receiver);
+
+    CHECK(rtsp_client_teardown(&client) == 200);
+    rtsp_client_close(&client);
+    CHECK(received != NULL);
+    CHECK(width == 640 && height == 480);
+    CHECK(decoded);
+}
+
+// A textured scene, brightened by offset, with a bright square at (x, y) when size is not 0
+static uint8_t *motion_frame(int offset, int x, int y, int size, size_t *length) {
+    const int width = 320, height = 240;
+    uint8_t *yuyv = malloc(width * height * 2);
+    for (int row = 0; row < height; row++) {
+        for (int col = 0; col < width; col++) {
+            uint8_t *p = yuyv + (row * width + col) * 2;
+            int luma = 60 + ((row / 16 + col / 16) % 2) * 40 + col / 8 + offset;
+            if (size && col >= x && col < x + size && row >= y && row < y + size) {
+                luma = 235;
+            }
+            p[0] = luma;
+            p[1] = 128;
+        }
+    }
+    uint8_t *jpeg = NULL;
+    if (!fmt2jpg(yuyv, width * height * 2, width, height, PIXFORMAT_YUV422, 80, &jpeg, length)) {
+        jpeg = NULL;
+    }
+    free(yuyv);
+    return jpeg;
+}
+
+static int motion_events;
+static esp_motion_event_t last_motion_event;
+
+static void count_motion_event(const esp_motion_event_t *event, void *arg) {
+    motion_events++;
+    last_motion_event = *event;
+}
+
+static void test_motion_detector(void) {
+    esp_motion_config_t config = ESP_MOTION_CONFIG_DEFAULT();
+    config.hold_ms = 1000;
+    esp_motion_t *motion;
+    CHECK(esp_motion_create(&config, &motion) == ESP_OK);
+    esp_motion_set_callback(motion, count_motion_event, NULL);
+
+    size_t length, bright_length, moved_length;
+    uint8_t *scene = motion_frame(0, 0, 0, 0, &length);
+    uint8_t *bright = motion_frame(20, 0, 0, 0, &bright_length);
+    uint8_t *moved = motion_frame(0, 256, 176, 48, &moved_length); // In the bottom right zone
+    CHECK(scene && bright && moved);
+
+    // The first frame starts the background and counts as motion until hold_ms has passed
+    esp_motion_event_t event;
+    motion_events = 0;
+    CHECK(esp_motion_process(motion, scene, length, 0, &event) == ESP_OK);
+    CHECK(event.active && motion_events == 1 && last_motion_event.active);
+    CHECK(esp_motion_process(motion, scene, length, 500000, &event) == ESP_OK);
+    CHECK(event.active && event.zones == 0);
+    CHECK(esp_motion_process(motion, scene, length, 1000000, &event) == ESP_OK);
+    CHECK(!event.active && motion_events == 2 && !last_motion_event.active);
+
+    // The whole picture getting brighter is not motion, something appearing in a zone is
+    CHECK(esp_motion_process(motion, bright, bright_length, 1100000, &event) == ESP_OK);
+    CHECK(!event.active && event.zones == 0);
+    CHECK(esp_motion_process(motion, moved, moved_length, 1200000, &event) == ESP_OK);
+    CHECK(event.active && motion_events == 3);
+    CHECK(event.zones == 1u << (ESP_MOTION_ZONES - 1));
+    CHECK(last_motion_event.zones == event.zones && last_motion_event.timestamp_us == 1200000);
+    esp_motion_delete(motion);
+
+    // Nothing in a zone without a threshold counts
+    config.zone_threshold[ESP_MOTION_ZONES - 1] = 0;
+    CHECK(esp_motion_create(&config, &motion) == ESP_OK);
+    CHECK(esp_motion_process(motion, scene, length, 0, &event) == ESP_OK);
+    CHECK(esp_motion_process(motion, scene, length, 1000000, &event) == ESP_OK);
+    CHECK(esp_motion_process(motion, moved, moved_length, 1100000, &event) == ESP_OK);
+    CHECK(!event.active && event.zones == 0);
+
+    // Frames that cannot be parsed are sent rather than missed
+    uint8_t garbage[64] = { 0xFF, 0xD8 };
+    CHECK(esp_motion_process(motion, garbage, sizeof(garbage), 1200000, &event) != ESP_OK);
+    CHECK(event.active);
+    esp_motion_delete(motion);
+
+    free(scene);
+    free(bright);
+    free(moved);
+}
+
+static void source_ready_task(void *arg) {
+    vTaskDelay(pdMS_TO_TICKS(50));
+    esp_rtsp_server_set_source_ready(true);
+    vTaskDelete(NULL);
+}
+
+static void test_describe_waits_for_source(void) {
+    rtsp_client_t client;
+    CHECK(rtsp_client_connect(&client, "127.0.0.1", RTSP_PORT, "/mjpeg/1") == 0);
+
+    // The camera does not come up in time
+    esp_rtsp_server_set_source_ready(false);
+    CHECK(rtsp_client_request(&client, "OPTIONS", NULL) == 200);
+    CHECK(rtsp_client_request(&client, "DESCRIBE", "Accept: application/sdp\r\n") == 503);
+    CHECK(strstr(client.response, "Retry-After:") != NULL);
+
+    // It does, DESCRIBE answers once it is ready
+    CHECK(xTaskCreate(source_ready_task, "source_ready", 4096, NULL, 5, NULL) == pdPASS);
+    CHECK(rtsp_client_request(&client, "DESCRIBE", "Accept: application/sdp\r\n") == 200);
+    CHECK(strstr(client.response, "m=video 0 RTP/AVP 26") != NULL);
+    rtsp_client_close(&client);
+}
+
+static void test_boot_timeline(void) {
+    // Marked by the server while the earlier tests streamed
+    int64_t listening = esp_timeline_get(ESP_TIMELINE_RTSP_LISTENING);
+    int64_t describe = esp_timeline_get(ESP_TIMELINE_FIRST_DESCRIBE);
+    int64_t frame = esp_timeline_get(ESP_TIMELINE_FIRST_FRAME);
+    int64_t rtp = esp_timeline_get(ESP_TIMELINE_FIRST_RTP);
+    CHECK(listening >= 0);
+    CHECK(describe >= listening);
+    CHECK(frame >= describe);
+    CHECK(rtp >= frame);
+
+    // Only the first mark counts
+    esp_timeline_mark(ESP_TIMELINE_FIRST_FRAME);
+    CHECK(esp_timeline_get(ESP_TIMELINE_FIRST_FRAME) == frame);
+
+    esp_timeline_reset();
+    CHECK(esp_timeline_get(ESP_TIMELINE_RTSP_LISTENING) == -1);
+    esp_timeline_mark("camera ready");
+    CHECK(esp_timeline_get("camera ready") >= 0);
+    CHECK(esp_timeline_get("network up") == -1);
+
+    // Marks beyond the capacity are dropped
+    static const char *events[ESP_TIMELINE_MAX_EVENTS + 1] = {
+            "0", "1", "2", "3", "4", "5", "6", "7", "8", "9", "10", "11", "12", "13", "14", "15", "16",
+    };
+    for (int i = 0; i < ESP_TIMELINE_MAX_EVENTS + 1; i++) {
+        esp_timeline_mark(events[i]);
+    }
+    CHECK(esp_timeline_get(events[ESP_TIMELINE_MAX_EVENTS - 2]) >= 0);
+    CHECK(esp_timeline_get(events[ESP_TIMELINE_MAX_EVENTS - 1]) == -1);
+    esp_timeline_log();
+}
+
+static void test_frames_shared(void) {
+    synthetic_camera_config_t config = SYNTHETIC_CAMERA_DEFAULT();
+    config.fps = 25;
+    CHECK(synthetic_camera_init(&config) == ESP_OK);
+    synthetic_camera_reset_stats();
+
+    // A stream that starts gets the next frame, a stream that is behind the one the other captured
+    uint32_t seq_a = 0, seq_b = 0;
+    shared_frame_t *a = frames_get(&seq_a);
+    CHECK(a != NULL);
+    shared_frame_t *b = frames_get(&seq_b);
+    CHECK(b != NULL);
+    CHECK(seq_b != seq_a);
+    frames_return(a);
+    a = frames_get(&seq_a);
+    CHECK(a == b);
+    CHECK(seq_a == seq_b);
+
+    synthetic_camera_stats_t stats;
+    synthetic_camera_get_stats(&stats);
+    CHECK(stats.frames == 2);
+
+    // The latest frame stays around for snapshots after the streams returned it
+    frames_return(a);
+    frames_return(b);
+    shared_frame_t *latest = frames_latest(1000000);
+    CHECK(latest == b);
+    frames_return(latest);
+    CHECK(frames_latest(-1) == NULL);
+}
+
+static void test_frames_motion(void) {
+    // Two streams watch for motion, one detector sees each frame once. The synthetic frames cannot be
+    // compared and count as motion, which starts with the first one.
+    CHECK(frames_motion_enable(NULL) == ESP_OK);
+    CHECK(frames_motion_enable(NULL) == ESP_OK);
+    motion_events = 0;
+    frames_set_motion_callback(count_motion_event, NULL);
+    uint32_t seq_a = 0, seq_b = 0;
+    for (int i = 0; i < 3; i++) {
+        shared_frame_t *a = frames_get(&seq_a);
+        shared_frame_t *b = frames_get(&seq_b);
+        CHECK(a != NULL && b != NULL);
+        CHECK(a->motion && b->motion);
+        frames_return(a);
+        frames_return(b);
+    }
+    CHECK(motion_events == 1 && last_motion_event.active);
+    frames_motion_disable();
+    frames_motion_disable();
+    frames_set_motion_callback(NULL, NULL);
+}
+
+// Sends a GET and reads the response until the server closes or size is reached
+static size_t http_get(const char *path, char *response, size_t size) {
+    int sock = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr = {
+            .sin_family = AF_INET,
+            .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+            .sin_port = htons(HTTP_PORT)
+    };
+    if (sock < 0 || connect(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(sock);
+        return 0;
+    }
+    char request[128];
+    int length = snprintf(request, sizeof(request), "GET %s HTTP/1.1\r\nHost: 127.0.0.1\r\n\r\n", path);
+    send(sock, request, length, 0);
+
+    size_t received = 0;
+    int n;
+    while (received < size && (n = recv(sock, response + received, size - received, 0)) > 0) {
+        received += n;
+    }
+    close(sock);
+    return received;
+}
+
+// The JPEG after the headers starting at part, checked against its Content-Length
+static const char *http_body(const char *part, size_t *length) {
+    const char *content_length = strstr(part, "Content-Length: ");
+    const char *body = strstr(part, "\r\n\r\n");
+    if (!content_length || !body || content_length > body) {
+        return NULL;
+    }
+    *length = strtoul(content_length + 16, NULL, 10);
+    return body + 4;
+}
+
+static void test_http_stream(void) {
+    size_t frame_length;
+    const uint8_t *frame = synthetic_camera_frame(&frame_length);
+
+    size_t size = 2 * frame_length + 1024;
+    char *response = calloc(1, size + 1);
+    CHECK(response != NULL);
+    size_t received = http_get("/stream", response, size);
+    CHECK(received == size);
+    CHECK(strncmp(response, "HTTP/1.1 200 OK\r\n", 17) == 0);
+    CHECK(strstr(response, "Content-Type: multipart/x-mixed-replace;boundary=") != NULL);
+
+    // Straight from the frame buffer
+    const char *headers_end = strstr(response, "\r\n\r\n");
+    CHECK(headers_end != NULL);
+    const char *part = headers_end + 4;
+    CHECK(strncmp(part, "--", 2) == 0);
+    size_t length;
+    const char *body = http_body(part, &length);
+    CHECK(body != NULL);
+    CHECK(length == frame_length);
+    CHECK(memcmp(body, frame, frame_length) == 0);
+    CHECK(strncmp(body + length, "\r\n--", 4) == 0);
+
+    // Not before the camera is up
+    esp_rtsp_server_set_source_ready(false);
+    received = http_get("/stream", response, size);
+    esp_rtsp_server_set_source_ready(true);
+    response[received] = 0;
+    CHECK(strncmp(response, "HTTP/1.1 503 Service Unavailable\r\n", 34) == 0);
+    free(response);
+}
+
+static void test_http_snapshot(void) {
+    size_t frame_length;
+    const uint8_t *frame = synthetic_camera_frame(&frame_length);
+
+    size_t size = frame_length + 1024;
+    char *response = calloc(1, size + 1);
+    CHECK(response != NULL);
+
+    // The stream before left its last frame, the snapshot does not wait for the camera
+    vTaskDelay(pdMS_TO_TICKS(200)); // Until the stream noticed its client is gone
+    synthetic_camera_reset_stats();
+    size_t received = http_get("/snapshot.jpg", response, size);
+    synthetic_camera_stats_t stats;
+    synthetic_camera_get_stats(&stats);
+    CHECK(stats.frames == 0);
+
+    CHECK(strncmp(response, "HTTP/1.1 200 OK\r\n", 17) == 0);
+    CHECK(strstr(response, "Content-Type: image/jpeg\r\n") != NULL);
+    size_t length;
+    const char *body = http_body(response, &length);
+    CHECK(body != NULL);
+    CHECK(length == frame_length);
+    CHECK(received == body - response + length);
+    CHECK(memcmp(body, frame, frame_length) == 0);
+
+    received = http_get("/nothing", response, size);
+    response[received] = 0;
+    CHECK(strncmp(response, "HTTP/1.1 404 Not Found\r\n", 24) == 0);
+    free(response);
+}
+
+static void test_metrics_registry(void) {
+    static esp_metric_t counter = ESP_METRIC_COUNTER_INIT("test_events_total{kind=\"a\"}");
+    static esp_metric_t gauge = ESP_METRIC_GAUGE_INIT("test_level");
+    static esp_metric_t histogram = ESP_METRIC_HISTOGRAM_INIT("test_latency_us");
+
+    esp_metric_add(&counter, 2);
+    esp_metric_add(&counter, 3);
+    esp_metric_set(&gauge, 7);
+    esp_metric_set(&gauge, 4);
+    esp_metric_observe(&histogram, 10);   // First bucket
+    esp_metric_observe(&histogram, 50);   // First bucket, the bounds are inclusive
+    esp_metric_observe(&histogram, 120);  // Up to 200
+    esp_metric_observe(&histogram, 1000000000); // +Inf
+
+    char text[2048];
+    size_t length = esp_metrics_format(text, sizeof(text), "test_");
+    CHECK(length == strlen(text));
+    CHECK(strstr(text, "test_events_total{kind=\"a\"} 5\n") != NULL);
+    CHECK(strstr(text, "test_level 4\n") != NULL);
+    CHECK(strstr(text, "test_latency_us_bucket{le=\"50\"} 2\n") != NULL);
+    CHECK(strstr(text, "test_latency_us_bucket{le=\"100\"} 2\n") != NULL);
+    CHECK(strstr(text, "test_latency_us_bucket{le=\"200\"} 3\n") != NULL);
+    CHECK(strstr(text, "test_latency_us_bucket{le=\"+Inf\"} 4\n") != NULL);
+    CHECK(strstr(text, "test_latency_us_sum 1000000180\n") != NULL);
+    CHECK(strstr(text, "test_latency_us_count 4\n") != NULL);
+    CHECK(strstr(text, "rtp_") == NULL);
+
+    // Registered once however often it is updated
+    char *first = strstr(text, "test_level");
+    CHECK(strstr(first + 1, "test_level") == NULL);
+
+    // The text ends at the last line that fits
+    length = esp_metrics_format(text, 30, "test_");
+    CHECK(length == strlen(text));
+    CHECK(length < 30);
+    CHECK(length == 0 || text[length - 1] == '\n');
+}
+
+static void test_play_without_setup(void) {
+    rtsp_client_t client;
+    CHECK(rtsp_client_connect(&client, "127.0.0.1", RTSP_PORT, "/mjpeg/1") == 0);
+
+    // There is no session to send to, the connection goes on
+    CHECK(rtsp_client_request(&client, "PLAY", "Session: 12348765\r\n") == 455);
+    CHECK(strstr(client.response, "cSeq: 1\r\n") != NULL);
+    CHECK(rtsp_client_request(&client, "OPTIONS", NULL) == 200);
+    rtsp_client_close(&client);
+}
+
+static void test_rtsp_get_parameter(void) {
+    rtsp_client_t client;
+    CHECK(rtsp_client_connect(&client, "127.0.0.1", RTSP_PORT, "/mjpeg/1") == 0);
+    CHECK(rtsp_client_request(&client, "OPTIONS", NULL) == 200);
+    CHECK(strstr(client.response, "GET_PARAMETER") != NULL);
+
+    // A keepalive
+    CHECK(rtsp_client_request(&client, "GET_PARAMETER", NULL) == 200);
+    CHECK(strstr(client.response, "Content-Length: 0\r\n") != NULL);
+
+    // The streams before sent frames
+    CHECK(rtsp_client_request_body(&client, "GET_PARAMETER", "Content-Type: text/parameters\r\n",
+                                   "rtp_frames_total\r\nrtp_send_us_count\r\n") == 200);
+    CHECK(strstr(client.response, "Content-Type: text/parameters\r\n") != NULL);
+    const char *frames = strstr(client.response, "\r\nrtp_frames_total ");
+    CHECK(frames != NULL);
+    CHECK(strtoul(frames + 19, NULL, 10) > 0);
+    CHECK(strstr(client.response, "rtp_send_us_count ") != NULL);
+    CHECK(strstr(client.response, "rtp_packets_total") == NULL);
+    rtsp_client_close(&client);
+}
+
+static void test_http_metrics(void) {
+    char *response = calloc(1, 16384);
+    CHECK(response != NULL);
+    http_get("/metrics", response, 16383);
+    CHECK(strncmp(response, "HTTP/1.1 200 OK\r\n", 17) == 0);
+    CHECK(strstr(response, "Content-Type: text/plain") != NULL);
+    CHECK(strstr(response, "\ncamera_capture_us_count ") != NULL);
+    CHECK(strstr(response, "\nframe_drops_total{cause=\"capture\"} ") != NULL);
+    CHECK(strstr(response, "\nhttp_frames_total ") != NULL);
+    CHECK(strstr(response, "\nheap_min_free_bytes ") != NULL);
+    free(response);
+}
+
+#define TRACE_WRITERS 4
+#define TRACE_MARK 0x7ace
+
+static void trace_writer_task(void *arg) {
+    uint32_t writer = (uint32_t)(intptr_t)arg;
+    for (uint32_t i = 0; i < 50; i++) {
+        ESP_TRACE(RTSP_REQUEST, TRACE_MARK + writer, i);
+    }
+    vTaskDelete(NULL);
+}
+
+// Counts the records of the writers in a dump, and checks each writer's are in order
+static int trace_count_marked(const uint8_t *dump, size_t length, uint32_t *next) {
+    int count = 0;
+    for (size_t offset = sizeof(esp_trace_header_t); offset + sizeof(esp_trace_record_t) <= length;
+         offset += sizeof(esp_trace_record_t)) {
+        esp_trace_record_t record;
+        memcpy(&record, dump + offset, sizeof(record));
+        uint32_t writer = record.arg0 - TRACE_MARK;
+        if (record.id != ESP_TRACE_RTSP_REQUEST || writer >= TRACE_WRITERS) {
+            continue;
+        }
+        if (next && record.arg1 != next[writer]++) {
+            return -1;
+        }
+        count++;
+    }
+    return count;
+}
+
+static void test_trace(void) {
+    static uint8_t dump[sizeof(esp_trace_header_t) + 2 * CONFIG_ESP_TRACE_RING_SIZE * sizeof(esp_trace_record_t)];
+    esp_trace_drain(dump, sizeof(dump)); // What the other tests left
+
+    for (int i = 0; i < TRACE_WRITERS; i++) {
+        CHECK(xTaskCreate(trace_writer_task, "trace", 4096, (void *)(intptr_t)i, 5, NULL) == pdPASS);
+    }
+    vTaskDelay(pdMS_TO_TICKS(100));
+
+    size_t length = esp_trace_drain(dump, sizeof(dump));
+    esp_trace_header_t header;
+    memcpy(&header, dump, sizeof(header));
+    CHECK(memcmp(header.magic, ESP_TRACE_MAGIC, sizeof(header.magic)) == 0);
+    CHECK(header.version == ESP_TRACE_VERSION);
+    CHECK(header.record_size == sizeof(esp_trace_record_t));
+    CHECK(header.lost == 0);
+    uint32_t next[TRACE_WRITERS] = { 0 };
+    CHECK(trace_count_marked(dump, length, next) == TRACE_WRITERS * 50);
+
+    // A full ring keeps the newest records and counts the others as lost
+    for (uint32_t i = 0; i < CONFIG_ESP_TRACE_RING_SIZE + 10; i++) {
+        ESP_TRACE(RTSP_REQUEST, TRACE_MARK, i);
+    }
+    length = esp_trace_drain(dump, sizeof(dump));
+    memcpy(&header, dump, sizeof(header));
+    CHECK(header.lost >= 10);
+    CHECK(length == sizeof(header) + CONFIG_ESP_TRACE_RING_SIZE * sizeof(esp_trace_record_t));
+    esp_trace_record_t last;
+    memcpy(&last, dump + length - sizeof(last), sizeof(last));
+    CHECK(last.arg1 == CONFIG_ESP_TRACE_RING_SIZE + 9);
+
+    // Over HTTP, with the record of the request itself
+    char *response = calloc(1, sizeof(dump));
+    CHECK(response != NULL);
+    size_t received = http_get("/trace", response, sizeof(dump));
+    const char *body = strstr(response, "\r\n\r\n");
+    CHECK(strncmp(response, "HTTP/1.1 200 OK\r\n", 17) == 0 && body);
+    body += 4;
+    CHECK(received - (body - response) >= sizeof(header) + sizeof(esp_trace_record_t));
+    CHECK(memcmp(body, ESP_TRACE_MAGIC, strlen(ESP_TRACE_MAGIC)) == 0);
+    memcpy(&last, body + sizeof(header), sizeof(last));
+    CHECK(last.id == ESP_TRACE_HTTP_REQUEST);
+    free(response);
+}
+
+static uint32_t le32(const uint8_t *p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+// The frames of a finished AVI, when its headers, frames and index agree, -1 otherwise
+static int avi_check(const char *path, size_t cluster_size) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        return -1;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    uint8_t *avi = malloc(size);
+    rewind(file);
+    bool read = avi && fread(avi, 1, size, file) == (size_t)size;
+    fclose(file);
+
+    int frames = -1;
+    const uint8_t *movi = avi + cluster_size - 12;
+    if (!read || memcmp(avi, "RIFF", 4) != 0 || le32(avi + 4) + 8 != size || memcmp(avi + 8, "AVI ", 4) != 0
+        || memcmp(movi, "LIST", 4) != 0 || memcmp(movi + 8, "movi", 4) != 0) {
+        goto done;
+    }
+    const uint8_t *index = movi + 8 + le32(movi + 4);
+    uint32_t count = le32(avi + 48); // Total frames of avih
+    if (memcmp(index, "idx1", 4) != 0 || le32(index + 4) != count * 16 || index + 8 + count * 16 != avi + size) {
+        goto done;
+    }
+    for (uint32_t i = 0; i < count; i++) {
+        const uint8_t *entry = index + 8 + i * 16;
+        const uint8_t *chunk = movi + 8 + le32(entry + 8);
+        if (memcmp(chunk, "00dc", 4) != 0 || le32(chunk + 4) != le32(entry + 12) || chunk[8] != 0xFF
+            || chunk[9] != 0xD8) {
+            goto done;
+        }
+    }
+    frames = count;
+
+    done:
+    free(avi);
+    return frames;
+}
+
+static bool copy_file(const char *from, const char *to) {
+    FILE *in = fopen(from, "rb"), *out = fopen(to, "wb");
+    char buffer[4096];
+    size_t n;
+    while (in && out && (n = fread(buffer, 1, sizeof(buffer), in)) > 0) {
+        fwrite(buffer, 1, n, out);
+    }
+    bool ok = in && out;
+    if (in) fclose(in);
+    if (out) fclose(out);
+    return ok;
+}
+
+static void test_recorder(void) {
+    char directory[] = "/tmp/rtsp-record-XXXXXX";
+    CHECK(mkdtemp(directory) != NULL);
+    char path[128], copy[128];
+
+    esp_recorder_config_t config = ESP_RECORDER_CONFIG_DEFAULT();
+    config.directory = directory;
+    config.cluster_size = 4096;
+    config.buffer_size = 512 * 1024;
+    config.sync_interval_ms = 100;
+
+    esp_recorder_t *recorder;
+    CHECK(esp_recorder_create(&config, &recorder) == ESP_OK);
+    CHECK(esp_recorder_start(recorder) == ESP_OK);
+    vTaskDelay(pdMS_TO_TICKS(600));
+    CHECK(esp_recorder_recording(recorder));
+
+    // A copy in the middle of the recording is what a power loss leaves
+    snprintf(path, sizeof(path), "%s/rec00001.avi", directory);
+    snprintf(copy, sizeof(copy), "%s/rec00007.avi", directory);
+    CHECK(copy_file(path, copy));
+    snprintf(path, sizeof(path), "%s/rec00001.idx", directory);
+    snprintf(copy, sizeof(copy), "%s/rec00007.idx", directory);
+    CHECK(copy_file(path, copy));
+
+    esp_recorder_stats_t stats;
+    esp_recorder_get_stats(recorder, &stats);
+    CHECK(stats.syncs > 0);
+    esp_recorder_delete(recorder);
+
+    snprintf(path, sizeof(path), "%s/rec00001.avi", directory);
+    int frames = avi_check(path, config.cluster_size);
+    CHECK(frames > 5);
+    snprintf(path, sizeof(path), "%s/rec00001.idx", directory);
+    CHECK(access(path, F_OK) != 0);
+
+    // The next recorder finishes the copy and numbers its files after it
+    CHECK(esp_recorder_create(&config, &recorder) == ESP_OK);
+    snprintf(path, sizeof(path), "%s/rec00007.avi", directory);
+    int recovered = avi_check(path, config.cluster_size);
+    CHECK(recovered > 0 && recovered <= frames);
+    CHECK(access(copy, F_OK) != 0);
+
+    CHECK(esp_recorder_start(recorder) == ESP_OK);
+    vTaskDelay(pdMS_TO_TICKS(200));
+    CHECK(esp_recorder_stop(recorder) == ESP_OK);
+    esp_recorder_delete(recorder);
+    snprintf(path, sizeof(path), "%s/rec00008.avi", directory);
+    CHECK(avi_check(path, config.cluster_size) > 0);
+
+    char command[160];
+    snprintf(command, sizeof(command), "rm -r %s", directory);
+    system(command);
+}
+
+// Drains the stream until it stops, the player finishes the frame it is sending
+static void receive_until_idle(rtsp_client_t *client, rtp_jpeg_receiver_t *receiver) {
+    uint8_t packet[2048];
+    int n;
+    while ((n = rtsp_client_receive(client, packet, sizeof(packet), 300)) > 0) {
+        rtp_jpeg_receiver_packet(receiver, packet, n, 0);
+    }
+}
+
+static void test_timeshift_replay(void) {
+    synthetic_camera_config_t config = SYNTHETIC_CAMERA_DEFAULT();
+    config.fps = 25;
+    config.frame_size = 16 * 1024;
+    CHECK(synthetic_camera_init(&config) == ESP_OK);
+    CHECK(timeshift_start(2 * 1024 * 1024) == ESP_OK);
+    vTaskDelay(pdMS_TO_TICKS(2500));
+
+    rtp_jpeg_receiver_t receiver;
+    CHECK(rtp_jpeg_receiver_init(&receiver) == 0);
+    rtsp_client_t client;
+    CHECK(rtsp_client_connect(&client, "127.0.0.1", RTSP_PORT, "/mjpeg/1") == 0);
+    CHECK(rtsp_client_setup(&client) == 200);
+    CHECK(rtsp_client_request(&client, "PLAY", "Session: 12348765\r\nRange: npt=-2-\r\n") == 200);
+    const char *range = strstr(client.response, "Range: npt=-");
+    CHECK(range != NULL);
+    double back = strtod(range + 12, NULL);
+    CHECK(back > 1.5 && back <= 2.0);
+
+    // The buffer goes out faster than it was captured
+    CHECK(receive_frame(&client, &receiver, NULL) == 0);
+    int64_t first = receiver.timestamp_ext;
+    int64_t started_us = esp_timer_get_time();
+    while (receiver.timestamp_ext - first < 90000 * 3 / 2) {
+        CHECK(receive_frame(&client, &receiver, NULL) == 0);
+    }
+    CHECK(esp_timer_get_time() - started_us < 1000000);
+
+    // Then live continues, as far behind the wall clock as the replay started
+    while (esp_timer_get_time() - started_us < 2000000) {
+        CHECK(receive_frame(&client, &receiver, NULL) == 0);
+    }
+    int64_t ahead_us = (receiver.timestamp_ext - first) * 100 / 9 - (esp_timer_get_time() - started_us);
+    CHECK(ahead_us > 1000000 && ahead_us < 2500000);
+
+    // A PAUSE stops the stream, the next PLAY continues after the last frame sent
+    CHECK(rtsp_client_request(&client, "PAUSE", "Session: 12348765\r\n") == 200);
+    receive_until_idle(&client, &receiver);
+    int64_t paused = receiver.timestamp_ext;
+    vTaskDelay(pdMS_TO_TICKS(500));
+    CHECK(rtsp_client_play(&client) == 200);
+    CHECK(strstr(client.response, "Range: npt=-") != NULL);
+    CHECK(receive_frame(&client, &receiver, NULL) == 0);
+    CHECK(receiver.timestamp_ext > paused);
+    CHECK(receiver.timestamp_ext - paused < 90000 / 10);
+
+    // A live PLAY says so
+    CHECK(rtsp_client_request(&client, "PLAY", "Session: 12348765\r\nRange: npt=0.000-\r\n") == 200);
+    CHECK(strstr(client.response, "Range: npt=now-") != NULL);
+
+    // A range that is not understood is refused, the stream and the connection go on
+    CHECK(rtsp_client_request(&client, "PLAY", "Session: 12348765\r\nRange: smpte=0:10:00-\r\n") == 457);
+    char cseq[32];
+    snprintf(cseq, sizeof(cseq), "cSeq: %d\r\n", client.cseq);
+    CHECK(strstr(client.response, cseq) != NULL);
+    CHECK(rtsp_client_request(&client, "OPTIONS", NULL) == 200);
+
+    CHECK(rtsp_client_teardown(&client) == 200);
+    CHECK(rtsp_client_request(&client, "PAUSE", "Session: 12348765\r\n") == 455);
+    rtsp_client_close(&client);
+    rtp_jpeg_receiver_free(&receiver);
+
+    // While the camera is not up the buffer does not read from it
+    esp_rtsp_server_set_source_ready(false);
+    vTaskDelay(pdMS_TO_TICKS(100)); // A capture that already started
+    synthetic_camera_stats_t before, after;
+    synthetic_camera_get_stats(&before);
+    vTaskDelay(pdMS_TO_TICKS(300));
+    synthetic_camera_get_stats(&after);
+    esp_rtsp_server_set_source_ready(true);
+    CHECK(after.frames == before.frames);
+    timeshift_stop();
+}
+
+static void test_admission_capacity(void) {
+    admission_set_capacity_kbps(0);
+
+    // Measured while the uplink was full
+    admission_sample(125000, 25, 3, 1, 1000000);
+    CHECK(admission_capacity_kbps() == 1000);
+
+    // Streams that use most of it without trouble say nothing about more
+    for (int i = 0; i < 50; i++) {
+        admission_sample(100000, 25, 0, 1, 1000000);
+    }
+    CHECK(admission_capacity_kbps() == 1000);
+
+    // More got through than was thought to fit
+    admission_sample(150000, 25, 0, 1, 1000000);
+    CHECK(admission_capacity_kbps() == 1200);
+
+    admission_set_capacity_kbps(0);
+}
+
+static void test_admission(void) {
+    synthetic_camera_config_t config = SYNTHETIC_CAMERA_DEFAULT();
+    config.fps = 25;
+    config.frame_size = 16 * 1024;
+    CHECK(synthetic_camera_init(&config) == ESP_OK);
+    esp_rtsp_server_set_uplink_capacity(0);
+
+    rtp_jpeg_receiver_t receiver;
+    CHECK(rtp_jpeg_receiver_init(&receiver) == 0);
+    rtsp_client_t a, b, c;
+    CHECK(rtsp_client_connect(&a, "127.0.0.1", RTSP_PORT, "/mjpeg/1") == 0);
+    CHECK(rtsp_client_setup(&a) == 200);
+    CHECK(rtsp_client_play(&a) == 200);
+    vTaskDelay(pdMS_TO_TICKS(4000)); // Long enough to measure the stream
+
+    CHECK(rtsp_client_request_body(&a, "GET_PARAMETER", "Content-Type: text/parameters\r\n", "rtsp_session_kbps\r\n") == 200);
+    const char *line = strstr(a.response, "rtsp_session_kbps{");
+    CHECK(line != NULL);
+    uint32_t kbps = strtoul(strstr(line, "} ") + 2, NULL, 10);
+    CHECK(kbps > 100);
+
+    // Room for a quarter of another stream, it gets that at a lower frame rate
+    esp_rtsp_server_set_uplink_capacity(kbps * 125 / 80);
+    uint64_t reduced = metric_admission_reduced.value;
+    CHECK(rtsp_client_connect(&b, "127.0.0.1", RTSP_PORT, "/mjpeg/1") == 0);
+    CHECK(rtsp_client_setup(&b) == 200);
+    CHECK(metric_admission_reduced.value == reduced + 1);
+    CHECK(rtsp_client_play(&b) == 200);
+
+    // Then there is no room left
+    CHECK(rtsp_client_connect(&c, "127.0.0.1", RTSP_PORT, "/mjpeg/1") == 0);
+    CHECK(rtsp_client_setup(&c) == 453);
+    CHECK(strstr(c.response, "cSeq: 1\r\n") != NULL);
+    rtsp_client_close(&c);
+
+    // The first stream goes on as it was
+    int64_t first = -1;
+    for (int i = 0; i < 5; i++) {
+        CHECK(receive_frame(&a, &receiver, NULL) == 0);
+        first = first < 0 ? receiver.timestamp_ext : first;
+    }
+    CHECK(receiver.timestamp_ext - first < 90000 * 5 / 4);
+
+    CHECK(rtsp_client_teardown(&b) == 200);
+    CHECK(rtsp_client_teardown(&a) == 200);
+    rtsp_client_close(&b);
+    rtsp_client_close(&a);
+    rtp_jpeg_receiver_free(&receiver);
+    esp_rtsp_server_set_uplink_capacity(0);
+}
+
+typedef struct {
+    int stage;      // The stage it is due at
+    int rounds;
+} test_item_t;
+
+static volatile int test_pipeline_errors;
+
+static void test_stage(void *item, void *arg, int stage) {
+    test_item_t *test_item = item;
+    if (test_item->stage != stage) {
+        test_pipeline_errors++;
+    }
+    test_item->stage = (stage + 1) % 3;
+}
+
+static void test_stage_first(void *item, void *arg) {
+    test_stage(item, arg, 0);
+    ((test_item_t *)item)->rounds++;
+}
+
+static void test_stage_slow(void *item, void *arg) {
+    vTaskDelay(pdMS_TO_TICKS(5));
+    test_stage(item, arg, 1);
+}
+
+static void test_stage_last(void *item, void *arg) {
+    test_stage(item, arg, 2);
+}
+
+static uint64_t pipeline_metric(const char *text, const char *name, const char *stage) {
+    char key[128];
+    snprintf(key, sizeof(key), "%s{pipeline=\"test\",stage=\"%s\"} ", name, stage);
+    const char *line = strstr(text, key);
+    return line ? strtoull(line + strlen(key), NULL, 10) : 0;
+}
+
+static void test_pipeline(void) {
+    static const pipeline_stage_t stages[] = {
+            { "first", test_stage_first, tskNO_AFFINITY, 5, 4096 },
+            { "slow", test_stage_slow, tskNO_AFFINITY, 5, 4096 },
+            { "last", test_stage_last, tskNO_AFFINITY, 5, 4096 },
+    };
+    test_item_t items[4] = { 0 };
+    void *refs[4] = { &items[0], &items[1], &items[2], &items[3] };
+
+    pipeline_t *pipeline;
+    test_pipeline_errors = 0;
+    CHECK(pipeline_create("test", stages, 3, refs, 9, NULL, &pipeline) == ESP_ERR_INVALID_ARG);
+    CHECK(pipeline_create("test", stages, 3, refs, 4, NULL, &pipeline) == ESP_OK);
+    vTaskDelay(pdMS_TO_TICKS(500));
+
+    char *text = calloc(1, 8192);
+    CHECK(text != NULL);
+    esp_metrics_format(text, 8192, "pipeline_");
+    pipeline_delete(pipeline);
+
+    // Every item went through the stages in order, and back
+    CHECK(test_pipeline_errors == 0);
+    for (int i = 0; i < 4; i++) {
+        CHECK(items[i].rounds > 1);
+    }
+
+    // The items pile up in front of the slow stage
+    uint64_t slow = pipeline_metric(text, "pipeline_items_total", "slow");
+    uint64_t last = pipeline_metric(text, "pipeline_items_total", "last");
+    CHECK(slow > 10 && last > 10);
+    CHECK(pipeline_metric(text, "pipeline_queue_items_sum", "slow") > 2 * slow);
+    CHECK(pipeline_metric(text, "pipeline_queue_items_sum", "last") < 2 * last);
+    CHECK(pipeline_metric(text, "pipeline_busy_us_total", "slow") > pipeline_metric(text, "pipeline_busy_us_total", "last"));
+
+    // A deleted pipeline has no metrics
+    esp_metrics_format(text, 8192, "pipeline_");
+    CHECK(strstr(text, "pipeline=\"test\"") == NULL);
+    free(text);
+}
+
+static esp_rtsp_server_handle_t server;
+
+static void test_media_sources(void) {
+    size_t small_length, large_length;
+    uint8_t *small = encode_yuv_frame(160, 120, 1, &small_length);
+    uint8_t *large = encode_yuv_frame(320, 240, 1, &large_length);
+    synthetic_camera_config_t config = SYNTHETIC_CAMERA_DEFAULT();
+    config.fps = 25;
+    CHECK(synthetic_camera_init(&config) == ESP_OK);
+    CHECK(small != NULL && large != NULL);
+
+    // A clip of two frames, slower than the streams ask for them so none is skipped. It stays
+    // registered as long as the server.
+    uint8_t *clip_data = malloc(small_length + large_length);
+    CHECK(clip_data != NULL);
+    memcpy(clip_data, small, small_length);
+    memcpy(clip_data + small_length, large, large_length);
+    free(large);
+
+    esp_media_source_t *clip, *pattern, *feed;
+    CHECK(esp_media_source_clip_create((const uint8_t *)"no frames", 9, 4, &clip) == ESP_ERR_INVALID_ARG);
+    CHECK(esp_media_source_clip_create(clip_data, small_length + large_length, 4, &clip) == ESP_OK);
+    CHECK(esp_media_source_pattern_create(176, 144, 10, &pattern) == ESP_OK);
+    CHECK(esp_media_source_feed_create(&feed) == ESP_OK);
+    CHECK(esp_rtsp_server_register_source(server, "clip", clip) == ESP_ERR_INVALID_ARG);
+    CHECK(esp_rtsp_server_register_source(server, "/clip", clip) == ESP_OK);
+    CHECK(esp_rtsp_server_register_source(server, "/pattern", pattern) == ESP_OK);
+    CHECK(esp_rtsp_server_register_source(server, "/feed", feed) == ESP_OK);
+
+    // The sources and the camera play at the same time
+    const char *paths[] = { "/clip", "/pattern/1", "/feed", "/mjpeg/1" };
+    rtsp_client_t clients[4];
+    rtp_jpeg_receiver_t receivers[4];
+    for (int i = 0; i < 4; i++) {
+        CHECK(rtp_jpeg_receiver_init(&receivers[i]) == 0);
+        CHECK(rtsp_client_connect(&clients[i], "127.0.0.1", RTSP_PORT, paths[i]) == 0);
+        CHECK(rtsp_client_request(&clients[i], "DESCRIBE", "Accept: application/sdp\r\n") == 200);
+        CHECK(strstr(clients[i].response, "m=video 0 RTP/AVP 26\r\n") != NULL);
+        CHECK((strstr(clients[i].response, "a=framerate:") != NULL) == (i < 2));
+        CHECK(rtsp_client_setup(&clients[i]) == 200);
+        CHECK(rtsp_client_play(&clients[i]) == 200);
+    }
+
+    // The feed sends what is pushed into it
+    CHECK(esp_media_source_feed_push(feed, small, small_length, 160, 120, PIXFORMAT_JPEG) == ESP_OK);
+    free(small);
+    CHECK(receive_frame(&clients[2], &receivers[2], NULL) == 0);
+    CHECK(receivers[2].width == 160 && receivers[2].height == 120);
+
+    // The pattern is encoded by the stream
+    CHECK(receive_frame(&clients[1], &receivers[1], NULL) == 0);
+    CHECK(receivers[1].width == 176 && receivers[1].height == 144);
+
+    CHECK(receive_frame(&clients[3], &receivers[3], NULL) == 0);
+
+    int widths = 0;
+    for (int i = 0; i < 3; i++) {
+        CHECK(receive_frame(&clients[0], &receivers[0], NULL) == 0);
+        widths |= receivers[0].width == 160 ? 1 : receivers[0].width == 320 ? 2 : 4;
+    }
+    CHECK(widths == 3);
+
+    for (int i = 0; i < 4; i++) {
+        CHECK(rtsp_client_teardown(&clients[i]) == 200);
+        rtsp_client_close(&clients[i]);
+        rtp_jpeg_receiver_free(&receivers[i]);
+    }
+}
+
+int main(int argc, char **argv) {
+    signal(SIGPIPE, SIG_IGN);
+    esp_log_level_set("*", ESP_LOG_WARN);
+
+    synthetic_camera_config_t config = SYNTHETIC_CAMERA_DEFAULT();
+    config.fps = 25;
+    if (synthetic_camera_init(&config) != ESP_OK) {
+        return 1;
+    }
+
+    if (esp_rtsp_server_start(&server) != ESP_OK) {
+        return 1;
+    }
+    vTaskDelay(pdMS_TO_TICKS(100)); // Let the server start listening
+
+    RUN(test_parse_options);
+    RUN(test_parse_setup_transport);
+    RUN(test_parse_range);
+    RUN(test_parse_invalid_method);
+    RUN(test_jpeg_decode);
+    RUN(test_send_small_frame);
+    RUN(test_receiver_reassembly);
+    RUN(test_stream_loopback);
+    RUN(test_jpeg_decode_restart);
+    RUN(test_send_restart_frame);
+    RUN(test_stream_encoded);
+    RUN(test_stream_yuv_loopback);
+    RUN(test_motion_detector);
+    RUN(test_describe_waits_for_source);
+    RUN(test_play_without_setup);
+    RUN(test_boot_timeline);
+    RUN(test_frames_shared);
+    RUN(test_frames_motion);
+    RUN(test_http_stream);
+    RUN(test_http_snapshot);
+    RUN(test_metrics_registry);
+    RUN(test_rtsp_get_parameter);
+    RUN(test_http_metrics);
+    RUN(test_trace);
+    RUN(test_recorder);
+    RUN(test_timeshift_replay);
+    RUN(test_admission_capacity);
+    RUN(test_admission);
+    RUN(test_pipeline);
+    RUN(test_media_sources);
+
+    esp_rtsp_server_stop(server);
+    synthetic_camera_deinit();
+
+    printf("%d failure(s)\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,29 @@
+//
+// Host (POSIX) stand-in for the ESP-IDF driver/ledc.h, only the types
+// referenced by esp_camera.h
+//
+
+#ifndef ESPCAM_POSIX_DRIVER_LEDC_H
+#define ESPCAM_POSIX_DRIVER_LEDC_H
+
+typedef enum {
+    LEDC_TIMER_0 = 0,
+    LEDC_TIMER_1,
+    LEDC_TIMER_2,
+    LEDC_TIMER_3,
+    LEDC_TIMER_MAX,
+} ledc_timer_t;
+
+typedef enum {
+    LEDC_CHANNEL_0 = 0,
+    LEDC_CHANNEL_1,
+    LEDC_CHANNEL_2,
+    LEDC_CHANNEL_3,
+    LEDC_CHANNEL_4,
+    LEDC_CHANNEL_5,
+    LEDC_CHANNEL_6,
+    LEDC_CHANNEL_7,
+    LEDC_CHANNEL_MAX,
+} ledc_channel_t;
+
+#endif //ESPCAM_POSIX_DRIVER_LEDC_H
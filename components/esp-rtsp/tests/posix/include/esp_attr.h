@@ -0,0 +1,11 @@
+//
+// Host (POSIX) stand-in for the ESP-IDF esp_attr.h, the host has no IRAM
+//
+
+#ifndef ESPCAM_POSIX_ESP_ATTR_H
+#define ESPCAM_POSIX_ESP_ATTR_H
+
+#define IRAM_ATTR
+#define DRAM_ATTR
+
+#endif //ESPCAM_POSIX_ESP_ATTR_H
@@ -0,0 +1,20 @@
+//
+// Host (POSIX) stand-in for the ESP-IDF esp_heap_caps.h, the host has no
+// separate internal RAM and PSRAM, it allocates from the one heap and
+// reports nothing free in either
+//
+
+#ifndef ESPCAM_POSIX_ESP_HEAP_CAPS_H
+#define ESPCAM_POSIX_ESP_HEAP_CAPS_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define MALLOC_CAP_SPIRAM   (1 << 10)
+#define MALLOC_CAP_INTERNAL (1 << 11)
+
+void *heap_caps_malloc(size_t size, uint32_t caps);
+size_t heap_caps_get_free_size(uint32_t caps);
+size_t heap_caps_get_minimum_free_size(uint32_t caps);
+
+#endif //ESPCAM_POSIX_ESP_HEAP_CAPS_H
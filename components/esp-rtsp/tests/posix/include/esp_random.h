@@ -0,0 +1,14 @@
+//
+// Host (POSIX) stand-in for the ESP-IDF esp_random.h
+//
+
+#ifndef ESPCAM_POSIX_ESP_RANDOM_H
+#define ESPCAM_POSIX_ESP_RANDOM_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+uint32_t esp_random(void);
+void esp_fill_random(void *buf, size_t len);
+
+#endif //ESPCAM_POSIX_ESP_RANDOM_H
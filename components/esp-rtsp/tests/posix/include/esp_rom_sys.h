@@ -0,0 +1,12 @@
+//
+// Host (POSIX) stand-in for the ESP-IDF esp_rom_sys.h
+//
+
+#ifndef ESPCAM_POSIX_ESP_ROM_SYS_H
+#define ESPCAM_POSIX_ESP_ROM_SYS_H
+
+#include <stdint.h>
+
+void esp_rom_delay_us(uint32_t us);
+
+#endif //ESPCAM_POSIX_ESP_ROM_SYS_H
@@ -0,0 +1,13 @@
+//
+// Host (POSIX) stand-in for the ESP-IDF esp_timer.h
+//
+
+#ifndef ESPCAM_POSIX_ESP_TIMER_H
+#define ESPCAM_POSIX_ESP_TIMER_H
+
+#include <stdint.h>
+
+// Microseconds since the first call, based on CLOCK_MONOTONIC
+int64_t esp_timer_get_time(void);
+
+#endif //ESPCAM_POSIX_ESP_TIMER_H
@@ -0,0 +1,39 @@
+//
+// Host (POSIX) stand-in for the FreeRTOS core definitions used by esp-rtsp
+//
+
+#ifndef ESPCAM_POSIX_FREERTOS_H
+#define ESPCAM_POSIX_FREERTOS_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "sdkconfig.h"
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdFALSE  ((BaseType_t) 0)
+#define pdTRUE   ((BaseType_t) 1)
+#define pdPASS   (pdTRUE)
+#define pdFAIL   (pdFALSE)
+
+#define errCOULD_NOT_ALLOCATE_REQUIRED_MEMORY (-1)
+
+#define configTICK_RATE_HZ CONFIG_FREERTOS_HZ
+#define portMAX_DELAY ((TickType_t) 0xffffffffUL)
+#define portTICK_PERIOD_MS ((TickType_t) 1000 / configTICK_RATE_HZ)
+#define pdMS_TO_TICKS(xTimeInMs) ((TickType_t) (((TickType_t) (xTimeInMs) * (TickType_t) configTICK_RATE_HZ) / (TickType_t) 1000U))
+
+#define tskNO_AFFINITY ((BaseType_t) 0x7FFFFFFF)
+
+// The host runs the tasks as if they were on a single core
+#define portNUM_PROCESSORS 1
+
+static inline BaseType_t xPortGetCoreID(void) {
+    return 0;
+}
+
+#endif //ESPCAM_POSIX_FREERTOS_H
@@ -0,0 +1,20 @@
+//
+// Host (POSIX) stand-in for the FreeRTOS queue API
+//
+
+#ifndef ESPCAM_POSIX_FREERTOS_QUEUE_H
+#define ESPCAM_POSIX_FREERTOS_QUEUE_H
+
+#include "FreeRTOS.h"
+
+typedef struct posix_queue *QueueHandle_t;
+
+QueueHandle_t xQueueCreate(UBaseType_t uxQueueLength, UBaseType_t uxItemSize);
+void vQueueDelete(QueueHandle_t xQueue);
+BaseType_t xQueueSend(QueueHandle_t xQueue, const void *pvItemToQueue, TickType_t xTicksToWait);
+BaseType_t xQueueReceive(QueueHandle_t xQueue, void *pvBuffer, TickType_t xTicksToWait);
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t xQueue);
+
+#define xQueueSendToBack(xQueue, pvItemToQueue, xTicksToWait) xQueueSend(xQueue, pvItemToQueue, xTicksToWait)
+
+#endif //ESPCAM_POSIX_FREERTOS_QUEUE_H
@@ -0,0 +1,41 @@
+//
+// Host (POSIX) stand-in for the FreeRTOS semaphore API, on top of the queues
+// like FreeRTOS itself does it
+//
+
+#ifndef ESPCAM_POSIX_FREERTOS_SEMPHR_H
+#define ESPCAM_POSIX_FREERTOS_SEMPHR_H
+
+#include <stdint.h>
+
+#include "FreeRTOS.h"
+#include "queue.h"
+
+typedef QueueHandle_t SemaphoreHandle_t;
+
+static inline SemaphoreHandle_t xSemaphoreCreateBinary(void) {
+    return xQueueCreate(1, sizeof(uint8_t));
+}
+
+static inline BaseType_t xSemaphoreGive(SemaphoreHandle_t xSemaphore) {
+    uint8_t token = 0;
+    return xQueueSend(xSemaphore, &token, 0);
+}
+
+static inline BaseType_t xSemaphoreTake(SemaphoreHandle_t xSemaphore, TickType_t xBlockTime) {
+    uint8_t token;
+    return xQueueReceive(xSemaphore, &token, xBlockTime);
+}
+
+// Not recursive and without priority inheritance, which the host does not need
+static inline SemaphoreHandle_t xSemaphoreCreateMutex(void) {
+    SemaphoreHandle_t mutex = xSemaphoreCreateBinary();
+    if (mutex) {
+        xSemaphoreGive(mutex);
+    }
+    return mutex;
+}
+
+#define vSemaphoreDelete(xSemaphore) vQueueDelete(xSemaphore)
+
+#endif //ESPCAM_POSIX_FREERTOS_SEMPHR_H
@@ -0,0 +1,32 @@
+//
+// Host (POSIX) stand-in for the FreeRTOS task API
+//
+// Tasks are joinable pthreads. Deleting another task cancels the thread and
+// waits for it to finish, so the caller can release anything the task was
+// using as soon as vTaskDelete returns, just like on the target. Stack
+// depth, priority and core affinity are accepted but not applied.
+//
+
+#ifndef ESPCAM_POSIX_FREERTOS_TASK_H
+#define ESPCAM_POSIX_FREERTOS_TASK_H
+
+#include "FreeRTOS.h"
+
+typedef struct posix_task *TaskHandle_t;
+typedef void (*TaskFunction_t)(void *);
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t pvTaskCode, const char *pcName, uint32_t usStackDepth,
+                                   void *pvParameters, UBaseType_t uxPriority, TaskHandle_t *pvCreatedTask,
+                                   BaseType_t xCoreID);
+
+static inline BaseType_t xTaskCreate(TaskFunction_t pvTaskCode, const char *pcName, uint32_t usStackDepth,
+                                     void *pvParameters, UBaseType_t uxPriority, TaskHandle_t *pvCreatedTask) {
+    return xTaskCreatePinnedToCore(pvTaskCode, pcName, usStackDepth, pvParameters, uxPriority, pvCreatedTask,
+                                   tskNO_AFFINITY);
+}
+
+void vTaskDelete(TaskHandle_t xTaskToDelete);
+void vTaskDelay(TickType_t xTicksToDelay);
+TickType_t xTaskGetTickCount(void);
+
+#endif //ESPCAM_POSIX_FREERTOS_TASK_H
@@ -0,0 +1,10 @@
+//
+// Host (POSIX) stand-in for lwip/err.h
+//
+
+#ifndef ESPCAM_POSIX_LWIP_ERR_H
+#define ESPCAM_POSIX_LWIP_ERR_H
+
+#include <errno.h>
+
+#endif //ESPCAM_POSIX_LWIP_ERR_H
@@ -0,0 +1,32 @@
+//
+// Host (POSIX) stand-in for lwip/sockets.h
+//
+// Maps onto the BSD socket API and adds the lwIP helpers used by esp-rtsp.
+//
+
+#ifndef ESPCAM_POSIX_LWIP_SOCKETS_H
+#define ESPCAM_POSIX_LWIP_SOCKETS_H
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/select.h>
+#include <sys/time.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+#include <assert.h>
+
+#include "esp_random.h"
+
+#define PP_HTONS(x) htons(x)
+#define PP_HTONL(x) htonl(x)
+
+char *inet_ntoa_r(struct in_addr addr, char *buf, int buflen);
+
+// Like lwIP, IPv4 clients on a dual stack socket are rendered as plain IPv4
+char *inet6_ntoa_r(struct in6_addr addr, char *buf, int buflen);
+
+#endif //ESPCAM_POSIX_LWIP_SOCKETS_H
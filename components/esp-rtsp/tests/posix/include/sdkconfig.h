@@ -0,0 +1,13 @@
+//
+// Host (POSIX) build configuration, stands in for the generated sdkconfig.h
+//
+
+#ifndef ESPCAM_POSIX_SDKCONFIG_H
+#define ESPCAM_POSIX_SDKCONFIG_H
+
+#define CONFIG_LOG_MAXIMUM_LEVEL 4
+#define CONFIG_FREERTOS_HZ 1000
+#define CONFIG_ESP_TRACE_ENABLED 1
+#define CONFIG_ESP_TRACE_RING_SIZE 256
+
+#endif //ESPCAM_POSIX_SDKCONFIG_H
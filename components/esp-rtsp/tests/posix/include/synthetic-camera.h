@@ -0,0 +1,55 @@
+//
+// Synthetic frame source standing in for esp_camera on the host.
+//
+// esp_camera_fb_get() hands out the same JPEG frame every time, paced to the
+// configured frame rate. The frame is either loaded from a file or generated:
+// a generated frame has the markers a sensor JPEG has (two DQT segments, SOF0,
+// SOS, EOI) around pseudo random entropy data, which exercises parsing and
+// packetization but does not decode to a picture.
+//
+// With pixformat PIXFORMAT_YUV422 the frames are an uncompressed YUYV test
+// pattern instead, like a sensor without JPEG output delivers, for the
+// software JPEG path.
+//
+
+#ifndef ESPCAM_SYNTHETIC_CAMERA_H
+#define ESPCAM_SYNTHETIC_CAMERA_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "esp_err.h"
+#include "sensor.h"
+
+typedef struct {
+    uint16_t width;
+    uint16_t height;
+    size_t frame_size;     // Size of a generated frame in bytes
+    uint32_t fps;          // 0 hands out frames as fast as they are requested
+    const char *jpeg_path; // Optional JPEG file to use instead of a generated frame
+    pixformat_t pixformat; // PIXFORMAT_JPEG or PIXFORMAT_YUV422
+} synthetic_camera_config_t;
+
+#define SYNTHETIC_CAMERA_DEFAULT() { \
+    .width = 1024,                   \
+    .height = 768,                   \
+    .frame_size = 64 * 1024,         \
+    .fps = 0,                        \
+    .jpeg_path = NULL,               \
+    .pixformat = PIXFORMAT_JPEG      \
+}
+
+typedef struct {
+    uint64_t frames;
+    uint64_t capture_us; // Total time spent inside esp_camera_fb_get
+} synthetic_camera_stats_t;
+
+esp_err_t synthetic_camera_init(const synthetic_camera_config_t *config);
+void synthetic_camera_deinit(void);
+
+const uint8_t *synthetic_camera_frame(size_t *length);
+
+void synthetic_camera_get_stats(synthetic_camera_stats_t *stats);
+void synthetic_camera_reset_stats(void);
+
+#endif //ESPCAM_SYNTHETIC_CAMERA_H
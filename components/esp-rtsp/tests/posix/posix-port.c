@@ -0,0 +1,373 @@
+//
+// Host (POSIX) implementation of the ESP-IDF, FreeRTOS and lwIP subset used
+// by esp-rtsp: logging, timers, random numbers, tasks, queues and sockets.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_random.h"
+#include "esp_heap_caps.h"
+#include "esp_netif.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "lwip/sockets.h"
+
+/* Logging */
+
+static esp_log_level_t s_log_level = ESP_LOG_INFO;
+static pthread_mutex_t s_log_lock = PTHREAD_MUTEX_INITIALIZER;
+
+void esp_log_level_set(const char *tag, esp_log_level_t level) {
+    if (tag && strcmp(tag, "*") == 0) {
+        s_log_level = level;
+    }
+}
+
+esp_log_level_t esp_log_level_get(const char *tag) {
+    return s_log_level;
+}
+
+uint32_t esp_log_timestamp(void) {
+    return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+void esp_log_write(esp_log_level_t level, const char *tag, const char *format, ...) {
+    va_list args;
+    va_start(args, format);
+    pthread_mutex_lock(&s_log_lock);
+    vfprintf(stderr, format, args);
+    pthread_mutex_unlock(&s_log_lock);
+    va_end(args);
+}
+
+const char *esp_err_to_name(esp_err_t code) {
+    switch (code) {
+        case ESP_OK: return "ESP_OK";
+        case ESP_FAIL: return "ESP_FAIL";
+        case ESP_ERR_NO_MEM: return "ESP_ERR_NO_MEM";
+        case ESP_ERR_INVALID_ARG: return "ESP_ERR_INVALID_ARG";
+        case ESP_ERR_INVALID_STATE: return "ESP_ERR_INVALID_STATE";
+        case ESP_ERR_INVALID_SIZE: return "ESP_ERR_INVALID_SIZE";
+        case ESP_ERR_NOT_FOUND: return "ESP_ERR_NOT_FOUND";
+        case ESP_ERR_NOT_SUPPORTED: return "ESP_ERR_NOT_SUPPORTED";
+        case ESP_ERR_TIMEOUT: return "ESP_ERR_TIMEOUT";
+        default: return "UNKNOWN ERROR";
+    }
+}
+
+/* Timers */
+
+static int64_t monotonic_us(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+int64_t esp_timer_get_time(void) {
+    static int64_t boot_time;
+    int64_t now = monotonic_us();
+
+    int64_t expected = 0;
+    __atomic_compare_exchange_n(&boot_time, &expected, now, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+
+    return now - __atomic_load_n(&boot_time, __ATOMIC_RELAXED);
+}
+
+void esp_rom_delay_us(uint32_t us) {
+    struct timespec ts = {
+            .tv_sec = us / 1000000,
+            .tv_nsec = (us % 1000000) * 1000
+    };
+    while (nanosleep(&ts, &ts) < 0 && errno == EINTR);
+}
+
+/* Random numbers, splitmix64 over a shared atomic counter */
+
+uint32_t esp_random(void) {
+    static uint64_t state;
+
+    uint64_t expected = 0;
+    __atomic_compare_exchange_n(&state, &expected, (uint64_t)monotonic_us() | 1, false,
+                                __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+
+    uint64_t z = __atomic_add_fetch(&state, 0x9E3779B97F4A7C15ULL, __ATOMIC_RELAXED);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return (uint32_t)((z ^ (z >> 31)) >> 32);
+}
+
+void esp_fill_random(void *buf, size_t len) {
+    uint8_t *p = buf;
+    while (len > 0) {
+        uint32_t r = esp_random();
+        size_t n = len < sizeof(r) ? len : sizeof(r);
+        memcpy(p, &r, n);
+        p += n;
+        len -= n;
+    }
+}
+
+/* Heap */
+
+void *heap_caps_malloc(size_t size, uint32_t caps) {
+    return malloc(size);
+}
+
+size_t heap_caps_get_free_size(uint32_t caps) {
+    return 0;
+}
+
+size_t heap_caps_get_minimum_free_size(uint32_t caps) {
+    return 0;
+}
+
+/* Network interface */
+
+struct esp_netif_obj {
+    const char *if_key;
+};
+
+static esp_netif_t s_loopback_netif = {
+        .if_key = "WIFI_STA_DEF"
+};
+
+esp_netif_t *esp_netif_get_handle_from_ifkey(const char *if_key) {
+    return &s_loopback_netif;
+}
+
+esp_err_t esp_netif_get_ip_info(esp_netif_t *esp_netif, esp_netif_ip_info_t *ip_info) {
+    if (!esp_netif || !ip_info) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    memset(ip_info, 0, sizeof(esp_netif_ip_info_t));
+    ip_info->ip.addr = htonl(INADDR_LOOPBACK);
+    ip_info->netmask.addr = htonl(0xff000000);
+    return ESP_OK;
+}
+
+/* Sockets */
+
+char *inet_ntoa_r(struct in_addr addr, char *buf, int buflen) {
+    return (char *)inet_ntop(AF_INET, &addr, buf, buflen);
+}
+
+char *inet6_ntoa_r(struct in6_addr addr, char *buf, int buflen) {
+    if (IN6_IS_ADDR_V4MAPPED(&addr)) {
+        return (char *)inet_ntop(AF_INET, &addr.s6_addr[12], buf, buflen);
+    }
+    return (char *)inet_ntop(AF_INET6, &addr, buf, buflen);
+}
+
+/* Tasks */
+
+struct posix_task {
+    pthread_t thread;
+    TaskFunction_t code;
+    void *parameters;
+    char name[16];
+};
+
+static __thread struct posix_task *s_current_task;
+
+static void *task_trampoline(void *arg) {
+    struct posix_task *task = arg;
+    s_current_task = task;
+
+    task->code(task->parameters);
+
+    // Returning from a task function is not allowed in FreeRTOS
+    ESP_LOGE("posix-port", "Task %s returned from its task function", task->name);
+    abort();
+}
+
+BaseType_t xTaskCreatePinnedToCore(TaskFunction_t pvTaskCode, const char *pcName, uint32_t usStackDepth,
+                                   void *pvParameters, UBaseType_t uxPriority, TaskHandle_t *pvCreatedTask,
+                                   BaseType_t xCoreID) {
+    struct posix_task *task = calloc(1, sizeof(struct posix_task));
+    if (!task) {
+        return errCOULD_NOT_ALLOCATE_REQUIRED_MEMORY;
+    }
+
+    task->code = pvTaskCode;
+    task->parameters = pvParameters;
+    strncpy(task->name, pcName ? pcName : "", sizeof(task->name) - 1);
+
+    // Publish the handle before the task runs, the task may use it right away
+    if (pvCreatedTask) {
+        *pvCreatedTask = task;
+    }
+
+    if (pthread_create(&task->thread, NULL, task_trampoline, task) != 0) {
+        if (pvCreatedTask) {
+            *pvCreatedTask = NULL;
+        }
+        free(task);
+        return errCOULD_NOT_ALLOCATE_REQUIRED_MEMORY;
+    }
+    pthread_setname_np(task->thread, task->name);
+
+    return pdPASS;
+}
+
+void vTaskDelete(TaskHandle_t xTaskToDelete) {
+    struct posix_task *task = xTaskToDelete ? xTaskToDelete : s_current_task;
+    if (!task) {
+        // Not a task created through xTaskCreate, e.g. the main thread
+        pthread_exit(NULL);
+    }
+
+    if (task == s_current_task) {
+        pthread_detach(pthread_self());
+        free(task);
+        s_current_task = NULL;
+        pthread_exit(NULL);
+    }
+
+    pthread_cancel(task->thread);
+    pthread_join(task->thread, NULL);
+    free(task);
+}
+
+void vTaskDelay(TickType_t xTicksToDelay) {
+    esp_rom_delay_us((uint32_t)xTicksToDelay * portTICK_PERIOD_MS * 1000);
+}
+
+TickType_t xTaskGetTickCount(void) {
+    return (TickType_t)(esp_timer_get_time() / 1000 / portTICK_PERIOD_MS);
+}
+
+/* Queues */
+
+struct posix_queue {
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    UBaseType_t length;
+    UBaseType_t item_size;
+    UBaseType_t head;
+    UBaseType_t count;
+    uint8_t storage[];
+};
+
+static void deadline_from_ticks(TickType_t ticks, struct timespec *deadline) {
+    clock_gettime(CLOCK_REALTIME, deadline);
+    uint64_t ns = (uint64_t)ticks * portTICK_PERIOD_MS * 1000000ULL + deadline->tv_nsec;
+    deadline->tv_sec += ns / 1000000000ULL;
+    deadline->tv_nsec = ns % 1000000000ULL;
+}
+
+static void queue_unlock(void *arg) {
+    pthread_mutex_unlock(arg);
+}
+
+// Waits on cond until ready() holds, returns false on timeout
+static bool queue_wait(struct posix_queue *queue, pthread_cond_t *cond, bool (*ready)(struct posix_queue *),
+                       TickType_t ticks) {
+    struct timespec deadline;
+    if (ticks != portMAX_DELAY) {
+        deadline_from_ticks(ticks, &deadline);
+    }
+
+    while (!ready(queue)) {
+        if (ticks == 0) {
+            return false;
+        }
+        if (ticks == portMAX_DELAY) {
+            pthread_cond_wait(cond, &queue->lock);
+        } else if (pthread_cond_timedwait(cond, &queue->lock, &deadline) == ETIMEDOUT) {
+            return ready(queue);
+        }
+    }
+    return true;
+}
+
+static bool queue_has_space(struct posix_queue *queue) {
+    return queue->count < queue->length;
+}
+
+static bool queue_has_items(struct posix_queue *queue) {
+    return queue->count > 0;
+}
+
+QueueHandle_t xQueueCreate(UBaseType_t uxQueueLength, UBaseType_t uxItemSize) {
+    if (uxQueueLength == 0) {
+        return NULL;
+    }
+
+    struct posix_queue *queue = calloc(1, sizeof(struct posix_queue) + (size_t)uxQueueLength * uxItemSize);
+    if (!queue) {
+        return NULL;
+    }
+
+    pthread_mutex_init(&queue->lock, NULL);
+    pthread_cond_init(&queue->not_empty, NULL);
+    pthread_cond_init(&queue->not_full, NULL);
+    queue->length = uxQueueLength;
+    queue->item_size = uxItemSize;
+
+    return queue;
+}
+
+void vQueueDelete(QueueHandle_t xQueue) {
+    if (!xQueue) {
+        return;
+    }
+
+    pthread_cond_destroy(&xQueue->not_full);
+    pthread_cond_destroy(&xQueue->not_empty);
+    pthread_mutex_destroy(&xQueue->lock);
+    free(xQueue);
+}
+
+BaseType_t xQueueSend(QueueHandle_t xQueue, const void *pvItemToQueue, TickType_t xTicksToWait) {
+    BaseType_t result = pdFAIL;
+
+    pthread_mutex_lock(&xQueue->lock);
+    pthread_cleanup_push(queue_unlock, &xQueue->lock);
+
+    if (queue_wait(xQueue, &xQueue->not_full, queue_has_space, xTicksToWait)) {
+        UBaseType_t tail = (xQueue->head + xQueue->count) % xQueue->length;
+        memcpy(xQueue->storage + (size_t)tail * xQueue->item_size, pvItemToQueue, xQueue->item_size);
+        xQueue->count++;
+        pthread_cond_signal(&xQueue->not_empty);
+        result = pdPASS;
+    }
+
+    pthread_cleanup_pop(1);
+    return result;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t xQueue, void *pvBuffer, TickType_t xTicksToWait) {
+    BaseType_t result = pdFAIL;
+
+    pthread_mutex_lock(&xQueue->lock);
+    pthread_cleanup_push(queue_unlock, &xQueue->lock);
+
+    if (queue_wait(xQueue, &xQueue->not_empty, queue_has_items, xTicksToWait)) {
+        memcpy(pvBuffer, xQueue->storage + (size_t)xQueue->head * xQueue->item_size, xQueue->item_size);
+        xQueue->head = (xQueue->head + 1) % xQueue->length;
+        xQueue->count--;
+        pthread_cond_signal(&xQueue->not_full);
+        result = pdPASS;
+    }
+
+    pthread_cleanup_pop(1);
+    return result;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t xQueue) {
+    pthread_mutex_lock(&xQueue->lock);
+    UBaseType_t count = xQueue->count;
+    pthread_mutex_unlock(&xQueue->lock);
+    return count;
+}
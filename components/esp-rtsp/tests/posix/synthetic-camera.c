@@ -0,0 +1,284 @@
+//
+// Synthetic frame source standing in for esp_camera on the host.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/time.h>
+
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "esp_random.h"
+#include "esp_camera.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "synthetic-camera.h"
+
+#define TAG "synthetic-camera"
+
+// Smallest generated frame: headers plus a little entropy data
+#define MIN_FRAME_SIZE 512
+
+static uint8_t *s_frame;
+static size_t s_frame_length;
+static uint16_t s_width;
+static uint16_t s_height;
+static pixformat_t s_pixformat;
+static int64_t s_frame_interval_us;
+static int64_t s_epoch_us;
+
+static uint64_t s_frames;
+static uint64_t s_capture_us;
+
+// Standard tables from the JPEG specification (Annex K.1), in zigzag order
+static const uint8_t s_luma_quant[64] = {
+        16, 11, 12, 14, 12, 10, 16, 14, 13, 14, 18, 17, 16, 19, 24, 40,
+        26, 24, 22, 22, 24, 49, 35, 37, 29, 40, 58, 51, 61, 60, 57, 51,
+        56, 55, 64, 72, 92, 78, 64, 68, 87, 69, 55, 56, 80, 109, 81, 87,
+        95, 98, 103, 104, 103, 62, 77, 113, 121, 112, 100, 120, 92, 101, 103, 99
+};
+
+static const uint8_t s_chroma_quant[64] = {
+        17, 18, 18, 24, 21, 24, 47, 26, 26, 47, 99, 66, 56, 66, 99, 99,
+        99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99,
+        99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99,
+        99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99
+};
+
+static uint8_t *put_marker(uint8_t *p, uint8_t marker, uint16_t length) {
+    *p++ = 0xFF;
+    *p++ = marker;
+    *p++ = length >> 8;
+    *p++ = length & 0xFF;
+    return p;
+}
+
+static esp_err_t generate_frame(size_t frame_size) {
+    if (frame_size < MIN_FRAME_SIZE) {
+        frame_size = MIN_FRAME_SIZE;
+    }
+
+    uint8_t *frame = malloc(frame_size);
+    if (!frame) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    uint8_t *p = frame;
+    *p++ = 0xFF;
+    *p++ = 0xD8; // SOI
+
+    p = put_marker(p, 0xE0, 16); // APP0
+    memcpy(p, "JFIF\0\x01\x01\x00\x00\x01\x00\x01\x00\x00", 14);
+    p += 14;
+
+    p = put_marker(p, 0xDB, 67); // DQT, luminance
+    *p++ = 0;
+    memcpy(p, s_luma_quant, 64);
+    p += 64;
+
+    p = put_marker(p, 0xDB, 67); // DQT, chrominance
+    *p++ = 1;
+    memcpy(p, s_chroma_quant, 64);
+    p += 64;
+
+    p = put_marker(p, 0xC0, 17); // SOF0, YCbCr 4:2:2 like the sensors produce
+    *p++ = 8;
+    *p++ = s_height >> 8;
+    *p++ = s_height & 0xFF;
+    *p++ = s_width >> 8;
+    *p++ = s_width & 0xFF;
+    *p++ = 3;
+    *p++ = 1; *p++ = 0x21; *p++ = 0;
+    *p++ = 2; *p++ = 0x11; *p++ = 1;
+    *p++ = 3; *p++ = 0x11; *p++ = 1;
+
+    p = put_marker(p, 0xDA, 12); // SOS
+    *p++ = 3;
+    *p++ = 1; *p++ = 0x00;
+    *p++ = 2; *p++ = 0x11;
+    *p++ = 3; *p++ = 0x11;
+    *p++ = 0; *p++ = 63; *p++ = 0;
+
+    // Entropy coded data, avoiding 0xFF so no marker appears in the scan
+    uint8_t *end = frame + frame_size - 2;
+    esp_fill_random(p, end - p);
+    for (; p < end; p++) {
+        if (*p == 0xFF) {
+            *p = 0xFE;
+        }
+    }
+
+    *p++ = 0xFF;
+    *p++ = 0xD9; // EOI
+
+    s_frame = frame;
+    s_frame_length = frame_size;
+    return ESP_OK;
+}
+
+// YUYV color bars above a gradient, studio range like the sensors deliver
+static esp_err_t generate_yuv422_frame(void) {
+    static const uint8_t bars[8][3] = {
+            { 235, 128, 128 }, { 210, 16, 146 }, { 170, 166, 16 }, { 145, 54, 34 },
+            { 106, 202, 222 }, { 81, 90, 240 }, { 41, 240, 110 }, { 16, 128, 128 },
+    };
+
+    size_t length = (size_t) s_width * s_height * 2;
+    uint8_t *frame = malloc(length);
+    if (!frame) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    for (int y = 0; y < s_height; y++) {
+        uint8_t *p = frame + (size_t) y * s_width * 2;
+        for (int x = 0; x < s_width; x += 2, p += 4) {
+            if (y < s_height / 2) {
+                const uint8_t *bar = bars[x * 8 / s_width];
+                p[0] = bar[0]; p[1] = bar[1]; p[2] = bar[0]; p[3] = bar[2];
+            } else {
+                p[0] = 16 + (x * 219) / s_width;
+                p[1] = 16 + (y * 224) / s_height;
+                p[2] = 16 + ((x + 1) * 219) / s_width;
+                p[3] = 240 - (x * 224) / s_width;
+            }
+        }
+    }
+
+    s_frame = frame;
+    s_frame_length = length;
+    return ESP_OK;
+}
+
+static esp_err_t load_frame(const char *path) {
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        ESP_LOGE(TAG, "Unable to open %s", path);
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    fseek(file, 0, SEEK_END);
+    long length = ftell(file);
+    fseek(file, 0, SEEK_SET);
+
+    uint8_t *frame = length > 4 ? malloc(length) : NULL;
+    if (!frame || fread(frame, 1, length, file) != (size_t)length) {
+        ESP_LOGE(TAG, "Unable to read %s", path);
+        free(frame);
+        fclose(file);
+        return ESP_FAIL;
+    }
+    fclose(file);
+
+    // Take the dimensions from the SOF0 segment
+    for (long i = 2; i + 9 < length; ) {
+        if (frame[i] != 0xFF) {
+            break;
+        }
+        if (frame[i + 1] == 0xC0) {
+            s_height = frame[i + 5] << 8 | frame[i + 6];
+            s_width = frame[i + 7] << 8 | frame[i + 8];
+            break;
+        }
+        i += 2 + (frame[i + 2] << 8 | frame[i + 3]);
+    }
+
+    s_frame = frame;
+    s_frame_length = length;
+    return ESP_OK;
+}
+
+esp_err_t synthetic_camera_init(const synthetic_camera_config_t *config) {
+    if (!config) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    synthetic_camera_deinit();
+
+    s_width = config->width;
+    s_height = config->height;
+    s_pixformat = config->pixformat;
+    s_frame_interval_us = config->fps ? 1000000 / config->fps : 0;
+    s_epoch_us = esp_timer_get_time();
+
+    if (s_pixformat != PIXFORMAT_JPEG && (s_pixformat != PIXFORMAT_YUV422 || config->jpeg_path || (s_width & 1))) {
+        ESP_LOGE(TAG, "Unsupported pixel format %d", s_pixformat);
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    esp_err_t err;
+    if (s_pixformat == PIXFORMAT_YUV422) {
+        err = generate_yuv422_frame();
+    } else {
+        err = config->jpeg_path ? load_frame(config->jpeg_path) : generate_frame(config->frame_size);
+    }
+    if (err != ESP_OK) {
+        return err;
+    }
+
+    ESP_LOGI(TAG, "Serving %dx%d frames of %zu bytes at %u fps", s_width, s_height, s_frame_length,
+             (unsigned) config->fps);
+    return ESP_OK;
+}
+
+void synthetic_camera_deinit(void) {
+    free(s_frame);
+    s_frame = NULL;
+    s_frame_length = 0;
+}
+
+const uint8_t *synthetic_camera_frame(size_t *length) {
+    if (length) {
+        *length = s_frame_length;
+    }
+    return s_frame;
+}
+
+void synthetic_camera_get_stats(synthetic_camera_stats_t *stats) {
+    stats->frames = __atomic_load_n(&s_frames, __ATOMIC_RELAXED);
+    stats->capture_us = __atomic_load_n(&s_capture_us, __ATOMIC_RELAXED);
+}
+
+void synthetic_camera_reset_stats(void) {
+    __atomic_store_n(&s_frames, 0, __ATOMIC_RELAXED);
+    __atomic_store_n(&s_capture_us, 0, __ATOMIC_RELAXED);
+}
+
+camera_fb_t *esp_camera_fb_get(void) {
+    // Descriptors of the shared, read only frame come from a ring, so nothing
+    // needs locking and a task can be cancelled at any point. The server shares
+    // a frame between its streams, the ring is much longer than any of them
+    // holds on to one.
+    static camera_fb_t descriptors[16];
+    static unsigned next_descriptor;
+
+    if (!s_frame) {
+        return NULL;
+    }
+
+    int64_t start = esp_timer_get_time();
+
+    // Wait for the next frame boundary, like a sensor delivering at a fixed rate
+    if (s_frame_interval_us) {
+        int64_t next = s_epoch_us + ((start - s_epoch_us) / s_frame_interval_us + 1) * s_frame_interval_us;
+        vTaskDelay(pdMS_TO_TICKS((next - start + 999) / 1000));
+    }
+
+    int64_t now = esp_timer_get_time();
+    camera_fb_t *fb = &descriptors[__atomic_fetch_add(&next_descriptor, 1, __ATOMIC_RELAXED) % 16];
+    fb->buf = s_frame;
+    fb->len = s_frame_length;
+    fb->width = s_width;
+    fb->height = s_height;
+    fb->format = s_pixformat;
+    fb->timestamp.tv_sec = now / 1000000;
+    fb->timestamp.tv_usec = now % 1000000;
+
+    __atomic_add_fetch(&s_frames, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&s_capture_us, now - start, __ATOMIC_RELAXED);
+    return fb;
+}
+
+void esp_camera_fb_return(camera_fb_t *fb) {
+}
@@ -0,0 +1,196 @@
+//
+// Reference RTSP/RTP JPEG receiver.
+//
+// Plays an RTSP stream without a video player and reports what actually
+// arrived: complete and incomplete frames, packet loss, interarrival jitter,
+// drift of the RTP timestamps against the arrival time and goodput. Works
+// against the host build of the server as well as a camera on the network.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <getopt.h>
+
+#include "esp_timer.h"
+
+#include "rtsp-client.h"
+#include "rtp-jpeg-receiver.h"
+
+static volatile sig_atomic_t s_stop;
+
+static void on_signal(int sig) {
+    s_stop = 1;
+}
+
+// rtsp://host[:port][/path]
+static int parse_url(const char *url, char *host, size_t host_size, int *port, const char **path) {
+    if (strncmp(url, "rtsp://", 7) != 0) {
+        return -1;
+    }
+    url += 7;
+
+    const char *slash = strchr(url, '/');
+    *path = slash ? slash : "/";
+    size_t length = slash ? (size_t)(slash - url) : strlen(url);
+
+    const char *colon = memchr(url, ':', length);
+    *port = colon ? atoi(colon + 1) : 554;
+    if (colon) {
+        length = colon - url;
+    }
+    if (length == 0 || length >= host_size || *port <= 0 || *port > 65535) {
+        return -1;
+    }
+
+    memcpy(host, url, length);
+    host[length] = '\0';
+    return 0;
+}
+
+static void write_frame(const char *directory, uint64_t index, const uint8_t *frame, size_t length) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/frame-%06llu.jpg", directory, (unsigned long long) index);
+
+    FILE *file = fopen(path, "wb");
+    if (!file || fwrite(frame, 1, length, file) != length) {
+        fprintf(stderr, "unable to write %s\n", path);
+    }
+    if (file) {
+        fclose(file);
+    }
+}
+
+static void print_header(void) {
+    printf("%7s %7s %6s %7s %9s %8s %9s %10s %9s %9s\n",
+           "time s", "frames", "incompl", "lost", "packets", "fps", "Mbit/s", "jitter ms", "drift ms", "frame B");
+}
+
+static void print_report(double elapsed, const rtp_jpeg_receiver_stats_t *now,
+                         const rtp_jpeg_receiver_stats_t *last, double interval) {
+    uint64_t frames = now->frames_complete - last->frames_complete;
+    printf("%7.1f %7llu %6llu %7llu %9llu %8.1f %9.2f %10.2f %9.1f %9.0f\n",
+           elapsed,
+           (unsigned long long) frames,
+           (unsigned long long) (now->frames_incomplete - last->frames_incomplete),
+           (unsigned long long) (now->lost - last->lost),
+           (unsigned long long) (now->packets - last->packets),
+           frames / interval,
+           (now->goodput_bytes - last->goodput_bytes) * 8 / interval / 1e6,
+           now->jitter_us / 1000,
+           now->drift_us / 1000.0,
+           frames ? (double) (now->goodput_bytes - last->goodput_bytes) / frames : 0.0);
+    fflush(stdout);
+}
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "usage: %s [-t seconds] [-o directory] [-q] rtsp://host[:port]/path\n"
+            "  -t  stop after this many seconds, 0 runs until interrupted (default 10)\n"
+            "  -o  write every complete frame to directory/frame-NNNNNN.jpg\n"
+            "  -q  only print the summary\n",
+            name);
+}
+
+int main(int argc, char **argv) {
+    int duration_s = 10;
+    const char *directory = NULL;
+    int quiet = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "t:o:qh")) != -1) {
+        switch (opt) {
+            case 't': duration_s = atoi(optarg); break;
+            case 'o': directory = optarg; break;
+            case 'q': quiet = 1; break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    char host[128];
+    int port;
+    const char *path;
+    if (optind >= argc || parse_url(argv[optind], host, sizeof(host), &port, &path) != 0) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    signal(SIGPIPE, SIG_IGN);
+
+    rtsp_client_t client;
+    if (rtsp_client_connect(&client, host, port, path) != 0 ||
+        rtsp_client_request(&client, "OPTIONS", NULL) != 200 ||
+        rtsp_client_request(&client, "DESCRIBE", "Accept: application/sdp\r\n") != 200 ||
+        rtsp_client_setup(&client) != 200 ||
+        rtsp_client_play(&client) != 200) {
+        fprintf(stderr, "RTSP handshake with %s failed\n", argv[optind]);
+        rtsp_client_close(&client);
+        return 1;
+    }
+
+    rtp_jpeg_receiver_t receiver;
+    rtp_jpeg_receiver_init(&receiver);
+
+    if (!quiet) {
+        print_header();
+    }
+
+    static uint8_t packet[65536];
+    rtp_jpeg_receiver_stats_t last = receiver.stats;
+    int64_t start = esp_timer_get_time();
+    int64_t end = start + (int64_t) duration_s * 1000000;
+    int64_t next_report = start + 1000000;
+    int64_t last_report = start;
+
+    while (!s_stop && (duration_s == 0 || esp_timer_get_time() < end)) {
+        int n = rtsp_client_receive(&client, packet, sizeof(packet), 100);
+        int64_t now = esp_timer_get_time();
+        if (n < 0) {
+            break;
+        }
+        if (n > 0 && rtp_jpeg_receiver_packet(&receiver, packet, n, now) == 1 && directory) {
+            size_t length;
+            const uint8_t *frame = rtp_jpeg_receiver_frame(&receiver, &length);
+            write_frame(directory, receiver.stats.frames_complete, frame, length);
+        }
+
+        if (now >= next_report) {
+            if (!quiet) {
+                print_report((now - start) / 1e6, &receiver.stats, &last, (now - last_report) / 1e6);
+            }
+            last = receiver.stats;
+            last_report = now;
+            next_report += 1000000;
+        }
+    }
+
+    double elapsed = (esp_timer_get_time() - start) / 1e6;
+    rtp_jpeg_receiver_stats_t *stats = &receiver.stats;
+
+    rtsp_client_teardown(&client);
+    rtsp_client_close(&client);
+
+    printf("\n%s: %.1f s\n", argv[optind], elapsed);
+    printf("  frames:   %llu complete, %llu incomplete, %.1f fps\n",
+           (unsigned long long) stats->frames_complete, (unsigned long long) stats->frames_incomplete,
+           stats->frames_complete / elapsed);
+    printf("  packets:  %llu received, %llu expected, %llu lost (%.2f%%), %llu reordered, %llu malformed\n",
+           (unsigned long long) stats->packets, (unsigned long long) stats->expected,
+           (unsigned long long) stats->lost, stats->expected ? 100.0 * stats->lost / stats->expected : 0.0,
+           (unsigned long long) stats->reordered, (unsigned long long) stats->malformed);
+    printf("  goodput:  %.2f Mbit/s\n", stats->goodput_bytes * 8 / elapsed / 1e6);
+    printf("  jitter:   %.2f ms\n", stats->jitter_us / 1000);
+    if (stats->drift_min_us <= stats->drift_max_us) {
+        printf("  drift:    %.1f ms (min %.1f, max %.1f)\n", stats->drift_us / 1000.0,
+               stats->drift_min_us / 1000.0, stats->drift_max_us / 1000.0);
+    }
+
+    int failed = stats->frames_complete == 0;
+    rtp_jpeg_receiver_free(&receiver);
+    return failed;
+}
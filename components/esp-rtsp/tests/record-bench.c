@@ -0,0 +1,123 @@
+//
+// Write benchmark of the recorder.
+//
+// Records the synthetic camera into a directory, a file there stands in for
+// the card, and reports the sustained write rate, the latency of the writes
+// and the frames that did not fit in the staging buffers. Point -d at a
+// mounted card or a slow device to see how it keeps up.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+#include "esp_err.h"
+#include "esp_log.h"
+#include "esp_timer.h"
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+
+#include "esp-recorder.h"
+#include "synthetic-camera.h"
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "usage: %s [-d directory] [-t seconds] [-s frame_bytes] [-f camera_fps] [-c cluster_bytes]\n"
+            "          [-b buffer_bytes] [-i sync_ms] [-k]\n"
+            "  -d  directory to record to (default a new one in /tmp)\n"
+            "  -t  duration in seconds (default 5)\n"
+            "  -s  size of the generated JPEG frames in bytes (default 65536)\n"
+            "  -f  synthetic camera frame rate, 0 is unlimited (default 0)\n"
+            "  -c  cluster size of the file system (default 32768)\n"
+            "  -b  size of each staging buffer (default 262144)\n"
+            "  -i  interval between syncs in ms (default 2000)\n"
+            "  -k  keep the recording\n",
+            name);
+}
+
+int main(int argc, char **argv) {
+    int duration_s = 5;
+    bool keep = false;
+    char directory[256] = "";
+    synthetic_camera_config_t camera_config = SYNTHETIC_CAMERA_DEFAULT();
+    esp_recorder_config_t config = ESP_RECORDER_CONFIG_DEFAULT();
+
+    int opt;
+    while ((opt = getopt(argc, argv, "d:t:s:f:c:b:i:kh")) != -1) {
+        switch (opt) {
+            case 'd': snprintf(directory, sizeof(directory), "%s", optarg); break;
+            case 't': duration_s = atoi(optarg); break;
+            case 's': camera_config.frame_size = strtoul(optarg, NULL, 10); break;
+            case 'f': camera_config.fps = atoi(optarg); break;
+            case 'c': config.cluster_size = strtoul(optarg, NULL, 10); break;
+            case 'b': config.buffer_size = strtoul(optarg, NULL, 10); break;
+            case 'i': config.sync_interval_ms = strtoul(optarg, NULL, 10); break;
+            case 'k': keep = true; break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    esp_log_level_set("*", ESP_LOG_WARN);
+
+    bool temporary = !directory[0];
+    if (temporary) {
+        snprintf(directory, sizeof(directory), "/tmp/rtsp-record-bench-XXXXXX");
+        if (!mkdtemp(directory)) {
+            perror("mkdtemp");
+            return 1;
+        }
+    }
+    config.directory = directory;
+
+    if (synthetic_camera_init(&camera_config) != ESP_OK) {
+        return 1;
+    }
+    size_t frame_length;
+    synthetic_camera_frame(&frame_length);
+
+    esp_recorder_t *recorder;
+    esp_err_t err = esp_recorder_create(&config, &recorder);
+    if (err != ESP_OK) {
+        fprintf(stderr, "unable to create the recorder: %s\n", esp_err_to_name(err));
+        return 1;
+    }
+
+    printf("frame: %zu bytes, camera: %u fps, cluster: %zu, buffer: %zu, sync: %u ms, %d s to %s\n",
+           frame_length, (unsigned)camera_config.fps, config.cluster_size, config.buffer_size,
+           (unsigned)config.sync_interval_ms, duration_s, directory);
+
+    int64_t start = esp_timer_get_time();
+    esp_recorder_start(recorder);
+    vTaskDelay(pdMS_TO_TICKS(duration_s * 1000));
+
+    // The sustained rate, without the last write and the index of the file
+    esp_recorder_stats_t stats;
+    esp_recorder_get_stats(recorder, &stats);
+    synthetic_camera_stats_t camera;
+    synthetic_camera_get_stats(&camera);
+    double elapsed = (esp_timer_get_time() - start) / 1e6;
+    esp_recorder_delete(recorder);
+
+    printf("%9s %9s %8s %9s %8s %13s %13s %6s\n",
+           "frames/s", "camera/s", "dropped", "MB/s", "writes", "avg write us", "max write us", "syncs");
+    printf("%9.1f %9.1f %8u %9.2f %8u %13.0f %13u %6u\n",
+           stats.frames / elapsed,
+           camera.frames / elapsed,
+           (unsigned)stats.dropped,
+           stats.bytes / elapsed / 1e6,
+           (unsigned)stats.writes,
+           stats.writes ? (double)stats.write_us / stats.writes : 0.0,
+           (unsigned)stats.max_write_us,
+           (unsigned)stats.syncs);
+
+    if (temporary && !keep) {
+        char command[300];
+        snprintf(command, sizeof(command), "rm -r %s", directory);
+        system(command);
+    }
+    synthetic_camera_deinit();
+    return stats.frames && stats.files ? 0 : 1;
+}
@@ -0,0 +1,413 @@
+//
+// Reference RTP/JPEG (RFC 2435) receiver for host side tests and tools.
+//
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "rtp-jpeg-receiver.h"
+
+#define RTP_PAYLOAD_JPEG 26
+#define RTP_CLOCK_RATE 90000
+#define RTP_HEADER_SIZE 12
+#define RTP_JPEG_HEADER_SIZE 8
+#define RTP_RESTART_HEADER_SIZE 4
+#define RTP_QUANT_HEADER_SIZE 4
+
+#define MAX_SCAN_SIZE (16 * 1024 * 1024)
+
+// RFC 2435 Appendix A, in zigzag order
+static const uint8_t s_luma_quantizer[64] = {
+        16, 11, 12, 14, 12, 10, 16, 14, 13, 14, 18, 17, 16, 19, 24, 40,
+        26, 24, 22, 22, 24, 49, 35, 37, 29, 40, 58, 51, 61, 60, 57, 51,
+        56, 55, 64, 72, 92, 78, 64, 68, 87, 69, 55, 56, 80, 109, 81, 87,
+        95, 98, 103, 104, 103, 62, 77, 113, 121, 112, 100, 120, 92, 101, 103, 99
+};
+
+static const uint8_t s_chroma_quantizer[64] = {
+        17, 18, 18, 24, 21, 24, 47, 26, 26, 47, 99, 66, 56, 66, 99, 99,
+        99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99,
+        99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99,
+        99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99, 99
+};
+
+// Standard Huffman tables (JPEG Annex K.3), RFC 2435 senders assume these
+static const uint8_t s_dc_lum_bits[16] = { 0, 1, 5, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0, 0, 0 };
+static const uint8_t s_dc_lum_val[12] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+static const uint8_t s_dc_chroma_bits[16] = { 0, 3, 1, 1, 1, 1, 1, 1, 1, 1, 1, 0, 0, 0, 0, 0 };
+static const uint8_t s_dc_chroma_val[12] = { 0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11 };
+static const uint8_t s_ac_lum_bits[16] = { 0, 2, 1, 3, 3, 2, 4, 3, 5, 5, 4, 4, 0, 0, 1, 0x7d };
+static const uint8_t s_ac_lum_val[162] = {
+        0x01, 0x02, 0x03, 0x00, 0x04, 0x11, 0x05, 0x12, 0x21, 0x31, 0x41, 0x06, 0x13, 0x51, 0x61, 0x07,
+        0x22, 0x71, 0x14, 0x32, 0x81, 0x91, 0xa1, 0x08, 0x23, 0x42, 0xb1, 0xc1, 0x15, 0x52, 0xd1, 0xf0,
+        0x24, 0x33, 0x62, 0x72, 0x82, 0x09, 0x0a, 0x16, 0x17, 0x18, 0x19, 0x1a, 0x25, 0x26, 0x27, 0x28,
+        0x29, 0x2a, 0x34, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48, 0x49,
+        0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68, 0x69,
+        0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x83, 0x84, 0x85, 0x86, 0x87, 0x88, 0x89,
+        0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5, 0xa6, 0xa7,
+        0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3, 0xc4, 0xc5,
+        0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda, 0xe1, 0xe2,
+        0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf1, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+        0xf9, 0xfa
+};
+static const uint8_t s_ac_chroma_bits[16] = { 0, 2, 1, 2, 4, 4, 3, 4, 7, 5, 4, 4, 0, 1, 2, 0x77 };
+static const uint8_t s_ac_chroma_val[162] = {
+        0x00, 0x01, 0x02, 0x03, 0x11, 0x04, 0x05, 0x21, 0x31, 0x06, 0x12, 0x41, 0x51, 0x07, 0x61, 0x71,
+        0x13, 0x22, 0x32, 0x81, 0x08, 0x14, 0x42, 0x91, 0xa1, 0xb1, 0xc1, 0x09, 0x23, 0x33, 0x52, 0xf0,
+        0x15, 0x62, 0x72, 0xd1, 0x0a, 0x16, 0x24, 0x34, 0xe1, 0x25, 0xf1, 0x17, 0x18, 0x19, 0x1a, 0x26,
+        0x27, 0x28, 0x29, 0x2a, 0x35, 0x36, 0x37, 0x38, 0x39, 0x3a, 0x43, 0x44, 0x45, 0x46, 0x47, 0x48,
+        0x49, 0x4a, 0x53, 0x54, 0x55, 0x56, 0x57, 0x58, 0x59, 0x5a, 0x63, 0x64, 0x65, 0x66, 0x67, 0x68,
+        0x69, 0x6a, 0x73, 0x74, 0x75, 0x76, 0x77, 0x78, 0x79, 0x7a, 0x82, 0x83, 0x84, 0x85, 0x86, 0x87,
+        0x88, 0x89, 0x8a, 0x92, 0x93, 0x94, 0x95, 0x96, 0x97, 0x98, 0x99, 0x9a, 0xa2, 0xa3, 0xa4, 0xa5,
+        0xa6, 0xa7, 0xa8, 0xa9, 0xaa, 0xb2, 0xb3, 0xb4, 0xb5, 0xb6, 0xb7, 0xb8, 0xb9, 0xba, 0xc2, 0xc3,
+        0xc4, 0xc5, 0xc6, 0xc7, 0xc8, 0xc9, 0xca, 0xd2, 0xd3, 0xd4, 0xd5, 0xd6, 0xd7, 0xd8, 0xd9, 0xda,
+        0xe2, 0xe3, 0xe4, 0xe5, 0xe6, 0xe7, 0xe8, 0xe9, 0xea, 0xf2, 0xf3, 0xf4, 0xf5, 0xf6, 0xf7, 0xf8,
+        0xf9, 0xfa
+};
+
+// RFC 2435 Appendix A, MakeTables()
+static void make_tables(uint8_t q, uint8_t *tables) {
+    int factor = q < 1 ? 1 : q > 99 ? 99 : q;
+    factor = factor < 50 ? 5000 / factor : 200 - factor * 2;
+
+    for (int i = 0; i < 64; i++) {
+        int lq = (s_luma_quantizer[i] * factor + 50) / 100;
+        int cq = (s_chroma_quantizer[i] * factor + 50) / 100;
+        tables[i] = lq < 1 ? 1 : lq > 255 ? 255 : lq;
+        tables[i + 64] = cq < 1 ? 1 : cq > 255 ? 255 : cq;
+    }
+}
+
+static uint8_t *put_huffman_table(uint8_t *p, uint8_t id, const uint8_t *bits, const uint8_t *values, int count) {
+    *p++ = 0xFF;
+    *p++ = 0xC4; // DHT
+    *p++ = 0;
+    *p++ = 3 + 16 + count;
+    *p++ = id;
+    memcpy(p, bits, 16);
+    p += 16;
+    memcpy(p, values, count);
+    return p + count;
+}
+
+// RFC 2435 Appendix B, MakeHeaders()
+static size_t make_headers(const rtp_jpeg_receiver_t *receiver, uint8_t *p) {
+    uint8_t *start = p;
+
+    *p++ = 0xFF;
+    *p++ = 0xD8; // SOI
+
+    for (int table = 0; table < 2; table++) {
+        *p++ = 0xFF;
+        *p++ = 0xDB; // DQT
+        *p++ = 0;
+        *p++ = 3 + 64;
+        *p++ = table;
+        memcpy(p, receiver->quant + 64 * table, 64);
+        p += 64;
+    }
+
+    *p++ = 0xFF;
+    *p++ = 0xC0; // SOF0
+    *p++ = 0;
+    *p++ = 17;
+    *p++ = 8;
+    *p++ = receiver->height >> 8;
+    *p++ = receiver->height & 0xFF;
+    *p++ = receiver->width >> 8;
+    *p++ = receiver->width & 0xFF;
+    *p++ = 3;
+    *p++ = 1; *p++ = (receiver->type & 0x3F) == 0 ? 0x21 : 0x22; *p++ = 0;
+    *p++ = 2; *p++ = 0x11; *p++ = 1;
+    *p++ = 3; *p++ = 0x11; *p++ = 1;
+
+    p = put_huffman_table(p, 0x00, s_dc_lum_bits, s_dc_lum_val, sizeof(s_dc_lum_val));
+    p = put_huffman_table(p, 0x10, s_ac_lum_bits, s_ac_lum_val, sizeof(s_ac_lum_val));
+    p = put_huffman_table(p, 0x01, s_dc_chroma_bits, s_dc_chroma_val, sizeof(s_dc_chroma_val));
+    p = put_huffman_table(p, 0x11, s_ac_chroma_bits, s_ac_chroma_val, sizeof(s_ac_chroma_val));
+
+    if (receiver->restart_interval) {
+        *p++ = 0xFF;
+        *p++ = 0xDD; // DRI
+        *p++ = 0;
+        *p++ = 4;
+        *p++ = receiver->restart_interval >> 8;
+        *p++ = receiver->restart_interval & 0xFF;
+    }
+
+    *p++ = 0xFF;
+    *p++ = 0xDA; // SOS
+    *p++ = 0;
+    *p++ = 12;
+    *p++ = 3;
+    *p++ = 1; *p++ = 0x00;
+    *p++ = 2; *p++ = 0x11;
+    *p++ = 3; *p++ = 0x11;
+    *p++ = 0; *p++ = 63; *p++ = 0;
+
+    return p - start;
+}
+
+static int finish_frame(rtp_jpeg_receiver_t *receiver) {
+    size_t needed = RTP_JPEG_RECEIVER_HEADER_SIZE + receiver->scan_length + 2;
+    if (needed > receiver->frame_capacity) {
+        uint8_t *frame = realloc(receiver->frame, needed);
+        if (!frame) {
+            return -1;
+        }
+        receiver->frame = frame;
+        receiver->frame_capacity = needed;
+    }
+
+    size_t length = make_headers(receiver, receiver->frame);
+    memcpy(receiver->frame + length, receiver->scan, receiver->scan_length);
+    length += receiver->scan_length;
+
+    if (receiver->scan_length < 2 ||
+        receiver->scan[receiver->scan_length - 2] != 0xFF || receiver->scan[receiver->scan_length - 1] != 0xD9) {
+        receiver->frame[length++] = 0xFF;
+        receiver->frame[length++] = 0xD9; // EOI
+    }
+
+    receiver->frame_length = length;
+    return 0;
+}
+
+int rtp_jpeg_receiver_init(rtp_jpeg_receiver_t *receiver) {
+    memset(receiver, 0, sizeof(*receiver));
+    rtp_jpeg_receiver_reset_stats(receiver);
+    return 0;
+}
+
+void rtp_jpeg_receiver_free(rtp_jpeg_receiver_t *receiver) {
+    free(receiver->scan);
+    free(receiver->frame);
+    memset(receiver, 0, sizeof(*receiver));
+}
+
+void rtp_jpeg_receiver_reset_stats(rtp_jpeg_receiver_t *receiver) {
+    memset(&receiver->stats, 0, sizeof(receiver->stats));
+    receiver->stats.drift_min_us = INT64_MAX;
+    receiver->stats.drift_max_us = INT64_MIN;
+
+    // Loss and drift are counted from the next packet on
+    receiver->synced = 0;
+}
+
+const uint8_t *rtp_jpeg_receiver_frame(rtp_jpeg_receiver_t *receiver, size_t *length) {
+    if (length) {
+        *length = receiver->frame_length;
+    }
+    return receiver->frame_length ? receiver->frame : NULL;
+}
+
+static void update_sequence(rtp_jpeg_receiver_t *receiver, uint16_t sequence) {
+    uint16_t delta = sequence - receiver->max_sequence;
+    if (delta != 0 && delta < 0x8000) {
+        if (sequence < receiver->max_sequence) {
+            receiver->sequence_cycles += 0x10000;
+        }
+        receiver->max_sequence = sequence;
+    } else {
+        receiver->stats.reordered++; // Late or duplicated
+    }
+}
+
+// Returns 1 for the first packet of a new frame
+static int update_timing(rtp_jpeg_receiver_t *receiver, uint32_t timestamp, int64_t arrival_us) {
+    rtp_jpeg_receiver_stats_t *stats = &receiver->stats;
+
+    int32_t delta = (int32_t)(timestamp - receiver->last_timestamp);
+    int64_t timestamp_ext = receiver->timestamp_ext + delta;
+
+    // RFC 3550 section 6.4.1, in 90 kHz ticks
+    int64_t transit = arrival_us * RTP_CLOCK_RATE / 1000000 - timestamp_ext;
+    int64_t d = transit - receiver->last_transit;
+    receiver->last_transit = transit;
+    double d_us = (double)(d < 0 ? -d : d) * 1000000 / RTP_CLOCK_RATE;
+    stats->jitter_us += (d_us - stats->jitter_us) / 16;
+
+    if (delta <= 0) {
+        return 0;
+    }
+
+    receiver->last_timestamp = timestamp;
+    receiver->timestamp_ext = timestamp_ext;
+
+    int64_t media_us = (timestamp_ext - receiver->first_timestamp_ext) * 1000000 / RTP_CLOCK_RATE;
+    stats->drift_us = arrival_us - receiver->first_arrival_us - media_us;
+    if (stats->drift_us < stats->drift_min_us) {
+        stats->drift_min_us = stats->drift_us;
+    }
+    if (stats->drift_us > stats->drift_max_us) {
+        stats->drift_max_us = stats->drift_us;
+    }
+    return 1;
+}
+
+static void sync_stream(rtp_jpeg_receiver_t *receiver, uint32_t ssrc, uint16_t sequence, uint32_t timestamp,
+                        int64_t arrival_us) {
+    receiver->synced = 1;
+    receiver->ssrc = ssrc;
+    receiver->base_sequence = sequence;
+    receiver->max_sequence = sequence;
+    receiver->sequence_cycles = 0;
+    receiver->expected_before = receiver->stats.expected;
+    receiver->last_timestamp = timestamp - 1;
+    receiver->timestamp_ext = -1;
+    receiver->first_timestamp_ext = 0;
+    receiver->first_arrival_us = arrival_us;
+    receiver->last_transit = arrival_us * RTP_CLOCK_RATE / 1000000;
+    receiver->in_frame = 0;
+    receiver->joining = 1;
+}
+
+int rtp_jpeg_receiver_packet(rtp_jpeg_receiver_t *receiver, const uint8_t *packet, size_t length, int64_t arrival_us) {
+    rtp_jpeg_receiver_stats_t *stats = &receiver->stats;
+
+    if (length < RTP_HEADER_SIZE + RTP_JPEG_HEADER_SIZE || packet[0] >> 6 != 2 ||
+        (packet[1] & 0x7F) != RTP_PAYLOAD_JPEG) {
+        stats->malformed++;
+        return -1;
+    }
+
+    const uint8_t *end = packet + length;
+    if (packet[0] & 0x20) { // Padding
+        end -= end[-1];
+    }
+    const uint8_t *p = packet + RTP_HEADER_SIZE + 4 * (packet[0] & 0x0F); // CSRCs
+    if ((packet[0] & 0x10) && p + 4 <= end) { // Header extension
+        p += 4 + 4 * (p[2] << 8 | p[3]);
+    }
+    if (p + RTP_JPEG_HEADER_SIZE > end) {
+        stats->malformed++;
+        return -1;
+    }
+
+    int marker = packet[1] & 0x80;
+    uint16_t sequence = packet[2] << 8 | packet[3];
+    uint32_t timestamp = (uint32_t)packet[4] << 24 | packet[5] << 16 | packet[6] << 8 | packet[7];
+    uint32_t ssrc = (uint32_t)packet[8] << 24 | packet[9] << 16 | packet[10] << 8 | packet[11];
+
+    uint32_t offset = p[1] << 16 | p[2] << 8 | p[3];
+    uint8_t type = p[4];
+    uint8_t q = p[5];
+    uint16_t width = p[6] * 8;
+    uint16_t height = p[7] * 8;
+    p += RTP_JPEG_HEADER_SIZE;
+
+    if ((type & 0x3F) > 1 || type > 127) {
+        stats->malformed++;
+        return -1;
+    }
+
+    uint16_t restart_interval = 0;
+    if (type >= 64) {
+        if (p + RTP_RESTART_HEADER_SIZE > end) {
+            stats->malformed++;
+            return -1;
+        }
+        restart_interval = p[0] << 8 | p[1];
+        p += RTP_RESTART_HEADER_SIZE;
+    }
+
+    const uint8_t *quant = NULL;
+    uint16_t quant_length = 0;
+    if (q >= 128 && offset == 0) {
+        if (p + RTP_QUANT_HEADER_SIZE > end) {
+            stats->malformed++;
+            return -1;
+        }
+        uint8_t precision = p[1];
+        quant_length = p[2] << 8 | p[3];
+        p += RTP_QUANT_HEADER_SIZE;
+        // Only 8 bit tables, one shared or a luma and a chroma table
+        if (precision != 0 || (quant_length != 0 && quant_length != 64 && quant_length != 128) ||
+            p + quant_length > end) {
+            stats->malformed++;
+            return -1;
+        }
+        quant = p;
+        p += quant_length;
+    }
+
+    if (offset + (end - p) > MAX_SCAN_SIZE) {
+        stats->malformed++;
+        return -1;
+    }
+
+    if (!receiver->synced || ssrc != receiver->ssrc) {
+        sync_stream(receiver, ssrc, sequence, timestamp, arrival_us);
+    } else {
+        update_sequence(receiver, sequence);
+    }
+
+    stats->packets++;
+    stats->expected = receiver->expected_before +
+                      receiver->sequence_cycles + receiver->max_sequence - receiver->base_sequence + 1;
+    stats->lost = stats->expected > stats->packets ? stats->expected - stats->packets : 0;
+    if (update_timing(receiver, timestamp, arrival_us)) {
+        if (receiver->in_frame) {
+            stats->frames_incomplete++; // The marker packet never arrived
+        }
+        if (receiver->joining && offset != 0) {
+            receiver->in_frame = 0;
+            return 0; // Joined the stream halfway a frame
+        }
+        receiver->joining = 0;
+        receiver->in_frame = 1;
+        receiver->frame_timestamp = timestamp;
+        receiver->scan_received = 0;
+        receiver->scan_length = 0;
+    } else if (!receiver->in_frame || timestamp != receiver->frame_timestamp) {
+        return 0; // Straggler of a frame that was already finished or given up on
+    }
+
+    if (offset == 0) {
+        receiver->type = type;
+        receiver->q = q;
+        receiver->width = width;
+        receiver->height = height;
+        receiver->restart_interval = restart_interval;
+        if (q < 128) {
+            make_tables(q, receiver->quant);
+            receiver->have_quant = 1;
+        } else if (quant_length) {
+            // Without a chroma table the luma table is used for both
+            memcpy(receiver->quant, quant, 64);
+            memcpy(receiver->quant + 64, quant + (quant_length == 128 ? 64 : 0), 64);
+            receiver->have_quant = 1;
+        } // A length of 0 keeps the tables of the previous frame
+    }
+
+    size_t fragment = end - p;
+    if (offset + fragment > receiver->scan_capacity) {
+        size_t capacity = receiver->scan_capacity ? receiver->scan_capacity : 64 * 1024;
+        while (capacity < offset + fragment) {
+            capacity *= 2;
+        }
+        uint8_t *scan = realloc(receiver->scan, capacity);
+        if (!scan) {
+            return -1;
+        }
+        receiver->scan = scan;
+        receiver->scan_capacity = capacity;
+    }
+    memcpy(receiver->scan + offset, p, fragment);
+    receiver->scan_received += fragment;
+
+    if (!marker) {
+        return 0;
+    }
+
+    receiver->in_frame = 0;
+    receiver->scan_length = offset + fragment;
+    if (receiver->scan_received != receiver->scan_length || !receiver->have_quant || finish_frame(receiver) != 0) {
+        stats->frames_incomplete++;
+        return 0;
+    }
+
+    stats->frames_complete++;
+    stats->goodput_bytes += receiver->scan_length;
+    return 1;
+}
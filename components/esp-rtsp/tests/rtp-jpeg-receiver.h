@@ -0,0 +1,84 @@
+//
+// Reference RTP/JPEG (RFC 2435) receiver for host side tests and tools.
+//
+// Reassembles the JPEG frames of a single RTP stream, rebuilding the headers
+// the sender stripped from the quant tables carried in band (or the Q factor),
+// and keeps the statistics needed to judge a stream: completeness, loss,
+// interarrival jitter, RTP timestamp drift against arrival time and goodput.
+//
+
+#ifndef ESPCAM_RTP_JPEG_RECEIVER_H
+#define ESPCAM_RTP_JPEG_RECEIVER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define RTP_JPEG_RECEIVER_HEADER_SIZE 1024 // Generated JPEG headers always fit
+
+typedef struct {
+    uint64_t packets;
+    uint64_t expected;           // Packets according to the sequence numbers
+    uint64_t lost;
+    uint64_t reordered;
+    uint64_t malformed;
+    uint64_t frames_complete;
+    uint64_t frames_incomplete;
+    uint64_t goodput_bytes;      // Scan data of complete frames
+    double jitter_us;            // RFC 3550 interarrival jitter
+    int64_t drift_us;            // Arrival time minus RTP time since the first frame
+    int64_t drift_min_us;
+    int64_t drift_max_us;
+} rtp_jpeg_receiver_stats_t;
+
+typedef struct {
+    // Stream state
+    int synced;
+    uint32_t ssrc;
+    uint16_t max_sequence;
+    uint32_t sequence_cycles;
+    uint32_t base_sequence;
+    uint64_t expected_before;    // Packets expected from earlier sources
+    uint32_t last_timestamp;
+    int64_t timestamp_ext;       // Unwrapped last_timestamp
+    int64_t first_arrival_us;
+    int64_t first_timestamp_ext;
+    int64_t last_transit;        // For the jitter estimate, in 90 kHz ticks
+
+    // Frame being reassembled
+    int joining;
+    int in_frame;
+    uint32_t frame_timestamp;
+    uint8_t type;
+    uint8_t q;
+    uint16_t width;
+    uint16_t height;
+    uint16_t restart_interval;
+    uint8_t quant[128];
+    int have_quant;
+    uint8_t *scan;
+    size_t scan_capacity;
+    size_t scan_received;        // Sum of fragment lengths
+    size_t scan_length;          // End of the fragment carrying the marker bit
+
+    // Last complete frame, headers and scan data
+    uint8_t *frame;
+    size_t frame_capacity;
+    size_t frame_length;
+
+    rtp_jpeg_receiver_stats_t stats;
+} rtp_jpeg_receiver_t;
+
+int rtp_jpeg_receiver_init(rtp_jpeg_receiver_t *receiver);
+void rtp_jpeg_receiver_free(rtp_jpeg_receiver_t *receiver);
+
+// Feed one RTP packet received at arrival_us (microseconds, any monotonic
+// clock). Returns 1 when it completed a frame, 0 when it did not and -1 when
+// the packet is not valid RTP/JPEG.
+int rtp_jpeg_receiver_packet(rtp_jpeg_receiver_t *receiver, const uint8_t *packet, size_t length, int64_t arrival_us);
+
+// The last complete frame as a JPEG file
+const uint8_t *rtp_jpeg_receiver_frame(rtp_jpeg_receiver_t *receiver, size_t *length);
+
+void rtp_jpeg_receiver_reset_stats(rtp_jpeg_receiver_t *receiver);
+
+#endif //ESPCAM_RTP_JPEG_RECEIVER_H
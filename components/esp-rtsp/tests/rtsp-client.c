@@ -0,0 +1,218 @@
+//
+// Minimal RTSP/RTP client for host side tests, benchmarks and tools.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <poll.h>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "rtsp-client.h"
+
+#define RTP_PORT_BASE 50000
+
+static int bind_udp(uint16_t port) {
+    int sock = socket(AF_INET, SOCK_DGRAM, 0);
+    if (sock < 0) {
+        return -1;
+    }
+
+    struct sockaddr_in addr = {
+            .sin_family = AF_INET,
+            .sin_addr.s_addr = htonl(INADDR_ANY),
+            .sin_port = htons(port)
+    };
+    if (bind(sock, (struct sockaddr *)&addr, sizeof(addr)) < 0) {
+        close(sock);
+        return -1;
+    }
+
+    // Frames arrive in bursts, give the kernel room to hold a few of them
+    int rcvbuf = 4 * 1024 * 1024;
+    setsockopt(sock, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    return sock;
+}
+
+int rtsp_client_connect(rtsp_client_t *client, const char *host, int port, const char *path) {
+    memset(client, 0, sizeof(rtsp_client_t));
+    client->socket = -1;
+    client->rtp_socket = -1;
+    client->rtcp_socket = -1;
+
+    char service[16];
+    snprintf(service, sizeof(service), "%d", port);
+
+    struct addrinfo hints = {
+            .ai_family = AF_INET,
+            .ai_socktype = SOCK_STREAM
+    };
+    struct addrinfo *result;
+    if (getaddrinfo(host, service, &hints, &result) != 0) {
+        return -1;
+    }
+
+    client->socket = socket(result->ai_family, result->ai_socktype, result->ai_protocol);
+    if (client->socket < 0 || connect(client->socket, result->ai_addr, result->ai_addrlen) < 0) {
+        freeaddrinfo(result);
+        rtsp_client_close(client);
+        return -1;
+    }
+    freeaddrinfo(result);
+
+    snprintf(client->url, sizeof(client->url), "rtsp://%s:%d%s", host, port, path);
+    return 0;
+}
+
+// Reads one response into client->response, including a body announced
+// through Content-Length
+static int read_response(rtsp_client_t *client) {
+    size_t len = 0;
+    char *body = NULL;
+    size_t content_length = 0;
+
+    for (;;) {
+        if (len >= sizeof(client->response) - 1) {
+            return -1;
+        }
+
+        ssize_t n = recv(client->socket, client->response + len, sizeof(client->response) - 1 - len, 0);
+        if (n <= 0) {
+            return -1;
+        }
+        len += n;
+        client->response[len] = 0;
+
+        if (!body) {
+            char *end = strstr(client->response, "\r\n\r\n");
+            if (!end) {
+                continue;
+            }
+            body = end + 4;
+
+            for (char *line = client->response; line && line < body; line = strstr(line, "\r\n")) {
+                line += (line[0] == '\r') ? 2 : 0;
+                if (strncasecmp(line, "Content-Length:", 15) == 0) {
+                    content_length = strtoul(line + 15, NULL, 10);
+                }
+            }
+        }
+
+        if ((size_t)(client->response + len - body) >= content_length) {
+            break;
+        }
+    }
+
+    int status;
+    if (sscanf(client->response, "RTSP/1.0 %d", &status) != 1) {
+        return -1;
+    }
+    return status;
+}
+
+int rtsp_client_request(rtsp_client_t *client, const char *method, const char *headers) {
+    return rtsp_client_request_body(client, method, headers, NULL);
+}
+
+int rtsp_client_request_body(rtsp_client_t *client, const char *method, const char *headers, const char *body) {
+    char request[1024];
+    char content_length[32] = "";
+    if (body) {
+        snprintf(content_length, sizeof(content_length), "Content-Length: %zu\r\n", strlen(body));
+    }
+    int len = snprintf(request, sizeof(request),
+                       "%s %s RTSP/1.0\r\n"
+                       "CSeq: %d\r\n"
+                       "%s%s"
+                       "\r\n"
+                       "%s",
+                       method, client->url, ++client->cseq, headers ? headers : "", content_length, body ? body : "");
+    if (len >= (int)sizeof(request)) {
+        return -1;
+    }
+
+    if (send(client->socket, request, len, MSG_NOSIGNAL) != len) {
+        return -1;
+    }
+
+    return read_response(client);
+}
+
+int rtsp_client_setup(rtsp_client_t *client) {
+    for (uint16_t port = RTP_PORT_BASE + (getpid() % 1000) * 2; port < 0xFFFE; port += 2) {
+        int rtp = bind_udp(port);
+        if (rtp < 0) {
+            continue;
+        }
+        int rtcp = bind_udp(port + 1);
+        if (rtcp < 0) {
+            close(rtp);
+            continue;
+        }
+        client->rtp_socket = rtp;
+        client->rtcp_socket = rtcp;
+        client->rtp_port = port;
+        break;
+    }
+
+    if (client->rtp_socket < 0) {
+        return -1;
+    }
+
+    char transport[128];
+    snprintf(transport, sizeof(transport), "Transport: RTP/AVP;unicast;client_port=%d-%d\r\n",
+             client->rtp_port, client->rtp_port + 1);
+
+    int status = rtsp_client_request(client, "SETUP", transport);
+    if (status == 200) {
+        char *server_port = strstr(client->response, "server_port=");
+        if (server_port) {
+            client->server_rtp_port = atoi(server_port + 12);
+        }
+    }
+    return status;
+}
+
+int rtsp_client_play(rtsp_client_t *client) {
+    return rtsp_client_request(client, "PLAY", "Session: 12348765\r\n");
+}
+
+int rtsp_client_teardown(rtsp_client_t *client) {
+    return rtsp_client_request(client, "TEARDOWN", "Session: 12348765\r\n");
+}
+
+void rtsp_client_close(rtsp_client_t *client) {
+    if (client->socket >= 0) {
+        close(client->socket);
+        client->socket = -1;
+    }
+    if (client->rtp_socket >= 0) {
+        close(client->rtp_socket);
+        client->rtp_socket = -1;
+    }
+    if (client->rtcp_socket >= 0) {
+        close(client->rtcp_socket);
+        client->rtcp_socket = -1;
+    }
+}
+
+int rtsp_client_receive(rtsp_client_t *client, uint8_t *buffer, size_t size, int timeout_ms) {
+    struct pollfd pfd = {
+            .fd = client->rtp_socket,
+            .events = POLLIN
+    };
+
+    int n = poll(&pfd, 1, timeout_ms);
+    if (n <= 0) {
+        return n < 0 && errno != EINTR ? -1 : 0;
+    }
+
+    ssize_t len = recv(client->rtp_socket, buffer, size, 0);
+    return len < 0 ? -1 : (int)len;
+}
@@ -0,0 +1,37 @@
+//
+// Minimal RTSP/RTP client for host side tests, benchmarks and tools.
+//
+
+#ifndef ESPCAM_RTSP_CLIENT_H
+#define ESPCAM_RTSP_CLIENT_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define RTSP_CLIENT_RESPONSE_SIZE 4096
+
+typedef struct {
+    int socket;
+    int rtp_socket;
+    int rtcp_socket;
+    uint16_t rtp_port;
+    uint16_t server_rtp_port;
+    int cseq;
+    char url[256];
+    char response[RTSP_CLIENT_RESPONSE_SIZE];
+} rtsp_client_t;
+
+// All functions return a negative value on a socket or protocol error, the
+// request functions return the RTSP status code of the response otherwise.
+int rtsp_client_connect(rtsp_client_t *client, const char *host, int port, const char *path);
+int rtsp_client_request(rtsp_client_t *client, const char *method, const char *headers);
+int rtsp_client_request_body(rtsp_client_t *client, const char *method, const char *headers, const char *body);
+int rtsp_client_setup(rtsp_client_t *client);
+int rtsp_client_play(rtsp_client_t *client);
+int rtsp_client_teardown(rtsp_client_t *client);
+void rtsp_client_close(rtsp_client_t *client);
+
+// Receive a single RTP packet, returns its length, 0 on timeout
+int rtsp_client_receive(rtsp_client_t *client, uint8_t *buffer, size_t size, int timeout_ms);
+
+#endif //ESPCAM_RTSP_CLIENT_H
@@ -0,0 +1,63 @@
+//
+// Host build of the RTSP server streaming the synthetic camera, to point
+// rtsp_receiver or a video player at.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <signal.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include "esp_err.h"
+#include "esp_log.h"
+
+#include "esp-rtsp.h"
+#include "synthetic-camera.h"
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "usage: %s [-s frame_bytes] [-f camera_fps] [-j file.jpg] [-y] [-v]\n"
+            "  -s  size of the generated JPEG frames in bytes (default 65536)\n"
+            "  -f  synthetic camera frame rate, 0 is unlimited (default 0)\n"
+            "  -j  stream this JPEG file instead of a generated frame\n"
+            "  -y  stream YUV422 frames, encoded to JPEG in software while they are sent\n"
+            "  -v  log at debug level\n",
+            name);
+}
+
+int main(int argc, char **argv) {
+    synthetic_camera_config_t config = SYNTHETIC_CAMERA_DEFAULT();
+    esp_log_level_t level = ESP_LOG_INFO;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "s:f:j:yvh")) != -1) {
+        switch (opt) {
+            case 's': config.frame_size = strtoul(optarg, NULL, 10); break;
+            case 'f': config.fps = atoi(optarg); break;
+            case 'j': config.jpeg_path = optarg; break;
+            case 'y': config.pixformat = PIXFORMAT_YUV422; break;
+            case 'v': level = ESP_LOG_DEBUG; break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    signal(SIGPIPE, SIG_IGN);
+    esp_log_level_set("*", level);
+
+    if (synthetic_camera_init(&config) != ESP_OK) {
+        return 1;
+    }
+
+    esp_rtsp_server_handle_t server;
+    if (esp_rtsp_server_start(&server) != ESP_OK) {
+        return 1;
+    }
+
+    printf("rtsp://127.0.0.1:%d/mjpeg/1\n", RTSP_PORT);
+    fflush(stdout);
+    pause();
+    return 0;
+}
@@ -0,0 +1,287 @@
+//
+// Decoder of the event trace of esp-trace.h.
+//
+// Reads a dump from GET /trace, or a console log with the lines of
+// esp_trace_dump_console() among the rest, and prints the records as a
+// timeline in the order they happened on any core, followed by the duration
+// of the captures and of sending a frame to each connection.
+//
+//   curl -s http://camera/trace > trace.bin && rtsp_trace trace.bin
+//   idf.py monitor | tee console.log; rtsp_trace -q console.log
+//
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <getopt.h>
+
+#include "esp-trace.h"
+
+#define MAX_CORES 2
+#define MAX_CONNECTIONS 16
+
+typedef struct {
+    uint64_t time_us; // Unwrapped
+    size_t order;     // In the dump, for records at the same time
+    esp_trace_record_t record;
+} event_t;
+
+typedef struct {
+    event_t *events;
+    size_t count;
+    size_t capacity;
+    uint64_t lost;
+    uint32_t last_time[MAX_CORES];
+    uint64_t epoch[MAX_CORES];
+    bool started[MAX_CORES];
+} trace_t;
+
+typedef struct {
+    const char *name;
+    uint64_t count;
+    uint64_t total_us;
+    uint64_t min_us;
+    uint64_t max_us;
+} span_t;
+
+static const char *event_names[] = {
+#define ESP_TRACE_NAME(id, name) name,
+        ESP_TRACE_EVENTS(ESP_TRACE_NAME)
+#undef ESP_TRACE_NAME
+};
+
+static void usage(const char *name) {
+    fprintf(stderr,
+            "usage: %s [-q] [file]\n"
+            "  -q  only print the durations, not every record\n"
+            "  reads a binary dump from /trace or a console log, from stdin without a file\n",
+            name);
+}
+
+// The time of the records is the low 32 bits of esp_timer, it goes back when it wraps
+static void add_record(trace_t *trace, const esp_trace_record_t *record) {
+    uint8_t core = record->core < MAX_CORES ? record->core : 0;
+    if (trace->started[core] && record->time_us < trace->last_time[core]
+        && trace->last_time[core] - record->time_us > UINT32_MAX / 2) {
+        trace->epoch[core] += 1ULL << 32;
+    }
+    trace->started[core] = true;
+    trace->last_time[core] = record->time_us;
+
+    if (trace->count == trace->capacity) {
+        trace->capacity = trace->capacity ? trace->capacity * 2 : 1024;
+        trace->events = realloc(trace->events, trace->capacity * sizeof(event_t));
+        if (!trace->events) {
+            fprintf(stderr, "out of memory\n");
+            exit(1);
+        }
+    }
+    trace->events[trace->count] = (event_t) {
+            .time_us = trace->epoch[core] + record->time_us,
+            .order = trace->count,
+            .record = *record,
+    };
+    trace->count++;
+}
+
+// A header or a record, both are the size of a record
+static bool add_block(trace_t *trace, const uint8_t *block) {
+    esp_trace_header_t header;
+    memcpy(&header, block, sizeof(header));
+    if (memcmp(header.magic, ESP_TRACE_MAGIC, sizeof(header.magic)) == 0) {
+        if (header.version != ESP_TRACE_VERSION || header.record_size != sizeof(esp_trace_record_t)) {
+            fprintf(stderr, "unsupported trace version %u with records of %u bytes\n",
+                    header.version, header.record_size);
+            return false;
+        }
+        trace->lost += header.lost;
+        return true;
+    }
+
+    esp_trace_record_t record;
+    memcpy(&record, block, sizeof(record));
+    add_record(trace, &record);
+    return true;
+}
+
+static bool read_binary(trace_t *trace, FILE *file) {
+    uint8_t block[sizeof(esp_trace_record_t)];
+    while (fread(block, sizeof(block), 1, file) == 1) {
+        if (!add_block(trace, block)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static int hex_digit(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// The trace lines are mixed with the log, possibly after a prefix of the monitor
+static bool read_console(trace_t *trace, FILE *file, const char *first, size_t first_length) {
+    char line[1024];
+    size_t length = first_length < sizeof(line) - 1 ? first_length : sizeof(line) - 1;
+    memcpy(line, first, length);
+    line[length] = '\0';
+    if (!strchr(line, '\n') && !fgets(line + length, sizeof(line) - length, file)) {
+        line[length] = '\0';
+    }
+
+    do {
+        const char *hex = strstr(line, ESP_TRACE_CONSOLE_PREFIX);
+        if (!hex) {
+            continue;
+        }
+        hex += strlen(ESP_TRACE_CONSOLE_PREFIX);
+
+        uint8_t block[sizeof(esp_trace_record_t)];
+        size_t i = 0;
+        for (; i < sizeof(block); i++) {
+            int high = hex_digit(hex[2 * i]), low = high < 0 ? -1 : hex_digit(hex[2 * i + 1]);
+            if (low < 0) {
+                break;
+            }
+            block[i] = high << 4 | low;
+        }
+        if (i == sizeof(block) && !add_block(trace, block)) {
+            return false;
+        }
+    } while (fgets(line, sizeof(line), file));
+    return true;
+}
+
+static int compare_events(const void *a, const void *b) {
+    const event_t *x = a, *y = b;
+    if (x->time_us != y->time_us) {
+        return x->time_us < y->time_us ? -1 : 1;
+    }
+    return x->order < y->order ? -1 : x->order > y->order;
+}
+
+static void span_add(span_t *span, uint64_t us) {
+    if (!span->count || us < span->min_us) {
+        span->min_us = us;
+    }
+    if (us > span->max_us) {
+        span->max_us = us;
+    }
+    span->count++;
+    span->total_us += us;
+}
+
+static void span_print(const span_t *span) {
+    if (!span->count) {
+        return;
+    }
+    printf("%-22s %8llu %10.3f %10.3f %10.3f\n", span->name, (unsigned long long)span->count,
+           span->min_us / 1000.0, (double)span->total_us / span->count / 1000.0, span->max_us / 1000.0);
+}
+
+int main(int argc, char **argv) {
+    bool quiet = false;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "qh")) != -1) {
+        switch (opt) {
+            case 'q': quiet = true; break;
+            default:
+                usage(argv[0]);
+                return opt == 'h' ? 0 : 1;
+        }
+    }
+
+    FILE *file = stdin;
+    if (optind < argc && !(file = fopen(argv[optind], "rb"))) {
+        fprintf(stderr, "unable to open %s\n", argv[optind]);
+        return 1;
+    }
+
+    trace_t trace = { 0 };
+    char start[sizeof(ESP_TRACE_MAGIC) - 1];
+    size_t start_length = fread(start, 1, sizeof(start), file);
+    bool ok;
+    if (start_length == sizeof(start) && memcmp(start, ESP_TRACE_MAGIC, sizeof(start)) == 0) {
+        uint8_t block[sizeof(esp_trace_record_t)];
+        memcpy(block, start, sizeof(start));
+        ok = fread(block + sizeof(start), sizeof(block) - sizeof(start), 1, file) == 1
+             && add_block(&trace, block) && read_binary(&trace, file);
+    } else {
+        ok = read_console(&trace, file, start, start_length);
+    }
+    if (file != stdin) {
+        fclose(file);
+    }
+    if (!ok) {
+        return 1;
+    }
+
+    qsort(trace.events, trace.count, sizeof(event_t), compare_events);
+
+    span_t capture = { .name = "capture" };
+    span_t send[MAX_CONNECTIONS] = { 0 };
+    uint64_t capture_begin = 0, send_begin[MAX_CONNECTIONS] = { 0 };
+    bool capturing = false, sending[MAX_CONNECTIONS] = { false };
+    char send_names[MAX_CONNECTIONS][32];
+
+    if (!quiet) {
+        printf("%12s %10s %4s  %-16s %10s %10s\n", "time ms", "delta us", "core", "event", "arg0", "arg1");
+    }
+    uint64_t first = trace.count ? trace.events[0].time_us : 0, previous = first;
+    for (size_t i = 0; i < trace.count; i++) {
+        const event_t *event = &trace.events[i];
+        const esp_trace_record_t *record = &event->record;
+        if (!quiet) {
+            const char *name = record->id < ESP_TRACE_EVENT_COUNT ? event_names[record->id] : "unknown";
+            printf("%12.3f %10llu %4u  %-16s %10u %10u\n", (event->time_us - first) / 1000.0,
+                   (unsigned long long)(event->time_us - previous), record->core, name, record->arg0, record->arg1);
+        }
+        previous = event->time_us;
+
+        uint32_t connection = record->arg0 % MAX_CONNECTIONS;
+        switch (record->id) {
+            case ESP_TRACE_CAPTURE_BEGIN:
+                capturing = true;
+                capture_begin = event->time_us;
+                break;
+            case ESP_TRACE_CAPTURE_END:
+                if (capturing) {
+                    span_add(&capture, event->time_us - capture_begin);
+                }
+                capturing = false;
+                break;
+            case ESP_TRACE_SEND_BEGIN:
+                sending[connection] = true;
+                send_begin[connection] = event->time_us;
+                break;
+            case ESP_TRACE_SEND_END:
+                if (sending[connection]) {
+                    if (!send[connection].count) {
+                        snprintf(send_names[connection], sizeof(send_names[connection]), "send connection %u",
+                                 record->arg0);
+                        send[connection].name = send_names[connection];
+                    }
+                    span_add(&send[connection], event->time_us - send_begin[connection]);
+                }
+                sending[connection] = false;
+                break;
+            default:
+                break;
+        }
+    }
+
+    printf("\n%llu records over %.3f ms, %llu lost\n", (unsigned long long)trace.count,
+           (previous - first) / 1000.0, (unsigned long long)trace.lost);
+    printf("%-22s %8s %10s %10s %10s\n", "span", "count", "min ms", "avg ms", "max ms");
+    span_print(&capture);
+    for (int i = 0; i < MAX_CONNECTIONS; i++) {
+        span_print(&send[i]);
+    }
+
+    free(trace.events);
+    return 0;
+}
@@ -0,0 +1,87 @@
+//
+// Boot timeline, see esp-timeline.h
+//
+
+#include <string.h>
+#include <stdbool.h>
+#include <esp_log.h>
+#include <esp_timer.h>
+
+#include "esp-timeline.h"
+
+#define TAG "timeline"
+
+typedef struct {
+    const char *event;  // NULL until the entry is filled in
+    int64_t time_us;
+} timeline_entry_t;
+
+static timeline_entry_t entries[ESP_TIMELINE_MAX_EVENTS];
+static unsigned claimed;    // Entries handed out to a mark
+
+static unsigned entry_count(void) {
+    unsigned n = __atomic_load_n(&claimed, __ATOMIC_ACQUIRE);
+    return n < ESP_TIMELINE_MAX_EVENTS ? n : ESP_TIMELINE_MAX_EVENTS;
+}
+
+// Entries being filled in by another task read as NULL and are skipped
+static const timeline_entry_t *find(const char *event) {
+    for (unsigned i = 0, n = entry_count(); i < n; i++) {
+        const char *e = __atomic_load_n(&entries[i].event, __ATOMIC_ACQUIRE);
+        if (e && (e == event || strcmp(e, event) == 0)) {
+            return &entries[i];
+        }
+    }
+    return NULL;
+}
+
+void esp_timeline_mark(const char *event) {
+    int64_t now = esp_timer_get_time();
+    if (find(event)) {
+        return;
+    }
+
+    unsigned i = __atomic_fetch_add(&claimed, 1, __ATOMIC_ACQ_REL);
+    if (i >= ESP_TIMELINE_MAX_EVENTS) {
+        return;
+    }
+    entries[i].time_us = now;
+    __atomic_store_n(&entries[i].event, event, __ATOMIC_RELEASE);
+}
+
+int64_t esp_timeline_get(const char *event) {
+    const timeline_entry_t *entry = find(event);
+    return entry ? entry->time_us : -1;
+}
+
+void esp_timeline_log(void) {
+    // Tasks marking at the same time may have claimed their entries out of order
+    timeline_entry_t sorted[ESP_TIMELINE_MAX_EVENTS];
+    unsigned n = 0;
+    for (unsigned i = 0, count = entry_count(); i < count; i++) {
+        timeline_entry_t entry = { __atomic_load_n(&entries[i].event, __ATOMIC_ACQUIRE), entries[i].time_us };
+        if (!entry.event) {
+            continue;
+        }
+        unsigned j = n++;
+        for (; j > 0 && sorted[j - 1].time_us > entry.time_us; j--) {
+            sorted[j] = sorted[j - 1];
+        }
+        sorted[j] = entry;
+    }
+
+    int64_t previous = 0;
+    ESP_LOGI(TAG, "Boot timeline, ms since start (+ms since the previous stage):");
+    for (unsigned i = 0; i < n; i++) {
+        ESP_LOGI(TAG, "%8.1f (+%7.1f) %s", sorted[i].time_us / 1000.0, (sorted[i].time_us - previous) / 1000.0,
+                 sorted[i].event);
+        previous = sorted[i].time_us;
+    }
+}
+
+void esp_timeline_reset(void) {
+    for (unsigned i = 0; i < ESP_TIMELINE_MAX_EVENTS; i++) {
+        __atomic_store_n(&entries[i].event, NULL, __ATOMIC_RELAXED);
+    }
+    __atomic_store_n(&claimed, 0, __ATOMIC_RELEASE);
+}
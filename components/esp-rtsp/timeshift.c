@@ -0,0 +1,260 @@
+//
+// Time-shift buffer of the last seconds of JPEG frames, see timeshift.h
+//
+
+#include <stdlib.h>
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <freertos/semphr.h>
+#include <esp_log.h>
+#include <esp_heap_caps.h>
+
+#include "timeshift.h"
+#include "frames.h"
+#include "rtsp-metrics.h"
+
+#define TAG "timeshift"
+
+#ifndef RTSP_TIMESHIFT_FRAMES
+#define RTSP_TIMESHIFT_FRAMES 1024 // Entries of the index, the ring holds at most this many frames
+#endif
+
+#ifndef RTSP_TIMESHIFT_INTERVAL_MS
+#define RTSP_TIMESHIFT_INTERVAL_MS 0 // Least delta between buffered frames, 0 buffers every frame
+#endif
+
+#define TIMESHIFT_STACKSIZE (4 * 1024) // The motion detector decodes on the stack of the task that captures
+#define TIMESHIFT_PRIORITY 4
+#define TIMESHIFT_RETRY_MS 100
+
+static struct {
+    uint8_t *ring;
+    size_t size;
+    timeshift_frame_t *index;   // A ring of its own, ordered by seq and by timestamp
+    uint32_t first;
+    uint32_t count;
+    uint32_t head;              // Position of the next byte written
+    uint32_t valid_from;        // The bytes before it are being overwritten
+    SemaphoreHandle_t lock;
+    volatile bool stop;
+    volatile bool running;
+} ts;
+
+static timeshift_frame_t *entry(uint32_t i) {
+    return &ts.index[(ts.first + i) % RTSP_TIMESHIFT_FRAMES];
+}
+
+// Called with the lock held, the first entry with a seq of at least seq
+static uint32_t lower_bound_seq(uint32_t seq) {
+    uint32_t low = 0, high = ts.count;
+    while (low < high) {
+        uint32_t middle = (low + high) / 2;
+        if ((int32_t)(entry(middle)->seq - seq) < 0) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+// Called with the lock held, the first entry with a timestamp of at least timestamp_us
+static uint32_t lower_bound_time(int64_t timestamp_us) {
+    uint32_t low = 0, high = ts.count;
+    while (low < high) {
+        uint32_t middle = (low + high) / 2;
+        if (entry(middle)->timestamp_us < timestamp_us) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    return low;
+}
+
+static void store(const camera_fb_t *fb, uint32_t seq, int64_t timestamp_us) {
+    uint32_t length = fb->len;
+    if (length > ts.size / 2) {
+        esp_metric_add(&metric_drop_timeshift, 1);
+        return;
+    }
+
+    // Make room, readers of the bytes that are overwritten now find out when they are done
+    xSemaphoreTake(ts.lock, portMAX_DELAY);
+    while (ts.count && (ts.count == RTSP_TIMESHIFT_FRAMES || ts.head + length - entry(0)->position > ts.size)) {
+        ts.first = (ts.first + 1) % RTSP_TIMESHIFT_FRAMES;
+        ts.count--;
+    }
+    uint32_t position = ts.head;
+    ts.valid_from = position + length - ts.size;
+    xSemaphoreGive(ts.lock);
+
+    size_t offset = position & (ts.size - 1);
+    size_t part = length < ts.size - offset ? length : ts.size - offset;
+    memcpy(ts.ring + offset, fb->buf, part);
+    memcpy(ts.ring, fb->buf + part, length - part);
+
+    xSemaphoreTake(ts.lock, portMAX_DELAY);
+    *entry(ts.count) = (timeshift_frame_t) {
+            .seq = seq,
+            .position = position,
+            .length = length,
+            .width = fb->width,
+            .height = fb->height,
+            .timestamp_us = timestamp_us,
+    };
+    ts.count++;
+    ts.head = position + length;
+    xSemaphoreGive(ts.lock);
+    esp_metric_add(&metric_timeshift_frames, 1);
+}
+
+static void timeshift_task(void *arg) {
+    uint32_t frame_seq = 0;
+    int64_t last_us = 0;
+
+    while (!ts.stop) {
+        if (!frames_wait_ready(TIMESHIFT_RETRY_MS)) {
+            continue;
+        }
+        shared_frame_t *frame = frames_get(&frame_seq);
+        if (!frame) {
+            vTaskDelay(pdMS_TO_TICKS(TIMESHIFT_RETRY_MS));
+            continue;
+        }
+        camera_fb_t *fb = frame->fb;
+        int64_t timestamp_us = (int64_t)fb->timestamp.tv_sec * 1000000 + fb->timestamp.tv_usec;
+        if (fb->format == PIXFORMAT_JPEG && timestamp_us - last_us >= RTSP_TIMESHIFT_INTERVAL_MS * 1000LL) {
+            store(fb, frame_seq, timestamp_us);
+            last_us = timestamp_us;
+        }
+        frames_return(frame);
+    }
+
+    ts.running = false;
+    vTaskDelete(NULL);
+}
+
+esp_err_t timeshift_start(size_t size) {
+    if (!size || (size & (size - 1)) || size > (1u << 31)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (ts.running) {
+        return ESP_ERR_INVALID_STATE;
+    }
+    if (!ts.lock && !(ts.lock = xSemaphoreCreateMutex())) {
+        return ESP_ERR_NO_MEM;
+    }
+
+    // Too large for internal RAM, there is no falling back to it
+    ts.ring = heap_caps_malloc(size, MALLOC_CAP_SPIRAM);
+    ts.index = heap_caps_malloc(RTSP_TIMESHIFT_FRAMES * sizeof(timeshift_frame_t), MALLOC_CAP_SPIRAM);
+    if (!ts.ring || !ts.index) {
+        free(ts.ring);
+        free(ts.index);
+        ts.ring = NULL;
+        ts.index = NULL;
+        return ESP_ERR_NO_MEM;
+    }
+    ts.size = size;
+    ts.first = 0;
+    ts.count = 0;
+    ts.head = 0;
+    ts.valid_from = -size;
+
+    ts.stop = false;
+    ts.running = true;
+    if (xTaskCreate(timeshift_task, "timeshift", TIMESHIFT_STACKSIZE, NULL, TIMESHIFT_PRIORITY, NULL) != pdPASS) {
+        ts.running = false;
+        timeshift_stop();
+        return ESP_FAIL;
+    }
+    ESP_LOGI(TAG, "Buffering the last %u KB of frames", (unsigned)(size / 1024));
+    return ESP_OK;
+}
+
+// Nothing may be reading from the buffer anymore
+void timeshift_stop(void) {
+    ts.stop = true;
+    while (ts.running) {
+        vTaskDelay(1);
+    }
+    if (ts.lock) {
+        xSemaphoreTake(ts.lock, portMAX_DELAY);
+    }
+    free(ts.ring);
+    free(ts.index);
+    ts.ring = NULL;
+    ts.index = NULL;
+    ts.count = 0;
+    if (ts.lock) {
+        xSemaphoreGive(ts.lock);
+    }
+}
+
+bool timeshift_running(void) {
+    return ts.running;
+}
+
+bool timeshift_find(int64_t timestamp_us, timeshift_frame_t *frame) {
+    if (!ts.ring) {
+        return false;
+    }
+    xSemaphoreTake(ts.lock, portMAX_DELAY);
+    uint32_t i = lower_bound_time(timestamp_us);
+    bool found = i < ts.count;
+    if (found) {
+        *frame = *entry(i);
+    }
+    xSemaphoreGive(ts.lock);
+    return found;
+}
+
+void timeshift_reader_free(timeshift_reader_t *reader) {
+    free(reader->buffer);
+    reader->buffer = NULL;
+    reader->size = 0;
+}
+
+esp_err_t timeshift_read(timeshift_reader_t *reader) {
+    if (!ts.ring) {
+        return ESP_ERR_NOT_FOUND;
+    }
+
+    for (;;) {
+        xSemaphoreTake(ts.lock, portMAX_DELAY);
+        uint32_t i = lower_bound_seq(reader->seq);
+        if (i == ts.count) {
+            xSemaphoreGive(ts.lock);
+            return ESP_ERR_NOT_FOUND;
+        }
+        timeshift_frame_t frame = *entry(i);
+        xSemaphoreGive(ts.lock);
+
+        if (frame.length > reader->size) {
+            timeshift_reader_free(reader);
+            uint8_t *buffer = heap_caps_malloc(frame.length, MALLOC_CAP_SPIRAM);
+            if (!buffer && !(buffer = malloc(frame.length))) {
+                return ESP_ERR_NO_MEM;
+            }
+            reader->buffer = buffer;
+            reader->size = frame.length;
+        }
+
+        size_t offset = frame.position & (ts.size - 1);
+        size_t part = frame.length < ts.size - offset ? frame.length : ts.size - offset;
+        memcpy(reader->buffer, ts.ring + offset, part);
+        memcpy(reader->buffer + part, ts.ring, frame.length - part);
+
+        // Overwritten while it was copied, the search then starts at the oldest frame
+        xSemaphoreTake(ts.lock, portMAX_DELAY);
+        bool valid = (int32_t)(frame.position - ts.valid_from) >= 0;
+        xSemaphoreGive(ts.lock);
+        if (valid) {
+            reader->frame = frame;
+            reader->seq = frame.seq + 1;
+            return ESP_OK;
+        }
+    }
+}
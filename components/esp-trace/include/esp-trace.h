@@ -0,0 +1,92 @@
+//
+// Binary event trace of the camera stream.
+//
+// ESP_TRACE() puts a fixed size record with an event id and two arguments in
+// the ring of the core it runs on. It takes no lock and formats nothing, so it
+// can be used in ISRs and on paths where a log line would distort the timing
+// that is being looked at. With CONFIG_ESP_TRACE_ENABLED off it compiles to
+// nothing.
+//
+// The rings are drained as a binary dump, over HTTP on /trace or as lines on
+// the console, which rtsp_trace on the host renders as a timeline.
+//
+
+#ifndef ESPCAM_ESP_TRACE_H
+#define ESPCAM_ESP_TRACE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include "sdkconfig.h"
+
+// Event ids, names and the meaning of the arguments. Only add to the end, the
+// ids are in dumps rtsp_trace reads.
+#define ESP_TRACE_EVENTS(X)                                                       \
+    X(CAM_VSYNC,       "cam vsync")        /* frame slot, -                    */ \
+    X(CAM_FRAME,       "cam frame")        /* frame slot, length               */ \
+    X(CAM_FB_OVERFLOW, "cam fb overflow")  /* frame slot, length               */ \
+    X(CAM_EV_OVERFLOW, "cam ev overflow")  /* cam event, -                     */ \
+    X(CAPTURE_BEGIN,   "capture begin")    /* -, -                             */ \
+    X(CAPTURE_END,     "capture end")      /* frame seq, length                */ \
+    X(SEND_BEGIN,      "send begin")       /* connection, frame seq            */ \
+    X(SEND_END,        "send end")         /* connection, packets              */ \
+    X(RTP_PACKET,      "rtp packet")       /* sequence number, size            */ \
+    X(RTP_ENOMEM,      "rtp enomem")       /* sequence number, retries left    */ \
+    X(RTSP_REQUEST,    "rtsp request")     /* method, cseq                     */ \
+    X(RTSP_ERROR,      "rtsp error")       /* status, -                        */ \
+    X(HTTP_REQUEST,    "http request")     /* socket, -                        */ \
+    X(HTTP_FRAME,      "http frame")       /* frame seq, length                */ \
+    X(RECORD_WRITE,    "record write")     /* bytes, us                        */
+
+typedef enum {
+#define ESP_TRACE_ID(id, name) ESP_TRACE_##id,
+    ESP_TRACE_EVENTS(ESP_TRACE_ID)
+#undef ESP_TRACE_ID
+    ESP_TRACE_EVENT_COUNT
+} esp_trace_id_t;
+
+// Little endian in the dumps, like the chip
+typedef struct {
+    uint32_t time_us;  // esp_timer, wraps after 71 minutes
+    uint16_t id;
+    uint8_t core;
+    uint8_t reserved;
+    uint32_t arg0;
+    uint32_t arg1;
+} esp_trace_record_t;
+
+// A dump starts with this header, followed by the records of one core after the other
+#define ESP_TRACE_MAGIC "ESPTRACE"
+#define ESP_TRACE_VERSION 1
+
+typedef struct {
+    char magic[8];
+    uint16_t version;
+    uint16_t record_size;
+    uint32_t lost;     // Records overwritten before they were drained
+} esp_trace_header_t;
+
+// The console dump has a record per line, after this prefix, in hex
+#define ESP_TRACE_CONSOLE_PREFIX "ESPTRACE "
+
+#if CONFIG_ESP_TRACE_ENABLED
+
+#define ESP_TRACE(id, arg0, arg1) esp_trace_record(ESP_TRACE_##id, (uint32_t)(arg0), (uint32_t)(arg1))
+
+void esp_trace_record(esp_trace_id_t id, uint32_t arg0, uint32_t arg1);
+
+// Moves the records that were not drained yet into buffer, after a header. Returns the
+// length of the dump, the records that do not fit stay for the next one. Drain from
+// one task at a time.
+size_t esp_trace_drain(uint8_t *buffer, size_t size);
+
+// Drains the rings to the console
+void esp_trace_dump_console(void);
+
+#else
+
+#define ESP_TRACE(id, arg0, arg1) do { } while (0)
+
+#endif
+
+#endif //ESPCAM_ESP_TRACE_H
@@ -0,0 +1,135 @@
+//
+// Binary event trace, see esp-trace.h
+//
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+#include <esp_attr.h>
+#include <esp_timer.h>
+
+#include "esp-trace.h"
+
+#if CONFIG_ESP_TRACE_ENABLED
+
+#define RING_SIZE CONFIG_ESP_TRACE_RING_SIZE
+#define RING_MASK (RING_SIZE - 1)
+
+_Static_assert((RING_SIZE & RING_MASK) == 0, "CONFIG_ESP_TRACE_RING_SIZE must be a power of two");
+_Static_assert(sizeof(esp_trace_header_t) == sizeof(esp_trace_record_t), "A console line holds a header or a record");
+
+typedef struct {
+    uint32_t seq;  // Index of the record plus one once it is written, 0 while it is being written
+    esp_trace_record_t record;
+} slot_t;
+
+typedef struct {
+    uint32_t head; // Records claimed by writers
+    uint32_t tail; // Records drained
+    slot_t slots[RING_SIZE];
+} ring_t;
+
+static ring_t rings[portNUM_PROCESSORS];
+static uint32_t lost;
+
+// An ISR that interrupts a record on the same core claims the next slot, nothing waits
+void IRAM_ATTR esp_trace_record(esp_trace_id_t id, uint32_t arg0, uint32_t arg1) {
+    uint8_t core = xPortGetCoreID();
+    ring_t *ring = &rings[core];
+    uint32_t index = __atomic_fetch_add(&ring->head, 1, __ATOMIC_RELAXED);
+    slot_t *slot = &ring->slots[index & RING_MASK];
+
+    __atomic_store_n(&slot->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    slot->record.time_us = (uint32_t)esp_timer_get_time();
+    slot->record.id = id;
+    slot->record.core = core;
+    slot->record.reserved = 0;
+    slot->record.arg0 = arg0;
+    slot->record.arg1 = arg1;
+    __atomic_store_n(&slot->seq, index + 1, __ATOMIC_RELEASE);
+}
+
+// Copies a record when it is complete and was not overwritten meanwhile
+static bool read_slot(const slot_t *slot, uint32_t index, esp_trace_record_t *record) {
+    if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != index + 1) {
+        return false;
+    }
+    memcpy(record, &slot->record, sizeof(esp_trace_record_t));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(&slot->seq, __ATOMIC_RELAXED) == index + 1;
+}
+
+static size_t drain_ring(ring_t *ring, esp_trace_record_t *out, size_t max) {
+    uint32_t head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    uint32_t tail = ring->tail;
+    if (head - tail > RING_SIZE) {
+        lost += head - tail - RING_SIZE;
+        tail = head - RING_SIZE;
+    }
+
+    size_t count = 0;
+    for (; tail != head && count < max; tail++) {
+        const slot_t *slot = &ring->slots[tail & RING_MASK];
+        if (read_slot(slot, tail, &out[count])) {
+            count++;
+            continue;
+        }
+        uint32_t seq = __atomic_load_n(&slot->seq, __ATOMIC_RELAXED);
+        if (seq == 0 || seq < tail + 1) {
+            break; // Still being written, it goes with the next drain
+        }
+        lost++; // Overwritten while it was read
+    }
+    ring->tail = tail;
+    return count;
+}
+
+size_t esp_trace_drain(uint8_t *buffer, size_t size) {
+    if (size < sizeof(esp_trace_header_t)) {
+        return 0;
+    }
+
+    esp_trace_record_t *records = (esp_trace_record_t *)(buffer + sizeof(esp_trace_header_t));
+    size_t max = (size - sizeof(esp_trace_header_t)) / sizeof(esp_trace_record_t);
+    size_t count = 0;
+    for (int core = 0; core < portNUM_PROCESSORS; core++) {
+        count += drain_ring(&rings[core], records + count, max - count);
+    }
+
+    esp_trace_header_t header = {
+            .magic = ESP_TRACE_MAGIC,
+            .version = ESP_TRACE_VERSION,
+            .record_size = sizeof(esp_trace_record_t),
+            .lost = lost,
+    };
+    memcpy(buffer, &header, sizeof(header));
+    lost = 0;
+    return sizeof(esp_trace_header_t) + count * sizeof(esp_trace_record_t);
+}
+
+static void print_line(const void *data, size_t length) {
+    char line[sizeof(ESP_TRACE_CONSOLE_PREFIX) + 2 * sizeof(esp_trace_record_t)];
+    size_t position = snprintf(line, sizeof(line), "%s", ESP_TRACE_CONSOLE_PREFIX);
+    for (size_t i = 0; i < length; i++) {
+        position += snprintf(line + position, sizeof(line) - position, "%02x", ((const uint8_t *)data)[i]);
+    }
+    printf("%s\n", line);
+}
+
+void esp_trace_dump_console(void) {
+    static uint8_t buffer[sizeof(esp_trace_header_t) + 32 * sizeof(esp_trace_record_t)];
+    size_t count;
+    do {
+        size_t length = esp_trace_drain(buffer, sizeof(buffer));
+        count = (length - sizeof(esp_trace_header_t)) / sizeof(esp_trace_record_t);
+        print_line(buffer, sizeof(esp_trace_header_t));
+        for (size_t i = 0; i < count; i++) {
+            print_line(buffer + sizeof(esp_trace_header_t) + i * sizeof(esp_trace_record_t), sizeof(esp_trace_record_t));
+        }
+    } while (count == 32);
+}
+
+#endif
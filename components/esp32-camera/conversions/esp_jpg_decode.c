@@ -13,8 +13,13 @@
 // limitations under the License.
 #include "esp_jpg_decode.h"
 
+#include <stdlib.h>
+#include <string.h>
+#include "esp_heap_caps.h"
 #include "esp_system.h"
-#if ESP_IDF_VERSION_MAJOR >= 4 // IDF 4+
+#if CONFIG_CAMERA_JPEG_DECODE_OPTIMIZED
+#include "tjpgd.h"  // optimized software decoder, faster than the one in ROM
+#elif ESP_IDF_VERSION_MAJOR >= 4 // IDF 4+
 #if CONFIG_IDF_TARGET_ESP32 // ESP32/PICO-D4
 #include "esp32/rom/tjpgd.h"
 #elif CONFIG_IDF_TARGET_ESP32S3
@@ -30,6 +35,12 @@
 #include "rom/tjpgd.h"
 #endif
 
+#ifdef JD_SZPOOL // tjpgd in target/, with Huffman lookup tables and a larger input buffer
+#define JPG_WORK_SIZE JD_SZPOOL
+#else
+#define JPG_WORK_SIZE 3100
+#endif
+
 #if defined(ARDUINO_ARCH_ESP32) && defined(CONFIG_ARDUHAL_ESP_LOG)
 #include "esp32-hal-log.h"
 #define TAG ""
@@ -84,7 +95,7 @@ static unsigned int _jpg_read(JDEC *decoder, uint8_t *buf, unsigned int len)
     if (len) {
         len = jpeg->reader(jpeg->arg, jpeg->index, buf, len);
         if (!len) {
-            ESP_LOGE(TAG, "Read Fail at %u/%u", jpeg->index, jpeg->len);
+            ESP_LOGE(TAG, "Read Fail at %u/%u", (unsigned)jpeg->index, (unsigned)jpeg->len);
         }
         jpeg->index += len;
     }
@@ -93,7 +104,6 @@ static unsigned int _jpg_read(JDEC *decoder, uint8_t *buf, unsigned int len)
 
 esp_err_t esp_jpg_decode(size_t len, jpg_scale_t scale, jpg_reader_cb reader, jpg_writer_cb writer, void * arg)
 {
-    static uint8_t work[3100];
     JDEC decoder;
     esp_jpg_decoder_t jpeg;
 
@@ -104,9 +114,18 @@ esp_err_t esp_jpg_decode(size_t len, jpg_scale_t scale, jpg_reader_cb reader, jp
     jpeg.scale = scale;
     jpeg.index = 0;
 
-    JRESULT jres = jd_prepare(&decoder, _jpg_read, work, 3100, &jpeg);
+    // Per call, so that decodes can run at the same time. The Huffman tables are looked up
+    // for every code, keep them in internal RAM.
+    uint8_t *work = (uint8_t *)heap_caps_malloc(JPG_WORK_SIZE, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+    if(!work){
+        ESP_LOGE(TAG, "Work buffer malloc failed! %u", JPG_WORK_SIZE);
+        return ESP_ERR_NO_MEM;
+    }
+
+    JRESULT jres = jd_prepare(&decoder, _jpg_read, work, JPG_WORK_SIZE, &jpeg);
     if(jres != JDR_OK){
         ESP_LOGE(TAG, "JPG Header Parse Failed! %s", jd_errors[jres]);
+        free(work);
         return ESP_FAIL;
     }
 
@@ -119,6 +138,7 @@ esp_err_t esp_jpg_decode(size_t len, jpg_scale_t scale, jpg_reader_cb reader, jp
     jres = jd_decomp(&decoder, _jpg_write, (uint8_t)jpeg.scale);
     //output end
     writer(arg, output_width, output_height, output_width, output_height, NULL);
+    free(work);
 
     if (jres != JDR_OK) {
         ESP_LOGE(TAG, "JPG Decompression Failed! %s", jd_errors[jres]);
@@ -132,3 +152,256 @@ esp_err_t esp_jpg_decode(size_t len, jpg_scale_t scale, jpg_reader_cb reader, jp
     return ESP_OK;
 }
 
+
+struct jpg_decoder {
+    JDEC jdec;
+    const uint8_t *src;
+    size_t len;
+    size_t index;               // Read offset for a decoder without jd_prepare_mem()
+    const jpg_output_t *output;
+    uint16_t width;
+    uint16_t height;
+    uint16_t left, top;         // Output window in output pixels, the right and bottom are exclusive
+    uint16_t right, bottom;
+    uint8_t *map;               // Luminance of the MCUs for esp_jpg_decoder_luma_map()
+    uint16_t map_cols;
+};
+
+#ifndef JD_HAS_MEM_INPUT
+static unsigned int _mem_read(JDEC *jdec, uint8_t *buf, unsigned int len)
+{
+    jpg_decoder_t *decoder = (jpg_decoder_t *)jdec->device;
+    if (len > decoder->len - decoder->index) {
+        len = decoder->len - decoder->index;
+    }
+    if (buf) {
+        memcpy(buf, decoder->src + decoder->index, len);
+    }
+    decoder->index += len;
+    return len;
+}
+#endif
+
+esp_err_t esp_jpg_decoder_open(void *work, size_t work_size, const uint8_t *src, size_t src_len,
+                               jpg_decoder_t **decoder, uint16_t *width, uint16_t *height)
+{
+    if (!work || !src || !decoder || ((uintptr_t)work % sizeof(void *))) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (work_size < sizeof(jpg_decoder_t) + JPG_WORK_SIZE) {
+        ESP_LOGE(TAG, "Workspace of %u bytes, need %u", (unsigned)work_size, (unsigned)(sizeof(jpg_decoder_t) + JPG_WORK_SIZE));
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    jpg_decoder_t *d = (jpg_decoder_t *)work;
+    uint8_t *pool = (uint8_t *)(d + 1);
+    d->src = src;
+    d->len = src_len;
+    d->index = 0;
+    d->output = NULL;
+#ifdef JD_HAS_MEM_INPUT
+    JRESULT jres = jd_prepare_mem(&d->jdec, src, src_len, pool, work_size - sizeof(jpg_decoder_t), d);
+#else
+    JRESULT jres = jd_prepare(&d->jdec, _mem_read, pool, work_size - sizeof(jpg_decoder_t), d);
+#endif
+    if (jres != JDR_OK) {
+        ESP_LOGE(TAG, "JPG Header Parse Failed! %s", jd_errors[jres]);
+        return ESP_FAIL;
+    }
+
+    d->width = d->jdec.width;
+    d->height = d->jdec.height;
+    if (width) {
+        *width = d->width;
+    }
+    if (height) {
+        *height = d->height;
+    }
+    *decoder = d;
+    return ESP_OK;
+}
+
+// RGB888 rectangles from tjpgd, clipped to the output window and written straight into its rows
+static unsigned int _output_rgb(JDEC *jdec, void *bitmap, JRECT *rect)
+{
+    const jpg_decoder_t *decoder = (const jpg_decoder_t *)jdec->device;
+    const jpg_output_t *output = decoder->output;
+    size_t w = rect->right + 1 - rect->left;
+    size_t left = rect->left > decoder->left ? rect->left : decoder->left;
+    size_t right = rect->right + 1u < decoder->right ? rect->right + 1u : decoder->right;
+    size_t top = rect->top > decoder->top ? rect->top : decoder->top;
+    size_t bottom = rect->bottom + 1u < decoder->bottom ? rect->bottom + 1u : decoder->bottom;
+
+    for (size_t y = top; y < bottom; y++) {
+        const uint8_t *data = (const uint8_t *)bitmap + ((y - rect->top) * w + left - rect->left) * 3;
+        uint8_t *o = output->buf[0] + (y - decoder->top) * output->stride[0];
+        if (output->format == JPG_OUTPUT_RGB888) {
+            o += (left - decoder->left) * 3;
+            for (size_t x = left; x < right; x++, o += 3, data += 3) {
+                o[0] = data[2];
+                o[1] = data[1];
+                o[2] = data[0];
+            }
+        } else {
+            o += (left - decoder->left) * 2;
+            for (size_t x = left; x < right; x++, o += 2, data += 3) {
+                uint16_t c = ((data[0] & 0xF8) << 8) | ((data[1] & 0xFC) << 3) | (data[2] >> 3);
+                o[0] = c & 0xFF;
+                o[1] = c >> 8;
+            }
+        }
+    }
+    return 1;
+}
+
+#ifdef JD_HAS_MEM_INPUT
+// The YCbCr blocks of an MCU from jd_decomp_ycc(), luma copied and chroma averaged down to 4:2:0,
+// clipped to the output window
+static unsigned int _output_yuv420p(JDEC *jdec, void *blocks, JRECT *rect)
+{
+    const jpg_decoder_t *decoder = (const jpg_decoder_t *)jdec->device;
+    const jpg_output_t *output = decoder->output;
+    const uint8_t *mcu = (const uint8_t *)blocks;
+    size_t mx = jdec->msx * 8, my = jdec->msy * 8;
+    size_t left = rect->left > decoder->left ? rect->left : decoder->left;
+    size_t right = rect->right + 1u < decoder->right ? rect->right + 1u : decoder->right;
+    size_t top = rect->top > decoder->top ? rect->top : decoder->top;
+    size_t bottom = rect->bottom + 1u < decoder->bottom ? rect->bottom + 1u : decoder->bottom;
+
+    for (size_t y = top; y < bottom; y++) {
+        uint8_t *o = output->buf[0] + (y - decoder->top) * output->stride[0];
+        const uint8_t *block = mcu + ((y - rect->top) / 8) * jdec->msx * 64 + ((y - rect->top) % 8) * 8;
+        for (size_t x = left; x < right; x++) {
+            o[x - decoder->left] = block[((x - rect->left) / 8) * 64 + (x - rect->left) % 8];
+        }
+    }
+
+    // A chroma block covers the whole MCU, sx by sy of its samples make one 4:2:0 sample. The
+    // window starts on even pixels, so chroma samples are not split at its edges.
+    const uint8_t *cb = mcu + jdec->msx * jdec->msy * 64, *cr = cb + 64;
+    size_t sx = 16 / mx, sy = 16 / my, shift = (sx == 2) + (sy == 2);
+    for (size_t y = top / 2; y < (bottom + 1) / 2; y++) {
+        uint8_t *u = output->buf[1] + (y - decoder->top / 2) * output->stride[1];
+        uint8_t *v = output->buf[2] + (y - decoder->top / 2) * output->stride[2];
+        for (size_t x = left / 2; x < (right + 1) / 2; x++) {
+            size_t i = (y - rect->top / 2) * sy * 8 + (x - rect->left / 2) * sx;
+            unsigned int su = 0, sv = 0;
+            for (size_t j = 0; j < sy; j++) {
+                for (size_t k = 0; k < sx; k++) {
+                    su += cb[i + j * 8 + k];
+                    sv += cr[i + j * 8 + k];
+                }
+            }
+            u[x - decoder->left / 2] = (su + (1 << shift >> 1)) >> shift;
+            v[x - decoder->left / 2] = (sv + (1 << shift >> 1)) >> shift;
+        }
+    }
+    return 1;
+}
+#endif
+
+esp_err_t esp_jpg_decoder_run(jpg_decoder_t *decoder, const jpg_output_t *output)
+{
+    if (!decoder || !output || output->scale > JPG_SCALE_MAX) {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    // Region of the image, then the window of it in output pixels
+    size_t roi_x = output->roi.x, roi_y = output->roi.y;
+    size_t roi_width = output->roi.width ? output->roi.width : decoder->width - roi_x;
+    size_t roi_height = output->roi.height ? output->roi.height : decoder->height - roi_y;
+    if (roi_x >= decoder->width || roi_y >= decoder->height ||
+            roi_width > decoder->width - roi_x || roi_height > decoder->height - roi_y) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    if (output->format == JPG_OUTPUT_YUV420P) {
+        roi_width += roi_x & 1;
+        roi_height += roi_y & 1;
+        roi_x &= ~1;
+        roi_y &= ~1;
+    }
+    decoder->left = roi_x >> output->scale;
+    decoder->top = roi_y >> output->scale;
+    decoder->right = (roi_x + roi_width) >> output->scale;
+    decoder->bottom = (roi_y + roi_height) >> output->scale;
+    size_t width = decoder->right - decoder->left;
+#ifdef JD_HAS_ROI
+    decoder->jdec.roi.left = roi_x;
+    decoder->jdec.roi.top = roi_y;
+    decoder->jdec.roi.right = roi_x + roi_width - 1;
+    decoder->jdec.roi.bottom = roi_y + roi_height - 1;
+#endif
+    JRESULT jres;
+
+    decoder->output = output;
+    switch (output->format) {
+    case JPG_OUTPUT_RGB565:
+    case JPG_OUTPUT_RGB888:
+        if (!output->buf[0] || output->stride[0] < width * (output->format == JPG_OUTPUT_RGB888 ? 3 : 2)) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        jres = jd_decomp(&decoder->jdec, _output_rgb, (uint8_t)output->scale);
+        break;
+#ifdef JD_HAS_MEM_INPUT
+    case JPG_OUTPUT_YUV420P:
+        if (output->scale != JPG_SCALE_NONE) {
+            return ESP_ERR_NOT_SUPPORTED;
+        }
+        if (!output->buf[0] || !output->buf[1] || !output->buf[2] || output->stride[0] < width ||
+                output->stride[1] < (width + 1) / 2 || output->stride[2] < (width + 1) / 2) {
+            return ESP_ERR_INVALID_ARG;
+        }
+        jres = jd_decomp_ycc(&decoder->jdec, _output_yuv420p);
+        break;
+#endif
+    default:
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    if (jres != JDR_OK) {
+        ESP_LOGE(TAG, "JPG Decompression Failed! %s", jd_errors[jres]);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+}
+
+#ifdef JD_HAS_MEM_INPUT
+// The mean luminance of an MCU from jd_decomp_dc()
+static unsigned int _output_luma(JDEC *jdec, void *luma, JRECT *rect)
+{
+    jpg_decoder_t *decoder = (jpg_decoder_t *)jdec->device;
+    decoder->map[rect->top / (jdec->msy * 8) * decoder->map_cols + rect->left / (jdec->msx * 8)] = *(uint8_t *)luma;
+    return 1;
+}
+#endif
+
+esp_err_t esp_jpg_decoder_luma_map(jpg_decoder_t *decoder, uint8_t *map, size_t size, uint16_t *cols, uint16_t *rows)
+{
+    if (!decoder || (!map && size)) {
+        return ESP_ERR_INVALID_ARG;
+    }
+#ifdef JD_HAS_MEM_INPUT
+    size_t mx = decoder->jdec.msx * 8, my = decoder->jdec.msy * 8;
+    size_t map_cols = (decoder->width + mx - 1) / mx, map_rows = (decoder->height + my - 1) / my;
+    if (cols) {
+        *cols = map_cols;
+    }
+    if (rows) {
+        *rows = map_rows;
+    }
+    if (size < map_cols * map_rows) {
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    decoder->map = map;
+    decoder->map_cols = map_cols;
+    JRESULT jres = jd_decomp_dc(&decoder->jdec, _output_luma);
+    if (jres != JDR_OK) {
+        ESP_LOGE(TAG, "JPG Decompression Failed! %s", jd_errors[jres]);
+        return ESP_FAIL;
+    }
+    return ESP_OK;
+#else
+    return ESP_ERR_NOT_SUPPORTED;
+#endif
+}
@@ -36,6 +36,103 @@ typedef bool (* jpg_writer_cb)(void * arg, uint16_t x, uint16_t y, uint16_t w, u
 
 esp_err_t esp_jpg_decode(size_t len, jpg_scale_t scale, jpg_reader_cb reader, jpg_writer_cb writer, void * arg);
 
+/**
+ * @brief Size of the workspace of a decoder, enough for baseline JPEG with two quantization tables
+ */
+#define JPG_DECODER_WORK_SIZE 8192
+
+typedef enum {
+    JPG_OUTPUT_RGB565,  /*!< 2 bytes per pixel in buf[0], in the byte order of jpg2rgb565() */
+    JPG_OUTPUT_RGB888,  /*!< 3 bytes per pixel in buf[0], in the B, G, R order of fmt2rgb888() */
+    JPG_OUTPUT_YUV420P, /*!< Y in buf[0], U (Cb) and V (Cr) at half width and height in buf[1] and buf[2] */
+} jpg_output_format_t;
+
+/**
+ * @brief Rectangle in pixels of the image
+ */
+typedef struct {
+    uint16_t x;
+    uint16_t y;
+    uint16_t width;             /*!< 0 for the rest of the row */
+    uint16_t height;            /*!< 0 for the rest of the image */
+} jpg_rect_t;
+
+/**
+ * @brief Where and how esp_jpg_decoder_run() writes the image
+ */
+typedef struct {
+    jpg_output_format_t format;
+    jpg_scale_t scale;          /*!< Scale down the image, JPG_OUTPUT_YUV420P supports JPG_SCALE_NONE only */
+    uint8_t *buf[3];            /*!< Pixels, or the Y, U and V planes */
+    size_t stride[3];           /*!< Bytes from the start of a row to the next in each buffer */
+    jpg_rect_t roi;             /*!< Region of interest, all zero for the whole image */
+} jpg_output_t;
+
+/**
+ * @brief JPEG decoder in a workspace of the caller, see esp_jpg_decoder_open()
+ */
+typedef struct jpg_decoder jpg_decoder_t;
+
+/**
+ * @brief Parse the headers of a JPEG in memory, ready to decode it with esp_jpg_decoder_run()
+ *
+ * The decoder keeps all its state in the workspace and reads the JPEG in place, so decoders in
+ * different workspaces can run at the same time, one per core for example. The workspace and the
+ * JPEG must stay valid until esp_jpg_decoder_run() returns.
+ *
+ * @param work      Workspace of JPG_DECODER_WORK_SIZE bytes, aligned for a pointer
+ * @param work_size Size of the workspace
+ * @param src       JPEG
+ * @param src_len   Length of the JPEG
+ * @param decoder   Returns the decoder, it lives in the workspace
+ * @param width     Returns the width of the image, can be NULL
+ * @param height    Returns the height of the image, can be NULL
+ *
+ * @return ESP_OK, ESP_ERR_INVALID_ARG or ESP_ERR_INVALID_SIZE for a workspace that is misaligned or too small,
+ *         ESP_FAIL for a JPEG that cannot be decoded
+ */
+esp_err_t esp_jpg_decoder_open(void *work, size_t work_size, const uint8_t *src, size_t src_len,
+                               jpg_decoder_t **decoder, uint16_t *width, uint16_t *height);
+
+/**
+ * @brief Decode the JPEG esp_jpg_decoder_open() parsed, once
+ *
+ * The buffers must hold the scaled image (width >> scale by height >> scale) at their strides.
+ * YUV420P is the full range YCbCr of the JPEG without colour conversion, chroma sampled down
+ * by averaging where the JPEG has more of it.
+ *
+ * With a region of interest, the buffers hold only that region: from (x >> scale, y >> scale) to
+ * ((x + width) >> scale, (y + height) >> scale), with x and y rounded down to even for YUV420P.
+ * MCUs outside of it are only parsed, without IDCT or colour conversion, whole restart intervals
+ * outside of it are skipped to the next marker and decoding stops after its last MCU row.
+ *
+ * @param decoder   Decoder from esp_jpg_decoder_open()
+ * @param output    Format and buffers of the output
+ *
+ * @return ESP_OK, ESP_ERR_INVALID_ARG for a region outside of the image or a stride too small for a row,
+ *         ESP_ERR_NOT_SUPPORTED for a scaled YUV420P or YUV420P with the decoder in ROM,
+ *         ESP_FAIL for a corrupted JPEG
+ */
+esp_err_t esp_jpg_decoder_run(jpg_decoder_t *decoder, const jpg_output_t *output);
+
+/**
+ * @brief Mean luminance of every MCU of the JPEG esp_jpg_decoder_open() parsed, instead of decoding it
+ *
+ * The means come from the DC coefficients, so the entropy coded data is only parsed: no IDCT and no
+ * colour conversion. It takes a fraction of a decode, cheap enough to watch every frame of a camera
+ * for motion. Like esp_jpg_decoder_run(), it can be called once per esp_jpg_decoder_open().
+ *
+ * @param decoder   Decoder from esp_jpg_decoder_open()
+ * @param map       Returns one byte per MCU, left to right and top to bottom
+ * @param size      Size of map, with 0 and a NULL map only cols and rows are returned
+ * @param cols      Returns the number of MCUs in a row, can be NULL
+ * @param rows      Returns the number of MCU rows, can be NULL
+ *
+ * @return ESP_OK, ESP_ERR_INVALID_SIZE for a map smaller than cols * rows, ESP_ERR_NOT_SUPPORTED with
+ *         the decoder in ROM, ESP_FAIL for a corrupted JPEG
+ */
+esp_err_t esp_jpg_decoder_luma_map(jpg_decoder_t *decoder, uint8_t *map, size_t size, uint16_t *cols, uint16_t *rows);
+
 #ifdef __cplusplus
 }
 #endif
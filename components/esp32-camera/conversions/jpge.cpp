@@ -16,6 +16,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#include <math.h>
 #include <malloc.h>
 #include "esp_heap_caps.h"
 
@@ -39,7 +40,7 @@ namespace jpge {
     static inline void jpge_free(void *p) { free(p); }
 
     // Various JPEG enums and tables.
-    enum { M_SOF0 = 0xC0, M_DHT = 0xC4, M_SOI = 0xD8, M_EOI = 0xD9, M_SOS = 0xDA, M_DQT = 0xDB, M_APP0 = 0xE0 };
+    enum { M_SOF0 = 0xC0, M_DHT = 0xC4, M_RST0 = 0xD0, M_SOI = 0xD8, M_EOI = 0xD9, M_SOS = 0xDA, M_DQT = 0xDB, M_DRI = 0xDD, M_APP0 = 0xE0 };
     enum { DC_LUM_CODES = 12, AC_LUM_CODES = 256, DC_CHROMA_CODES = 12, AC_CHROMA_CODES = 256, MAX_HUFF_SYMBOLS = 257, MAX_HUFF_CODESIZE = 32 };
 
     static const uint8 s_zag[64] = { 0,1,8,16,9,2,3,10,17,24,32,25,18,11,4,5,12,19,26,33,40,48,41,34,27,20,13,6,7,14,21,28,35,42,49,56,57,50,43,36,29,22,15,23,30,37,44,51,58,59,52,45,38,31,39,46,53,60,61,54,47,55,62,63 };
@@ -70,14 +71,13 @@ namespace jpge {
 
     const int YR = 19595, YG = 38470, YB = 7471, CB_R = -11059, CB_G = -21709, CB_B = 32768, CR_R = 32768, CR_G = -27439, CR_B = -5329;
 
-    static int32 m_last_quality = 0;
-    static int32 m_quantization_tables[2][64];
-
-    static bool m_huff_initialized = false;
-    static uint m_huff_codes[4][256];
-    static uint8 m_huff_code_sizes[4][256];
-    static uint8 m_huff_bits[4][17];
-    static uint8 m_huff_val[4][256];
+    // aan_scale[u] * aan_scale[v] << 14, the output scale of DCT2D() besides (8 << PASS_BITS)
+    static const uint16 s_aan_scales[64] = {
+        16384,22725,21407,19266,16384,12873,8867,4520, 22725,31521,29692,26722,22725,17855,12299,6270,
+        21407,29692,27969,25172,21407,16819,11585,5906, 19266,26722,25172,22654,19266,15137,10426,5315,
+        16384,22725,21407,19266,16384,12873,8867,4520, 12873,17855,16819,15137,12873,10114,6967,3552,
+        8867,12299,11585,10426,8867,6967,4799,2446, 4520,6270,5906,5315,4520,3552,2446,1247
+    };
 
     static inline uint8 clamp(int i) {
         if (i < 0) {
@@ -111,81 +111,171 @@ namespace jpge {
         }
     }
 
-    // Forward DCT - DCT derived from jfdctint.
-    enum { CONST_BITS = 13, ROW_BITS = 2 };
-#define DCT_DESCALE(x, n) (((x) + (((int32)1) << ((n) - 1))) >> (n))
-#define DCT_MUL(var, c) (static_cast<int16>(var) * static_cast<int32>(c))
+    // Forward DCT - AAN (Arai, Agui, Nakajima) as in jfdctfst, 5 multiplies per pass.
+    // The outputs are left scaled by 8 * aan_scale[u] * aan_scale[v] << PASS_BITS,
+    // compute_quant_table() folds that scale into the quantizer multipliers.
+    enum { CONST_BITS = 13, PASS_BITS = 2, QUANT_BITS = 20 };
+#define DCT_MUL(var, c) (((var) * (c) + (1 << (CONST_BITS - 1))) >> CONST_BITS)
 #define DCT1D(s0, s1, s2, s3, s4, s5, s6, s7) \
     int32 t0 = s0 + s7, t7 = s0 - s7, t1 = s1 + s6, t6 = s1 - s6, t2 = s2 + s5, t5 = s2 - s5, t3 = s3 + s4, t4 = s3 - s4; \
     int32 t10 = t0 + t3, t13 = t0 - t3, t11 = t1 + t2, t12 = t1 - t2; \
-    int32 u1 = DCT_MUL(t12 + t13, 4433); \
-    s2 = u1 + DCT_MUL(t13, 6270); \
-    s6 = u1 + DCT_MUL(t12, -15137); \
-    u1 = t4 + t7; \
-    int32 u2 = t5 + t6, u3 = t4 + t6, u4 = t5 + t7; \
-    int32 z5 = DCT_MUL(u3 + u4, 9633); \
-    t4 = DCT_MUL(t4, 2446); t5 = DCT_MUL(t5, 16819); \
-    t6 = DCT_MUL(t6, 25172); t7 = DCT_MUL(t7, 12299); \
-    u1 = DCT_MUL(u1, -7373); u2 = DCT_MUL(u2, -20995); \
-    u3 = DCT_MUL(u3, -16069); u4 = DCT_MUL(u4, -3196); \
-    u3 += z5; u4 += z5; \
-    s0 = t10 + t11; s1 = t7 + u1 + u4; s3 = t6 + u2 + u3; s4 = t10 - t11; s5 = t5 + u2 + u4; s7 = t4 + u1 + u3;
+    s0 = t10 + t11; s4 = t10 - t11; \
+    int32 z1 = DCT_MUL(t12 + t13, 5793); /* 0.707106781 */ \
+    s2 = t13 + z1; s6 = t13 - z1; \
+    t10 = t4 + t5; t11 = t5 + t6; t12 = t6 + t7; \
+    int32 z5 = DCT_MUL(t10 - t12, 3135); /* 0.382683433 */ \
+    int32 z2 = DCT_MUL(t10, 4433) + z5; /* 0.541196100 */ \
+    int32 z4 = DCT_MUL(t12, 10703) + z5; /* 1.306562965 */ \
+    int32 z3 = DCT_MUL(t11, 5793); \
+    int32 z11 = t7 + z3, z13 = t7 - z3; \
+    s5 = z13 + z2; s3 = z13 - z2; s1 = z11 + z4; s7 = z11 - z4;
 
     static void DCT2D(int32 *p) {
         int32 c, *q = p;
         for (c = 7; c >= 0; c--, q += 8) {
-            int32 s0 = q[0], s1 = q[1], s2 = q[2], s3 = q[3], s4 = q[4], s5 = q[5], s6 = q[6], s7 = q[7];
+            int32 s0 = q[0] << PASS_BITS, s1 = q[1] << PASS_BITS, s2 = q[2] << PASS_BITS, s3 = q[3] << PASS_BITS;
+            int32 s4 = q[4] << PASS_BITS, s5 = q[5] << PASS_BITS, s6 = q[6] << PASS_BITS, s7 = q[7] << PASS_BITS;
             DCT1D(s0, s1, s2, s3, s4, s5, s6, s7);
-            q[0] = s0 << ROW_BITS; q[1] = DCT_DESCALE(s1, CONST_BITS-ROW_BITS); q[2] = DCT_DESCALE(s2, CONST_BITS-ROW_BITS); q[3] = DCT_DESCALE(s3, CONST_BITS-ROW_BITS);
-            q[4] = s4 << ROW_BITS; q[5] = DCT_DESCALE(s5, CONST_BITS-ROW_BITS); q[6] = DCT_DESCALE(s6, CONST_BITS-ROW_BITS); q[7] = DCT_DESCALE(s7, CONST_BITS-ROW_BITS);
+            q[0] = s0; q[1] = s1; q[2] = s2; q[3] = s3; q[4] = s4; q[5] = s5; q[6] = s6; q[7] = s7;
         }
         for (q = p, c = 7; c >= 0; c--, q++) {
             int32 s0 = q[0*8], s1 = q[1*8], s2 = q[2*8], s3 = q[3*8], s4 = q[4*8], s5 = q[5*8], s6 = q[6*8], s7 = q[7*8];
             DCT1D(s0, s1, s2, s3, s4, s5, s6, s7);
-            q[0*8] = DCT_DESCALE(s0, ROW_BITS+3); q[1*8] = DCT_DESCALE(s1, CONST_BITS+ROW_BITS+3); q[2*8] = DCT_DESCALE(s2, CONST_BITS+ROW_BITS+3); q[3*8] = DCT_DESCALE(s3, CONST_BITS+ROW_BITS+3);
-            q[4*8] = DCT_DESCALE(s4, ROW_BITS+3); q[5*8] = DCT_DESCALE(s5, CONST_BITS+ROW_BITS+3); q[6*8] = DCT_DESCALE(s6, CONST_BITS+ROW_BITS+3); q[7*8] = DCT_DESCALE(s7, CONST_BITS+ROW_BITS+3);
+            q[0*8] = s0; q[1*8] = s1; q[2*8] = s2; q[3*8] = s3; q[4*8] = s4; q[5*8] = s5; q[6*8] = s6; q[7*8] = s7;
         }
     }
 
     // Compute the actual canonical Huffman codes/code sizes given the JPEG huff bits and val arrays.
-    static void compute_huffman_table(uint *codes, uint8 *code_sizes, uint8 *bits, uint8 *val)
+    static void compute_huffman_table(uint *codes, uint8 *code_sizes, const uint8 *bits, const uint8 *val)
     {
-        int i, l, last_p, si;
-        static uint8 huff_size[257];
-        static uint huff_code[257];
-        uint code;
-
+        uint code = 0;
         int p = 0;
-        for (l = 1; l <= 16; l++) {
-            for (i = 1; i <= bits[l]; i++) {
-                huff_size[p++] = (char)l;
+
+        memset(codes, 0, sizeof(codes[0])*256);
+        memset(code_sizes, 0, sizeof(code_sizes[0])*256);
+        for (int l = 1; l <= 16; l++, code <<= 1) {
+            for (int i = 1; i <= bits[l]; i++, p++) {
+                codes[val[p]]      = code++;
+                code_sizes[val[p]] = static_cast<uint8>(l);
             }
         }
+    }
 
-        huff_size[p] = 0;
-        last_p = p; // write sentinel
-
-        code = 0; si = huff_size[0]; p = 0;
+    // The tables every encoder shares, built on first use and read only after that,
+    // so that encoders can run on several tasks at once
+    struct shared_tables {
+        uint huff_codes[4][256];
+        uint8 huff_code_sizes[4][256];
+        uint8 y_range[256], c_range[256]; // BT.601 studio range to full range
 
-        while (huff_size[p]) {
-            while (huff_size[p] == si) {
-                huff_code[p++] = code++;
+        shared_tables()
+        {
+            compute_huffman_table(huff_codes[0+0], huff_code_sizes[0+0], s_dc_lum_bits, s_dc_lum_val);
+            compute_huffman_table(huff_codes[2+0], huff_code_sizes[2+0], s_ac_lum_bits, s_ac_lum_val);
+            compute_huffman_table(huff_codes[0+1], huff_code_sizes[0+1], s_dc_chroma_bits, s_dc_chroma_val);
+            compute_huffman_table(huff_codes[2+1], huff_code_sizes[2+1], s_ac_chroma_bits, s_ac_chroma_val);
+            for (int i = 0; i < 256; i++)
+            {
+                // Y 16..235 and Cb, Cr 16..240 to 0..255
+                y_range[i] = clamp(((i - 16) * 255 * 2 + 219) / (219 * 2));
+                c_range[i] = clamp(128 + ((i - 128) * 255 * 2 + (i < 128 ? -224 : 224)) / (224 * 2));
             }
-            code <<= 1;
-            si++;
         }
+    };
 
-        memset(codes, 0, sizeof(codes[0])*256);
-        memset(code_sizes, 0, sizeof(code_sizes[0])*256);
-        for (p = 0; p < last_p; p++) {
-            codes[val[p]]      = huff_code[p];
-            code_sizes[val[p]] = huff_size[p];
+    static const shared_tables &get_shared_tables()
+    {
+        static const shared_tables tables; // Initialized once, thread safe
+        return tables;
+    }
+
+    // Huffman tables built from the symbol counts of one image, for params::m_two_pass_flag
+    struct optimized_tables {
+        uint32 counts[4][256];
+        uint8 bits[4][17];
+        uint8 val[4][256];
+        uint codes[4][256];
+        uint8 code_sizes[4][256];
+    };
+
+    // Optimal JPEG huff bits and val arrays for the symbol counts, JPEG Annex K.2.
+    // Code lengths are limited to 16 bits and no code consists of 1 bits only.
+    static void compute_optimal_table(uint8 *bits, uint8 *val, const uint32 *counts)
+    {
+        uint32 freq[MAX_HUFF_SYMBOLS];
+        int code_size[MAX_HUFF_SYMBOLS], others[MAX_HUFF_SYMBOLS];
+        int length_count[MAX_HUFF_CODESIZE + 1];
+
+        for (int i = 0; i < 256; i++)
+            freq[i] = counts[i];
+        freq[256] = 1; // Reserved, takes the all 1 bits code
+        memset(code_size, 0, sizeof(code_size));
+        for (int i = 0; i < MAX_HUFF_SYMBOLS; i++)
+            others[i] = -1;
+
+        for ( ; ; )
+        {
+            // The two least frequent symbols, the higher one first on a tie
+            int c1 = -1, c2 = -1;
+            for (int i = 0; i < MAX_HUFF_SYMBOLS; i++)
+                if (freq[i] && (c1 < 0 || freq[i] <= freq[c1]))
+                    c1 = i;
+            for (int i = 0; i < MAX_HUFF_SYMBOLS; i++)
+                if (freq[i] && i != c1 && (c2 < 0 || freq[i] <= freq[c2]))
+                    c2 = i;
+            if (c2 < 0)
+                break;
+
+            freq[c1] += freq[c2];
+            freq[c2] = 0;
+            for (code_size[c1]++; others[c1] >= 0; code_size[c1]++)
+                c1 = others[c1];
+            others[c1] = c2;
+            for (code_size[c2]++; others[c2] >= 0; code_size[c2]++)
+                c2 = others[c2];
         }
+
+        memset(length_count, 0, sizeof(length_count));
+        for (int i = 0; i < MAX_HUFF_SYMBOLS; i++)
+            if (code_size[i])
+                length_count[JPGE_MIN(code_size[i], MAX_HUFF_CODESIZE)]++;
+
+        // Move the symbols of codes longer than 16 bits up the tree
+        for (int i = MAX_HUFF_CODESIZE; i > 16; i--)
+        {
+            while (length_count[i] > 0)
+            {
+                int j = i - 2;
+                while (!length_count[j])
+                    j--;
+                length_count[i] -= 2;
+                length_count[i - 1]++;
+                length_count[j + 1] += 2;
+                length_count[j]--;
+            }
+        }
+        // Drop the reserved symbol, it has one of the longest codes
+        int longest = 16;
+        while (!length_count[longest])
+            longest--;
+        length_count[longest]--;
+
+        bits[0] = 0;
+        for (int i = 1; i <= 16; i++)
+            bits[i] = static_cast<uint8>(length_count[i]);
+
+        // Symbols by code length, the reserved one sorts last within its length
+        int p = 0;
+        for (int l = 1; l <= MAX_HUFF_CODESIZE; l++)
+            for (int i = 0; i < 256; i++)
+                if (code_size[i] == l)
+                    val[p++] = static_cast<uint8>(i);
     }
 
     void jpeg_encoder::flush_output_buffer()
     {
         if (m_out_buf_left != JPGE_OUT_BUF_SIZE) {
+            m_bytes_flushed += JPGE_OUT_BUF_SIZE - m_out_buf_left;
             m_all_stream_writes_succeeded = m_all_stream_writes_succeeded && m_pStream->put_buf(m_out_buf, JPGE_OUT_BUF_SIZE - m_out_buf_left);
         }
         m_pOut_buf = m_out_buf;
@@ -200,21 +290,76 @@ namespace jpge {
         }
     }
 
-    void jpeg_encoder::put_bits(uint bits, uint len)
+    void jpeg_encoder::emit_bit_buffer_byte()
     {
-        uint8 c = 0;
-        m_bit_buffer |= ((uint32)bits << (24 - (m_bits_in += len)));
-        while (m_bits_in >= 8) {
-            c = (uint8)((m_bit_buffer >> 16) & 0xFF);
-            emit_byte(c);
-            if (c == 0xFF) {
-                emit_byte(0);
+        uint8 c = static_cast<uint8>(m_bit_buffer >> 56);
+        emit_byte(c);
+        if (c == 0xFF) {
+            emit_byte(0);
+        }
+        m_bit_buffer <<= 8;
+        m_bits_in -= 8;
+    }
+
+    // len is at most 32, codes and their extra bits can go in one call
+    inline void jpeg_encoder::put_bits(uint bits, uint len)
+    {
+        m_bit_buffer |= static_cast<uint64>(bits) << (64 - (m_bits_in += len));
+        if (m_bits_in < 32) {
+            return;
+        }
+        uint32 word = static_cast<uint32>(m_bit_buffer >> 32);
+        // Whole word at once unless a byte is 0xFF and needs stuffing
+        if (m_out_buf_left >= 4 && !((~word - 0x01010101) & word & 0x80808080)) {
+            m_pOut_buf[0] = static_cast<uint8>(word >> 24); m_pOut_buf[1] = static_cast<uint8>(word >> 16);
+            m_pOut_buf[2] = static_cast<uint8>(word >> 8); m_pOut_buf[3] = static_cast<uint8>(word);
+            m_pOut_buf += 4;
+            if ((m_out_buf_left -= 4) == 0) {
+                flush_output_buffer();
+            }
+            m_bit_buffer <<= 32;
+            m_bits_in -= 32;
+        } else {
+            while (m_bits_in >= 8) {
+                emit_bit_buffer_byte();
             }
-            m_bit_buffer <<= 8;
-            m_bits_in -= 8;
         }
     }
 
+    // Emits the complete bytes of the bit buffer, fewer than 8 bits stay behind
+    void jpeg_encoder::flush_bits()
+    {
+        while (m_bits_in >= 8) {
+            emit_bit_buffer_byte();
+        }
+    }
+
+    // Pads the last byte of the scan with 1 bits, as before a marker
+    void jpeg_encoder::pad_bits()
+    {
+        uint pad = (8 - (m_bits_in & 7)) & 7;
+        if (pad) {
+            put_bits((1 << pad) - 1, pad);
+        }
+        flush_bits();
+    }
+
+    // RSTn closing restart interval num, the DC predictions start over after it
+    void jpeg_encoder::emit_restart(int num)
+    {
+        if (m_pass_num == 1)
+        {
+            if (reserve_symbols(1))
+                m_pSymbols[m_symbols_len++] = static_cast<uint8>(0x80 + (num & 7));
+        }
+        else
+        {
+            pad_bits();
+            emit_marker(M_RST0 + (num & 7));
+        }
+        memset(m_last_dc_val, 0, sizeof(m_last_dc_val));
+    }
+
     void jpeg_encoder::emit_word(uint i)
     {
         emit_byte(uint8(i >> 8)); emit_byte(uint8(i & 0xFF));
@@ -251,10 +396,18 @@ namespace jpge {
             emit_word(64 + 1 + 2);
             emit_byte(static_cast<uint8>(i));
             for (int j = 0; j < 64; j++)
-                emit_byte(static_cast<uint8>(m_quantization_tables[i][j]));
+                emit_byte(m_quantization_tables[i][j]);
         }
     }
 
+    // Emit restart interval, in MCUs
+    void jpeg_encoder::emit_dri()
+    {
+        emit_marker(M_DRI);
+        emit_word(4);
+        emit_word(m_params.m_restart_rows * m_mcus_per_row);
+    }
+
     // Emit start of frame marker
     void jpeg_encoder::emit_sof()
     {
@@ -273,7 +426,7 @@ namespace jpge {
     }
 
     // Emit Huffman table.
-    void jpeg_encoder::emit_dht(uint8 *bits, uint8 *val, int index, bool ac_flag)
+    void jpeg_encoder::emit_dht(const uint8 *bits, const uint8 *val, int index, bool ac_flag)
     {
         emit_marker(M_DHT);
 
@@ -294,11 +447,20 @@ namespace jpge {
     // Emit all Huffman tables.
     void jpeg_encoder::emit_dhts()
     {
-        emit_dht(m_huff_bits[0+0], m_huff_val[0+0], 0, false);
-        emit_dht(m_huff_bits[2+0], m_huff_val[2+0], 0, true);
+        if (m_pOptimized)
+        {
+            for (int i = 0; i < ((m_num_components == 3) ? 2 : 1); i++)
+            {
+                emit_dht(m_pOptimized->bits[0 + i], m_pOptimized->val[0 + i], i, false);
+                emit_dht(m_pOptimized->bits[2 + i], m_pOptimized->val[2 + i], i, true);
+            }
+            return;
+        }
+        emit_dht(s_dc_lum_bits, s_dc_lum_val, 0, false);
+        emit_dht(s_ac_lum_bits, s_ac_lum_val, 0, true);
         if (m_num_components == 3) {
-            emit_dht(m_huff_bits[0+1], m_huff_val[0+1], 1, false);
-            emit_dht(m_huff_bits[2+1], m_huff_val[2+1], 1, true);
+            emit_dht(s_dc_chroma_bits, s_dc_chroma_val, 1, false);
+            emit_dht(s_ac_chroma_bits, s_ac_chroma_val, 1, true);
         }
     }
 
@@ -321,6 +483,19 @@ namespace jpge {
         emit_byte(0);
     }
 
+    // Emit all markers at beginning of image file.
+    void jpeg_encoder::emit_markers()
+    {
+        emit_marker(M_SOI);
+        emit_jfif_app0();
+        emit_dqt();
+        emit_sof();
+        emit_dhts();
+        if (m_params.m_restart_rows)
+            emit_dri();
+        emit_sos();
+    }
+
     void jpeg_encoder::load_block_8_8_grey(int x)
     {
         uint8 *pSrc;
@@ -381,104 +556,297 @@ namespace jpge {
         }
     }
 
+    // Loaders for YCbCr sources, every MCU line holds a Y row of m_image_x_mcu
+    // samples followed by Cb and Cr rows of m_image_x_mcu / 2 samples.
+    void jpeg_encoder::load_block_8_8_planar(int x, int y)
+    {
+        uint8 *pSrc;
+        sample_array_t *pDst = m_sample_array;
+        x <<= 3;
+        y <<= 3;
+        for (int i = 0; i < 8; i++, pDst += 8)
+        {
+            pSrc = m_mcu_lines[y + i] + x;
+            pDst[0] = pSrc[0] - 128; pDst[1] = pSrc[1] - 128; pDst[2] = pSrc[2] - 128; pDst[3] = pSrc[3] - 128;
+            pDst[4] = pSrc[4] - 128; pDst[5] = pSrc[5] - 128; pDst[6] = pSrc[6] - 128; pDst[7] = pSrc[7] - 128;
+        }
+    }
+
+    void jpeg_encoder::load_block_chroma_h1v1(int x, int c)
+    {
+        uint8 *pSrc;
+        sample_array_t *pDst = m_sample_array;
+        x = m_image_x_mcu + (c - 1) * (m_image_x_mcu >> 1) + (x << 2);
+        for (int i = 0; i < 8; i++, pDst += 8)
+        {
+            pSrc = m_mcu_lines[i] + x;
+            pDst[0] = pDst[1] = pSrc[0] - 128; pDst[2] = pDst[3] = pSrc[1] - 128;
+            pDst[4] = pDst[5] = pSrc[2] - 128; pDst[6] = pDst[7] = pSrc[3] - 128;
+        }
+    }
+
+    void jpeg_encoder::load_block_chroma_h2v1(int x, int c)
+    {
+        uint8 *pSrc;
+        sample_array_t *pDst = m_sample_array;
+        x = m_image_x_mcu + (c - 1) * (m_image_x_mcu >> 1) + (x << 3);
+        for (int i = 0; i < 8; i++, pDst += 8)
+        {
+            pSrc = m_mcu_lines[i] + x;
+            pDst[0] = pSrc[0] - 128; pDst[1] = pSrc[1] - 128; pDst[2] = pSrc[2] - 128; pDst[3] = pSrc[3] - 128;
+            pDst[4] = pSrc[4] - 128; pDst[5] = pSrc[5] - 128; pDst[6] = pSrc[6] - 128; pDst[7] = pSrc[7] - 128;
+        }
+    }
+
+    void jpeg_encoder::load_block_chroma_h2v2(int x, int c)
+    {
+        uint8 *pSrc1, *pSrc2;
+        sample_array_t *pDst = m_sample_array;
+        x = m_image_x_mcu + (c - 1) * (m_image_x_mcu >> 1) + (x << 3);
+        int a = 0, b = 1;
+        for (int i = 0; i < 16; i += 2, pDst += 8)
+        {
+            pSrc1 = m_mcu_lines[i + 0] + x;
+            pSrc2 = m_mcu_lines[i + 1] + x;
+            pDst[0] = ((pSrc1[0] + pSrc2[0] + a) >> 1) - 128; pDst[1] = ((pSrc1[1] + pSrc2[1] + b) >> 1) - 128;
+            pDst[2] = ((pSrc1[2] + pSrc2[2] + a) >> 1) - 128; pDst[3] = ((pSrc1[3] + pSrc2[3] + b) >> 1) - 128;
+            pDst[4] = ((pSrc1[4] + pSrc2[4] + a) >> 1) - 128; pDst[5] = ((pSrc1[5] + pSrc2[5] + b) >> 1) - 128;
+            pDst[6] = ((pSrc1[6] + pSrc2[6] + a) >> 1) - 128; pDst[7] = ((pSrc1[7] + pSrc2[7] + b) >> 1) - 128;
+            int temp = a; a = b; b = temp;
+        }
+    }
+
     void jpeg_encoder::load_quantized_coefficients(int component_num)
     {
-        int32 *q = m_quantization_tables[component_num > 0];
+        const uint32 *q = m_quantization_scales[component_num > 0];
         int16 *pDst = m_coefficient_array;
+        uint64 mask = 0;
+        const uint32 ac_round = m_ac_round;
+        uint32 round = 1 << (QUANT_BITS - 1); // The DC is always rounded to nearest
         for (int i = 0; i < 64; i++)
         {
             sample_array_t j = m_sample_array[s_zag[i]];
+            int16 c;
             if (j < 0)
-            {
-                if ((j = -j + (*q >> 1)) < *q)
-                    *pDst++ = 0;
-                else
-                    *pDst++ = static_cast<int16>(-(j / *q));
-            }
+                c = -static_cast<int16>((static_cast<uint32>(-j) * q[i] + round) >> QUANT_BITS);
             else
-            {
-                if ((j = j + (*q >> 1)) < *q)
-                    *pDst++ = 0;
-                else
-                    *pDst++ = static_cast<int16>((j / *q));
-            }
-            q++;
+                c = static_cast<int16>((static_cast<uint32>(j) * q[i] + round) >> QUANT_BITS);
+            pDst[i] = c;
+            round = ac_round;
         }
+        for (int i = 0; i < 64; i++)
+            mask |= static_cast<uint64>(pDst[i] != 0) << (63 - i);
+        m_coefficient_mask = mask & m_level_mask;
     }
 
     void jpeg_encoder::code_coefficients_pass_two(int component_num)
     {
-        int i, j, run_len, nbits, temp1, temp2;
-        int16 *pSrc = m_coefficient_array;
-        uint *codes[2];
-        uint8 *code_sizes[2];
+        int i, run_len, nbits, temp1, temp2;
+        const uint *codes[2];
+        const uint8 *code_sizes[2];
+        const int table = component_num > 0;
+
+        codes[0] = m_huff_codes[0 + table]; codes[1] = m_huff_codes[2 + table];
+        code_sizes[0] = m_huff_code_sizes[0 + table]; code_sizes[1] = m_huff_code_sizes[2 + table];
+
+        temp1 = temp2 = m_coefficient_array[0] - m_last_dc_val[component_num];
+        m_last_dc_val[component_num] = m_coefficient_array[0];
 
-        if (component_num == 0)
+        if (temp1 < 0)
         {
-            codes[0] = m_huff_codes[0 + 0]; codes[1] = m_huff_codes[2 + 0];
-            code_sizes[0] = m_huff_code_sizes[0 + 0]; code_sizes[1] = m_huff_code_sizes[2 + 0];
+            temp1 = -temp1; temp2--;
         }
-        else
+
+        nbits = temp1 ? 32 - __builtin_clz(temp1) : 0;
+        put_bits((codes[0][nbits] << nbits) | (temp2 & ((1 << nbits) - 1)), code_sizes[0][nbits] + nbits);
+
+        // Walk the nonzero AC coefficients only, the leading zeros of the mask are the zero runs
+        uint64 mask = m_coefficient_mask << 1;
+        for (i = 0; mask; )
         {
-            codes[0] = m_huff_codes[0 + 1]; codes[1] = m_huff_codes[2 + 1];
-            code_sizes[0] = m_huff_code_sizes[0 + 1]; code_sizes[1] = m_huff_code_sizes[2 + 1];
+            run_len = __builtin_clzll(mask);
+            mask <<= run_len + 1;
+            i += run_len + 1;
+            while (run_len >= 16)
+            {
+                put_bits(codes[1][0xF0], code_sizes[1][0xF0]);
+                run_len -= 16;
+            }
+            if ((temp2 = temp1 = m_coefficient_array[i]) < 0)
+            {
+                temp1 = -temp1;
+                temp2--;
+            }
+            nbits = 32 - __builtin_clz(temp1);
+            int j = (run_len << 4) + nbits;
+            put_bits((codes[1][j] << nbits) | (temp2 & ((1 << nbits) - 1)), code_sizes[1][j] + nbits);
         }
+        if (i < 63)
+            put_bits(codes[1][0], code_sizes[1][0]);
+    }
 
-        temp1 = temp2 = pSrc[0] - m_last_dc_val[component_num];
-        m_last_dc_val[component_num] = pSrc[0];
+    // Grows the symbol buffer of pass one to hold len more bytes
+    bool jpeg_encoder::reserve_symbols(uint len)
+    {
+        if (m_symbols_len + len <= m_symbols_size)
+            return true;
+        uint size = JPGE_MAX(m_symbols_size * 2, m_symbols_len + len);
+        uint8 *pSymbols = static_cast<uint8*>(jpge_malloc(size));
+        if (!pSymbols)
+        {
+            m_all_stream_writes_succeeded = false;
+            return false;
+        }
+        if (m_symbols_len)
+            memcpy(pSymbols, m_pSymbols, m_symbols_len);
+        jpge_free(m_pSymbols);
+        m_pSymbols = pSymbols;
+        m_symbols_size = size;
+        return true;
+    }
 
+    static inline uint8 *store_extra_bits(uint8 *p, int bits, int nbits)
+    {
+        bits &= (1 << nbits) - 1;
+        if (nbits > 8)
+            *p++ = static_cast<uint8>(bits >> 8);
+        if (nbits)
+            *p++ = static_cast<uint8>(bits);
+        return p;
+    }
+
+    // Counts the symbols of the block and stores them compactly until the tables are known:
+    // (component << 4) + DC size, then every AC symbol, each followed by its extra bits in 0 to 2 bytes.
+    // A block ends with the EOB symbol or its 63rd coefficient, bytes 0x80 + n stand for RSTn.
+    void jpeg_encoder::code_coefficients_pass_one(int component_num)
+    {
+        enum { MAX_BLOCK_BYTES = 1 + 2 + 63 * 3 };
+        if (!reserve_symbols(MAX_BLOCK_BYTES))
+            return;
+
+        int i, run_len, nbits, temp1, temp2;
+        uint32 *dc_counts = m_pOptimized->counts[0 + (component_num > 0)];
+        uint32 *ac_counts = m_pOptimized->counts[2 + (component_num > 0)];
+        uint8 *p = m_pSymbols + m_symbols_len;
+
+        temp1 = temp2 = m_coefficient_array[0] - m_last_dc_val[component_num];
+        m_last_dc_val[component_num] = m_coefficient_array[0];
         if (temp1 < 0)
         {
             temp1 = -temp1; temp2--;
         }
+        nbits = temp1 ? 32 - __builtin_clz(temp1) : 0;
+        dc_counts[nbits]++;
+        *p++ = static_cast<uint8>((component_num << 4) + nbits);
+        p = store_extra_bits(p, temp2, nbits);
 
-        nbits = 0;
-        while (temp1)
+        uint64 mask = m_coefficient_mask << 1;
+        for (i = 0; mask; )
+        {
+            run_len = __builtin_clzll(mask);
+            mask <<= run_len + 1;
+            i += run_len + 1;
+            for ( ; run_len >= 16; run_len -= 16)
+            {
+                ac_counts[0xF0]++;
+                *p++ = 0xF0;
+            }
+            if ((temp2 = temp1 = m_coefficient_array[i]) < 0)
+            {
+                temp1 = -temp1;
+                temp2--;
+            }
+            nbits = 32 - __builtin_clz(temp1);
+            int j = (run_len << 4) + nbits;
+            ac_counts[j]++;
+            *p++ = static_cast<uint8>(j);
+            p = store_extra_bits(p, temp2, nbits);
+        }
+        if (i < 63)
         {
-            nbits++; temp1 >>= 1;
+            ac_counts[0]++;
+            *p++ = 0;
         }
+        m_symbols_len = p - m_pSymbols;
+    }
 
-        put_bits(codes[0][nbits], code_sizes[0][nbits]);
-        if (nbits) put_bits(temp2 & ((1 << nbits) - 1), nbits);
+    void jpeg_encoder::optimize_huffman_tables()
+    {
+        for (int i = 0; i < 4; i++)
+        {
+            if ((m_num_components == 1) && (i & 1))
+                continue;
+            compute_optimal_table(m_pOptimized->bits[i], m_pOptimized->val[i], m_pOptimized->counts[i]);
+            compute_huffman_table(m_pOptimized->codes[i], m_pOptimized->code_sizes[i], m_pOptimized->bits[i], m_pOptimized->val[i]);
+        }
+        m_huff_codes = m_pOptimized->codes;
+        m_huff_code_sizes = m_pOptimized->code_sizes;
+    }
 
-        for (run_len = 0, i = 1; i < 64; i++)
+    // Pass two of the two pass mode, codes the symbols stored by pass one with the optimized tables
+    void jpeg_encoder::code_symbols()
+    {
+        const uint8 *p = m_pSymbols, *pEnd = m_pSymbols + m_symbols_len;
+        while (p < pEnd)
         {
-            if ((temp1 = m_coefficient_array[i]) == 0)
-                run_len++;
-            else
+            int c = *p++;
+            if (c & 0x80)
             {
-                while (run_len >= 16)
-                {
-                    put_bits(codes[1][0xF0], code_sizes[1][0xF0]);
-                    run_len -= 16;
-                }
-                if ((temp2 = temp1) < 0)
+                pad_bits();
+                emit_marker(M_RST0 + (c & 7));
+                continue;
+            }
+
+            const int table = (c >> 4) > 0;
+            const uint *codes = m_huff_codes[2 + table];
+            const uint8 *code_sizes = m_huff_code_sizes[2 + table];
+            int nbits = c & 15, bits = 0;
+            if (nbits > 8)
+                bits = *p++ << 8;
+            if (nbits)
+                bits |= *p++;
+            put_bits((m_huff_codes[0 + table][nbits] << nbits) | bits, m_huff_code_sizes[0 + table][nbits] + nbits);
+
+            for (int i = 0; i < 63; )
+            {
+                int j = *p++;
+                if (!j)
                 {
-                    temp1 = -temp1;
-                    temp2--;
+                    put_bits(codes[0], code_sizes[0]);
+                    break;
                 }
-                nbits = 1;
-                while (temp1 >>= 1)
-                    nbits++;
-                j = (run_len << 4) + nbits;
-                put_bits(codes[1][j], code_sizes[1][j]);
-                put_bits(temp2 & ((1 << nbits) - 1), nbits);
-                run_len = 0;
+                nbits = j & 15;
+                bits = 0;
+                if (nbits > 8)
+                    bits = *p++ << 8;
+                if (nbits)
+                    bits |= *p++;
+                i += nbits ? (j >> 4) + 1 : 16;
+                put_bits((codes[j] << nbits) | bits, code_sizes[j] + nbits);
             }
         }
-        if (run_len)
-            put_bits(codes[1][0], code_sizes[1][0]);
     }
 
     void jpeg_encoder::code_block(int component_num)
     {
         DCT2D(m_sample_array);
         load_quantized_coefficients(component_num);
-        code_coefficients_pass_two(component_num);
+        if (m_pass_num == 1)
+            code_coefficients_pass_one(component_num);
+        else
+            code_coefficients_pass_two(component_num);
     }
 
     void jpeg_encoder::process_mcu_row()
     {
+        if (m_params.m_target_bytes)
+            update_rate_level();
+        if (m_params.m_restart_rows && m_mcu_row != m_first_mcu_row && !(m_mcu_row % m_params.m_restart_rows))
+        {
+            emit_restart(m_mcu_row / m_params.m_restart_rows - 1);
+        }
+        m_mcu_row++;
+
         if (m_num_components == 1)
         {
             for (int i = 0; i < m_mcus_per_row; i++)
@@ -486,6 +854,28 @@ namespace jpge {
                 load_block_8_8_grey(i); code_block(0);
             }
         }
+        else if (m_source_format != SOURCE_RGB)
+        {
+            for (int i = 0; i < m_mcus_per_row; i++)
+            {
+                if (m_comp_h_samp[0] == 1)
+                {
+                    load_block_8_8_planar(i, 0); code_block(0);
+                    load_block_chroma_h1v1(i, 1); code_block(1); load_block_chroma_h1v1(i, 2); code_block(2);
+                }
+                else if (m_comp_v_samp[0] == 1)
+                {
+                    load_block_8_8_planar(i * 2 + 0, 0); code_block(0); load_block_8_8_planar(i * 2 + 1, 0); code_block(0);
+                    load_block_chroma_h2v1(i, 1); code_block(1); load_block_chroma_h2v1(i, 2); code_block(2);
+                }
+                else
+                {
+                    load_block_8_8_planar(i * 2 + 0, 0); code_block(0); load_block_8_8_planar(i * 2 + 1, 0); code_block(0);
+                    load_block_8_8_planar(i * 2 + 0, 1); code_block(0); load_block_8_8_planar(i * 2 + 1, 1); code_block(0);
+                    load_block_chroma_h2v2(i, 1); code_block(1); load_block_chroma_h2v2(i, 2); code_block(2);
+                }
+            }
+        }
         else if ((m_comp_h_samp[0] == 1) && (m_comp_v_samp[0] == 1))
         {
             for (int i = 0; i < m_mcus_per_row; i++)
@@ -529,6 +919,8 @@ namespace jpge {
             else
                 Y_to_YCC(pDst, Psrc, m_image_x);
         }
+        if (m_params.m_target_bytes)
+            m_activity += line_activity(pDst, m_num_components);
 
         // Possibly duplicate pixels at end of scanline if not a multiple of 8 or 16
         if (m_num_components == 1)
@@ -543,6 +935,37 @@ namespace jpge {
             }
         }
 
+        finish_mcu_line();
+    }
+
+    // Y_step and c_step are the distances between samples, chroma rows hold (m_image_x + 1) / 2 samples
+    void jpeg_encoder::load_mcu_ycc(const uint8 *pY, const uint8 *pCb, const uint8 *pCr, int y_step, int c_step)
+    {
+        uint8 *pDst = m_mcu_lines[m_mcu_y_ofs];
+        int chroma_x = (m_image_x + 1) >> 1, chroma_x_mcu = m_image_x_mcu >> 1;
+
+        for (int i = 0; i < m_image_x; i++, pY += y_step)
+            pDst[i] = m_pTables->y_range[*pY];
+        memset(pDst + m_image_x, pDst[m_image_x - 1], m_image_x_mcu - m_image_x);
+        if (m_params.m_target_bytes)
+            m_activity += line_activity(pDst, 1);
+
+        if (m_num_components == 3)
+        {
+            uint8 *pDst_cb = pDst + m_image_x_mcu, *pDst_cr = pDst_cb + chroma_x_mcu;
+            for (int i = 0; i < chroma_x; i++, pCb += c_step, pCr += c_step)
+            {
+                pDst_cb[i] = m_pTables->c_range[*pCb]; pDst_cr[i] = m_pTables->c_range[*pCr];
+            }
+            memset(pDst_cb + chroma_x, pDst_cb[chroma_x - 1], chroma_x_mcu - chroma_x);
+            memset(pDst_cr + chroma_x, pDst_cr[chroma_x - 1], chroma_x_mcu - chroma_x);
+        }
+
+        finish_mcu_line();
+    }
+
+    void jpeg_encoder::finish_mcu_line()
+    {
         if (++m_mcu_y_ofs == m_mcu_y)
         {
             process_mcu_row();
@@ -551,20 +974,127 @@ namespace jpge {
     }
 
     // Quantization table generation.
-    void jpeg_encoder::compute_quant_table(int32 *pDst, const int16 *pSrc)
+    void jpeg_encoder::compute_quant_table(uint8 *pDst, uint32 *pScale, const int16 *pSrc)
     {
-        int32 q;
-        if (m_params.m_quality < 50)
-            q = 5000 / m_params.m_quality;
-        else
-            q = 200 - m_params.m_quality * 2;
+        int32 q = m_scale;
         for (int i = 0; i < 64; i++)
         {
-            int32 j = *pSrc++; j = (j * q + 50L) / 100L;
-            *pDst++ = JPGE_MIN(JPGE_MAX(j, 1), 255);
+            int32 j = pSrc[i]; j = (j * q + 50L) / 100L;
+            pDst[i] = static_cast<uint8>(JPGE_MIN(JPGE_MAX(j, 1), 255));
+            // 2^QUANT_BITS / ((8 << PASS_BITS) * aan scale * quantizer), rounded
+            uint32 d = s_aan_scales[s_zag[i]] * pDst[i];
+            pScale[i] = ((1u << (QUANT_BITS + 14 - 3 - PASS_BITS)) + (d >> 1)) / d;
         }
     }
 
+    // Rate control, see params::m_target_bytes.
+    // Row levels: the AC coefficients are rounded towards zero by more and more of a quantizer
+    // step (round in 1/16 steps, 8 is to nearest), then only the first ones in zigzag order are kept.
+    static const struct { uint8 round, coefficients; } s_rate_levels[] = {
+        { 8, 64 }, { 7, 64 }, { 6, 64 }, { 5, 64 }, { 4, 64 }, { 3, 64 }, { 3, 48 },
+        { 3, 36 }, { 3, 28 }, { 3, 21 }, { 3, 15 }, { 3, 10 }, { 3, 6 }, { 3, 3 }
+    };
+    enum { RATE_LEVELS = sizeof(s_rate_levels) / sizeof(s_rate_levels[0]) };
+    static const float RATE_HEADROOM = 1.05f;    // The tables aim above the target, rows can only take bytes away
+    static const float RATE_LEVEL_GAIN = 0.05f;  // Bytes a row saves per level, roughly
+    static const float RATE_SCALE_EXPONENT = 1.5f;
+
+    // Frame sizes fall about with the quantizer scale to the power of -1 / RATE_SCALE_EXPONENT. The last
+    // frame is taken as if its rows were not coarsened, and the scale moves by at most a factor 4 per frame.
+    int jpeg_encoder::predict_scale() const
+    {
+        int scale = (m_params.m_quality < 50) ? 5000 / m_params.m_quality : 200 - m_params.m_quality * 2;
+        const rate_state *pState = m_params.m_pRate_state;
+        if (!m_params.m_target_bytes || !pState || !pState->m_scale || !pState->m_bytes)
+            return scale;
+
+        float bytes = pState->m_bytes * (1.0f + pState->m_level * (RATE_LEVEL_GAIN / 16));
+        float factor = powf(bytes / (m_params.m_target_bytes * RATE_HEADROOM), RATE_SCALE_EXPONENT);
+        float predicted = pState->m_scale * JPGE_MIN(JPGE_MAX(factor, 0.25f), 4.0f);
+        return JPGE_MIN(JPGE_MAX(static_cast<int>(predicted + 0.5f), 1), 5000);
+    }
+
+    // Sum of the differences of the luma samples to their left and upper neighbours within the MCU row,
+    // plus a floor for the bits every block takes: a measure of the bytes a line will need that costs
+    // one pass over it
+    uint32 jpeg_encoder::line_activity(const uint8 *pY, int step) const
+    {
+        uint32 sum = m_image_x / 2;
+        const uint8 *pEnd = pY + m_image_x * step;
+        if (m_mcu_y_ofs)
+        {
+            const uint8 *pUp = m_mcu_lines[m_mcu_y_ofs - 1];
+            for (pY += step, pUp += step; pY < pEnd; pY += step, pUp += step)
+                sum += abs(pY[0] - pY[-step]) + abs(pY[0] - pUp[0]);
+        }
+        else
+        {
+            for (pY += step; pY < pEnd; pY += step)
+                sum += 2 * abs(pY[0] - pY[-step]);
+        }
+        return sum;
+    }
+
+    uint32 jpeg_encoder::bytes_out() const
+    {
+        return m_bytes_flushed + (JPGE_OUT_BUF_SIZE - m_out_buf_left) + (m_bits_in >> 3);
+    }
+
+    void jpeg_encoder::set_rate_level(int level)
+    {
+        m_rate_level = JPGE_MIN(JPGE_MAX(level, 0), RATE_LEVELS - 1);
+        m_ac_round = s_rate_levels[m_rate_level].round << (QUANT_BITS - 4);
+        m_level_mask = ~0ULL << (64 - s_rate_levels[m_rate_level].coefficients);
+    }
+
+    // Before every MCU row, whose luma is loaded: compares the bytes per activity the last rows took
+    // with what the rest of the frame may take, the frame's activity being estimated from the rows so
+    // far and the last frame
+    void jpeg_encoder::update_rate_level()
+    {
+        uint32 bytes = bytes_out() - m_scan_start;
+        uint32 row_activity = m_activity - m_coded_activity;
+        int done = m_mcu_row - m_first_mcu_row, rows = m_end_mcu_row - m_first_mcu_row;
+
+        if (done)
+        {
+            uint32 last_row_activity = m_coded_activity - m_row_start_activity;
+            float last_rate = last_row_activity ? static_cast<float>(bytes - m_row_start_bytes) / last_row_activity : 0;
+            m_bytes_per_activity = (done == 1) ? last_rate : (m_bytes_per_activity + last_rate) * 0.5f;
+
+            float activity = static_cast<float>(m_activity) * rows / (done + 1);
+            const rate_state *pState = m_params.m_pRate_state;
+            if (pState && pState->m_activity)
+                activity = (activity + pState->m_activity) * 0.5f;
+            float remaining = JPGE_MAX(activity - m_coded_activity, static_cast<float>(row_activity));
+            float allowed = (static_cast<float>(m_scan_budget) - bytes) / remaining;
+
+            int level = m_rate_level;
+            if (allowed < m_bytes_per_activity * 0.8f)
+                level += 2;
+            else if (allowed < m_bytes_per_activity * 0.97f)
+                level++;
+            else if (allowed > m_bytes_per_activity * 1.03f)
+                level--;
+            set_rate_level(level);
+        }
+
+        m_level_sum += m_rate_level;
+        m_row_start_bytes = bytes;
+        m_row_start_activity = m_coded_activity;
+        m_coded_activity = m_activity;
+    }
+
+    void jpeg_encoder::finish_rate_state()
+    {
+        rate_state *pState = m_params.m_pRate_state;
+        int rows = m_end_mcu_row - m_first_mcu_row;
+        pState->m_scale = m_scale;
+        pState->m_bytes = bytes_out();
+        pState->m_activity = m_activity;
+        pState->m_level = rows ? m_level_sum * 16 / rows : 0;
+    }
+
     // Higher-level methods.
     bool jpeg_encoder::jpg_open(int p_x_res, int p_y_res, int src_channels)
     {
@@ -610,6 +1140,8 @@ namespace jpge {
         m_image_y_mcu    = (m_image_y + m_mcu_y - 1) & (~(m_mcu_y - 1));
         m_image_bpl_xlt  = m_image_x * m_num_components;
         m_image_bpl_mcu  = m_image_x_mcu * m_num_components;
+        if (m_source_format != SOURCE_RGB && m_num_components == 3)
+            m_image_bpl_mcu = m_image_x_mcu * 2; // Chroma rows are stored at half width
         m_mcus_per_row   = m_image_x_mcu / m_mcu_x;
 
         if ((m_mcu_lines[0] = static_cast<uint8*>(jpge_malloc(m_image_bpl_mcu * m_mcu_y))) == NULL) {
@@ -618,24 +1150,20 @@ namespace jpge {
         for (int i = 1; i < m_mcu_y; i++)
             m_mcu_lines[i] = m_mcu_lines[i-1] + m_image_bpl_mcu;
 
-        if(m_last_quality != m_params.m_quality){
-            m_last_quality = m_params.m_quality;
-            compute_quant_table(m_quantization_tables[0], s_std_lum_quant);
-            compute_quant_table(m_quantization_tables[1], s_std_croma_quant);
-        }
-
-        if(!m_huff_initialized){
-            m_huff_initialized = true;
-
-            memcpy(m_huff_bits[0+0], s_dc_lum_bits, 17);    memcpy(m_huff_val[0+0], s_dc_lum_val, DC_LUM_CODES);
-            memcpy(m_huff_bits[2+0], s_ac_lum_bits, 17);    memcpy(m_huff_val[2+0], s_ac_lum_val, AC_LUM_CODES);
-            memcpy(m_huff_bits[0+1], s_dc_chroma_bits, 17); memcpy(m_huff_val[0+1], s_dc_chroma_val, DC_CHROMA_CODES);
-            memcpy(m_huff_bits[2+1], s_ac_chroma_bits, 17); memcpy(m_huff_val[2+1], s_ac_chroma_val, AC_CHROMA_CODES);
-
-            compute_huffman_table(&m_huff_codes[0+0][0], &m_huff_code_sizes[0+0][0], m_huff_bits[0+0], m_huff_val[0+0]);
-            compute_huffman_table(&m_huff_codes[2+0][0], &m_huff_code_sizes[2+0][0], m_huff_bits[2+0], m_huff_val[2+0]);
-            compute_huffman_table(&m_huff_codes[0+1][0], &m_huff_code_sizes[0+1][0], m_huff_bits[0+1], m_huff_val[0+1]);
-            compute_huffman_table(&m_huff_codes[2+1][0], &m_huff_code_sizes[2+1][0], m_huff_bits[2+1], m_huff_val[2+1]);
+        m_scale = predict_scale();
+        compute_quant_table(m_quantization_tables[0], m_quantization_scales[0], s_std_lum_quant);
+        compute_quant_table(m_quantization_tables[1], m_quantization_scales[1], s_std_croma_quant);
+        m_pTables = &get_shared_tables();
+        m_huff_codes = m_pTables->huff_codes;
+        m_huff_code_sizes = m_pTables->huff_code_sizes;
+        if (m_params.m_two_pass_flag)
+        {
+            if ((m_pOptimized = static_cast<optimized_tables*>(jpge_malloc(sizeof(optimized_tables)))) == NULL)
+                return false;
+            memset(m_pOptimized->counts, 0, sizeof(m_pOptimized->counts));
+            // About 3 bytes per 8 pixels at usual qualities, grown as needed
+            if (!reserve_symbols(JPGE_MAX(m_image_x * m_image_y / 8, 1024)))
+                return false;
         }
 
         m_out_buf_left = JPGE_OUT_BUF_SIZE;
@@ -643,16 +1171,39 @@ namespace jpge {
         m_bit_buffer = 0;
         m_bits_in = 0;
         m_mcu_y_ofs = 0;
-        m_pass_num = 2;
+        m_pass_num = m_params.m_two_pass_flag ? 1 : 2;
+        m_bytes_flushed = 0;
+        m_activity = m_coded_activity = m_row_start_activity = 0;
+        m_level_sum = 0;
+        m_bytes_per_activity = 0;
+        set_rate_level(0);
         memset(m_last_dc_val, 0, 3 * sizeof(m_last_dc_val[0]));
 
-        // Emit all markers at beginning of image file.
-        emit_marker(M_SOI);
-        emit_jfif_app0();
-        emit_dqt();
-        emit_sof();
-        emit_dhts();
-        emit_sos();
+        // A strip starts at a restart interval of the whole image
+        if (m_params.m_strip_lines)
+        {
+            int mcu_rows = m_image_y_mcu / m_mcu_y;
+            m_first_mcu_row = m_params.m_strip_first_line / m_mcu_y;
+            m_end_mcu_row = (m_params.m_strip_first_line + m_params.m_strip_lines + m_mcu_y - 1) / m_mcu_y;
+            if ((m_params.m_strip_first_line % m_mcu_y) || (m_params.m_strip_first_line + m_params.m_strip_lines > m_image_y) ||
+                    (m_end_mcu_row < mcu_rows && (m_params.m_strip_lines % m_mcu_y)) ||
+                    ((m_first_mcu_row || m_end_mcu_row < mcu_rows) && (!m_params.m_restart_rows || (m_first_mcu_row % m_params.m_restart_rows) || (m_end_mcu_row < mcu_rows && (m_end_mcu_row % m_params.m_restart_rows)))))
+                return false;
+        }
+        else
+        {
+            m_first_mcu_row = 0;
+            m_end_mcu_row = m_image_y_mcu / m_mcu_y;
+        }
+        m_mcu_row = m_first_mcu_row;
+        if (m_params.m_restart_rows * m_mcus_per_row > 0xFFFF)
+            return false;
+
+        // The two pass mode emits the markers once the tables are known
+        if (m_first_mcu_row == 0 && m_pass_num == 2)
+            emit_markers();
+        m_scan_start = m_row_start_bytes = bytes_out();
+        m_scan_budget = JPGE_MAX(m_params.m_target_bytes - static_cast<int>(m_scan_start) - 2, 0);
 
         return m_all_stream_writes_succeeded;
     }
@@ -668,9 +1219,30 @@ namespace jpge {
             process_mcu_row();
         }
 
-        put_bits(0x7F, 7);
+        if (m_pass_num == 1)
+        {
+            if (!m_all_stream_writes_succeeded)
+                return false;
+            optimize_huffman_tables();
+            emit_markers();
+            code_symbols();
+            m_pass_num++;
+        }
+
+        // A strip before the end of the image ends with the restart marker that follows it
+        if (m_end_mcu_row < m_image_y_mcu / m_mcu_y)
+        {
+            emit_restart(m_end_mcu_row / m_params.m_restart_rows - 1);
+            flush_output_buffer();
+            m_pass_num++;
+            return true;
+        }
+
+        pad_bits();
         emit_marker(M_EOI);
         flush_output_buffer();
+        if (m_params.m_target_bytes && m_params.m_pRate_state)
+            finish_rate_state();
         m_all_stream_writes_succeeded = m_all_stream_writes_succeeded && m_pStream->put_buf(NULL, 0);
         m_pass_num++; // purposely bump up m_pass_num, for debugging
         return true;
@@ -679,6 +1251,10 @@ namespace jpge {
     void jpeg_encoder::clear()
     {
         m_mcu_lines[0] = NULL;
+        m_pOptimized = NULL;
+        m_pSymbols = NULL;
+        m_symbols_len = m_symbols_size = 0;
+        m_source_format = SOURCE_RGB;
         m_pass_num = 0;
         m_all_stream_writes_succeeded = true;
     }
@@ -702,9 +1278,23 @@ namespace jpge {
         return jpg_open(width, height, src_channels);
     }
 
+    bool jpeg_encoder::init(output_stream *pStream, int width, int height, source_format_t format, const params &comp_params)
+    {
+        deinit();
+        if ((!pStream) || (width < 1) || (height < 1) || (!comp_params.check())) return false;
+        if ((format != SOURCE_YUYV) && (format != SOURCE_YUV420P)) return false;
+        if ((format == SOURCE_YUYV) && (width & 1)) return false;
+        m_pStream = pStream;
+        m_params = comp_params;
+        m_source_format = format;
+        return jpg_open(width, height, (format == SOURCE_YUYV) ? 2 : 1);
+    }
+
     void jpeg_encoder::deinit()
     {
         jpge_free(m_mcu_lines[0]);
+        jpge_free(m_pOptimized);
+        jpge_free(m_pSymbols);
         clear();
     }
 
@@ -718,11 +1308,27 @@ namespace jpge {
                 if (!process_end_of_image()) {
                     return false;
                 }
-            } else {
+            } else if (m_source_format == SOURCE_YUYV) {
+                const uint8 *pSrc = static_cast<const uint8*>(pScanline);
+                load_mcu_ycc(pSrc, pSrc + 1, pSrc + 3, 2, 4);
+            } else if (m_source_format == SOURCE_RGB) {
                 load_mcu(pScanline);
+            } else {
+                return false;
             }
         }
         return m_all_stream_writes_succeeded;
     }
 
+    bool jpeg_encoder::process_scanline(const void* pY, const void* pCb, const void* pCr)
+    {
+        if ((m_pass_num < 1) || (m_pass_num > 2) || (m_source_format != SOURCE_YUV420P) || (!pY) || (!pCb) || (!pCr)) {
+            return false;
+        }
+        if (m_all_stream_writes_succeeded) {
+            load_mcu_ycc(static_cast<const uint8*>(pY), static_cast<const uint8*>(pCb), static_cast<const uint8*>(pCr), 1, 1);
+        }
+        return m_all_stream_writes_succeeded;
+    }
+
 } // namespace jpge
@@ -4,21 +4,43 @@
 #ifndef JPEG_ENCODER_H
 #define JPEG_ENCODER_H
 
+#include <stddef.h>
+
 namespace jpge
 {
     typedef unsigned char  uint8;
     typedef signed short   int16;
     typedef signed int     int32;
     typedef unsigned short uint16;
+    typedef unsigned long long uint64;
     typedef unsigned int   uint32;
     typedef unsigned int   uint;
 
     // JPEG chroma subsampling factors. Y_ONLY (grayscale images) and H2V2 (color images) are the most common.
     enum subsampling_t { Y_ONLY = 0, H1V1 = 1, H2V1 = 2, H2V2 = 3 };
 
+    // Source scanline layouts besides the RGB or grey scanlines selected with src_channels.
+    // YCbCr sources skip the RGB to YCbCr conversion and their chroma is used as sampled.
+    // They are taken as BT.601 studio range like the camera output (see yuv.c) and expanded to the JFIF full range.
+    // SOURCE_YUYV: width * 2 bytes per scanline, Y0 Cb Y1 Cr, width must be even.
+    // SOURCE_YUV420P: separate Y, Cb and Cr rows, see process_scanline(pY, pCb, pCr).
+    enum source_format_t { SOURCE_RGB = 0, SOURCE_YUYV = 1, SOURCE_YUV420P = 2 };
+
+    // Rate control statistics of the last frame, kept by the caller from frame to frame for params::m_target_bytes.
+    // All zero before the first frame, which is then coded at params::m_quality.
+    struct rate_state {
+            inline rate_state() : m_scale(0), m_bytes(0), m_activity(0), m_level(0) { }
+
+            int m_scale;       // Quantizer scale in percent of the standard tables
+            uint32 m_bytes;    // Size of the frame
+            uint32 m_activity; // Sum of the luma gradients, see jpeg_encoder::line_activity()
+            uint32 m_level;    // Mean coarsening level of the MCU rows in 1/16
+    };
+
     // JPEG compression parameters structure.
     struct params {
-            inline params() : m_quality(85), m_subsampling(H2V2) { }
+            inline params() : m_quality(85), m_subsampling(H2V2), m_restart_rows(0), m_strip_first_line(0), m_strip_lines(0), m_two_pass_flag(false),
+                m_target_bytes(0), m_pRate_state(NULL) { }
 
             inline bool check() const {
                 if ((m_quality < 1) || (m_quality > 100)) {
@@ -27,6 +49,15 @@ namespace jpge
                 if ((uint)m_subsampling > (uint)H2V2) {
                     return false;
                 }
+                if ((m_restart_rows < 0) || (m_strip_first_line < 0) || (m_strip_lines < 0)) {
+                    return false;
+                }
+                if (m_two_pass_flag && m_strip_lines) {
+                    return false;
+                }
+                if ((m_target_bytes < 0) || (m_target_bytes && (m_two_pass_flag || m_strip_lines))) {
+                    return false;
+                }
                 return true;
             }
 
@@ -39,6 +70,31 @@ namespace jpge
             // 2 = H2V1 subsampling (YCbCr 2x1x1, 4 blocks per MCU)
             // 3 = H2V2 subsampling (YCbCr 4x1x1, 6 blocks per MCU-- very common)
             subsampling_t m_subsampling;
+
+            // MCU rows per restart interval, 0 for none. The DC predictions start over after every RSTn marker.
+            int m_restart_rows;
+
+            // Encode only scanlines m_strip_first_line to m_strip_first_line + m_strip_lines - 1 of the image, 0 lines for all.
+            // Strips let separate encoders work on one image: each has to start and, unless it is the last,
+            // end on a restart interval. Only the first strip emits the headers and only the last one the EOI
+            // and the final put_buf(NULL, 0), the others end with the RSTn that follows them, so the outputs
+            // of all strips concatenated in order are the image.
+            int m_strip_first_line;
+            int m_strip_lines;
+
+            // Set to true to code the image with Huffman tables optimized for it instead of the standard ones,
+            // typically 5-10% smaller. The symbols are kept in memory until the last scanline, so nothing is
+            // written before, and RTP/JPEG (RFC 2435) receivers cannot decode the result. Not for strips.
+            bool m_two_pass_flag;
+
+            // Bytes per frame to aim at in a single pass, 0 to code at m_quality. The quantizer scale is predicted
+            // from the size and luma activity of the last frame in *m_pRate_state (m_quality without it or for the
+            // first frame), then the AC coefficients of every MCU row are rounded towards zero, or the highest ones
+            // dropped, as far as the bytes coded so far ask for. Tables only change between frames and coarsening
+            // rows can only take bytes away, so a frame lands within a few percent of the target once the scale has
+            // settled. Not for strips or the two pass mode.
+            int m_target_bytes;
+            rate_state *m_pRate_state;
     };
     
     // Output stream abstract class - used by the jpeg_encoder class to write to the output stream.
@@ -47,9 +103,12 @@ namespace jpge
         public:
             virtual ~output_stream() { };
             virtual bool put_buf(const void* Pbuf, int len) = 0;
-            virtual uint get_size() const = 0;
+            virtual size_t get_size() const = 0;
     };
     
+    struct shared_tables;
+    struct optimized_tables;
+
     // Lower level jpeg_encoder class - useful if more control is needed than the above helper functions.
     class jpeg_encoder {
         public:
@@ -64,12 +123,20 @@ namespace jpge
             // Returns false on out of memory or if a stream write fails.
             bool init(output_stream *pStream, int width, int height, int src_channels, const params &comp_params = params());
 
+            // Initializes the compressor for YCbCr source data, see source_format_t.
+            // H2V1 matches the sampling of YUYV and H2V2 the one of YUV420P, those encode without resampling chroma.
+            bool init(output_stream *pStream, int width, int height, source_format_t format, const params &comp_params = params());
+
             // Call this method with each source scanline.
             // width * src_channels bytes per scanline is expected (RGB or Y format).
             // You must call with NULL after all scanlines are processed to finish compression.
             // Returns false on out of memory or if a stream write fails.
             bool process_scanline(const void* pScanline);
 
+            // SOURCE_YUV420P variant: one row of Y and the (width + 1) / 2 byte Cb and Cr rows that go with it.
+            // Every chroma row is passed twice, with both luma rows it covers.
+            bool process_scanline(const void* pY, const void* pCb, const void* pCr);
+
             // Deinitializes the compressor, freeing any allocated memory. May be called at any time.
             void deinit();
 
@@ -82,6 +149,13 @@ namespace jpge
 
             output_stream *m_pStream;
             params m_params;
+            source_format_t m_source_format;
+            const shared_tables *m_pTables;
+            optimized_tables *m_pOptimized;
+            const uint (*m_huff_codes)[256];
+            const uint8 (*m_huff_code_sizes)[256];
+            uint8 m_quantization_tables[2][64];
+            uint32 m_quantization_scales[2][64]; // 2^QUANT_BITS / (DCT output scale * quantizer), zigzag order like the tables
             uint8 m_num_components;
             uint8 m_comp_h_samp[3], m_comp_v_samp[3];
             int m_image_x, m_image_y, m_image_bpp, m_image_bpl;
@@ -91,22 +165,40 @@ namespace jpge
             int m_mcu_x, m_mcu_y;
             uint8 *m_mcu_lines[16];
             uint8 m_mcu_y_ofs;
+            int m_mcu_row, m_first_mcu_row, m_end_mcu_row;
             sample_array_t m_sample_array[64];
             int16 m_coefficient_array[64];
+            uint64 m_coefficient_mask; // Bit 63 - i is set for every nonzero m_coefficient_array[i]
+            int m_scale; // Quantizer scale in percent of the standard tables
+
+            // Rate control, see params::m_target_bytes
+            uint32 m_ac_round;      // Rounding of the AC coefficients, 2^QUANT_BITS is a quantizer step
+            uint64 m_level_mask;    // The coefficients the row level keeps
+            int m_rate_level, m_level_sum;
+            float m_bytes_per_activity; // Of the last rows, at the current level
+            uint32 m_row_start_bytes, m_row_start_activity;
+            uint32 m_activity, m_coded_activity;
+            uint32 m_bytes_flushed, m_scan_start, m_scan_budget;
 
             int m_last_dc_val[3];
             uint8 m_out_buf[JPGE_OUT_BUF_SIZE];
             uint8 *m_pOut_buf;
             uint m_out_buf_left;
-            uint32 m_bit_buffer;
+            uint64 m_bit_buffer; // Filled from the top bit down
             uint m_bits_in;
             uint8 m_pass_num;
+            uint8 *m_pSymbols; // Pass one: the coded symbols and their extra bits, see code_coefficients_pass_one()
+            uint m_symbols_len, m_symbols_size;
             bool m_all_stream_writes_succeeded;
 
             bool jpg_open(int p_x_res, int p_y_res, int src_channels);
 
             void flush_output_buffer();
             void put_bits(uint bits, uint len);
+            void flush_bits();
+            void pad_bits();
+            void emit_restart(int num);
+            void emit_bit_buffer_byte();
 
             void emit_byte(uint8 i);
             void emit_word(uint i);
@@ -114,25 +206,43 @@ namespace jpge
 
             void emit_jfif_app0();
             void emit_dqt();
+            void emit_dri();
             void emit_sof();
-            void emit_dht(uint8 *bits, uint8 *val, int index, bool ac_flag);
+            void emit_dht(const uint8 *bits, const uint8 *val, int index, bool ac_flag);
             void emit_dhts();
             void emit_sos();
-
-            void compute_quant_table(int32 *dst, const int16 *src);
+            void emit_markers();
+
+            void compute_quant_table(uint8 *dst, uint32 *scale, const int16 *src);
+            int predict_scale() const;
+            uint32 line_activity(const uint8 *pY, int step) const;
+            uint32 bytes_out() const;
+            void update_rate_level();
+            void set_rate_level(int level);
+            void finish_rate_state();
             void load_quantized_coefficients(int component_num);
 
             void load_block_8_8_grey(int x);
             void load_block_8_8(int x, int y, int c);
             void load_block_16_8(int x, int c);
             void load_block_16_8_8(int x, int c);
+            void load_block_8_8_planar(int x, int y);
+            void load_block_chroma_h1v1(int x, int c);
+            void load_block_chroma_h2v1(int x, int c);
+            void load_block_chroma_h2v2(int x, int c);
 
+            bool reserve_symbols(uint len);
+            void code_coefficients_pass_one(int component_num);
             void code_coefficients_pass_two(int component_num);
+            void optimize_huffman_tables();
+            void code_symbols();
             void code_block(int component_num);
 
             void process_mcu_row();
             bool process_end_of_image();
             void load_mcu(const void* src);
+            void load_mcu_ycc(const uint8 *pY, const uint8 *pCb, const uint8 *pCr, int y_step, int c_step);
+            void finish_mcu_line();
             void clear();
             void init();
     };
@@ -18,10 +18,20 @@
 extern "C" {
 #endif
 
+#include <stddef.h>
 #include <stdint.h>
 
 void yuv2rgb(uint8_t y, uint8_t u, uint8_t v, uint8_t *r, uint8_t *g, uint8_t *b);
 
+/*
+ * Convert pixel_count pixels of YUYV (YUV422) to packed RGB888, BGR888 or
+ * RGB565 (high byte first, like the sensors output it). pixel_count should be
+ * even, the output is identical to calling yuv2rgb() for every pixel.
+ */
+void yuv422_to_rgb888(const uint8_t *src, uint8_t *dst, size_t pixel_count);
+void yuv422_to_bgr888(const uint8_t *src, uint8_t *dst, size_t pixel_count);
+void yuv422_to_rgb565(const uint8_t *src, uint8_t *dst, size_t pixel_count);
+
 #ifdef __cplusplus
 }
 #endif
@@ -13,6 +13,7 @@
 // limitations under the License.
 #include <stddef.h>
 #include <string.h>
+#include <new>
 #include "esp_attr.h"
 #include "soc/efuse_reg.h"
 #include "esp_heap_caps.h"
@@ -20,6 +21,15 @@
 #include "img_converters.h"
 #include "jpge.h"
 #include "yuv.h"
+#include "sdkconfig.h"
+
+#if ESP_PLATFORM
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/semphr.h"
+#else
+#include <pthread.h>
+#endif
 
 #if defined(ARDUINO_ARCH_ESP32) && defined(CONFIG_ARDUHAL_ESP_LOG)
 #include "esp32-hal-log.h"
@@ -29,6 +39,13 @@
 static const char* TAG = "to_jpg";
 #endif
 
+#ifndef CONFIG_CAMERA_JPEG_ENCODE_STRIPS
+#define CONFIG_CAMERA_JPEG_ENCODE_STRIPS 1
+#endif
+
+#define JPG_MAX_STRIPS          8
+#define JPG_STRIP_TASK_STACK    4096
+
 static void *_malloc(size_t size)
 {
     void * res = malloc(size);
@@ -65,51 +82,39 @@ static IRAM_ATTR void convert_line_format(uint8_t * src, pixformat_t format, uin
             dst[o++] = (src[i+1] & 0x1F) << 3;
         }
     } else if(format == PIXFORMAT_YUV422) {
-        uint8_t y0, y1, u, v;
-        uint8_t r, g, b;
         l = width * 2;
         src += l * line;
-        for(i=0; i<l; i+=4) {
-            y0 = src[i];
-            u = src[i+1];
-            y1 = src[i+2];
-            v = src[i+3];
-
-            yuv2rgb(y0, u, v, &r, &g, &b);
-            dst[o++] = r;
-            dst[o++] = g;
-            dst[o++] = b;
-
-            yuv2rgb(y1, u, v, &r, &g, &b);
-            dst[o++] = r;
-            dst[o++] = g;
-            dst[o++] = b;
-        }
+        yuv422_to_rgb888(src, dst, width);
     }
 }
 
-bool convert_image(uint8_t *src, uint16_t width, uint16_t height, pixformat_t format, uint8_t quality, jpge::output_stream *dst_stream)
+// Encodes the scanlines of comp_params' strip, the whole image when it has none
+static bool encode_lines(uint8_t *src, uint16_t width, uint16_t height, pixformat_t format, const jpge::params &comp_params, jpge::output_stream *dst_stream)
 {
-    int num_channels = 3;
-    jpge::subsampling_t subsampling = jpge::H2V2;
-
-    if(format == PIXFORMAT_GRAYSCALE) {
-        num_channels = 1;
-        subsampling = jpge::Y_ONLY;
-    }
+    int first_line = comp_params.m_strip_first_line;
+    int end_line = comp_params.m_strip_lines ? first_line + comp_params.m_strip_lines : height;
+    jpge::jpeg_encoder dst_image;
 
-    if(!quality) {
-        quality = 1;
-    } else if(quality > 100) {
-        quality = 100;
+    if(format == PIXFORMAT_YUV422 && !(width & 1)) {
+        if (!dst_image.init(dst_stream, width, height, jpge::SOURCE_YUYV, comp_params)) {
+            ESP_LOGE(TAG, "JPG encoder init failed");
+            return false;
+        }
+        for (int i = first_line; i < end_line; i++) {
+            if (!dst_image.process_scanline(src + i * width * 2)) {
+                ESP_LOGE(TAG, "JPG process line %u failed", i);
+                return false;
+            }
+        }
+        if (!dst_image.process_scanline(NULL)) {
+            ESP_LOGE(TAG, "JPG image finish failed");
+            return false;
+        }
+        dst_image.deinit();
+        return true;
     }
 
-    jpge::params comp_params = jpge::params();
-    comp_params.m_subsampling = subsampling;
-    comp_params.m_quality = quality;
-
-    jpge::jpeg_encoder dst_image;
-
+    int num_channels = (format == PIXFORMAT_GRAYSCALE) ? 1 : 3;
     if (!dst_image.init(dst_stream, width, height, num_channels, comp_params)) {
         ESP_LOGE(TAG, "JPG encoder init failed");
         return false;
@@ -121,7 +126,7 @@ bool convert_image(uint8_t *src, uint16_t width, uint16_t height, pixformat_t fo
         return false;
     }
 
-    for (int i = 0; i < height; i++) {
+    for (int i = first_line; i < end_line; i++) {
         convert_line_format(src, format, line, width, num_channels, i);
         if (!dst_image.process_scanline(line)) {
             ESP_LOGE(TAG, "JPG process line %u failed", i);
@@ -139,97 +144,318 @@ bool convert_image(uint8_t *src, uint16_t width, uint16_t height, pixformat_t fo
     return true;
 }
 
-class callback_stream : public jpge::output_stream {
+// Output collected in memory that grows as needed, for the strips that wait for the ones
+// before them and for the fmt2jpg() result
+class memory_stream : public jpge::output_stream {
 protected:
-    jpg_out_cb ocb;
-    void * oarg;
-    size_t index;
+    uint8_t *buf;
+    size_t len, capacity, initial_capacity;
 
 public:
-    callback_stream(jpg_out_cb cb, void * arg) : ocb(cb), oarg(arg), index(0) { }
-    virtual ~callback_stream() { }
-    virtual bool put_buf(const void* data, int len)
+    memory_stream(size_t initial = 16 * 1024) : buf(NULL), len(0), capacity(0), initial_capacity(initial) { }
+    virtual ~memory_stream() { free(buf); }
+    virtual bool put_buf(const void* data, int size)
     {
-        index += ocb(oarg, index, data, len);
+        if (!data) {
+            return true;
+        }
+        if (len + size > capacity) {
+            size_t new_capacity = capacity ? capacity * 2 : initial_capacity;
+            while (new_capacity < len + size) {
+                new_capacity *= 2;
+            }
+            uint8_t *new_buf = (uint8_t *)_malloc(new_capacity);
+            if (!new_buf) {
+                return false;
+            }
+            if (len) {
+                memcpy(new_buf, buf, len);
+            }
+            free(buf);
+            buf = new_buf;
+            capacity = new_capacity;
+        }
+        memcpy(buf + len, data, size);
+        len += size;
         return true;
     }
     virtual size_t get_size() const
     {
-        return index;
+        return len;
+    }
+    const uint8_t *data() const
+    {
+        return buf;
+    }
+    // Hands the buffer over to the caller, who has to free it
+    uint8_t *release()
+    {
+        uint8_t *res = buf;
+        buf = NULL;
+        len = capacity = 0;
+        return res;
     }
 };
 
-bool fmt2jpg_cb(uint8_t *src, size_t src_len, uint16_t width, uint16_t height, pixformat_t format, uint8_t quality, jpg_out_cb cb, void * arg)
+struct strip_job {
+    uint8_t *src;
+    uint16_t width, height;
+    pixformat_t format;
+    jpge::params params;
+    memory_stream stream;
+    bool result;
+#if ESP_PLATFORM
+    SemaphoreHandle_t done;
+#else
+    pthread_t thread;
+#endif
+};
+
+#if ESP_PLATFORM
+static void strip_task(void *arg)
 {
-    callback_stream dst_stream(cb, arg);
-    return convert_image(src, width, height, format, quality, &dst_stream);
+    strip_job *job = (strip_job *)arg;
+    job->result = encode_lines(job->src, job->width, job->height, job->format, job->params, &job->stream);
+    xSemaphoreGive(job->done);
+    vTaskDelete(NULL);
 }
 
-bool frame2jpg_cb(camera_fb_t * fb, uint8_t quality, jpg_out_cb cb, void * arg)
+// Runs the job on the other core, false when it could not be started
+static bool strip_start(strip_job *job)
 {
-    return fmt2jpg_cb(fb->buf, fb->len, fb->width, fb->height, fb->format, quality, cb, arg);
+    job->done = xSemaphoreCreateBinary();
+    if (!job->done) {
+        return false;
+    }
+#if CONFIG_FREERTOS_UNICORE
+    BaseType_t core = tskNO_AFFINITY;
+#else
+    BaseType_t core = !xPortGetCoreID();
+#endif
+    if (xTaskCreatePinnedToCore(strip_task, "jpg_strip", JPG_STRIP_TASK_STACK, job, uxTaskPriorityGet(NULL), NULL, core) != pdPASS) {
+        vSemaphoreDelete(job->done);
+        return false;
+    }
+    return true;
 }
 
+static void strip_join(strip_job *job)
+{
+    xSemaphoreTake(job->done, portMAX_DELAY);
+    vSemaphoreDelete(job->done);
+}
+#else
+static void *strip_thread(void *arg)
+{
+    strip_job *job = (strip_job *)arg;
+    job->result = encode_lines(job->src, job->width, job->height, job->format, job->params, &job->stream);
+    return NULL;
+}
 
+static bool strip_start(strip_job *job)
+{
+    return pthread_create(&job->thread, NULL, strip_thread, job) == 0;
+}
 
-class memory_stream : public jpge::output_stream {
-protected:
-    uint8_t *out_buf;
-    size_t max_len, index;
+static void strip_join(strip_job *job)
+{
+    pthread_join(job->thread, NULL);
+}
+#endif
 
-public:
-    memory_stream(void *pBuf, uint buf_size) : out_buf(static_cast<uint8_t*>(pBuf)), max_len(buf_size), index(0) { }
+// Splits the image into bands of whole restart intervals. The first band is encoded by the
+// calling task straight into dst_stream, the others by tasks of their own into memory, they
+// are appended once the first one is done. Optimized Huffman tables and rate control need a single strip.
+static bool convert_image(uint8_t *src, uint16_t width, uint16_t height, pixformat_t format, uint8_t quality, int strips, bool optimize, jpg_rate_control_t *rate, jpge::output_stream *dst_stream)
+{
+    jpge::params comp_params = jpge::params();
+    comp_params.m_subsampling = jpge::H2V2;
+    comp_params.m_quality = quality ? (quality > 100 ? 100 : quality) : 1;
+    if(format == PIXFORMAT_GRAYSCALE) {
+        comp_params.m_subsampling = jpge::Y_ONLY;
+    } else if(format == PIXFORMAT_YUV422 && !(width & 1)) {
+        // Encode the camera's YCbCr directly, H2V1 keeps its chroma as sampled
+        comp_params.m_subsampling = jpge::H2V1;
+    }
+    if (optimize) {
+        comp_params.m_two_pass_flag = true;
+        strips = 1;
+    }
+    if (rate) {
+        jpge::rate_state state;
+        state.m_scale = rate->scale;
+        state.m_bytes = rate->last_size;
+        state.m_activity = rate->activity;
+        state.m_level = rate->level;
+        comp_params.m_quality = rate->quality ? (rate->quality > 100 ? 100 : rate->quality) : 1;
+        comp_params.m_target_bytes = rate->target_size > INT32_MAX ? INT32_MAX : rate->target_size;
+        comp_params.m_pRate_state = &state;
+        bool result = encode_lines(src, width, height, format, comp_params, dst_stream);
+        if (result) {
+            rate->scale = state.m_scale;
+            rate->last_size = state.m_bytes;
+            rate->activity = state.m_activity;
+            rate->level = state.m_level;
+        }
+        return result;
+    }
 
-    virtual ~memory_stream() { }
+    // At least two MCU rows per strip and a restart interval that fits into DRI
+    int mcu_x = (comp_params.m_subsampling >= jpge::H2V1) ? 16 : 8;
+    int mcu_y = (comp_params.m_subsampling == jpge::H2V2) ? 16 : 8;
+    int mcu_rows = (height + mcu_y - 1) / mcu_y;
+    if (strips > JPG_MAX_STRIPS) {
+        strips = JPG_MAX_STRIPS;
+    }
+    if (strips > mcu_rows / 2) {
+        strips = mcu_rows / 2;
+    }
+    int strip_rows = strips > 1 ? (mcu_rows + strips - 1) / strips : mcu_rows;
+    if (strips <= 1 || strip_rows * ((width + mcu_x - 1) / mcu_x) > 0xFFFF) {
+        return encode_lines(src, width, height, format, comp_params, dst_stream);
+    }
+    strips = (mcu_rows + strip_rows - 1) / strip_rows;
+    comp_params.m_restart_rows = strip_rows;
 
-    virtual bool put_buf(const void* pBuf, int len)
-    {
-        if (!pBuf) {
-            //end of image
-            return true;
-        }
-        if ((size_t)len > (max_len - index)) {
-            //ESP_LOGW(TAG, "JPG output overflow: %d bytes (%d,%d,%d)", len - (max_len - index), len, index, max_len);
-            len = max_len - index;
-        }
-        if (len) {
-            memcpy(out_buf + index, pBuf, len);
-            index += len;
+    strip_job *jobs = new (std::nothrow) strip_job[strips - 1];
+    if (!jobs) {
+        ESP_LOGE(TAG, "Strip jobs alloc failed");
+        return false;
+    }
+    for (int i = 0; i < strips - 1; i++) {
+        strip_job *job = &jobs[i];
+        int first_line = (i + 1) * strip_rows * mcu_y;
+        job->src = src;
+        job->width = width;
+        job->height = height;
+        job->format = format;
+        job->params = comp_params;
+        job->params.m_strip_first_line = first_line;
+        job->params.m_strip_lines = (height - first_line < strip_rows * mcu_y) ? height - first_line : strip_rows * mcu_y;
+        job->result = false;
+    }
+
+    int started = 0;
+    while (started < strips - 1 && strip_start(&jobs[started])) {
+        started++;
+    }
+
+    jpge::params first_params = comp_params;
+    first_params.m_strip_lines = strip_rows * mcu_y;
+    bool result = encode_lines(src, width, height, format, first_params, dst_stream);
+
+    // Whatever could not be started runs here
+    for (int i = 0; i < strips - 1; i++) {
+        if (i < started) {
+            strip_join(&jobs[i]);
+        } else {
+            jobs[i].result = encode_lines(src, width, height, format, jobs[i].params, &jobs[i].stream);
         }
-        return true;
     }
+    for (int i = 0; i < strips - 1 && result; i++) {
+        result = jobs[i].result && dst_stream->put_buf(jobs[i].stream.data(), jobs[i].stream.get_size());
+    }
+    delete[] jobs;
+
+    return result && dst_stream->put_buf(NULL, 0);
+}
+
+class callback_stream : public jpge::output_stream {
+protected:
+    jpg_out_cb ocb;
+    void * oarg;
+    size_t index;
 
+public:
+    callback_stream(jpg_out_cb cb, void * arg) : ocb(cb), oarg(arg), index(0) { }
+    virtual ~callback_stream() { }
+    // A callback that takes less than it was given ends the encoding, the JPEG would have a hole
+    virtual bool put_buf(const void* data, int len)
+    {
+        size_t written = ocb(oarg, index, data, len);
+        index += written;
+        return written == (size_t)len;
+    }
     virtual size_t get_size() const
     {
         return index;
     }
 };
 
-bool fmt2jpg(uint8_t *src, size_t src_len, uint16_t width, uint16_t height, pixformat_t format, uint8_t quality, uint8_t ** out, size_t * out_len)
+bool fmt2jpg_cb(uint8_t *src, size_t src_len, uint16_t width, uint16_t height, pixformat_t format, uint8_t quality, jpg_out_cb cb, void * arg)
 {
-    //todo: allocate proper buffer for holding JPEG data
-    //this should be enough for CIF frame size
-    int jpg_buf_len = 128*1024;
-
+    callback_stream dst_stream(cb, arg);
+    return convert_image(src, width, height, format, quality, CONFIG_CAMERA_JPEG_ENCODE_STRIPS, false, NULL, &dst_stream);
+}
 
-    uint8_t * jpg_buf = (uint8_t *)_malloc(jpg_buf_len);
-    if(jpg_buf == NULL) {
-        ESP_LOGE(TAG, "JPG buffer malloc failed");
+bool fmt2jpg_rate_cb(uint8_t *src, size_t src_len, uint16_t width, uint16_t height, pixformat_t format, jpg_rate_control_t *rate, jpg_out_cb cb, void * arg)
+{
+    if (!rate || !rate->target_size) {
+        ESP_LOGE(TAG, "No rate target");
         return false;
     }
-    memory_stream dst_stream(jpg_buf, jpg_buf_len);
+    callback_stream dst_stream(cb, arg);
+    return convert_image(src, width, height, format, 0, 1, false, rate, &dst_stream);
+}
+
+bool frame2jpg_cb(camera_fb_t * fb, uint8_t quality, jpg_out_cb cb, void * arg)
+{
+    return fmt2jpg_cb(fb->buf, fb->len, fb->width, fb->height, fb->format, quality, cb, arg);
+}
+
+bool frame2jpg_rate_cb(camera_fb_t * fb, jpg_rate_control_t *rate, jpg_out_cb cb, void * arg)
+{
+    return fmt2jpg_rate_cb(fb->buf, fb->len, fb->width, fb->height, fb->format, rate, cb, arg);
+}
+
 
-    if(!convert_image(src, width, height, format, quality, &dst_stream)) {
-        free(jpg_buf);
+
+static bool convert_to_buffer(uint8_t *src, uint16_t width, uint16_t height, pixformat_t format, uint8_t quality, int strips, bool optimize, jpg_rate_control_t *rate, uint8_t ** out, size_t * out_len)
+{
+    // About 2 bits per pixel to start with, the buffer grows for detailed or high quality frames
+    size_t initial_len = rate ? rate->target_size + rate->target_size / 8 : (size_t)width * height / 4;
+    memory_stream dst_stream(initial_len < 16 * 1024 ? 16 * 1024 : initial_len);
+
+    if(!convert_image(src, width, height, format, quality, strips, optimize, rate, &dst_stream) || !dst_stream.get_size()) {
+        ESP_LOGE(TAG, "JPG conversion failed");
         return false;
     }
 
-    *out = jpg_buf;
     *out_len = dst_stream.get_size();
+    *out = dst_stream.release();
     return true;
 }
 
+bool fmt2jpg_strips(uint8_t *src, size_t src_len, uint16_t width, uint16_t height, pixformat_t format, uint8_t quality, int strips, uint8_t ** out, size_t * out_len)
+{
+    return convert_to_buffer(src, width, height, format, quality, strips, false, NULL, out, out_len);
+}
+
+bool fmt2jpg(uint8_t *src, size_t src_len, uint16_t width, uint16_t height, pixformat_t format, uint8_t quality, uint8_t ** out, size_t * out_len)
+{
+    return convert_to_buffer(src, width, height, format, quality, CONFIG_CAMERA_JPEG_ENCODE_STRIPS, false, NULL, out, out_len);
+}
+
+bool fmt2jpg_optimized(uint8_t *src, size_t src_len, uint16_t width, uint16_t height, pixformat_t format, uint8_t quality, uint8_t ** out, size_t * out_len)
+{
+    return convert_to_buffer(src, width, height, format, quality, 1, true, NULL, out, out_len);
+}
+
+bool fmt2jpg_rate(uint8_t *src, size_t src_len, uint16_t width, uint16_t height, pixformat_t format, jpg_rate_control_t *rate, uint8_t ** out, size_t * out_len)
+{
+    if (!rate || !rate->target_size) {
+        ESP_LOGE(TAG, "No rate target");
+        return false;
+    }
+    return convert_to_buffer(src, width, height, format, 0, 1, false, rate, out, out_len);
+}
+
 bool frame2jpg(camera_fb_t * fb, uint8_t quality, uint8_t ** out, size_t * out_len)
 {
     return fmt2jpg(fb->buf, fb->len, fb->width, fb->height, fb->format, quality, out, out_len);
 }
+
+bool frame2jpg_optimized(camera_fb_t * fb, uint8_t quality, uint8_t ** out, size_t * out_len)
+{
+    return fmt2jpg_optimized(fb->buf, fb->len, fb->width, fb->height, fb->format, quality, out, out_len);
+}
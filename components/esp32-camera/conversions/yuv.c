@@ -11,6 +11,7 @@
 // WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
 // See the License for the specific language governing permissions and
 // limitations under the License.
+#include <string.h>
 #include "yuv.h"
 #include "esp_attr.h"
 
@@ -296,3 +297,155 @@ void IRAM_ATTR yuv2rgb(uint8_t y, uint8_t u, uint8_t v, uint8_t *r, uint8_t *g,
     *g = YUYV_CONSTRAIN(gi);
     *b = YUYV_CONSTRAIN(bi);
 }
+
+/*
+ * Block kernels, YUV_BLOCK pixels per iteration.
+ *
+ * Every column of yuv_table is k * (x - x0) / 8192 rounded towards zero, so
+ * the kernels compute the table instead of looking it up and produce exactly
+ * the same output as yuv2rgb(). All arithmetic fits 16 bit lanes, written
+ * with GCC vector extensions. They only pay off where the compiler turns the
+ * byte shuffles into single instructions (SSSE3, NEON). Elsewhere, including
+ * the ESP32 targets, the generic lowering is slower than the table, which
+ * stays the default.
+ */
+#if defined(__SSSE3__) || defined(__ARM_NEON)
+#define YUV_VECTOR 1
+#else
+#define YUV_VECTOR 0
+#endif
+
+#if YUV_VECTOR
+#define YUV_BLOCK 8
+
+#define YUV_K_Y   9535  // 1.164 * 8192
+#define YUV_K_VR  13075 // 1.596 * 8192
+#define YUV_K_VG  3204  // 0.391 * 8192
+#define YUV_K_UG  6656  // 0.813 * 8192
+#define YUV_K_UB  16531 // 2.018 * 8192
+
+typedef uint8_t yuv_u8x16_t __attribute__((vector_size(16)));
+typedef int16_t yuv_i16x8_t __attribute__((vector_size(16)));
+typedef uint16_t yuv_u16x8_t __attribute__((vector_size(16)));
+
+#if defined(__clang__)
+#define YUV_SHUFFLE(a, b, ...) __builtin_shufflevector((yuv_u8x16_t)(a), (yuv_u8x16_t)(b), __VA_ARGS__)
+#else
+#define YUV_SHUFFLE(a, b, ...) __builtin_shuffle((yuv_u8x16_t)(a), (yuv_u8x16_t)(b), (yuv_u8x16_t){__VA_ARGS__})
+#endif
+
+/*
+ * x * k / 8192 rounded towards zero, for |x| < 256 and k < 16384 + 256.
+ * Splitting k in bytes keeps every intermediate below 65536:
+ * floor(a * k / 8192) == (a * (k >> 8) + (a * (k & 0xFF) >> 8)) >> 5
+ */
+static inline yuv_i16x8_t yuv_scale(yuv_i16x8_t x, uint16_t k)
+{
+    yuv_i16x8_t sign = x >> 15;
+    yuv_u16x8_t a = (yuv_u16x8_t)((x ^ sign) - sign);
+    yuv_i16x8_t m = (yuv_i16x8_t)((a * (uint16_t)(k >> 8) + ((a * (uint16_t)(k & 0xFF)) >> 8)) >> 5);
+    return (m ^ sign) - sign;
+}
+
+static inline yuv_i16x8_t yuv_clamp(yuv_i16x8_t v)
+{
+    v &= (yuv_i16x8_t)(v >= 0);
+    yuv_i16x8_t over = (yuv_i16x8_t)(v > 255);
+    return (v & ~over) | (over & 255);
+}
+
+// YUYV to one R, G and B value per 16 bit lane
+static inline void yuv422_block(const uint8_t *src, yuv_i16x8_t *r, yuv_i16x8_t *g, yuv_i16x8_t *b)
+{
+    yuv_u8x16_t in, zero = {0};
+    memcpy(&in, src, sizeof(in));
+
+    yuv_i16x8_t y = (yuv_i16x8_t)YUV_SHUFFLE(in, zero, 0, 16, 2, 16, 4, 16, 6, 16, 8, 16, 10, 16, 12, 16, 14, 16);
+    yuv_i16x8_t u = (yuv_i16x8_t)YUV_SHUFFLE(in, zero, 1, 16, 1, 16, 5, 16, 5, 16, 9, 16, 9, 16, 13, 16, 13, 16);
+    yuv_i16x8_t v = (yuv_i16x8_t)YUV_SHUFFLE(in, zero, 3, 16, 3, 16, 7, 16, 7, 16, 11, 16, 11, 16, 15, 16, 15, 16);
+
+    y = yuv_scale(y - 16, YUV_K_Y);
+    u -= 128;
+    v -= 128;
+
+    *r = yuv_clamp(y + yuv_scale(v, YUV_K_VR));
+    *g = yuv_clamp(y - yuv_scale(u, YUV_K_UG) - yuv_scale(v, YUV_K_VG));
+    *b = yuv_clamp(y + yuv_scale(u, YUV_K_UB));
+}
+
+// Interleave the low bytes of three lanes into 24 bytes of packed pixels
+static inline void yuv_store_888(uint8_t *dst, yuv_i16x8_t c0, yuv_i16x8_t c1, yuv_i16x8_t c2)
+{
+    yuv_u8x16_t c01 = YUV_SHUFFLE(c0, c1, 0, 16, 2, 18, 4, 20, 6, 22, 8, 24, 10, 26, 12, 28, 14, 30);
+    yuv_u8x16_t lo = YUV_SHUFFLE(c01, c2, 0, 1, 16, 2, 3, 18, 4, 5, 20, 6, 7, 22, 8, 9, 24, 10);
+    yuv_u8x16_t hi = YUV_SHUFFLE(c01, c2, 11, 26, 12, 13, 28, 14, 15, 30, 0, 0, 0, 0, 0, 0, 0, 0);
+    memcpy(dst, &lo, 16);
+    memcpy(dst + 16, &hi, 8);
+}
+#endif /* YUV_VECTOR */
+
+void IRAM_ATTR yuv422_to_rgb888(const uint8_t *src, uint8_t *dst, size_t pixel_count)
+{
+    size_t i = 0;
+#if YUV_VECTOR
+    for (; i + YUV_BLOCK <= pixel_count; i += YUV_BLOCK) {
+        yuv_i16x8_t r, g, b;
+        yuv422_block(src, &r, &g, &b);
+        yuv_store_888(dst, r, g, b);
+        src += YUV_BLOCK * 2;
+        dst += YUV_BLOCK * 3;
+    }
+#endif
+    for (; i + 2 <= pixel_count; i += 2) {
+        yuv2rgb(src[0], src[1], src[3], &dst[0], &dst[1], &dst[2]);
+        yuv2rgb(src[2], src[1], src[3], &dst[3], &dst[4], &dst[5]);
+        src += 4;
+        dst += 6;
+    }
+}
+
+void IRAM_ATTR yuv422_to_bgr888(const uint8_t *src, uint8_t *dst, size_t pixel_count)
+{
+    size_t i = 0;
+#if YUV_VECTOR
+    for (; i + YUV_BLOCK <= pixel_count; i += YUV_BLOCK) {
+        yuv_i16x8_t r, g, b;
+        yuv422_block(src, &r, &g, &b);
+        yuv_store_888(dst, b, g, r);
+        src += YUV_BLOCK * 2;
+        dst += YUV_BLOCK * 3;
+    }
+#endif
+    for (; i + 2 <= pixel_count; i += 2) {
+        yuv2rgb(src[0], src[1], src[3], &dst[2], &dst[1], &dst[0]);
+        yuv2rgb(src[2], src[1], src[3], &dst[5], &dst[4], &dst[3]);
+        src += 4;
+        dst += 6;
+    }
+}
+
+void IRAM_ATTR yuv422_to_rgb565(const uint8_t *src, uint8_t *dst, size_t pixel_count)
+{
+    size_t i = 0;
+#if YUV_VECTOR
+    for (; i + YUV_BLOCK <= pixel_count; i += YUV_BLOCK) {
+        yuv_i16x8_t r, g, b;
+        yuv422_block(src, &r, &g, &b);
+        yuv_i16x8_t hb = (r & 0xF8) | (g >> 5);
+        yuv_i16x8_t lb = ((g << 3) & 0xE0) | (b >> 3);
+        yuv_u8x16_t out = YUV_SHUFFLE(hb, lb, 0, 16, 2, 18, 4, 20, 6, 22, 8, 24, 10, 26, 12, 28, 14, 30);
+        memcpy(dst, &out, sizeof(out));
+        src += YUV_BLOCK * 2;
+        dst += YUV_BLOCK * 2;
+    }
+#endif
+    for (; i + 2 <= pixel_count; i += 2) {
+        uint8_t r, g, b;
+        for (int j = 0; j < 2; j++) {
+            yuv2rgb(src[2 * j], src[1], src[3], &r, &g, &b);
+            *dst++ = (r & 0xF8) | (g >> 5);
+            *dst++ = ((g << 3) & 0xE0) | (b >> 3);
+        }
+        src += 4;
+    }
+}
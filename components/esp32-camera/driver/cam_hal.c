@@ -17,6 +17,7 @@
 #include "esp_heap_caps.h"
 #include "ll_cam.h"
 #include "cam_hal.h"
+#include "esp-trace.h"
 
 #if (ESP_IDF_VERSION_MAJOR == 3) && (ESP_IDF_VERSION_MINOR == 3)
 #include "rom/ets_sys.h"
@@ -106,7 +107,11 @@ void IRAM_ATTR ll_cam_send_event(cam_obj_t *cam, cam_event_t cam_event, BaseType
     if (xQueueSendFromISR(cam->event_queue, (void *)&cam_event, HPTaskAwoken) != pdTRUE) {
         ll_cam_stop(cam);
         cam->state = CAM_STATE_IDLE;
+#if CONFIG_ESP_TRACE_ENABLED
+        ESP_TRACE(CAM_EV_OVERFLOW, cam_event, 0);
+#else
         ESP_CAMERA_ETS_PRINTF(DRAM_STR("cam_hal: EV-%s-OVF\r\n"), cam_event==CAM_IN_SUC_EOF_EVENT ? DRAM_STR("EOF") : DRAM_STR("VSYNC"));
+#endif
     }
 }
 
@@ -128,6 +133,7 @@ static void cam_task(void *arg)
             case CAM_STATE_IDLE: {
                 if (cam_event == CAM_VSYNC_EVENT) {
                     //DBG_PIN_SET(1);
+                    ESP_TRACE(CAM_VSYNC, frame_pos, 0);
                     if(cam_start_frame(&frame_pos)){
                         cam_obj->frames[frame_pos].fb.len = 0;
                         cam_obj->state = CAM_STATE_READ_BUF;
@@ -144,6 +150,7 @@ static void cam_task(void *arg)
                 if (cam_event == CAM_IN_SUC_EOF_EVENT) {
                     if(!cam_obj->psram_mode){
                         if (cam_obj->fb_size < (frame_buffer_event->len + pixels_per_dma)) {
+                            ESP_TRACE(CAM_FB_OVERFLOW, frame_pos, frame_buffer_event->len);
                             ESP_LOGW(TAG, "FB-OVF");
                             ll_cam_stop(cam_obj);
                             DBG_PIN_SET(0);
@@ -163,12 +170,14 @@ static void cam_task(void *arg)
 
                 } else if (cam_event == CAM_VSYNC_EVENT) {
                     //DBG_PIN_SET(1);
+                    ESP_TRACE(CAM_VSYNC, frame_pos, 0);
                     ll_cam_stop(cam_obj);
 
                     if (cnt || !cam_obj->jpeg_mode || cam_obj->psram_mode) {
                         if (cam_obj->jpeg_mode) {
                             if (!cam_obj->psram_mode) {
                                 if (cam_obj->fb_size < (frame_buffer_event->len + pixels_per_dma)) {
+                                    ESP_TRACE(CAM_FB_OVERFLOW, frame_pos, frame_buffer_event->len);
                                     ESP_LOGW(TAG, "FB-OVF");
                                     cnt--;
                                 } else {
@@ -195,6 +204,9 @@ static void cam_task(void *arg)
                                 ESP_LOGE(TAG, "FB-SIZE: %u != %u", frame_buffer_event->len, (unsigned) cam_obj->fb_size);
                             }
                         }
+                        if (!cam_obj->frames[frame_pos].en) {
+                            ESP_TRACE(CAM_FRAME, frame_pos, frame_buffer_event->len);
+                        }
                         //send frame
                         if(!cam_obj->frames[frame_pos].en && xQueueSend(cam_obj->frame_buffer_queue, (void *)&frame_buffer_event, 0) != pdTRUE) {
                             //pop frame buffer from the queue
@@ -87,6 +87,18 @@ static const char *CAMERA_SENSOR_NVS_KEY = "sensor";
 static const char *CAMERA_PIXFORMAT_NVS_KEY = "pixformat";
 static camera_state_t *s_state = NULL;
 
+#if CONFIG_CAMERA_PROBE_HINT
+static const char *CAMERA_PROBE_NVS_NAMESPACE = "camera";
+static const char *CAMERA_PROBE_NVS_KEY = "probe";
+
+// The sensor found by the last probe
+typedef struct {
+    uint8_t index;      // in g_sensors
+    uint8_t slv_addr;
+    uint16_t pid;
+} camera_probe_hint_t;
+#endif
+
 #if CONFIG_IDF_TARGET_ESP32S3 // LCD_CAM module of ESP32-S3 will generate xclk
 #define CAMERA_ENABLE_OUT_CLOCK(v)
 #define CAMERA_DISABLE_OUT_CLOCK()
@@ -145,6 +157,53 @@ static const sensor_func_t g_sensors[] = {
 #endif
 };
 
+#if CONFIG_CAMERA_PROBE_HINT
+static bool camera_probe_hint_load(camera_probe_hint_t *hint)
+{
+#if ESP_IDF_VERSION_MAJOR > 3
+    nvs_handle_t handle;
+#else
+    nvs_handle handle;
+#endif
+    if (nvs_open(CAMERA_PROBE_NVS_NAMESPACE, NVS_READONLY, &handle) != ESP_OK) {
+        return false;
+    }
+    size_t size = sizeof(camera_probe_hint_t);
+    esp_err_t ret = nvs_get_blob(handle, CAMERA_PROBE_NVS_KEY, hint, &size);
+    nvs_close(handle);
+    return ret == ESP_OK && size == sizeof(camera_probe_hint_t);
+}
+
+static void camera_probe_hint_save(const camera_probe_hint_t *hint)
+{
+#if ESP_IDF_VERSION_MAJOR > 3
+    nvs_handle_t handle;
+#else
+    nvs_handle handle;
+#endif
+    esp_err_t ret = nvs_open(CAMERA_PROBE_NVS_NAMESPACE, NVS_READWRITE, &handle);
+    if (ret == ESP_OK) {
+        ret = nvs_set_blob(handle, CAMERA_PROBE_NVS_KEY, hint, sizeof(camera_probe_hint_t));
+        if (ret == ESP_OK) {
+            ret = nvs_commit(handle);
+        }
+        nvs_close(handle);
+    }
+    if (ret != ESP_OK) {
+        ESP_LOGD(TAG, "Probe hint not saved: %s", esp_err_to_name(ret));
+    }
+}
+
+// Checks only the sensor the last probe found, the ID it reads must be the one found then
+static bool camera_probe_hint_detect(const camera_probe_hint_t *hint, sensor_id_t *id)
+{
+    if (hint->index >= sizeof(g_sensors) / sizeof(sensor_func_t) || SCCB_Probe_Addr(hint->slv_addr) != 0) {
+        return false;
+    }
+    return g_sensors[hint->index].detect(hint->slv_addr, id) && id->PID == hint->pid;
+}
+#endif
+
 static esp_err_t camera_probe(const camera_config_t *config, camera_model_t *out_camera_model)
 {
     esp_err_t ret = ESP_OK;
@@ -206,40 +265,63 @@ static esp_err_t camera_probe(const camera_config_t *config, camera_model_t *out
     ESP_LOGD(TAG, "Searching for camera address");
     vTaskDelay(10 / portTICK_PERIOD_MS);
 
-    uint8_t slv_addr = SCCB_Probe();
-
-    if (slv_addr == 0) {
-        ret = ESP_ERR_NOT_FOUND;
-        goto err;
-    }
-
-    ESP_LOGI(TAG, "Detected camera at address=0x%02x", slv_addr);
-    s_state->sensor.slv_addr = slv_addr;
-    s_state->sensor.xclk_freq_hz = config->xclk_freq_hz;
-
-    /**
-     * Read sensor ID and then initialize sensor
-     * Attention: Some sensors have the same SCCB address. Therefore, several attempts may be made in the detection process
-     */
     sensor_id_t *id = &s_state->sensor.id;
-    for (size_t i = 0; i < sizeof(g_sensors) / sizeof(sensor_func_t); i++) {
-        if (g_sensors[i].detect(slv_addr, id)) {
-            camera_sensor_info_t *info = esp_camera_sensor_get_info(id);
-            if (NULL != info) {
-                *out_camera_model = info->model;
-                ESP_LOGI(TAG, "Detected %s camera", info->name);
-                g_sensors[i].init(&s_state->sensor);
-                break;
+    uint8_t slv_addr = 0;
+    size_t sensor_index = 0;
+    camera_sensor_info_t *info = NULL;
+#if CONFIG_CAMERA_PROBE_HINT
+    camera_probe_hint_t hint;
+    bool have_hint = camera_probe_hint_load(&hint);
+    if (have_hint && camera_probe_hint_detect(&hint, id)) {
+        info = esp_camera_sensor_get_info(id);
+        slv_addr = hint.slv_addr;
+        sensor_index = hint.index;
+        ESP_LOGI(TAG, "Detected camera at address=0x%02x, as on the last boot", slv_addr);
+    }
+#endif
+    if (NULL == info) {
+        slv_addr = SCCB_Probe();
+        if (slv_addr == 0) {
+            ret = ESP_ERR_NOT_FOUND;
+            goto err;
+        }
+        ESP_LOGI(TAG, "Detected camera at address=0x%02x", slv_addr);
+
+        /**
+         * Read sensor ID and then initialize sensor
+         * Attention: Some sensors have the same SCCB address. Therefore, several attempts may be made in the detection process
+         */
+        for (size_t i = 0; i < sizeof(g_sensors) / sizeof(sensor_func_t) && NULL == info; i++) {
+            if (g_sensors[i].detect(slv_addr, id)) {
+                info = esp_camera_sensor_get_info(id);
+                sensor_index = i;
             }
         }
     }
 
-    if (CAMERA_NONE == *out_camera_model) { //If no supported sensors are detected
+    if (NULL == info) { //If no supported sensors are detected
         ESP_LOGE(TAG, "Detected camera not supported.");
         ret = ESP_ERR_NOT_SUPPORTED;
         goto err;
     }
 
+    *out_camera_model = info->model;
+    ESP_LOGI(TAG, "Detected %s camera", info->name);
+    s_state->sensor.slv_addr = slv_addr;
+    s_state->sensor.xclk_freq_hz = config->xclk_freq_hz;
+    g_sensors[sensor_index].init(&s_state->sensor);
+
+#if CONFIG_CAMERA_PROBE_HINT
+    if (!have_hint || hint.index != sensor_index || hint.slv_addr != slv_addr || hint.pid != id->PID) {
+        hint = (camera_probe_hint_t) {
+            .index = sensor_index,
+            .slv_addr = slv_addr,
+            .pid = id->PID,
+        };
+        camera_probe_hint_save(&hint);
+    }
+#endif
+
     ESP_LOGI(TAG, "Camera PID=0x%02x VER=0x%02x MIDL=0x%02x MIDH=0x%02x",
              id->PID, id->VER, id->MIDH, id->MIDL);
 
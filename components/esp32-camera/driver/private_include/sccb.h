@@ -9,14 +9,24 @@
 #ifndef __SCCB_H__
 #define __SCCB_H__
 #include <stdint.h>
+
+#define SCCB_REG_ADDR16         0x01    /*!< The sensor has 16 bit register addresses */
+#define SCCB_AUTO_INCREMENT     0x02    /*!< The sensor writes the bytes after the first to the following registers */
 int SCCB_Init(int pin_sda, int pin_scl);
 int SCCB_Use_Port(int sccb_i2c_port);
 int SCCB_Deinit(void);
+// Address of the first sensor acknowledging, the addresses of the common sensors tried first, 0 without one
 uint8_t SCCB_Probe(void);
+// 0 when a sensor acknowledges at slv_addr
+int SCCB_Probe_Addr(uint8_t slv_addr);
 uint8_t SCCB_Read(uint8_t slv_addr, uint8_t reg);
 int SCCB_Write(uint8_t slv_addr, uint8_t reg, uint8_t data);
 uint8_t SCCB_Read16(uint8_t slv_addr, uint16_t reg);
 int SCCB_Write16(uint8_t slv_addr, uint16_t reg, uint8_t data);
 uint16_t SCCB_Read_Addr16_Val16(uint8_t slv_addr, uint16_t reg);
 int SCCB_Write_Addr16_Val16(uint8_t slv_addr, uint16_t reg, uint16_t data);
+// Writes a register table of a sensor driver, {reg, value} pairs up to {tail, x}, with {dly, ms}
+// entries waiting after everything before them is written. Registers counting up are written
+// in one burst with SCCB_AUTO_INCREMENT, and bursts share a transaction up to SCCB_BATCH_SIZE bytes.
+int SCCB_Write_Regs(uint8_t slv_addr, const uint16_t (*regs)[2], uint16_t dly, uint16_t tail, int flags);
 #endif // __SCCB_H__
@@ -0,0 +1,45 @@
+/*
+ * Shadow of the sensor registers known to the driver.
+ *
+ * A sensor driver keeps what it wrote to, or read from, the registers of the
+ * sensor, so changing bits of a register needs no read over SCCB and writing
+ * the value a register already has needs no transaction at all. Registers the
+ * sensor changes by itself, like the gains of its auto exposure, or that act
+ * on being written, like a reset, are volatile and always go to the bus.
+ *
+ * All functions take a NULL shadow, which knows no registers.
+ */
+#ifndef __SCCB_SHADOW_H__
+#define __SCCB_SHADOW_H__
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#define SCCB_SHADOW_SIZE        128     /*!< Registers kept, a power of two */
+
+typedef struct {
+    uint16_t first;
+    uint16_t last;
+} sccb_shadow_range_t;
+
+typedef struct {
+    uint32_t tags[SCCB_SHADOW_SIZE];    /*!< Register in the slot, SCCB_SHADOW_VALID when it is known */
+    uint8_t values[SCCB_SHADOW_SIZE];
+    const sccb_shadow_range_t *volatile_regs;
+    size_t volatile_count;
+    uint32_t hits;                      /*!< Reads and writes the shadow saved the bus */
+} sccb_shadow_t;
+
+// volatile_regs must outlive the shadow, NULL when out of memory
+sccb_shadow_t *sccb_shadow_create(const sccb_shadow_range_t *volatile_regs, size_t volatile_count);
+void sccb_shadow_delete(sccb_shadow_t *shadow);
+// Forgets all registers, after a reset of the sensor or a failed write of a table
+void sccb_shadow_clear(sccb_shadow_t *shadow);
+bool sccb_shadow_get(sccb_shadow_t *shadow, uint16_t reg, uint8_t *value);
+// Whether writing value to reg can be skipped, it is known to have it already
+bool sccb_shadow_unchanged(sccb_shadow_t *shadow, uint16_t reg, uint8_t value);
+void sccb_shadow_set(sccb_shadow_t *shadow, uint16_t reg, uint8_t value);
+void sccb_shadow_invalidate(sccb_shadow_t *shadow, uint16_t reg);
+// Keeps the values of a register table written with SCCB_Write_Regs()
+void sccb_shadow_set_regs(sccb_shadow_t *shadow, const uint16_t (*regs)[2], uint16_t dly, uint16_t tail);
+#endif // __SCCB_SHADOW_H__
@@ -37,6 +37,14 @@ static const char* TAG = "sccb";
 #define ACK_CHECK_DIS           0x0                   /*!< I2C master will not check ack from slave */
 #define ACK_VAL                 0x0                   /*!< I2C ack value */
 #define NACK_VAL                0x1                   /*!< I2C nack value */
+#ifdef CONFIG_SCCB_PROBE_TIMEOUT_MS
+#define SCCB_PROBE_TIMEOUT_MS   CONFIG_SCCB_PROBE_TIMEOUT_MS
+#else
+#define SCCB_PROBE_TIMEOUT_MS   20
+#endif
+// At least one tick, shorter timeouts round down to none below a tick rate of 1000 Hz
+#define SCCB_PROBE_TIMEOUT_TICKS (pdMS_TO_TICKS(SCCB_PROBE_TIMEOUT_MS) ? pdMS_TO_TICKS(SCCB_PROBE_TIMEOUT_MS) : 1)
+#define SCCB_BATCH_SIZE         128                   /*!< Bytes on the bus per transaction of SCCB_Write_Regs() */
 #if CONFIG_SCCB_HARDWARE_I2C_PORT1
 const int SCCB_I2C_PORT_DEFAULT = 1;
 #else
@@ -92,22 +100,32 @@ int SCCB_Deinit(void)
     return i2c_driver_delete(sccb_i2c_port);
 }
 
+int SCCB_Probe_Addr(uint8_t slv_addr)
+{
+    i2c_cmd_handle_t cmd = i2c_cmd_link_create();
+    i2c_master_start(cmd);
+    i2c_master_write_byte(cmd, ( slv_addr << 1 ) | WRITE_BIT, ACK_CHECK_EN);
+    i2c_master_stop(cmd);
+    esp_err_t ret = i2c_master_cmd_begin(sccb_i2c_port, cmd, SCCB_PROBE_TIMEOUT_TICKS);
+    i2c_cmd_link_delete(cmd);
+    return ret == ESP_OK ? 0 : -1;
+}
+
 uint8_t SCCB_Probe(void)
 {
-    uint8_t slave_addr = 0x0;
+    // The sensors of most boards first, then whatever else is left
+    static const camera_model_t likely[] = { CAMERA_OV2640, CAMERA_OV5640, CAMERA_OV7725 };
+    uint8_t tried[CAMERA_MODEL_MAX];
+    size_t tried_count = 0;
 
-    for (size_t i = 0; i < CAMERA_MODEL_MAX; i++) {
-        if (slave_addr == camera_sensor[i].sccb_addr) {
+    for (size_t i = 0; i < sizeof(likely) / sizeof(likely[0]) + CAMERA_MODEL_MAX; i++) {
+        size_t model = i < sizeof(likely) / sizeof(likely[0]) ? likely[i] : i - sizeof(likely) / sizeof(likely[0]);
+        uint8_t slave_addr = camera_sensor[model].sccb_addr;
+        if (memchr(tried, slave_addr, tried_count)) {
             continue;
         }
-        slave_addr = camera_sensor[i].sccb_addr;
-        i2c_cmd_handle_t cmd = i2c_cmd_link_create();
-        i2c_master_start(cmd);
-        i2c_master_write_byte(cmd, ( slave_addr << 1 ) | WRITE_BIT, ACK_CHECK_EN);
-        i2c_master_stop(cmd);
-        esp_err_t ret = i2c_master_cmd_begin(sccb_i2c_port, cmd, 1000 / portTICK_RATE_MS);
-        i2c_cmd_link_delete(cmd);
-        if( ret == ESP_OK) {
+        tried[tried_count++] = slave_addr;
+        if (SCCB_Probe_Addr(slave_addr) == 0) {
             return slave_addr;
         }
     }
@@ -258,3 +276,82 @@ int SCCB_Write_Addr16_Val16(uint8_t slv_addr, uint16_t reg, uint16_t data)
     }
     return ret == ESP_OK ? 0 : -1;
 }
+
+// Sends the bursts queued in the command link, their bytes are in buf
+static int sccb_batch_send(i2c_cmd_handle_t *cmd, size_t *len, uint16_t first_reg)
+{
+    if (!*cmd) {
+        return 0;
+    }
+    i2c_master_stop(*cmd);
+    esp_err_t ret = i2c_master_cmd_begin(sccb_i2c_port, *cmd, 1000 / portTICK_RATE_MS);
+    i2c_cmd_link_delete(*cmd);
+    *cmd = NULL;
+    *len = 0;
+    if(ret != ESP_OK) {
+        ESP_LOGE(TAG, "W [%04x...] batch fail, ret:%d", first_reg, ret);
+    }
+    return ret == ESP_OK ? 0 : -1;
+}
+
+int SCCB_Write_Regs(uint8_t slv_addr, const uint16_t (*regs)[2], uint16_t dly, uint16_t tail, int flags)
+{
+    uint8_t buf[SCCB_BATCH_SIZE];
+    size_t len = 0, addr_len = (flags & SCCB_REG_ADDR16) ? 2 : 1;
+    i2c_cmd_handle_t cmd = NULL;
+    uint16_t first_reg = 0;
+    int ret = 0;
+
+    for (size_t i = 0; !ret && regs[i][0] != tail; ) {
+        uint16_t reg = regs[i][0];
+        if (reg == dly) {
+            ret = sccb_batch_send(&cmd, &len, first_reg);
+            vTaskDelay(regs[i][1] / portTICK_RATE_MS);
+            i++;
+            continue;
+        }
+
+        // Registers counting up from reg go out in one burst
+        size_t n = 1;
+        if (flags & SCCB_AUTO_INCREMENT) {
+            while (1 + addr_len + n < SCCB_BATCH_SIZE && regs[i + n][0] != tail && regs[i + n][0] != dly &&
+                    regs[i + n][0] == (uint16_t)(reg + n)) {
+                n++;
+            }
+        }
+        if (len + 1 + addr_len + n > SCCB_BATCH_SIZE) {
+            ret = sccb_batch_send(&cmd, &len, first_reg);
+            if (ret) {
+                break;
+            }
+        }
+        if (!cmd) {
+            cmd = i2c_cmd_link_create();
+            first_reg = reg;
+        } else {
+            i2c_master_stop(cmd);
+        }
+
+        uint8_t *burst = buf + len;
+        size_t burst_len = 0;
+        burst[burst_len++] = (slv_addr << 1) | WRITE_BIT;
+        if (addr_len == 2) {
+            burst[burst_len++] = reg >> 8;
+        }
+        burst[burst_len++] = reg & 0xFF;
+        for (size_t j = 0; j < n; j++) {
+            burst[burst_len++] = regs[i + j][1];
+        }
+        i2c_master_start(cmd);
+        i2c_master_write(cmd, burst, burst_len, ACK_CHECK_EN);
+        len += burst_len;
+        i += n;
+    }
+
+    if (!ret) {
+        ret = sccb_batch_send(&cmd, &len, first_reg);
+    } else if (cmd) {
+        i2c_cmd_link_delete(cmd);
+    }
+    return ret;
+}
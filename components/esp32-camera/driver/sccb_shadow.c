@@ -0,0 +1,106 @@
+/*
+ * Shadow of the sensor registers known to the driver, see sccb_shadow.h.
+ *
+ * A direct mapped cache: a register has one slot, and a register mapping to
+ * the same slot takes it over, the other is read from the sensor again.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include "sccb_shadow.h"
+
+#define SCCB_SHADOW_VALID       0x10000
+
+static size_t slot(uint16_t reg)
+{
+    // Fibonacci hashing spreads the runs of registers of a block over the slots
+    return ((uint32_t)reg * 2654435761u) >> 16 & (SCCB_SHADOW_SIZE - 1);
+}
+
+static bool is_volatile(const sccb_shadow_t *shadow, uint16_t reg)
+{
+    for (size_t i = 0; i < shadow->volatile_count; i++) {
+        if (reg >= shadow->volatile_regs[i].first && reg <= shadow->volatile_regs[i].last) {
+            return true;
+        }
+    }
+    return false;
+}
+
+sccb_shadow_t *sccb_shadow_create(const sccb_shadow_range_t *volatile_regs, size_t volatile_count)
+{
+    sccb_shadow_t *shadow = calloc(1, sizeof(sccb_shadow_t));
+    if (shadow) {
+        shadow->volatile_regs = volatile_regs;
+        shadow->volatile_count = volatile_count;
+    }
+    return shadow;
+}
+
+void sccb_shadow_delete(sccb_shadow_t *shadow)
+{
+    free(shadow);
+}
+
+void sccb_shadow_clear(sccb_shadow_t *shadow)
+{
+    if (shadow) {
+        memset(shadow->tags, 0, sizeof(shadow->tags));
+    }
+}
+
+bool sccb_shadow_get(sccb_shadow_t *shadow, uint16_t reg, uint8_t *value)
+{
+    if (!shadow) {
+        return false;
+    }
+    size_t i = slot(reg);
+    if (shadow->tags[i] != (SCCB_SHADOW_VALID | reg)) {
+        return false;
+    }
+    shadow->hits++;
+    *value = shadow->values[i];
+    return true;
+}
+
+bool sccb_shadow_unchanged(sccb_shadow_t *shadow, uint16_t reg, uint8_t value)
+{
+    if (!shadow) {
+        return false;
+    }
+    size_t i = slot(reg);
+    if (shadow->tags[i] != (SCCB_SHADOW_VALID | reg) || shadow->values[i] != value) {
+        return false;
+    }
+    shadow->hits++;
+    return true;
+}
+
+void sccb_shadow_set(sccb_shadow_t *shadow, uint16_t reg, uint8_t value)
+{
+    if (!shadow || is_volatile(shadow, reg)) {
+        return;
+    }
+    size_t i = slot(reg);
+    shadow->tags[i] = SCCB_SHADOW_VALID | reg;
+    shadow->values[i] = value;
+}
+
+void sccb_shadow_invalidate(sccb_shadow_t *shadow, uint16_t reg)
+{
+    if (!shadow) {
+        return;
+    }
+    size_t i = slot(reg);
+    if (shadow->tags[i] == (SCCB_SHADOW_VALID | reg)) {
+        shadow->tags[i] = 0;
+    }
+}
+
+void sccb_shadow_set_regs(sccb_shadow_t *shadow, const uint16_t (*regs)[2], uint16_t dly, uint16_t tail)
+{
+    for (size_t i = 0; shadow && regs[i][0] != tail; i++) {
+        if (regs[i][0] != dly) {
+            sccb_shadow_set(shadow, regs[i][0], regs[i][1]);
+        }
+    }
+}
@@ -90,6 +90,9 @@ static int set_reg_bits(uint8_t slv_addr, uint16_t reg, uint8_t offset, uint8_t
 
 static int write_regs(uint8_t slv_addr, const uint16_t (*regs)[2])
 {
+#ifndef REG_DEBUG_ON
+    return SCCB_Write_Regs(slv_addr, regs, REG_DLY, REGLIST_TAIL, 0);
+#else
     int i = 0, ret = 0;
     while (!ret && regs[i][0] != REGLIST_TAIL) {
         if (regs[i][0] == REG_DLY) {
@@ -100,6 +103,7 @@ static int write_regs(uint8_t slv_addr, const uint16_t (*regs)[2])
         i++;
     }
     return ret;
+#endif
 }
 
 static void print_regs(uint8_t slv_addr)
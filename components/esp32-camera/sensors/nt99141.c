@@ -110,6 +110,9 @@ static int set_reg_bits(uint8_t slv_addr, uint16_t reg, uint8_t offset, uint8_t
 
 static int write_regs(uint8_t slv_addr, const uint16_t (*regs)[2])
 {
+#ifndef REG_DEBUG_ON
+    return SCCB_Write_Regs(slv_addr, regs, REG_DLY, REGLIST_TAIL, SCCB_REG_ADDR16);
+#else
     int i = 0, ret = 0;
 
     while (!ret && regs[i][0] != REGLIST_TAIL) {
@@ -123,6 +126,7 @@ static int write_regs(uint8_t slv_addr, const uint16_t (*regs)[2])
     }
 
     return ret;
+#endif
 }
 
 static int write_reg16(uint8_t slv_addr, const uint16_t reg, uint16_t value)
@@ -10,6 +10,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include "sccb.h"
+#include "sccb_shadow.h"
 #include "xclk.h"
 #include "ov2640.h"
 #include "ov2640_regs.h"
@@ -24,6 +25,20 @@
 static const char* TAG = "ov2640";
 #endif
 
+// Registers of both banks in the shadow, bank << 8 | reg
+#define SHADOW_REG(bank, reg) ((uint16_t)((bank) << 8 | (reg)))
+
+// Set by the auto exposure, or acting on being written
+static const sccb_shadow_range_t volatile_regs[] = {
+    {SHADOW_REG(BANK_DSP, RESET), SHADOW_REG(BANK_DSP, RESET)},
+    {SHADOW_REG(BANK_SENSOR, GAIN), SHADOW_REG(BANK_SENSOR, GAIN)},
+    {SHADOW_REG(BANK_SENSOR, REG04), SHADOW_REG(BANK_SENSOR, REG04)},
+    {SHADOW_REG(BANK_SENSOR, AEC), SHADOW_REG(BANK_SENSOR, AEC)},
+    {SHADOW_REG(BANK_SENSOR, COM7), SHADOW_REG(BANK_SENSOR, COM7)},
+    {SHADOW_REG(BANK_SENSOR, REG45), SHADOW_REG(BANK_SENSOR, REG45)},
+};
+static sccb_shadow_t *shadow;
+
 static volatile ov2640_bank_t reg_bank = BANK_MAX;
 static int set_bank(sensor_t *sensor, ov2640_bank_t bank)
 {
@@ -43,8 +58,12 @@ static int write_regs(sensor_t *sensor, const uint8_t (*regs)[2])
             res = set_bank(sensor, regs[i][1]);
         } else {
             res = SCCB_Write(sensor->slv_addr, regs[i][0], regs[i][1]);
+            if (!res) {
+                sccb_shadow_set(shadow, SHADOW_REG(reg_bank, regs[i][0]), regs[i][1]);
+            }
         }
         if (res) {
+            sccb_shadow_clear(shadow);
             return res;
         }
         i++;
@@ -54,34 +73,42 @@ static int write_regs(sensor_t *sensor, const uint8_t (*regs)[2])
 
 static int write_reg(sensor_t *sensor, ov2640_bank_t bank, uint8_t reg, uint8_t value)
 {
+    if (sccb_shadow_unchanged(shadow, SHADOW_REG(bank, reg), value)) {
+        return 0;
+    }
     int ret = set_bank(sensor, bank);
     if(!ret) {
         ret = SCCB_Write(sensor->slv_addr, reg, value);
     }
-    return ret;
-}
-
-static int set_reg_bits(sensor_t *sensor, uint8_t bank, uint8_t reg, uint8_t offset, uint8_t mask, uint8_t value)
-{
-    int ret = 0;
-    uint8_t c_value, new_value;
-
-    ret = set_bank(sensor, bank);
-    if(ret) {
-        return ret;
+    if(!ret) {
+        sccb_shadow_set(shadow, SHADOW_REG(bank, reg), value);
+    } else {
+        sccb_shadow_invalidate(shadow, SHADOW_REG(bank, reg));
     }
-    c_value = SCCB_Read(sensor->slv_addr, reg);
-    new_value = (c_value & ~(mask << offset)) | ((value & mask) << offset);
-    ret = SCCB_Write(sensor->slv_addr, reg, new_value);
     return ret;
 }
 
 static int read_reg(sensor_t *sensor, ov2640_bank_t bank, uint8_t reg)
 {
+    uint8_t value;
+    if (sccb_shadow_get(shadow, SHADOW_REG(bank, reg), &value)) {
+        return value;
+    }
     if(set_bank(sensor, bank)){
         return 0;
     }
-    return SCCB_Read(sensor->slv_addr, reg);
+    value = SCCB_Read(sensor->slv_addr, reg);
+    sccb_shadow_set(shadow, SHADOW_REG(bank, reg), value);
+    return value;
+}
+
+static int set_reg_bits(sensor_t *sensor, uint8_t bank, uint8_t reg, uint8_t offset, uint8_t mask, uint8_t value)
+{
+    uint8_t c_value, new_value;
+
+    c_value = read_reg(sensor, bank, reg);
+    new_value = (c_value & ~(mask << offset)) | ((value & mask) << offset);
+    return write_reg(sensor, bank, reg, new_value);
 }
 
 static uint8_t get_reg_bits(sensor_t *sensor, uint8_t bank, uint8_t reg, uint8_t offset, uint8_t mask)
@@ -102,6 +129,7 @@ static int reset(sensor_t *sensor)
 {
     int ret = 0;
     WRITE_REG_OR_RETURN(BANK_SENSOR, COM7, COM7_SRST);
+    sccb_shadow_clear(shadow);
     vTaskDelay(10 / portTICK_PERIOD_MS);
     WRITE_REGS_OR_RETURN(ov2640_settings_cif);
     return ret;
@@ -565,6 +593,11 @@ int ov2640_detect(int slv_addr, sensor_id_t *id)
 
 int ov2640_init(sensor_t *sensor)
 {
+    if (!shadow) {
+        shadow = sccb_shadow_create(volatile_regs, sizeof(volatile_regs) / sizeof(volatile_regs[0]));
+    }
+    sccb_shadow_clear(shadow);
+
     sensor->reset = reset;
     sensor->init_status = init_status;
     sensor->set_pixformat = set_pixformat;
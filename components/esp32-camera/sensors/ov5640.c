@@ -10,6 +10,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include "sccb.h"
+#include "sccb_shadow.h"
 #include "xclk.h"
 #include "ov5640.h"
 #include "ov5640_regs.h"
@@ -26,13 +27,32 @@ static const char *TAG = "ov5640";
 
 //#define REG_DEBUG_ON
 
+// Set by the sensor itself, or acting on being written
+static const sccb_shadow_range_t volatile_regs[] = {
+    {0x3000, 0x3005},       // system resets
+    {SYSTEM_CTROL0, SYSTEM_CTROL0},
+    {0x3022, 0x3029},       // auto focus firmware commands and status
+    {0x3212, 0x3212},       // group access launch
+    {0x3400, 0x3405},       // AWB gains
+    {0x3500, 0x3502},       // exposure
+    {0x350a, 0x350b},       // gain
+};
+static sccb_shadow_t *shadow;
+
 static int read_reg(uint8_t slv_addr, const uint16_t reg){
+    uint8_t value;
+    if (sccb_shadow_get(shadow, reg, &value)) {
+        return value;
+    }
     int ret = SCCB_Read16(slv_addr, reg);
 #ifdef REG_DEBUG_ON
     if (ret < 0) {
         ESP_LOGE(TAG, "READ REG 0x%04x FAILED: %d", reg, ret);
     }
 #endif
+    if (ret >= 0) {
+        sccb_shadow_set(shadow, reg, ret);
+    }
     return ret;
 }
 
@@ -108,6 +128,9 @@ static int read_reg16(uint8_t slv_addr, const uint16_t reg){
 static int write_reg(uint8_t slv_addr, const uint16_t reg, uint8_t value){
     int ret = 0;
 #ifndef REG_DEBUG_ON
+    if (sccb_shadow_unchanged(shadow, reg, value)) {
+        return 0;
+    }
     ret = SCCB_Write16(slv_addr, reg, value);
 #else
     int old_value = read_reg(slv_addr, reg);
@@ -125,6 +148,11 @@ static int write_reg(uint8_t slv_addr, const uint16_t reg, uint8_t value){
         ESP_LOGE(TAG, "WRITE REG 0x%04x FAILED: %d", reg, ret);
     }
 #endif
+    if (ret == 0) {
+        sccb_shadow_set(shadow, reg, value);
+    } else {
+        sccb_shadow_invalidate(shadow, reg);
+    }
     return ret;
 }
 
@@ -144,6 +172,15 @@ static int set_reg_bits(uint8_t slv_addr, uint16_t reg, uint8_t offset, uint8_t
 
 static int write_regs(uint8_t slv_addr, const uint16_t (*regs)[2])
 {
+#ifndef REG_DEBUG_ON
+    int ret = SCCB_Write_Regs(slv_addr, regs, REG_DLY, REGLIST_TAIL, SCCB_REG_ADDR16 | SCCB_AUTO_INCREMENT);
+    if (ret == 0) {
+        sccb_shadow_set_regs(shadow, regs, REG_DLY, REGLIST_TAIL);
+    } else {
+        sccb_shadow_clear(shadow);
+    }
+    return ret;
+#else
     int i = 0, ret = 0;
     while (!ret && regs[i][0] != REGLIST_TAIL) {
         if (regs[i][0] == REG_DLY) {
@@ -154,6 +191,7 @@ static int write_regs(uint8_t slv_addr, const uint16_t (*regs)[2])
         i++;
     }
     return ret;
+#endif
 }
 
 static int write_reg16(uint8_t slv_addr, const uint16_t reg, uint16_t value)
@@ -254,6 +292,7 @@ static int reset(sensor_t *sensor)
     int ret = 0;
     // Software Reset: clear all registers and reset them to their default values
     ret = write_reg(sensor->slv_addr, SYSTEM_CTROL0, 0x82);
+    sccb_shadow_clear(shadow);
     if(ret){
         ESP_LOGE(TAG, "Software Reset FAILED!");
         return ret;
@@ -1091,6 +1130,11 @@ int ov5640_detect(int slv_addr, sensor_id_t *id)
 
 int ov5640_init(sensor_t *sensor)
 {
+    if (!shadow) {
+        shadow = sccb_shadow_create(volatile_regs, sizeof(volatile_regs) / sizeof(volatile_regs[0]));
+    }
+    sccb_shadow_clear(shadow);
+
     sensor->reset = reset;
     sensor->set_pixformat = set_pixformat;
     sensor->set_framesize = set_framesize;
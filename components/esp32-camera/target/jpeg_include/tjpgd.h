@@ -6,13 +6,21 @@
 /*---------------------------------------------------------------------------*/
 /* System Configurations */
 
-#define	JD_SZBUF		512	/* Size of stream input buffer */
+#define	JD_SZBUF		2048	/* Size of stream input buffer */
+#define	JD_HUFFBIT		9	/* Length of the code words decoded with a single table look up (bits) */
 #define JD_FORMAT		0	/* Output pixel format 0:RGB888 (3 BYTE/pix), 1:RGB565 (1 WORD/pix) */
 #define	JD_USE_SCALE	1	/* Use descaling feature for output */
 #define JD_TBLCLIP		1	/* Use table for saturation (might be a bit faster but increases 1K bytes of code size) */
 
+/* Size of the memory pool for a session with two dequantizer tables, as the camera and the
+   encoder produce. The Huffman lookup tables take 6 bytes of it per entry
+   (two AC tables of WORD and two DC tables of BYTE). */
+#define	JD_SZPOOL		(3100 - 512 + JD_SZBUF + 6 * (1 << JD_HUFFBIT))
+
 /*---------------------------------------------------------------------------*/
 
+#include <stdint.h>
+
 #ifdef __cplusplus
 extern "C" {
 #endif
@@ -33,9 +41,9 @@ typedef unsigned short	WORD;
 typedef unsigned short	WCHAR;
 
 /* These types must be 32-bit integer */
-typedef long			LONG;
-typedef unsigned long	ULONG;
-typedef unsigned long	DWORD;
+typedef int32_t			LONG;
+typedef uint32_t		ULONG;
+typedef uint32_t		DWORD;
 
 
 /* Error code */
@@ -66,7 +74,9 @@ struct JDEC {
 	UINT dctr;				/* Number of bytes available in the input buffer */
 	BYTE* dptr;				/* Current data read ptr */
 	BYTE* inbuf;			/* Bit stream input buffer */
-	BYTE dmsk;				/* Current bit in the current read byte */
+	DWORD wreg;				/* Bit register, next bits of the stream from the MSB */
+	UINT dbit;				/* Number of stream bits in the bit register */
+	BYTE marker;			/* Marker that ended the entropy coded data (0:not found yet) */
 	BYTE scale;				/* Output scaling ratio */
 	BYTE msx, msy;			/* MCU size in unit of block (width, height) */
 	BYTE qtid[3];			/* Quantization table ID of each component */
@@ -76,6 +86,8 @@ struct JDEC {
 	BYTE* huffbits[2][2];	/* Huffman bit distribution tables [id][dcac] */
 	WORD* huffcode[2][2];	/* Huffman code word tables [id][dcac] */
 	BYTE* huffdata[2][2];	/* Huffman decoded data tables [id][dcac] */
+	BYTE* hufflut_dc[2];	/* Lookup table of the short DC code words [id], length << 4 | data */
+	WORD* hufflut_ac[2];	/* Lookup table of the short AC code words [id], length << 8 | data */
 	LONG* qttbl[4];			/* Dequaitizer tables [id] */
 	void* workbuf;			/* Working buffer for IDCT and RGB output */
 	BYTE* mcubuf;			/* Working buffer for the MCU */
@@ -83,6 +95,10 @@ struct JDEC {
 	UINT sz_pool;			/* Size of momory pool (bytes available) */
 	UINT (*infunc)(JDEC*, BYTE*, UINT);/* Pointer to jpeg stream input function */
 	void* device;			/* Pointer to I/O device identifiler for the session */
+	JRECT roi;				/* Region to decompress in pixels of the image, jd_prepare() sets the whole image */
+	const BYTE* mem;		/* JPEG stream in memory (jd_prepare_mem) */
+	UINT szmem;				/* Size of the JPEG stream in memory */
+	UINT ofsmem;			/* Read offset in the JPEG stream in memory */
 };
 
 
@@ -91,6 +107,19 @@ struct JDEC {
 JRESULT jd_prepare (JDEC*, UINT(*)(JDEC*,BYTE*,UINT), void*, UINT, void*);
 JRESULT jd_decomp (JDEC*, UINT(*)(JDEC*,void*,JRECT*), BYTE);
 
+/* Extensions of the esp32-camera tjpgd */
+#define JD_HAS_MEM_INPUT	1	/* jd_prepare_mem(), jd_decomp_ycc() and jd_decomp_dc() are available */
+#define JD_HAS_ROI		1	/* Only the MCUs in JDEC.roi are output */
+
+/* Prepare for a JPEG stream in memory, the entropy coded data is read where it is */
+JRESULT jd_prepare_mem (JDEC*, const BYTE*, UINT, void*, UINT, void*);
+/* Decompress without color conversion: the output function gets the blocks of every
+   MCU (Y blocks left to right and top to bottom, then Cb and Cr) and its clipped rectangle */
+JRESULT jd_decomp_ycc (JDEC*, UINT(*)(JDEC*,void*,JRECT*));
+/* Only the DC values: the output function gets the mean luminance of every MCU as a
+   BYTE and its clipped rectangle, without IDCT */
+JRESULT jd_decomp_dc (JDEC*, UINT(*)(JDEC*,void*,JRECT*));
+
 
 #ifdef __cplusplus
 }
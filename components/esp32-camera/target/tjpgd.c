@@ -16,6 +16,11 @@
 / Oct 04,'11 R0.01  First release.
 / Feb 19,'12 R0.01a Fixed decompression fails when scan starts with an escape seq.
 / Sep 03,'12 R0.01b Added JD_TBLCLIP option.
+/              esp32-camera: Huffman lookup tables, a bit register instead of
+/              bit by bit extraction and fast paths for flat IDCT blocks.
+/              esp32-camera: Added jd_prepare_mem() and jd_decomp_ycc().
+/              esp32-camera: Added region of interest decompression.
+/              esp32-camera: Added jd_decomp_dc().
 /----------------------------------------------------------------------------*/
 
 #include "tjpgd.h"
@@ -200,9 +205,9 @@ UINT create_huffman_tbl (	/* 0:OK, !0:Failed */
 	UINT ndata				/* Size of input data */
 )
 {
-	UINT i, j, b, np, cls, num;
-	BYTE d, *pb, *pd;
-	WORD hc, *ph;
+	UINT i, j, k, b, n, np, cls, num;
+	BYTE d, *pb, *pd, *pl;
+	WORD hc, *ph, *pw;
 
 
 	while (ndata) {	/* Process all tables in the segment */
@@ -239,6 +244,36 @@ UINT create_huffman_tbl (	/* 0:OK, !0:Failed */
 			if (!cls && d > 11) return JDR_FMT1;
 			*pd++ = d;
 		}
+
+		/* Build the lookup table indexed by the next JD_HUFFBIT bits of the stream. Every
+		   entry that starts with a code word up to JD_HUFFBIT bits long holds its length and
+		   data, the others are 0 and left to the code word search. */
+		pd = jd->huffdata[num][cls];
+		pl = 0; pw = 0;
+		if (cls) {
+			pw = alloc_pool(jd, (1 << JD_HUFFBIT) * sizeof (WORD));
+			if (!pw) return JDR_MEM1;		/* Err: not enough memory */
+			jd->hufflut_ac[num] = pw;
+			for (i = 0; i < (1 << JD_HUFFBIT); i++) pw[i] = 0;
+		} else {
+			pl = alloc_pool(jd, 1 << JD_HUFFBIT);
+			if (!pl) return JDR_MEM1;		/* Err: not enough memory */
+			jd->hufflut_dc[num] = pl;
+			for (i = 0; i < (1 << JD_HUFFBIT); i++) pl[i] = 0;
+		}
+		for (j = i = 0; i < JD_HUFFBIT; i++) {	/* Code words of i + 1 bits */
+			for (b = pb[i]; b; b--, j++) {
+				if (ph[j] >> (i + 1)) return JDR_FMT1;	/* Err: too many code words for the length */
+				k = ph[j] << (JD_HUFFBIT - 1 - i);		/* First entry starting with the code word */
+				for (n = 1 << (JD_HUFFBIT - 1 - i); n; n--, k++) {
+					if (cls) {
+						pw[k] = (WORD)((i + 1) << 8 | pd[j]);
+					} else {
+						pl[k] = (BYTE)((i + 1) << 4 | pd[j]);
+					}
+				}
+			}
+		}
 	}
 
 	return JDR_OK;
@@ -248,51 +283,76 @@ UINT create_huffman_tbl (	/* 0:OK, !0:Failed */
 
 
 /*-----------------------------------------------------------------------*/
-/* Extract N bits from input stream                                      */
+/* Load the input stream into the bit register                           */
 /*-----------------------------------------------------------------------*/
 
 static
-INT bitext (	/* >=0: extracted data, <0: error code */
-	JDEC* jd,	/* Pointer to the decompressor object */
-	UINT nbit	/* Number of bits to extract (1 to 11) */
+void fill_bits (
+	JDEC* jd	/* Pointer to the decompressor object */
 )
 {
-	BYTE msk, s, *dp;
-	UINT dc, v, f;
+	UINT dc, dbit;
+	DWORD w;
+	BYTE d, *dp;
 
 
-	msk = jd->dmsk; dc = jd->dctr; dp = jd->dptr;	/* Bit mask, number of data available, read ptr */
-	s = *dp; v = f = 0;
-	do {
-		if (!msk) {				/* Next byte? */
-			if (!dc) {			/* No input data is available, re-fill input buffer */
-				dp = jd->inbuf;	/* Top of input buffer */
-				dc = jd->infunc(jd, dp, JD_SZBUF);
-				if (!dc) return 0 - (INT)JDR_INP;	/* Err: read error or wrong stream termination */
-			} else {
-				dp++;			/* Next data ptr */
+	dc = jd->dctr; dp = jd->dptr;	/* Number of data available, read ptr */
+	w = jd->wreg; dbit = jd->dbit;	/* Bit register and number of bits in it */
+	while (dbit <= 24 && !jd->marker) {	/* Add bytes until the register is full or a marker is found */
+		if (!dc) {			/* No input data is available, re-fill input buffer */
+			dp = jd->inbuf;	/* Top of input buffer */
+			dc = jd->infunc(jd, dp, JD_SZBUF);
+			if (!dc) {		/* End of the stream, treat it as EOI */
+				jd->marker = 0xD9; break;
 			}
-			dc--;				/* Decrement number of available bytes */
-			if (f) {			/* In flag sequence? */
-				f = 0;			/* Exit flag sequence */
-				if (*dp != 0) return 0 - (INT)JDR_FMT1;	/* Err: unexpected flag is detected (may be collapted data) */
-				*dp = s = 0xFF;			/* The flag is a data 0xFF */
-			} else {
-				s = *dp;				/* Get next data byte */
-				if (s == 0xFF) {		/* Is start of flag sequence? */
-					f = 1; continue;	/* Enter flag sequence */
+		}
+		dc--;
+		d = *dp++;			/* Get next data byte */
+		if (d == 0xFF) {	/* Is start of flag sequence? */
+			if (!dc) {
+				dp = jd->inbuf;
+				dc = jd->infunc(jd, dp, JD_SZBUF);
+				if (!dc) {
+					jd->marker = 0xD9; break;
 				}
 			}
-			msk = 0x80;		/* Read from MSB */
+			dc--;
+			if (*dp++) {	/* A marker ends the entropy coded data, the rest of the register stays 0 */
+				jd->marker = dp[-1]; break;
+			}				/* else the flag is a data 0xFF */
 		}
-		v <<= 1;	/* Get a bit */
-		if (s & msk) v++;
-		msk >>= 1;
-		nbit--;
-	} while (nbit);
-	jd->dmsk = msk; jd->dctr = dc; jd->dptr = dp;
-
-	return (INT)v;
+		w |= (DWORD)d << (24 - dbit);
+		dbit += 8;
+	}
+	jd->dctr = dc; jd->dptr = dp;
+	jd->wreg = w; jd->dbit = dbit;
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Extract N bits from input stream                                      */
+/*-----------------------------------------------------------------------*/
+
+static
+INT bitext (	/* >=0: extracted data, <0: error code */
+	JDEC* jd,	/* Pointer to the decompressor object */
+	UINT nbit	/* Number of bits to extract (1 to 15) */
+)
+{
+	DWORD w;
+
+
+	if (jd->dbit < nbit) {
+		fill_bits(jd);
+		if (jd->dbit < nbit) return 0 - (INT)JDR_FMT1;	/* Err: the data runs into a marker (may be collapted data) */
+	}
+	w = jd->wreg;
+	jd->wreg = w << nbit;
+	jd->dbit -= nbit;
+
+	return (INT)(w >> (32 - nbit));
 }
 
 
@@ -303,58 +363,51 @@ INT bitext (	/* >=0: extracted data, <0: error code */
 /*-----------------------------------------------------------------------*/
 
 static
-INT huffext (			/* >=0: decoded data, <0: error code */
-	JDEC* jd,			/* Pointer to the decompressor object */
-	const BYTE* hbits,	/* Pointer to the bit distribution table */
-	const WORD* hcode,	/* Pointer to the code word table */
-	const BYTE* hdata	/* Pointer to the data table */
+INT huffext (	/* >=0: decoded data, <0: error code */
+	JDEC* jd,	/* Pointer to the decompressor object */
+	UINT id,	/* Huffman table ID */
+	UINT cls	/* Class of the table, 0:DC, 1:AC */
 )
 {
-	BYTE msk, s, *dp;
-	UINT dc, v, f, bl, nd;
+	const BYTE *hbits, *hdata;
+	const WORD *hcode;
+	DWORD w;
+	UINT d, bl, nd, v;
 
 
-	msk = jd->dmsk; dc = jd->dctr; dp = jd->dptr;	/* Bit mask, number of data available, read ptr */
-	s = *dp; v = f = 0;
-	bl = 16;	/* Max code length */
-	do {
-		if (!msk) {		/* Next byte? */
-			if (!dc) {	/* No input data is available, re-fill input buffer */
-				dp = jd->inbuf;	/* Top of input buffer */
-				dc = jd->infunc(jd, dp, JD_SZBUF);
-				if (!dc) return 0 - (INT)JDR_INP;	/* Err: read error or wrong stream termination */
-			} else {
-				dp++;	/* Next data ptr */
-			}
-			dc--;		/* Decrement number of available bytes */
-			if (f) {		/* In flag sequence? */
-				f = 0;		/* Exit flag sequence */
-				if (*dp != 0)
-					return 0 - (INT)JDR_FMT1;	/* Err: unexpected flag is detected (may be collapted data) */
-				*dp = s = 0xFF;			/* The flag is a data 0xFF */
-			} else {
-				s = *dp;				/* Get next data byte */
-				if (s == 0xFF) {		/* Is start of flag sequence? */
-					f = 1; continue;	/* Enter flag sequence, get trailing byte */
-				}
-			}
-			msk = 0x80;		/* Read from MSB */
-		}
-		v <<= 1;	/* Get a bit */
-		if (s & msk) v++;
-		msk >>= 1;
-
-		for (nd = *hbits++; nd; nd--) {	/* Search the code word in this bit length */
-			if (v == *hcode++) {		/* Matched? */
-				jd->dmsk = msk; jd->dctr = dc; jd->dptr = dp;
-				return *hdata;			/* Return the decoded data */
+	if (jd->dbit < 16) fill_bits(jd);	/* Have the longest code word in the register */
+	w = jd->wreg;
+
+	if (cls) {	/* Look the code word up with the next JD_HUFFBIT bits */
+		d = jd->hufflut_ac[id][w >> (32 - JD_HUFFBIT)];
+		bl = d >> 8; d &= 0xFF;
+	} else {
+		d = jd->hufflut_dc[id][w >> (32 - JD_HUFFBIT)];
+		bl = d >> 4; d &= 0x0F;
+	}
+
+	if (!bl) {	/* Longer code word, search it in the tables from JD_HUFFBIT + 1 bits on */
+		hbits = jd->huffbits[id][cls];
+		hcode = jd->huffcode[id][cls];
+		hdata = jd->huffdata[id][cls];
+		for (nd = 0; bl < JD_HUFFBIT; bl++) nd += hbits[bl];	/* Skip the short code words */
+		hcode += nd; hdata += nd;
+		do {
+			v = w >> (31 - bl);		/* Leading bl + 1 bits */
+			for (nd = hbits[bl++]; nd; nd--) {	/* Search the code word in this bit length */
+				if (v == *hcode++) break;		/* Matched? */
+				hdata++;
 			}
-			hdata++;
-		}
-		bl--;
-	} while (bl);
+		} while (!nd && bl < 16);
+		if (!nd) return 0 - (INT)JDR_FMT1;	/* Err: code not found (may be collapted data) */
+		d = *hdata;
+	}
+
+	if (bl > jd->dbit) return 0 - (INT)JDR_FMT1;	/* Err: the code runs into a marker (may be collapted data) */
+	jd->wreg = w << bl;
+	jd->dbit -= bl;
 
-	return 0 - (INT)JDR_FMT1;	/* Err: code not found (may be collapted data) */
+	return (INT)d;	/* Return the decoded data */
 }
 
 
@@ -377,6 +430,14 @@ void block_idct (
 
 	/* Process columns */
 	for (i = 0; i < 8; i++) {
+		if (!(src[8 * 1] | src[8 * 2] | src[8 * 3] | src[8 * 4] | src[8 * 5] | src[8 * 6] | src[8 * 7])) {
+			v0 = src[8 * 0];	/* Only the DC element in this column, it comes out unchanged in every row */
+			src[8 * 1] = v0; src[8 * 2] = v0; src[8 * 3] = v0;
+			src[8 * 4] = v0; src[8 * 5] = v0; src[8 * 6] = v0; src[8 * 7] = v0;
+			src++;
+			continue;
+		}
+
 		v0 = src[8 * 0];	/* Get even elements */
 		v1 = src[8 * 2];
 		v2 = src[8 * 4];
@@ -425,6 +486,12 @@ void block_idct (
 	src -= 8;
 	for (i = 0; i < 8; i++) {
 		v0 = src[0] + (128L << 8);	/* Get even elements (remove DC offset (-128) here) */
+		if (!(src[1] | src[2] | src[3] | src[4] | src[5] | src[6] | src[7])) {
+			dst[0] = dst[1] = dst[2] = dst[3] = dst[4] = dst[5] = dst[6] = dst[7] = BYTECLIP(v0 >> 8);	/* Flat row */
+			dst += 8;
+			src += 8;
+			continue;
+		}
 		v1 = src[2];
 		v2 = src[4];
 		v3 = src[6];
@@ -483,27 +550,23 @@ JRESULT mcu_load (
 )
 {
 	LONG *tmp = (LONG*)jd->workbuf;	/* Block working buffer for de-quantize and IDCT */
-	UINT blk, nby, nbc, i, z, id, cmp;
+	UINT blk, nby, nbc, i, z, id, cmp, nac, clr;
 	INT b, d, e;
 	BYTE *bp;
-	const BYTE *hb, *hd;
-	const WORD *hc;
 	const LONG *dqf;
 
 
 	nby = jd->msx * jd->msy;	/* Number of Y blocks (1, 2 or 4) */
 	nbc = 2;					/* Number of C blocks (2) */
 	bp = jd->mcubuf;			/* Pointer to the first block */
+	clr = 1;					/* The working buffer has been used for RGB output */
 
 	for (blk = 0; blk < nby + nbc; blk++) {
 		cmp = (blk < nby) ? 0 : blk - nby + 1;	/* Component number 0:Y, 1:Cb, 2:Cr */
 		id = cmp ? 1 : 0;						/* Huffman table ID of the component */
 
 		/* Extract a DC element from input stream */
-		hb = jd->huffbits[id][0];				/* Huffman table for the DC element */
-		hc = jd->huffcode[id][0];
-		hd = jd->huffdata[id][0];
-		b = huffext(jd, hb, hc, hd);			/* Extract a huffman coded data (bit length) */
+		b = huffext(jd, id, 0);					/* Extract a huffman coded data (bit length) */
 		if (b < 0) return 0 - b;				/* Err: invalid code or input */
 		d = jd->dcv[cmp];						/* DC value of previous block */
 		if (b) {								/* If there is any difference from previous block */
@@ -518,13 +581,13 @@ JRESULT mcu_load (
 		tmp[0] = d * dqf[0] >> 8;				/* De-quantize, apply scale factor of Arai algorithm and descale 8 bits */
 
 		/* Extract following 63 AC elements from input stream */
-		for (i = 1; i < 64; i++) tmp[i] = 0;	/* Clear rest of elements */
-		hb = jd->huffbits[id][1];				/* Huffman table for the AC elements */
-		hc = jd->huffcode[id][1];
-		hd = jd->huffdata[id][1];
+		if (clr) {
+			for (i = 1; i < 64; i++) tmp[i] = 0;	/* Clear rest of elements */
+		}
+		nac = 0;				/* Number of AC elements loaded */
 		i = 1;					/* Top of the AC elements */
 		do {
-			b = huffext(jd, hb, hc, hd);		/* Extract a huffman coded value (zero runs and bit length) */
+			b = huffext(jd, id, 1);				/* Extract a huffman coded value (zero runs and bit length) */
 			if (b == 0) break;					/* EOB? */
 			if (b < 0) return 0 - b;			/* Err: invalid code or input error */
 			z = (UINT)b >> 4;					/* Number of leading zero elements */
@@ -539,13 +602,21 @@ JRESULT mcu_load (
 				if (!(d & b)) d -= (b << 1) - 1;/* Restore negative value if needed */
 				z = ZIG(i);						/* Zigzag-order to raster-order converted index */
 				tmp[z] = d * dqf[z] >> 8;		/* De-quantize, apply scale factor of Arai algorithm and descale 8 bits */
+				nac++;
 			}
 		} while (++i < 64);		/* Next AC element */
 
-		if (JD_USE_SCALE && jd->scale == 3)
+		if (JD_USE_SCALE && jd->scale == 3) {
 			*bp = (*tmp / 256) + 128;	/* If scale ratio is 1/8, IDCT can be ommited and only DC element is used */
-		else
+			clr = nac;					/* The AC elements are left in the buffer */
+		} else if (!nac) {
+			d = BYTECLIP((tmp[0] + (128L << 8)) >> 8);	/* Only the DC element, the IDCT is a flat block */
+			for (i = 0; i < 64; i++) bp[i] = (BYTE)d;
+			clr = 0;
+		} else {
 			block_idct(tmp, bp);		/* Apply IDCT and store the block to the MCU buffer */
+			clr = 1;					/* IDCT works in place */
+		}
 
 		bp += 64;				/* Next block */
 	}
@@ -556,6 +627,67 @@ JRESULT mcu_load (
 
 
 
+/*-----------------------------------------------------------------------*/
+/* Skip an MCU: Only follow the stream and the DC values                 */
+/*-----------------------------------------------------------------------*/
+
+static
+JRESULT mcu_skip (
+	JDEC* jd,		/* Pointer to the decompressor object */
+	LONG* ydc		/* Sum of the DC values of the Y blocks */
+)
+{
+	UINT blk, nby, i, id, cmp, bl;
+	INT b, d, e;
+
+
+	nby = jd->msx * jd->msy;	/* Number of Y blocks (1, 2 or 4) */
+	*ydc = 0;
+
+	for (blk = 0; blk < nby + 2; blk++) {
+		cmp = (blk < nby) ? 0 : blk - nby + 1;	/* Component number 0:Y, 1:Cb, 2:Cr */
+		id = cmp ? 1 : 0;						/* Huffman table ID of the component */
+
+		b = huffext(jd, id, 0);					/* DC element, the next block is coded relative to it */
+		if (b < 0) return 0 - b;
+		if (b) {
+			e = bitext(jd, b);
+			if (e < 0) return 0 - e;
+			d = 1 << (b - 1);
+			if (!(e & d)) e -= (d << 1) - 1;
+			jd->dcv[cmp] += e;
+		}
+		if (!cmp) *ydc += jd->dcv[0];
+
+		i = 1;
+		do {									/* AC elements, their values are not needed */
+			if (jd->dbit < 25) fill_bits(jd);
+			b = jd->hufflut_ac[id][jd->wreg >> (32 - JD_HUFFBIT)];
+			bl = ((UINT)b >> 8) + (b & 0x0F);	/* Code word and the value bits after it */
+			if ((b >> 8) && bl <= jd->dbit) {	/* Both in the register, drop them at once */
+				jd->wreg <<= bl;
+				jd->dbit -= bl;
+				b &= 0xFF;
+			} else {
+				b = huffext(jd, id, 1);
+				if (b < 0) return 0 - b;
+				if (b & 0x0F) {
+					d = bitext(jd, b & 0x0F);
+					if (d < 0) return 0 - d;
+				}
+			}
+			if (b == 0) break;					/* EOB? */
+			i += (UINT)b >> 4;					/* Skip zero elements */
+			if (i >= 64) return JDR_FMT1;		/* Too long zero run */
+		} while (++i < 64);
+	}
+
+	return JDR_OK;
+}
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Output an MCU: Convert YCrCb to RGB and output it in RGB form         */
 /*-----------------------------------------------------------------------*/
@@ -707,6 +839,47 @@ JRESULT mcu_output (
 
 
 
+/*-----------------------------------------------------------------------*/
+/* Skip the entropy coded data up to the next marker                     */
+/*-----------------------------------------------------------------------*/
+
+static
+void skip_interval (
+	JDEC* jd	/* Pointer to the decompressor object */
+)
+{
+	UINT dc;
+	BYTE *dp;
+
+
+	dc = jd->dctr; dp = jd->dptr;
+	jd->wreg = 0; jd->dbit = 0;		/* Whatever is in the bit register belongs to the skipped data */
+	while (!jd->marker) {
+		if (!dc) {		/* No input data is available, re-fill input buffer */
+			dp = jd->inbuf;
+			dc = jd->infunc(jd, dp, JD_SZBUF);
+			if (!dc) {
+				jd->marker = 0xD9; break;
+			}
+		}
+		dc--;
+		if (*dp++ != 0xFF) continue;
+		if (!dc) {
+			dp = jd->inbuf;
+			dc = jd->infunc(jd, dp, JD_SZBUF);
+			if (!dc) {
+				jd->marker = 0xD9; break;
+			}
+		}
+		dc--;
+		jd->marker = *dp++;	/* A marker, or 0 after a data 0xFF to go on */
+	}
+	jd->dctr = dc; jd->dptr = dp;
+}
+
+
+
+
 /*-----------------------------------------------------------------------*/
 /* Process restart interval                                              */
 /*-----------------------------------------------------------------------*/
@@ -722,21 +895,23 @@ JRESULT restart (
 	BYTE *dp;
 
 
-	/* Discard padding bits and get two bytes from the input stream */
-	dp = jd->dptr; dc = jd->dctr;
-	d = 0;
-	for (i = 0; i < 2; i++) {
-		if (!dc) {	/* No input data is available, re-fill input buffer */
-			dp = jd->inbuf;
-			dc = jd->infunc(jd, dp, JD_SZBUF);
-			if (!dc) return JDR_INP;
-		} else {
-			dp++;
+	if (jd->marker) {	/* The marker has already been read into the bit register */
+		d = 0xFF00 | jd->marker;
+	} else {			/* Get two bytes from the input stream */
+		dp = jd->dptr; dc = jd->dctr;
+		d = 0;
+		for (i = 0; i < 2; i++) {
+			if (!dc) {	/* No input data is available, re-fill input buffer */
+				dp = jd->inbuf;
+				dc = jd->infunc(jd, dp, JD_SZBUF);
+				if (!dc) return JDR_INP;
+			}
+			dc--;
+			d = (d << 8) | *dp++;	/* Get a byte */
 		}
-		dc--;
-		d = (d << 8) | *dp;	/* Get a byte */
+		jd->dptr = dp; jd->dctr = dc;
 	}
-	jd->dptr = dp; jd->dctr = dc; jd->dmsk = 0;
+	jd->wreg = 0; jd->dbit = 0; jd->marker = 0;	/* Discard padding bits */
 
 	/* Check the marker */
 	if ((d & 0xFFD8) != 0xFFD0 || (d & 7) != (rstn & 7))
@@ -787,6 +962,8 @@ JRESULT jd_prepare (
 			jd->huffcode[i][j] = 0;
 			jd->huffdata[i][j] = 0;
 		}
+		jd->hufflut_dc[i] = 0;
+		jd->hufflut_ac[i] = 0;
 	}
 	for (i = 0; i < 4; i++) jd->qttbl[i] = 0;
 
@@ -891,10 +1068,14 @@ JRESULT jd_prepare (
 			if (!jd->mcubuf) return JDR_MEM1;			/* Err: not enough memory */
 
 			/* Pre-load the JPEG data to extract it from the bit stream */
-			jd->dptr = seg; jd->dctr = 0; jd->dmsk = 0;	/* Prepare to read bit stream */
+			jd->roi.left = 0; jd->roi.right = jd->width - 1;	/* Decompress the whole image by default */
+			jd->roi.top = 0; jd->roi.bottom = jd->height - 1;
+
+			jd->dptr = seg; jd->dctr = 0;				/* Prepare to read bit stream */
+			jd->wreg = 0; jd->dbit = 0; jd->marker = 0;
 			if (ofs %= JD_SZBUF) {						/* Align read offset to JD_SZBUF */
 				jd->dctr = jd->infunc(jd, seg + ofs, JD_SZBUF - (UINT)ofs);
-				jd->dptr = seg + ofs - 1;
+				jd->dptr = seg + ofs;
 			}
 
 			return JDR_OK;		/* Initialization succeeded. Ready to decompress the JPEG image. */
@@ -926,45 +1107,193 @@ JRESULT jd_prepare (
 
 
 /*-----------------------------------------------------------------------*/
-/* Start to decompress the JPEG picture                                  */
+/* Input function for a JPEG stream in memory                            */
 /*-----------------------------------------------------------------------*/
 
-JRESULT jd_decomp (
-	JDEC* jd,								/* Initialized decompression object */
-	UINT (*outfunc)(JDEC*, void*, JRECT*),	/* RGB output function */
-	BYTE scale								/* Output de-scaling factor (0 to 3) */
+static
+UINT mem_input (
+	JDEC* jd,	/* Pointer to the decompressor object */
+	BYTE* buf,	/* Buffer to load the data to (0:skip) */
+	UINT nd		/* Number of bytes to read */
+)
+{
+	UINT i;
+
+
+	if (nd > jd->szmem - jd->ofsmem) nd = jd->szmem - jd->ofsmem;
+	if (buf) {
+		for (i = 0; i < nd; i++) buf[i] = jd->mem[jd->ofsmem + i];
+	}
+	jd->ofsmem += nd;
+
+	return nd;
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Analyze a JPEG image in memory and Initialize decompressor object     */
+/*-----------------------------------------------------------------------*/
+
+JRESULT jd_prepare_mem (
+	JDEC* jd,			/* Blank decompressor object */
+	const BYTE* data,	/* JPEG stream, it must be kept until the end of jd_decomp() */
+	UINT ndata,			/* Size of the JPEG stream */
+	void* pool,			/* Working buffer for the decompression session */
+	UINT sz_pool,		/* Size of working buffer */
+	void* dev			/* I/O device identifier for the session */
 )
 {
-	UINT x, y, mx, my;
-	WORD rst, rsc;
 	JRESULT rc;
 
 
-	if (scale > (JD_USE_SCALE ? 3 : 0)) return JDR_PAR;
-	jd->scale = scale;
+	jd->mem = data; jd->szmem = ndata; jd->ofsmem = 0;
+	rc = jd_prepare(jd, mem_input, pool, sz_pool, dev);	/* Load the segments through the input buffer */
+	if (rc == JDR_OK) {
+		jd->ofsmem -= jd->dctr;					/* The pre-loaded data has not been used yet */
+		jd->dptr = (BYTE*)data + jd->ofsmem;	/* Read the entropy coded data in place, */
+		jd->dctr = ndata - jd->ofsmem;
+		jd->ofsmem = ndata;						/* with nothing left to input after it */
+	}
+
+	return rc;
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Decompress all MCUs of the JPEG picture                               */
+/*-----------------------------------------------------------------------*/
+
+static
+JRESULT decomp (
+	JDEC* jd,								/* Initialized decompression object */
+	UINT (*outfunc)(JDEC*, void*, JRECT*),	/* Output function */
+	BYTE mode								/* 0:RGB, 1:YCbCr blocks, 2:Mean luminance of the MCU */
+)
+{
+	UINT x, y, mx, my, n, nx, nmcu, m, r, cs, ce;
+	UINT rx0, rx1, ry0, ry1;
+	LONG ydc;
+	BYTE luma;
+	JRESULT rc;
+	JRECT rect;
+
 
 	mx = jd->msx * 8; my = jd->msy * 8;			/* Size of the MCU (pixel) */
+	nx = (jd->width + mx - 1) / mx;				/* Number of MCUs in a row and in the image */
+	nmcu = nx * ((jd->height + my - 1) / my);
+	rx0 = jd->roi.left / mx; rx1 = jd->roi.right / mx;	/* Region of interest in MCUs */
+	ry0 = jd->roi.top / my; ry1 = jd->roi.bottom / my;
+	if (jd->roi.left > jd->roi.right || jd->roi.top > jd->roi.bottom || jd->roi.right >= jd->width || jd->roi.bottom >= jd->height)
+		return JDR_PAR;
 
 	jd->dcv[2] = jd->dcv[1] = jd->dcv[0] = 0;	/* Initialize DC values */
-	rst = rsc = 0;
 
 	rc = JDR_OK;
-	for (y = 0; y < jd->height; y += my) {		/* Vertical loop of MCUs */
-		for (x = 0; x < jd->width; x += mx) {	/* Horizontal loop of MCUs */
-			if (jd->nrst && rst++ == jd->nrst) {	/* Process restart interval if enabled */
-				rc = restart(jd, rsc++);
-				if (rc != JDR_OK) return rc;
-				rst = 1;
+	for (n = 0; n < nmcu && n / nx <= ry1; n++) {	/* MCUs in stream order, up to the last row of the region */
+		if (jd->nrst && n && n % jd->nrst == 0) {	/* Process restart interval if enabled */
+			rc = restart(jd, (WORD)(n / jd->nrst - 1));
+			if (rc != JDR_OK) return rc;
+		}
+		if (jd->nrst && n % jd->nrst == 0) {	/* Whole restart interval outside the region? */
+			m = (n + jd->nrst <= nmcu ? n + jd->nrst : nmcu) - 1;	/* Last MCU in the interval */
+			for (r = n / nx; r <= m / nx; r++) {
+				cs = (r == n / nx) ? n % nx : 0;
+				ce = (r == m / nx) ? m % nx : nx - 1;
+				if (r >= ry0 && r <= ry1 && cs <= rx1 && ce >= rx0) break;
 			}
-			rc = mcu_load(jd);					/* Load an MCU (decompress huffman coded stream and apply IDCT) */
+			if (r > m / nx) {	/* Jump to the next marker without decoding */
+				skip_interval(jd);
+				n = m;
+				continue;
+			}
+		}
+		x = n % nx; y = n / nx;
+		if (y < ry0 || x < rx0 || x > rx1) {	/* Outside the region, only follow the stream */
+			rc = mcu_skip(jd, &ydc);
 			if (rc != JDR_OK) return rc;
-			rc = mcu_output(jd, outfunc, x, y);	/* Output the MCU (color space conversion, scaling and output) */
+			continue;
+		}
+		x *= mx; y *= my;
+		rect.left = x; rect.right = (x + mx <= jd->width ? x + mx : jd->width) - 1;
+		rect.top = y; rect.bottom = (y + my <= jd->height ? y + my : jd->height) - 1;
+		if (mode == 2) {					/* Mean of the Y blocks from their DC values, without IDCT */
+			rc = mcu_skip(jd, &ydc);
+			if (rc != JDR_OK) return rc;
+			ydc = ydc * (jd->qttbl[jd->qtid[0]][0] >> 8) / (LONG)(jd->msx * jd->msy) / 256 + 128;
+			luma = (BYTE)(ydc < 0 ? 0 : ydc > 255 ? 255 : ydc);
+			rc = outfunc(jd, &luma, &rect) ? JDR_OK : JDR_INTR;
 			if (rc != JDR_OK) return rc;
+			continue;
 		}
+		rc = mcu_load(jd);					/* Load an MCU (decompress huffman coded stream and apply IDCT) */
+		if (rc != JDR_OK) return rc;
+		if (mode) {							/* Output the blocks of the MCU as they are */
+			rc = outfunc(jd, jd->mcubuf, &rect) ? JDR_OK : JDR_INTR;
+		} else {
+			rc = mcu_output(jd, outfunc, x, y);	/* Output the MCU (color space conversion, scaling and output) */
+		}
+		if (rc != JDR_OK) return rc;
 	}
 
 	return rc;
 }
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Start to decompress the JPEG picture                                  */
+/*-----------------------------------------------------------------------*/
+
+JRESULT jd_decomp (
+	JDEC* jd,								/* Initialized decompression object */
+	UINT (*outfunc)(JDEC*, void*, JRECT*),	/* RGB output function */
+	BYTE scale								/* Output de-scaling factor (0 to 3) */
+)
+{
+	if (scale > (JD_USE_SCALE ? 3 : 0)) return JDR_PAR;
+	jd->scale = scale;
+
+	return decomp(jd, outfunc, 0);
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Start to decompress the JPEG picture into YCbCr blocks                */
+/*-----------------------------------------------------------------------*/
+
+JRESULT jd_decomp_ycc (
+	JDEC* jd,								/* Initialized decompression object */
+	UINT (*outfunc)(JDEC*, void*, JRECT*)	/* YCbCr MCU output function */
+)
+{
+	jd->scale = 0;
+
+	return decomp(jd, outfunc, 1);
+}
+
+
+
+
+/*-----------------------------------------------------------------------*/
+/* Extract the mean luminance of every MCU from its DC values            */
+/*-----------------------------------------------------------------------*/
+
+JRESULT jd_decomp_dc (
+	JDEC* jd,								/* Initialized decompression object */
+	UINT (*outfunc)(JDEC*, void*, JRECT*)	/* Luminance output function */
+)
+{
+	jd->scale = 0;
+
+	return decomp(jd, outfunc, 2);
+}
 #endif//SUPPORT_JPEG
 
 
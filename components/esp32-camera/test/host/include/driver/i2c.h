@@ -0,0 +1,61 @@
+//
+// Host stand-in for the legacy ESP-IDF I2C master driver. The command links are
+// played against the simulated sensor of mock_i2c.c, see mock_i2c.h.
+//
+
+#ifndef _HOST_DRIVER_I2C_H_
+#define _HOST_DRIVER_I2C_H_
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "esp_err.h"
+#include "freertos/FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef int i2c_port_t;
+typedef enum { I2C_MODE_SLAVE, I2C_MODE_MASTER } i2c_mode_t;
+typedef enum { I2C_MASTER_WRITE, I2C_MASTER_READ } i2c_rw_t;
+typedef enum { I2C_MASTER_ACK, I2C_MASTER_NACK, I2C_MASTER_LAST_NACK } i2c_ack_type_t;
+
+#define I2C_NUM_0           0
+#define I2C_NUM_1           1
+#define I2C_NUM_MAX         2
+#define GPIO_PULLUP_DISABLE 0
+#define GPIO_PULLUP_ENABLE  1
+
+typedef struct {
+    i2c_mode_t mode;
+    int sda_io_num;
+    int scl_io_num;
+    bool sda_pullup_en;
+    bool scl_pullup_en;
+    struct {
+        uint32_t clk_speed;
+    } master;
+} i2c_config_t;
+
+typedef struct i2c_cmd_link *i2c_cmd_handle_t;
+
+esp_err_t i2c_param_config(i2c_port_t port, const i2c_config_t *conf);
+esp_err_t i2c_driver_install(i2c_port_t port, i2c_mode_t mode, size_t slv_rx_buf_len, size_t slv_tx_buf_len,
+                             int intr_alloc_flags);
+esp_err_t i2c_driver_delete(i2c_port_t port);
+
+i2c_cmd_handle_t i2c_cmd_link_create(void);
+void i2c_cmd_link_delete(i2c_cmd_handle_t cmd);
+esp_err_t i2c_master_start(i2c_cmd_handle_t cmd);
+esp_err_t i2c_master_stop(i2c_cmd_handle_t cmd);
+esp_err_t i2c_master_write_byte(i2c_cmd_handle_t cmd, uint8_t data, bool ack_en);
+esp_err_t i2c_master_write(i2c_cmd_handle_t cmd, const uint8_t *data, size_t data_len, bool ack_en);
+esp_err_t i2c_master_read_byte(i2c_cmd_handle_t cmd, uint8_t *data, i2c_ack_type_t ack);
+esp_err_t i2c_master_cmd_begin(i2c_port_t port, i2c_cmd_handle_t cmd, TickType_t ticks_to_wait);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _HOST_DRIVER_I2C_H_ */
@@ -0,0 +1,12 @@
+//
+// Host stand-in for the ESP-IDF driver/ledc.h, only the types esp_camera.h
+// refers to.
+//
+
+#ifndef _HOST_DRIVER_LEDC_H_
+#define _HOST_DRIVER_LEDC_H_
+
+typedef enum { LEDC_TIMER_0 = 0 } ledc_timer_t;
+typedef enum { LEDC_CHANNEL_0 = 0 } ledc_channel_t;
+
+#endif /* _HOST_DRIVER_LEDC_H_ */
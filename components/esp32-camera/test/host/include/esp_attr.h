@@ -0,0 +1,12 @@
+//
+// Host stand-in for the ESP-IDF esp_attr.h, placement attributes are no-ops.
+//
+
+#ifndef _HOST_ESP_ATTR_H_
+#define _HOST_ESP_ATTR_H_
+
+#define IRAM_ATTR
+#define DRAM_ATTR
+#define EXT_RAM_ATTR
+
+#endif /* _HOST_ESP_ATTR_H_ */
@@ -0,0 +1,16 @@
+//
+// Host stand-in for the ESP-IDF esp_heap_caps.h, there is a single heap.
+//
+
+#ifndef _HOST_ESP_HEAP_CAPS_H_
+#define _HOST_ESP_HEAP_CAPS_H_
+
+#include <stdlib.h>
+
+#define MALLOC_CAP_8BIT     (1 << 2)
+#define MALLOC_CAP_SPIRAM   (1 << 10)
+#define MALLOC_CAP_INTERNAL (1 << 11)
+
+#define heap_caps_malloc(size, caps) malloc(size)
+
+#endif /* _HOST_ESP_HEAP_CAPS_H_ */
@@ -0,0 +1,16 @@
+//
+// Host stand-in for the ESP-IDF esp_log.h, errors and warnings go to stderr.
+//
+
+#ifndef _HOST_ESP_LOG_H_
+#define _HOST_ESP_LOG_H_
+
+#include <stdio.h>
+
+#define ESP_LOGE(tag, format, ...) fprintf(stderr, "E %s: " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGW(tag, format, ...) fprintf(stderr, "W %s: " format "\n", tag, ##__VA_ARGS__)
+#define ESP_LOGI(tag, format, ...) do { (void) (tag); } while (0)
+#define ESP_LOGD(tag, format, ...) do { (void) (tag); } while (0)
+#define ESP_LOGV(tag, format, ...) do { (void) (tag); } while (0)
+
+#endif /* _HOST_ESP_LOG_H_ */
@@ -0,0 +1,13 @@
+//
+// Host stand-in for the ESP-IDF esp_system.h. Claims a recent IDF without a
+// JPEG decoder in ROM, so esp_jpg_decode.c uses the tjpgd in target/.
+//
+
+#ifndef _HOST_ESP_SYSTEM_H_
+#define _HOST_ESP_SYSTEM_H_
+
+#include "esp_err.h"
+
+#define ESP_IDF_VERSION_MAJOR 5
+
+#endif /* _HOST_ESP_SYSTEM_H_ */
@@ -0,0 +1,15 @@
+//
+// Host stand-in for the FreeRTOS.h of ESP-IDF, one tick is a millisecond.
+//
+
+#ifndef _HOST_FREERTOS_H_
+#define _HOST_FREERTOS_H_
+
+#include <stdint.h>
+
+typedef uint32_t TickType_t;
+
+#define portTICK_PERIOD_MS  1
+#define pdMS_TO_TICKS(ms)   ((TickType_t) (ms))
+
+#endif /* _HOST_FREERTOS_H_ */
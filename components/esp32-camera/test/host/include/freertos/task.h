@@ -0,0 +1,20 @@
+//
+// Host stand-in for the FreeRTOS task.h, vTaskDelay() is recorded by the mock I2C bus.
+//
+
+#ifndef _HOST_FREERTOS_TASK_H_
+#define _HOST_FREERTOS_TASK_H_
+
+#include "freertos/FreeRTOS.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+void vTaskDelay(const TickType_t ticks);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _HOST_FREERTOS_TASK_H_ */
@@ -0,0 +1,11 @@
+//
+// Host stand-in for the generated sdkconfig.h, no target and no PSRAM.
+// The SCCB bus runs at the default clock of the Kconfig.
+//
+
+#ifndef _HOST_SDKCONFIG_H_
+#define _HOST_SDKCONFIG_H_
+
+#define CONFIG_SCCB_CLK_FREQ 100000
+
+#endif /* _HOST_SDKCONFIG_H_ */
@@ -0,0 +1,3 @@
+//
+// Host stand-in for the ESP-IDF soc/efuse_reg.h, nothing of it is used.
+//
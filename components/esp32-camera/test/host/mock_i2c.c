@@ -0,0 +1,208 @@
+//
+// Simulated sensor on the I2C bus of the host build, see mock_i2c.h.
+//
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "driver/i2c.h"
+#include "freertos/task.h"
+#include "mock_i2c.h"
+
+typedef enum { OP_START, OP_STOP, OP_WRITE, OP_READ } op_type_t;
+
+typedef struct {
+    op_type_t type;
+    uint8_t data;
+    uint8_t *dst;
+} op_t;
+
+struct i2c_cmd_link {
+    op_t *ops;
+    size_t count;
+    size_t size;
+};
+
+static struct {
+    uint8_t addr;
+    int flags;
+    uint8_t regs[0x10000];
+    uint16_t pointer;
+    uint32_t *log;
+    size_t log_count;
+    size_t log_size;
+    int nack_after;
+    uint32_t clk_speed;
+    mock_i2c_stats_t stats;
+} sensor = {
+        .nack_after = -1,
+        .clk_speed = 100000,
+};
+
+static void log_entry(uint32_t entry) {
+    if (sensor.log_count == sensor.log_size) {
+        sensor.log_size = sensor.log_size ? sensor.log_size * 2 : 1024;
+        sensor.log = realloc(sensor.log, sensor.log_size * sizeof(uint32_t));
+    }
+    sensor.log[sensor.log_count++] = entry;
+}
+
+void mock_i2c_reset(uint8_t addr, int flags) {
+    sensor.addr = addr;
+    sensor.flags = flags;
+    memset(sensor.regs, 0, sizeof(sensor.regs));
+    sensor.pointer = 0;
+    sensor.log_count = 0;
+    sensor.nack_after = -1;
+    memset(&sensor.stats, 0, sizeof(sensor.stats));
+}
+
+void mock_i2c_nack_after(int n) {
+    sensor.nack_after = n;
+}
+
+const uint8_t *mock_i2c_registers(void) {
+    return sensor.regs;
+}
+
+size_t mock_i2c_log(const uint32_t **log) {
+    *log = sensor.log;
+    return sensor.log_count;
+}
+
+mock_i2c_stats_t mock_i2c_stats(void) {
+    return sensor.stats;
+}
+
+double mock_i2c_bus_ms(void) {
+    // Nine clocks a byte with the acknowledge, about one each for the start and the stop
+    double clocks = sensor.stats.bytes * 9.0 + sensor.stats.starts * 2.0;
+    return clocks * 1000.0 / sensor.clk_speed + sensor.stats.transactions * MOCK_I2C_TRANSACTION_US / 1000.0;
+}
+
+void vTaskDelay(const TickType_t ticks) {
+    sensor.stats.delays++;
+    sensor.stats.delay_ms += ticks * portTICK_PERIOD_MS;
+    log_entry(MOCK_I2C_LOG_DELAY | ticks);
+}
+
+esp_err_t i2c_param_config(i2c_port_t port, const i2c_config_t *conf) {
+    if (port < 0 || port >= I2C_NUM_MAX || conf->mode != I2C_MODE_MASTER || !conf->master.clk_speed) {
+        return ESP_ERR_INVALID_ARG;
+    }
+    sensor.clk_speed = conf->master.clk_speed;
+    return ESP_OK;
+}
+
+esp_err_t i2c_driver_install(i2c_port_t port, i2c_mode_t mode, size_t slv_rx_buf_len, size_t slv_tx_buf_len,
+                             int intr_alloc_flags) {
+    return port >= 0 && port < I2C_NUM_MAX ? ESP_OK : ESP_ERR_INVALID_ARG;
+}
+
+esp_err_t i2c_driver_delete(i2c_port_t port) {
+    return ESP_OK;
+}
+
+i2c_cmd_handle_t i2c_cmd_link_create(void) {
+    return calloc(1, sizeof(struct i2c_cmd_link));
+}
+
+void i2c_cmd_link_delete(i2c_cmd_handle_t cmd) {
+    if (cmd) {
+        free(cmd->ops);
+        free(cmd);
+    }
+}
+
+static esp_err_t add_op(i2c_cmd_handle_t cmd, op_type_t type, uint8_t data, uint8_t *dst) {
+    if (cmd->count == cmd->size) {
+        cmd->size = cmd->size ? cmd->size * 2 : 16;
+        cmd->ops = realloc(cmd->ops, cmd->size * sizeof(op_t));
+    }
+    cmd->ops[cmd->count++] = (op_t) { type, data, dst };
+    return ESP_OK;
+}
+
+esp_err_t i2c_master_start(i2c_cmd_handle_t cmd) {
+    return add_op(cmd, OP_START, 0, NULL);
+}
+
+esp_err_t i2c_master_stop(i2c_cmd_handle_t cmd) {
+    return add_op(cmd, OP_STOP, 0, NULL);
+}
+
+esp_err_t i2c_master_write_byte(i2c_cmd_handle_t cmd, uint8_t data, bool ack_en) {
+    return add_op(cmd, OP_WRITE, data, NULL);
+}
+
+esp_err_t i2c_master_write(i2c_cmd_handle_t cmd, const uint8_t *data, size_t data_len, bool ack_en) {
+    for (size_t i = 0; i < data_len; i++) {
+        add_op(cmd, OP_WRITE, data[i], NULL);
+    }
+    return ESP_OK;
+}
+
+esp_err_t i2c_master_read_byte(i2c_cmd_handle_t cmd, uint8_t *data, i2c_ack_type_t ack) {
+    return add_op(cmd, OP_READ, 0, data);
+}
+
+// Plays the messages of the command link against the sensor. Like the real bus
+// the messages before a missing acknowledge have taken effect.
+esp_err_t i2c_master_cmd_begin(i2c_port_t port, i2c_cmd_handle_t cmd, TickType_t ticks_to_wait) {
+    sensor.stats.transactions++;
+    bool nack = sensor.nack_after == 0;
+    if (sensor.nack_after >= 0) {
+        sensor.nack_after--;
+    }
+
+    size_t addr_len = (sensor.flags & MOCK_I2C_ADDR16) ? 2 : 1;
+    size_t position = 0; // Byte of the current message
+    bool read = false;
+    for (size_t i = 0; i < cmd->count; i++) {
+        const op_t *op = &cmd->ops[i];
+        switch (op->type) {
+            case OP_START:
+                sensor.stats.starts++;
+                position = 0;
+                break;
+            case OP_STOP:
+                break;
+            case OP_WRITE:
+                sensor.stats.bytes++;
+                if (position == 0) {
+                    if (nack || op->data >> 1 != sensor.addr) {
+                        return ESP_FAIL;
+                    }
+                    read = op->data & 1;
+                } else if (read) {
+                    return ESP_FAIL;
+                } else if (position <= addr_len) {
+                    // The register address, high byte first
+                    sensor.pointer = position == 1 ? op->data : (uint16_t) (sensor.pointer << 8 | op->data);
+                } else {
+                    if (position > addr_len + 1 && !(sensor.flags & MOCK_I2C_AUTO_INCREMENT)) {
+                        return ESP_FAIL;
+                    }
+                    sensor.regs[sensor.pointer] = op->data;
+                    log_entry((uint32_t) sensor.pointer << 8 | op->data);
+                    if (sensor.flags & MOCK_I2C_AUTO_INCREMENT) {
+                        sensor.pointer++;
+                    }
+                }
+                position++;
+                break;
+            case OP_READ:
+                sensor.stats.bytes++;
+                if (!read) {
+                    return ESP_FAIL;
+                }
+                *op->dst = sensor.regs[sensor.pointer];
+                if (sensor.flags & MOCK_I2C_AUTO_INCREMENT) {
+                    sensor.pointer++;
+                }
+                position++;
+                break;
+        }
+    }
+    return ESP_OK;
+}
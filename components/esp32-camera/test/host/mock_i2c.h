@@ -0,0 +1,54 @@
+//
+// Simulated sensor on the I2C bus of the host build, behind the driver/i2c.h
+// stand-in. It keeps a register file, logs the writes and delays in the order
+// they reach the sensor, and counts the transactions and bytes on the bus.
+//
+
+#ifndef _MOCK_I2C_H_
+#define _MOCK_I2C_H_
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define MOCK_I2C_ADDR16         0x01    // 16 bit register addresses
+#define MOCK_I2C_AUTO_INCREMENT 0x02    // Bytes after the first go to the following registers
+
+#define MOCK_I2C_LOG_DELAY      0x80000000u // Log entry of a vTaskDelay(), the low bits are the ticks
+
+// Transaction overhead of the legacy ESP-IDF driver, queueing the command link,
+// the interrupts and waking the task, on top of the clock cycles on the bus
+#define MOCK_I2C_TRANSACTION_US 30
+
+typedef struct {
+    uint32_t transactions;  // i2c_master_cmd_begin() calls
+    uint32_t starts;        // Start conditions, one per addressed message
+    uint32_t bytes;         // Bytes on the bus, the address bytes included
+    uint32_t delays;
+    uint32_t delay_ms;
+} mock_i2c_stats_t;
+
+// Clears the registers, the log and the stats, the sensor answers at addr
+void mock_i2c_reset(uint8_t addr, int flags);
+
+// Transaction number n from now on is not acknowledged, -1 never
+void mock_i2c_nack_after(int n);
+
+const uint8_t *mock_i2c_registers(void);
+
+// Writes as reg << 8 | value, delays as MOCK_I2C_LOG_DELAY | ticks
+size_t mock_i2c_log(const uint32_t **log);
+
+mock_i2c_stats_t mock_i2c_stats(void);
+
+// Time on the bus at the configured clock, the delays not included
+double mock_i2c_bus_ms(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* _MOCK_I2C_H_ */
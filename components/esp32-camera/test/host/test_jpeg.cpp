@@ -0,0 +1,1209 @@
+//
+// Round trip tests and benchmark for the JPEG encoder in jpge.cpp.
+//
+// Images are encoded, decoded again with tjpgd and compared against the
+// source in PSNR, covering the RGB path as well as the native YCbCr inputs.
+//
+
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "img_converters.h"
+#include "jpge.h"
+#include "yuv.h"
+
+static int failures;
+
+#define CHECK(cond) do {                                                    \
+        if (!(cond)) {                                                      \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++;                                                     \
+            return;                                                         \
+        }                                                                   \
+    } while(0)
+
+#define RUN(test) do {                                                      \
+        int before = failures;                                              \
+        test();                                                             \
+        printf("%s %s\n", failures == before ? "PASS" : "FAIL", #test);     \
+    } while(0)
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+class buffer_stream : public jpge::output_stream {
+public:
+    uint8_t *data;
+    size_t size, capacity;
+
+    buffer_stream() : data(NULL), size(0), capacity(0) { }
+    virtual ~buffer_stream() { free(data); }
+    virtual bool put_buf(const void *buf, int len)
+    {
+        if (size + len > capacity) {
+            capacity = (size + len) * 2;
+            data = (uint8_t *)realloc(data, capacity);
+        }
+        memcpy(data + size, buf, len);
+        size += len;
+        return true;
+    }
+    virtual size_t get_size() const { return size; }
+};
+
+// Smooth gradients with a little texture, chroma sampled once per pixel pair
+static uint8_t *make_yuyv(int width, int height) {
+    uint8_t *yuyv = (uint8_t *)malloc(width * height * 2);
+    for (int y = 0; y < height; y++) {
+        uint8_t *row = yuyv + y * width * 2;
+        for (int x = 0; x < width; x += 2) {
+            row[2 * x] = 16 + (x * 200 / width + ((x / 4 + y / 4) & 1) * 12);
+            row[2 * x + 1] = 64 + y * 128 / height;
+            row[2 * x + 2] = 16 + ((x + 1) * 200 / width + (((x + 1) / 4 + y / 4) & 1) * 12);
+            row[2 * x + 3] = 192 - x * 128 / width;
+        }
+    }
+    return yuyv;
+}
+
+// BT.601 studio range to BGR. Not yuv2rgb(), yuv_table has the green
+// coefficients of U and V the other way round, while decoders follow JFIF.
+static void bt601_to_bgr(uint8_t y, uint8_t u, uint8_t v, uint8_t *bgr) {
+    double l = 1.164 * (y - 16);
+    double c[3] = { l + 2.018 * (u - 128), l - 0.391 * (u - 128) - 0.813 * (v - 128), l + 1.596 * (v - 128) };
+    for (int i = 0; i < 3; i++) {
+        bgr[i] = c[i] < 0 ? 0 : c[i] > 255 ? 255 : (uint8_t)(c[i] + 0.5);
+    }
+}
+
+static uint8_t *make_reference(const uint8_t *yuyv, int width, int height) {
+    uint8_t *bgr = (uint8_t *)malloc(width * height * 3);
+    for (int i = 0; i < width * height; i++) {
+        const uint8_t *pair = yuyv + (i & ~1) * 2;
+        bt601_to_bgr(pair[(i & 1) * 2], pair[1], pair[3], bgr + 3 * i);
+    }
+    return bgr;
+}
+
+// PSNR of the decoded JPEG against a BGR reference
+static double decoded_psnr(const uint8_t *jpeg, size_t length, const uint8_t *bgr, int width, int height) {
+    size_t count = width * height * 3;
+    uint8_t *decoded = (uint8_t *)malloc(count);
+    if (!fmt2rgb888(jpeg, length, PIXFORMAT_JPEG, decoded)) {
+        free(decoded);
+        return 0;
+    }
+    double error = 0;
+    for (size_t i = 0; i < count; i++) {
+        double d = (double)decoded[i] - bgr[i];
+        error += d * d;
+    }
+    free(decoded);
+    return error ? 10 * log10(255.0 * 255.0 * count / error) : 99;
+}
+
+// The RGB path, as convert_image() fed YUV422 frames to the encoder before the YCbCr input
+static bool encode_rgb(const uint8_t *yuyv, int width, int height, jpge::subsampling_t subsampling,
+                       buffer_stream *stream) {
+    jpge::params params;
+    params.m_quality = 90;
+    params.m_subsampling = subsampling;
+    jpge::jpeg_encoder encoder;
+    if (!encoder.init(stream, width, height, 3, params)) {
+        return false;
+    }
+    uint8_t *line = (uint8_t *)malloc(width * 3);
+    for (int y = 0; y < height; y++) {
+        yuv422_to_rgb888(yuyv + y * width * 2, line, width);
+        encoder.process_scanline(line);
+    }
+    free(line);
+    return encoder.process_scanline(NULL);
+}
+
+static bool encode_yuyv(const uint8_t *yuyv, int width, int height, jpge::subsampling_t subsampling,
+                        buffer_stream *stream) {
+    jpge::params params;
+    params.m_quality = 90;
+    params.m_subsampling = subsampling;
+    jpge::jpeg_encoder encoder;
+    if (!encoder.init(stream, width, height, jpge::SOURCE_YUYV, params)) {
+        return false;
+    }
+    for (int y = 0; y < height; y++) {
+        encoder.process_scanline(yuyv + y * width * 2);
+    }
+    return encoder.process_scanline(NULL);
+}
+
+static void test_yuyv_round_trip(void) {
+    // Sizes that are and are not a multiple of the MCU size
+    static const int sizes[][2] = { { 64, 32 }, { 322, 237 }, { 2, 1 }, { 640, 480 } };
+    static const jpge::subsampling_t subsamplings[] = { jpge::Y_ONLY, jpge::H1V1, jpge::H2V1, jpge::H2V2 };
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        int width = sizes[s][0], height = sizes[s][1];
+        uint8_t *yuyv = make_yuyv(width, height);
+        uint8_t *bgr = make_reference(yuyv, width, height);
+
+        for (size_t m = 0; m < sizeof(subsamplings) / sizeof(subsamplings[0]); m++) {
+            buffer_stream native, rgb;
+            CHECK(encode_yuyv(yuyv, width, height, subsamplings[m], &native));
+            CHECK(encode_rgb(yuyv, width, height, subsamplings[m], &rgb));
+            if (subsamplings[m] == jpge::Y_ONLY) {
+                // tjpgd does not decode grayscale
+                CHECK(native.size > 2 && native.data[0] == 0xFF && native.data[1] == 0xD8);
+                continue;
+            }
+            double native_psnr = decoded_psnr(native.data, native.size, bgr, width, height);
+            double rgb_psnr = decoded_psnr(rgb.data, rgb.size, bgr, width, height);
+            if (width == 640) {
+                printf("  %dx%d subsampling %d: native %.2f dB %zu B, rgb %.2f dB %zu B\n", width, height,
+                       (int)subsamplings[m], native_psnr, native.size, rgb_psnr, rgb.size);
+            }
+            CHECK(native_psnr > 35);
+        }
+        free(yuyv);
+        free(bgr);
+    }
+}
+
+// Planar 4:2:0 from the YUYV image, chroma of every other row
+static void test_yuv420p_round_trip(void) {
+    const int width = 321, height = 243, chroma_width = (width + 1) / 2;
+    uint8_t *yuyv = make_yuyv(width + 1, height);
+    uint8_t *y_plane = (uint8_t *)malloc(width * height);
+    uint8_t *cb_plane = (uint8_t *)malloc(chroma_width * ((height + 1) / 2));
+    uint8_t *cr_plane = (uint8_t *)malloc(chroma_width * ((height + 1) / 2));
+    uint8_t *bgr = (uint8_t *)malloc(width * height * 3);
+
+    for (int y = 0; y < height; y++) {
+        const uint8_t *row = yuyv + y * (width + 1) * 2;
+        for (int x = 0; x < width; x++) {
+            y_plane[y * width + x] = row[2 * x];
+            const uint8_t *pair = yuyv + (y & ~1) * (width + 1) * 2 + (x & ~1) * 2;
+            bt601_to_bgr(row[2 * x], pair[1], pair[3], bgr + 3 * (y * width + x));
+        }
+        if (!(y & 1)) {
+            for (int x = 0; x < chroma_width; x++) {
+                cb_plane[y / 2 * chroma_width + x] = row[4 * x + 1];
+                cr_plane[y / 2 * chroma_width + x] = row[4 * x + 3];
+            }
+        }
+    }
+
+    buffer_stream stream;
+    jpge::params params;
+    params.m_quality = 90;
+    params.m_subsampling = jpge::H2V2;
+    jpge::jpeg_encoder encoder;
+    CHECK(encoder.init(&stream, width, height, jpge::SOURCE_YUV420P, params));
+    CHECK(!encoder.process_scanline(y_plane)); // Needs the three plane variant
+    for (int y = 0; y < height; y++) {
+        CHECK(encoder.process_scanline(y_plane + y * width, cb_plane + y / 2 * chroma_width,
+                                       cr_plane + y / 2 * chroma_width));
+    }
+    CHECK(encoder.process_scanline(NULL));
+    CHECK(decoded_psnr(stream.data, stream.size, bgr, width, height) > 30);
+
+    free(yuyv);
+    free(y_plane);
+    free(cb_plane);
+    free(cr_plane);
+    free(bgr);
+}
+
+static void test_invalid_init(void) {
+    buffer_stream stream;
+    jpge::jpeg_encoder encoder;
+    CHECK(!encoder.init(&stream, 321, 240, jpge::SOURCE_YUYV));
+    CHECK(!encoder.init(&stream, 320, 240, jpge::SOURCE_RGB));
+    CHECK(encoder.init(&stream, 320, 240, jpge::SOURCE_YUYV));
+    CHECK(!encoder.process_scanline(stream.data, stream.data, stream.data));
+}
+
+// fmt2jpg() takes the native path for YUV422 frames
+static void test_fmt2jpg_yuv422(void) {
+    const int width = 320, height = 240;
+    uint8_t *yuyv = make_yuyv(width, height);
+    uint8_t *bgr = make_reference(yuyv, width, height);
+
+    uint8_t *jpeg = NULL;
+    size_t length = 0;
+    CHECK(fmt2jpg(yuyv, width * height * 2, width, height, PIXFORMAT_YUV422, 90, &jpeg, &length));
+    // SOF0 component 0 sampling factors, 2x1 for H2V1
+    uint8_t *sof = (uint8_t *)memmem(jpeg, length, "\xFF\xC0", 2);
+    CHECK(sof && sof[11] == 0x21);
+    CHECK(decoded_psnr(jpeg, length, bgr, width, height) > 30);
+
+    free(jpeg);
+    free(yuyv);
+    free(bgr);
+}
+
+struct failing_out {
+    size_t room;    // Bytes taken before the output fails
+    size_t written;
+    int calls;      // After it failed
+};
+
+static size_t failing_write(void *arg, size_t index, const void *data, size_t len) {
+    failing_out *out = (failing_out *)arg;
+    if (!data) {
+        return 0;
+    }
+    if (out->written + len > out->room) {
+        out->calls++;
+        return 0;
+    }
+    out->written += len;
+    return len;
+}
+
+// Output that fails part way, e.g. a client that stalls, ends the encoding with an error
+static void test_fmt2jpg_cb_write_failure(void) {
+    const int width = 320, height = 240;
+    uint8_t *yuyv = make_yuyv(width, height);
+
+    failing_out out = { 2048, 0, 0 };
+    CHECK(!fmt2jpg_cb(yuyv, width * height * 2, width, height, PIXFORMAT_YUV422, 80, failing_write, &out));
+    CHECK(out.calls == 1);
+
+    failing_out room = { SIZE_MAX, 0, 0 };
+    CHECK(fmt2jpg_cb(yuyv, width * height * 2, width, height, PIXFORMAT_YUV422, 80, failing_write, &room));
+    CHECK(room.written > out.room && room.calls == 0);
+    free(yuyv);
+}
+
+static int count_markers(const uint8_t *jpeg, size_t length, uint8_t first, uint8_t last) {
+    int count = 0;
+    for (size_t i = 0; i + 1 < length; i++) {
+        if (jpeg[i] == 0xFF && jpeg[i + 1] >= first && jpeg[i + 1] <= last) {
+            count++;
+        }
+    }
+    return count;
+}
+
+// Strips are spliced with restart markers and decode to the same image as one strip
+static void test_strips(void) {
+    static const int sizes[][2] = { { 640, 480 }, { 322, 237 }, { 64, 32 }, { 16, 16 } };
+    static const pixformat_t formats[] = { PIXFORMAT_YUV422, PIXFORMAT_RGB888 };
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        int width = sizes[s][0], height = sizes[s][1];
+        uint8_t *yuyv = make_yuyv(width, height);
+        uint8_t *bgr = make_reference(yuyv, width, height);
+
+        for (size_t f = 0; f < sizeof(formats) / sizeof(formats[0]); f++) {
+            uint8_t *src = formats[f] == PIXFORMAT_YUV422 ? yuyv : bgr;
+            size_t src_len = width * height * (formats[f] == PIXFORMAT_YUV422 ? 2 : 3);
+            uint8_t *single = NULL;
+            size_t single_length = 0;
+            CHECK(fmt2jpg_strips(src, src_len, width, height, formats[f], 80, 1, &single, &single_length));
+            CHECK(count_markers(single, single_length, 0xDD, 0xDD) == 0);
+            double single_psnr = decoded_psnr(single, single_length, bgr, width, height);
+            free(single);
+
+            for (int strips = 2; strips <= 4; strips++) {
+                uint8_t *jpeg = NULL;
+                size_t length = 0;
+                CHECK(fmt2jpg_strips(src, src_len, width, height, formats[f], 80, strips, &jpeg, &length));
+                int mcu_y = formats[f] == PIXFORMAT_YUV422 ? 8 : 16;
+                int mcu_rows = (height + mcu_y - 1) / mcu_y;
+                int used = mcu_rows / 2 < strips ? mcu_rows / 2 : strips;
+                if (used > 1) {
+                    int rows = (mcu_rows + used - 1) / used;
+                    used = (mcu_rows + rows - 1) / rows;
+                }
+                CHECK(count_markers(jpeg, length, 0xDD, 0xDD) == (used > 1));
+                CHECK(count_markers(jpeg, length, 0xD0, 0xD7) == (used > 1 ? used - 1 : 0));
+                CHECK(jpeg[length - 2] == 0xFF && jpeg[length - 1] == 0xD9);
+                CHECK(fabs(decoded_psnr(jpeg, length, bgr, width, height) - single_psnr) < 0.01);
+                free(jpeg);
+            }
+        }
+        free(yuyv);
+        free(bgr);
+    }
+}
+
+static bool encode_params(const uint8_t *yuyv, int width, int height, const jpge::params &params,
+                          buffer_stream *stream) {
+    jpge::jpeg_encoder encoder;
+    if (!encoder.init(stream, width, height, jpge::SOURCE_YUYV, params)) {
+        return false;
+    }
+    for (int y = 0; y < height; y++) {
+        if (!encoder.process_scanline(yuyv + y * width * 2)) {
+            return false;
+        }
+    }
+    return encoder.process_scanline(NULL);
+}
+
+// Optimized tables code the same coefficients in fewer bytes, the decoded image is unchanged
+static void test_two_pass(void) {
+    static const int sizes[][2] = { { 640, 480 }, { 322, 237 }, { 16, 8 } };
+    static const jpge::subsampling_t subsamplings[] = { jpge::Y_ONLY, jpge::H1V1, jpge::H2V1, jpge::H2V2 };
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        int width = sizes[s][0], height = sizes[s][1];
+        uint8_t *yuyv = make_yuyv(width, height);
+        uint8_t *one = (uint8_t *)malloc(width * height * 3), *two = (uint8_t *)malloc(width * height * 3);
+
+        for (size_t m = 0; m < sizeof(subsamplings) / sizeof(subsamplings[0]); m++) {
+            for (int restart_rows = 0; restart_rows <= 3; restart_rows += 3) {
+                jpge::params params;
+                params.m_quality = 80;
+                params.m_subsampling = subsamplings[m];
+                params.m_restart_rows = restart_rows;
+                buffer_stream single, optimized;
+                CHECK(encode_params(yuyv, width, height, params, &single));
+                params.m_two_pass_flag = true;
+                CHECK(encode_params(yuyv, width, height, params, &optimized));
+
+                CHECK(optimized.size < single.size);
+                CHECK(count_markers(optimized.data, optimized.size, 0xD0, 0xD7) ==
+                      count_markers(single.data, single.size, 0xD0, 0xD7));
+                CHECK(optimized.data[optimized.size - 2] == 0xFF && optimized.data[optimized.size - 1] == 0xD9);
+                if (width == 640 && !restart_rows) {
+                    printf("  %dx%d subsampling %d: %zu B, optimized %zu B (%.1f%%)\n", width, height,
+                           (int)subsamplings[m], single.size, optimized.size,
+                           100.0 * optimized.size / single.size - 100);
+                }
+                if (subsamplings[m] == jpge::Y_ONLY) {
+                    continue; // tjpgd does not decode grayscale
+                }
+                CHECK(fmt2rgb888(single.data, single.size, PIXFORMAT_JPEG, one));
+                CHECK(fmt2rgb888(optimized.data, optimized.size, PIXFORMAT_JPEG, two));
+                CHECK(memcmp(one, two, width * height * 3) == 0);
+            }
+        }
+
+        jpge::params params;
+        params.m_two_pass_flag = true;
+        params.m_strip_lines = 16;
+        buffer_stream stream;
+        CHECK(!encode_params(yuyv, width, height, params, &stream)); // Strips share the standard tables
+
+        free(yuyv);
+        free(one);
+        free(two);
+    }
+}
+
+static void bench(const char *name, bool (*encode)(const uint8_t *, int, int, jpge::subsampling_t, buffer_stream *),
+                  const uint8_t *yuyv, int width, int height, jpge::subsampling_t subsampling) {
+    const int rounds = 20;
+    double start = now_s();
+    for (int round = 0; round < rounds; round++) {
+        buffer_stream stream;
+        encode(yuyv, width, height, subsampling, &stream);
+    }
+    double elapsed = now_s() - start;
+    printf("  %-22s %8.2f ms/frame %8.1f MPix/s\n", name, elapsed / rounds * 1e3,
+           rounds * width * height / elapsed / 1e6);
+}
+
+struct picture_t {
+    const uint8_t *jpeg;
+    uint8_t *bgr;
+    int width, height;
+};
+
+static bool picture_write(void *arg, uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint8_t *data) {
+    picture_t *picture = (picture_t *)arg;
+    if (!data) {
+        if (x == 0 && y == 0) {
+            picture->width = w;
+            picture->height = h;
+            picture->bgr = (uint8_t *)malloc(w * h * 3);
+        }
+        return picture->bgr != NULL;
+    }
+    for (int line = 0; line < h; line++) {
+        uint8_t *dst = picture->bgr + ((y + line) * picture->width + x) * 3;
+        for (int i = 0; i < w; i++, data += 3, dst += 3) {
+            dst[0] = data[2]; dst[1] = data[1]; dst[2] = data[0];
+        }
+    }
+    return true;
+}
+
+static size_t picture_read(void *arg, size_t index, uint8_t *buf, size_t len) {
+    if (buf) {
+        memcpy(buf, ((picture_t *)arg)->jpeg + index, len);
+    }
+    return len;
+}
+
+// Decoded through the reader and writer callbacks of esp_jpg_decode()
+static bool decode_picture(const uint8_t *jpeg, size_t length, jpg_scale_t scale, picture_t *picture) {
+    picture->jpeg = jpeg;
+    picture->bgr = NULL;
+    return esp_jpg_decode(length, scale, picture_read, picture_write, picture) == ESP_OK;
+}
+
+static bool load_picture(const char *name, picture_t *picture) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", CAMERA_TEST_PICTURES, name);
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        return false;
+    }
+    static uint8_t jpeg[256 * 1024];
+    size_t length = fread(jpeg, 1, sizeof(jpeg), file);
+    fclose(file);
+
+    return decode_picture(jpeg, length, JPG_SCALE_NONE, picture);
+}
+
+struct hashed_t {
+    const uint8_t *jpeg;
+    uint32_t hash;
+};
+
+// FNV-1a over every rectangle the decoder writes, position included
+static bool hash_write(void *arg, uint16_t x, uint16_t y, uint16_t w, uint16_t h, uint8_t *data) {
+    hashed_t *hashed = (hashed_t *)arg;
+    uint16_t header[4] = { x, y, w, h };
+    const uint8_t *bytes = (const uint8_t *)header;
+    for (size_t i = 0; i < sizeof(header); i++) {
+        hashed->hash = (hashed->hash ^ bytes[i]) * 16777619u;
+    }
+    for (size_t i = 0; data && i < (size_t)w * h * 3; i++) {
+        hashed->hash = (hashed->hash ^ data[i]) * 16777619u;
+    }
+    return true;
+}
+
+static size_t hash_read(void *arg, size_t index, uint8_t *buf, size_t len) {
+    if (buf) {
+        memcpy(buf, ((hashed_t *)arg)->jpeg + index, len);
+    }
+    return len;
+}
+
+static uint32_t decode_hash(const uint8_t *jpeg, size_t length, jpg_scale_t scale) {
+    hashed_t hashed = { jpeg, 2166136261u };
+    if (esp_jpg_decode(length, scale, hash_read, hash_write, &hashed) != ESP_OK) {
+        return 0;
+    }
+    return hashed.hash;
+}
+
+static size_t read_picture(const char *name, uint8_t *jpeg, size_t size) {
+    char path[512];
+    snprintf(path, sizeof(path), "%s/%s", CAMERA_TEST_PICTURES, name);
+    FILE *file = fopen(path, "rb");
+    if (!file) {
+        return 0;
+    }
+    size_t length = fread(jpeg, 1, size, file);
+    fclose(file);
+    return length;
+}
+
+// Output of the bit by bit tjpgd at every scale, the Huffman lookup tables and the IDCT fast
+// paths must not change a single pixel
+static void test_decode_golden(void) {
+    static const char *names[] = { "test_inside.jpeg", "test_outside.jpeg", "testimg.jpeg" };
+    static const jpge::subsampling_t subsamplings[] = { jpge::H1V1, jpge::H2V1, jpge::H2V2 };
+    static const uint32_t golden[][4] = {
+            { 0x00a4718b, 0xb8800376, 0xe3074778, 0x68345dc8 }, // test_inside.jpeg
+            { 0x21622f14, 0xd54d10ef, 0x10a3a084, 0x8c821e4c }, // test_outside.jpeg
+            { 0x941b366f, 0x5bda2a38, 0x842b7920, 0xbb875a1e }, // testimg.jpeg
+            { 0xb9d7e398, 0x6c330585, 0x3d3b7956, 0x8835bc50 }, // H1V1
+            { 0xb9d7e398, 0x6c330585, 0x3d3b7956, 0x8835bc50 }, // H1V1, restart markers
+            { 0xd103f341, 0x79e6f62e, 0x2fa527c8, 0x7e20d3ff }, // H2V1
+            { 0xd103f341, 0x79e6f62e, 0x2fa527c8, 0x7e20d3ff }, // H2V1, restart markers
+            { 0x2e24c1c3, 0xa4ed3f8f, 0x562f5113, 0x45ff4221 }, // H2V2
+            { 0x2e24c1c3, 0xa4ed3f8f, 0x562f5113, 0x45ff4221 }, // H2V2, restart markers
+    };
+    static uint8_t jpeg[256 * 1024];
+    size_t index = 0;
+
+    for (size_t n = 0; n < sizeof(names) / sizeof(names[0]); n++, index++) {
+        size_t length = read_picture(names[n], jpeg, sizeof(jpeg));
+        CHECK(length);
+        for (int scale = JPG_SCALE_NONE; scale <= JPG_SCALE_8X; scale++) {
+            CHECK(decode_hash(jpeg, length, (jpg_scale_t)scale) == golden[index][scale]);
+        }
+        CHECK(decode_hash(jpeg, length / 2, JPG_SCALE_NONE) == 0); // Truncated scan
+    }
+
+    const int width = 322, height = 237;
+    uint8_t *yuyv = make_yuyv(width, height);
+    for (size_t m = 0; m < sizeof(subsamplings) / sizeof(subsamplings[0]); m++) {
+        for (int restart_rows = 0; restart_rows <= 1; restart_rows++, index++) {
+            jpge::params params;
+            params.m_quality = 90;
+            params.m_subsampling = subsamplings[m];
+            params.m_restart_rows = restart_rows;
+            buffer_stream stream;
+            CHECK(encode_params(yuyv, width, height, params, &stream));
+            for (int scale = JPG_SCALE_NONE; scale <= JPG_SCALE_8X; scale++) {
+                CHECK(decode_hash(stream.data, stream.size, (jpg_scale_t)scale) == golden[index][scale]);
+            }
+        }
+    }
+    free(yuyv);
+}
+
+static jpg_output_t make_output(jpg_output_format_t format, jpg_scale_t scale, uint8_t *buf, size_t stride) {
+    jpg_output_t output;
+    memset(&output, 0, sizeof(output));
+    output.format = format;
+    output.scale = scale;
+    output.buf[0] = buf;
+    output.stride[0] = stride;
+    return output;
+}
+
+// tjpgd's YCbCr to RGB, with the same integer coefficients and truncation
+static void tjpgd_ycc_to_bgr(int y, int cb, int cr, uint8_t *bgr) {
+    int c[3] = { y + (1814 * (cb - 128)) / 1024, y - (352 * (cb - 128) + 731 * (cr - 128)) / 1024,
+                 y + (1435 * (cr - 128)) / 1024 };
+    for (int i = 0; i < 3; i++) {
+        bgr[i] = c[i] < 0 ? 0 : c[i] > 255 ? 255 : c[i];
+    }
+}
+
+// Decodes into YUV420P and converts back to BGR, returns the PSNR against the BGR decode
+static double yuv420p_psnr(const uint8_t *jpeg, size_t length, const uint8_t *bgr, int width, int height) {
+    static uint64_t work[JPG_DECODER_WORK_SIZE / 8];
+    jpg_decoder_t *decoder;
+    if (esp_jpg_decoder_open(work, sizeof(work), jpeg, length, &decoder, NULL, NULL) != ESP_OK) {
+        return 0;
+    }
+    size_t stride = width + 3, chroma_stride = (width + 1) / 2 + 1;
+    uint8_t *planes = (uint8_t *)malloc(stride * height + 2 * chroma_stride * ((height + 1) / 2));
+    jpg_output_t output = make_output(JPG_OUTPUT_YUV420P, JPG_SCALE_NONE, planes, stride);
+    output.buf[1] = planes + stride * height;
+    output.buf[2] = output.buf[1] + chroma_stride * ((height + 1) / 2);
+    output.stride[1] = output.stride[2] = chroma_stride;
+    double error = 0;
+    if (esp_jpg_decoder_run(decoder, &output) != ESP_OK) {
+        error = -1;
+    }
+    for (int y = 0; y < height && error >= 0; y++) {
+        for (int x = 0; x < width; x++) {
+            uint8_t pixel[3];
+            tjpgd_ycc_to_bgr(planes[y * stride + x], output.buf[1][y / 2 * chroma_stride + x / 2],
+                             output.buf[2][y / 2 * chroma_stride + x / 2], pixel);
+            for (int i = 0; i < 3; i++) {
+                double d = (double)pixel[i] - bgr[(y * width + x) * 3 + i];
+                error += d * d;
+            }
+        }
+    }
+    free(planes);
+    return error < 0 ? 0 : error ? 10 * log10(255.0 * 255.0 * width * height * 3 / error) : 99;
+}
+
+// The context decoder writes what esp_jpg_decode() does at any stride. YUV420P converted back
+// matches exactly where the JPEG is 4:2:0 too.
+static void test_decoder_context(void) {
+    static const char *names[] = { "test_inside.jpeg", "test_outside.jpeg", "testimg.jpeg" };
+    static uint8_t jpeg[256 * 1024];
+    static uint64_t work[JPG_DECODER_WORK_SIZE / 8];
+
+    for (size_t n = 0; n < sizeof(names) / sizeof(names[0]); n++) {
+        size_t length = read_picture(names[n], jpeg, sizeof(jpeg));
+        CHECK(length);
+        for (int scale = JPG_SCALE_NONE; scale <= JPG_SCALE_8X; scale += 2) {
+            picture_t picture;
+            CHECK(decode_picture(jpeg, length, (jpg_scale_t)scale, &picture));
+            int width = picture.width, height = picture.height;
+
+            jpg_decoder_t *decoder;
+            uint16_t full_width, full_height;
+            CHECK(esp_jpg_decoder_open(work, sizeof(work), jpeg, length, &decoder, &full_width, &full_height) == ESP_OK);
+            CHECK(full_width >> scale == width && full_height >> scale == height);
+            size_t stride = width * 3 + 5;
+            uint8_t *rgb = (uint8_t *)malloc(stride * height);
+            jpg_output_t output = make_output(JPG_OUTPUT_RGB888, (jpg_scale_t)scale, rgb, stride);
+            CHECK(esp_jpg_decoder_run(decoder, &output) == ESP_OK);
+            for (int y = 0; y < height; y++) {
+                CHECK(memcmp(rgb + y * stride, picture.bgr + y * width * 3, width * 3) == 0);
+            }
+
+            CHECK(esp_jpg_decoder_open(work, sizeof(work), jpeg, length, &decoder, NULL, NULL) == ESP_OK);
+            stride = width * 2 + 2;
+            output = make_output(JPG_OUTPUT_RGB565, (jpg_scale_t)scale, rgb, stride);
+            CHECK(esp_jpg_decoder_run(decoder, &output) == ESP_OK);
+            for (int i = 0; i < width * height; i++) {
+                const uint8_t *bgr = picture.bgr + i * 3, *o = rgb + (i / width) * stride + (i % width) * 2;
+                uint16_t c = ((bgr[2] & 0xF8) << 8) | ((bgr[1] & 0xFC) << 3) | (bgr[0] >> 3);
+                CHECK(o[0] == (c & 0xFF) && o[1] == c >> 8);
+            }
+            free(rgb);
+
+            if (scale == JPG_SCALE_NONE) {
+                CHECK(yuv420p_psnr(jpeg, length, picture.bgr, width, height) == 99);
+            }
+            free(picture.bgr);
+        }
+    }
+
+    // The encoder's H1V1 and H2V1 have their chroma averaged down
+    const int width = 322, height = 237;
+    uint8_t *yuyv = make_yuyv(width, height);
+    for (int m = jpge::H1V1; m <= jpge::H2V1; m++) {
+        jpge::params params;
+        params.m_quality = 90;
+        params.m_subsampling = (jpge::subsampling_t)m;
+        buffer_stream stream;
+        CHECK(encode_params(yuyv, width, height, params, &stream));
+        picture_t picture;
+        CHECK(decode_picture(stream.data, stream.size, JPG_SCALE_NONE, &picture));
+        double psnr = yuv420p_psnr(stream.data, stream.size, picture.bgr, width, height);
+        free(picture.bgr);
+        CHECK(psnr > 35 && psnr < 99);
+    }
+    free(yuyv);
+
+    jpg_decoder_t *decoder;
+    size_t length = read_picture(names[0], jpeg, sizeof(jpeg));
+    CHECK(esp_jpg_decoder_open(work, 1024, jpeg, length, &decoder, NULL, NULL) == ESP_ERR_INVALID_SIZE);
+    CHECK(esp_jpg_decoder_open((uint8_t *)work + 1, sizeof(work) - 8, jpeg, length, &decoder, NULL, NULL) ==
+          ESP_ERR_INVALID_ARG);
+    CHECK(esp_jpg_decoder_open(work, sizeof(work), jpeg, 100, &decoder, NULL, NULL) == ESP_FAIL);
+    CHECK(esp_jpg_decoder_open(work, sizeof(work), jpeg, length, &decoder, NULL, NULL) == ESP_OK);
+    uint8_t row[320 * 3];
+    jpg_output_t output = make_output(JPG_OUTPUT_RGB888, JPG_SCALE_NONE, row, 320 * 3 - 1);
+    CHECK(esp_jpg_decoder_run(decoder, &output) == ESP_ERR_INVALID_ARG);
+    output = make_output(JPG_OUTPUT_YUV420P, JPG_SCALE_2X, row, 160);
+    output.buf[1] = output.buf[2] = row;
+    output.stride[1] = output.stride[2] = 80;
+    CHECK(esp_jpg_decoder_run(decoder, &output) == ESP_ERR_NOT_SUPPORTED);
+}
+
+struct parallel_decode_t {
+    const uint8_t *jpeg;
+    size_t length;
+    const uint8_t *expected;
+    int width, height;
+    int mismatches;
+};
+
+static void *parallel_decode(void *arg) {
+    parallel_decode_t *job = (parallel_decode_t *)arg;
+    void *work = malloc(JPG_DECODER_WORK_SIZE);
+    uint8_t *rgb = (uint8_t *)malloc(job->width * job->height * 3);
+    for (int round = 0; round < 20; round++) {
+        jpg_decoder_t *decoder;
+        jpg_output_t output = make_output(JPG_OUTPUT_RGB888, JPG_SCALE_NONE, rgb, job->width * 3);
+        if (esp_jpg_decoder_open(work, JPG_DECODER_WORK_SIZE, job->jpeg, job->length, &decoder, NULL, NULL) != ESP_OK ||
+                esp_jpg_decoder_run(decoder, &output) != ESP_OK ||
+                memcmp(rgb, job->expected, job->width * job->height * 3) != 0) {
+            job->mismatches++;
+        }
+    }
+    free(rgb);
+    free(work);
+    return NULL;
+}
+
+// Decoders in their own workspaces share nothing, as one per core would run them
+static void test_decoder_parallel(void) {
+    static const char *names[] = { "test_inside.jpeg", "test_outside.jpeg" };
+    static uint8_t jpeg[2][256 * 1024];
+    parallel_decode_t jobs[2];
+    picture_t pictures[2];
+    pthread_t threads[2];
+
+    for (int i = 0; i < 2; i++) {
+        jobs[i].length = read_picture(names[i], jpeg[i], sizeof(jpeg[i]));
+        CHECK(decode_picture(jpeg[i], jobs[i].length, JPG_SCALE_NONE, &pictures[i]));
+        jobs[i].jpeg = jpeg[i];
+        jobs[i].expected = pictures[i].bgr;
+        jobs[i].width = pictures[i].width;
+        jobs[i].height = pictures[i].height;
+        jobs[i].mismatches = 0;
+    }
+    for (int i = 0; i < 2; i++) {
+        CHECK(pthread_create(&threads[i], NULL, parallel_decode, &jobs[i]) == 0);
+    }
+    for (int i = 0; i < 2; i++) {
+        pthread_join(threads[i], NULL);
+        free(pictures[i].bgr);
+    }
+    CHECK(jobs[0].mismatches == 0 && jobs[1].mismatches == 0);
+}
+
+// Decodes a region of the JPEG into the planes at their strides
+static esp_err_t decode_region(const uint8_t *jpeg, size_t length, jpg_output_format_t format, jpg_scale_t scale,
+                               jpg_rect_t roi, uint8_t *const *buf, const size_t *stride) {
+    static uint64_t work[JPG_DECODER_WORK_SIZE / 8];
+    jpg_decoder_t *decoder;
+    esp_err_t err = esp_jpg_decoder_open(work, sizeof(work), jpeg, length, &decoder, NULL, NULL);
+    if (err != ESP_OK) {
+        return err;
+    }
+    jpg_output_t output = make_output(format, scale, buf[0], stride[0]);
+    for (int i = 1; i < 3; i++) {
+        output.buf[i] = buf[i];
+        output.stride[i] = stride[i];
+    }
+    output.roi = roi;
+    return esp_jpg_decoder_run(decoder, &output);
+}
+
+// Every region is the crop of the whole image, and nothing is written past the end of its rows
+static void check_regions(const uint8_t *jpeg, size_t length, int width, int height) {
+    const jpg_rect_t regions[] = {
+            { 0, 0, 16, 16 },
+            { 13, 7, 61, 45 },
+            { (uint16_t)(width / 3), (uint16_t)(height / 3), (uint16_t)(width / 3), (uint16_t)(height / 3) },
+            { (uint16_t)(width - 5), (uint16_t)(height - 3), 0, 0 },
+            { 17, 0, 1, (uint16_t)height },
+            { 0, (uint16_t)(height / 2), (uint16_t)width, 1 },
+            { 0, 0, 0, 0 },
+    };
+    size_t full_stride[3] = { (size_t)width * 3, (size_t)(width + 1) / 2, (size_t)(width + 1) / 2 };
+    size_t chroma_size = full_stride[1] * ((height + 1) / 2);
+    uint8_t *full = (uint8_t *)malloc(width * height * 3 + 2 * chroma_size);
+    uint8_t *out = (uint8_t *)malloc((width * 3 + 1) * height + 2 * (chroma_size + height));
+
+    for (int scale = JPG_SCALE_NONE; scale <= JPG_SCALE_2X; scale++) {
+        uint8_t *full_buf[3] = { full, NULL, NULL };
+        CHECK(decode_region(jpeg, length, JPG_OUTPUT_RGB888, (jpg_scale_t)scale, regions[6], full_buf, full_stride) ==
+              ESP_OK);
+        for (size_t r = 0; r < sizeof(regions) / sizeof(regions[0]); r++) {
+            const jpg_rect_t &roi = regions[r];
+            int x0 = roi.x >> scale, x1 = (roi.x + (roi.width ? roi.width : width - roi.x)) >> scale;
+            int y0 = roi.y >> scale, y1 = (roi.y + (roi.height ? roi.height : height - roi.y)) >> scale;
+            size_t stride[3] = { (size_t)(x1 - x0) * 3 + 1, 0, 0 };
+            uint8_t *buf[3] = { out, NULL, NULL };
+            memset(out, 0xA5, stride[0] * (y1 - y0));
+            CHECK(decode_region(jpeg, length, JPG_OUTPUT_RGB888, (jpg_scale_t)scale, roi, buf, stride) == ESP_OK);
+            for (int y = y0; y < y1; y++) {
+                const uint8_t *row = out + (y - y0) * stride[0];
+                CHECK(memcmp(row, full + y * full_stride[0] + x0 * 3, (x1 - x0) * 3) == 0);
+                CHECK(row[stride[0] - 1] == 0xA5);
+            }
+        }
+    }
+
+    uint8_t *full_buf[3] = { full, full + width * height, full + width * height + chroma_size };
+    full_stride[0] = width;
+    CHECK(decode_region(jpeg, length, JPG_OUTPUT_YUV420P, JPG_SCALE_NONE, regions[6], full_buf, full_stride) ==
+          ESP_OK);
+    for (size_t r = 0; r < sizeof(regions) / sizeof(regions[0]); r++) {
+        const jpg_rect_t &roi = regions[r];
+        int x0 = roi.x & ~1, x1 = roi.x + (roi.width ? roi.width : width - roi.x);
+        int y0 = roi.y & ~1, y1 = roi.y + (roi.height ? roi.height : height - roi.y);
+        size_t stride[3] = { (size_t)(x1 - x0) + 1, (size_t)(x1 - x0 + 1) / 2 + 1, (size_t)(x1 - x0 + 1) / 2 + 1 };
+        uint8_t *buf[3] = { out, out + stride[0] * (y1 - y0), out + stride[0] * (y1 - y0) + stride[1] * height };
+        memset(out, 0xA5, stride[0] * (y1 - y0) + 2 * stride[1] * height);
+        CHECK(decode_region(jpeg, length, JPG_OUTPUT_YUV420P, JPG_SCALE_NONE, roi, buf, stride) == ESP_OK);
+        for (int y = y0; y < y1; y++) {
+            CHECK(memcmp(buf[0] + (y - y0) * stride[0], full_buf[0] + y * width + x0, x1 - x0) == 0);
+        }
+        for (int y = y0 / 2; y < (y1 + 1) / 2; y++) {
+            for (int i = 1; i < 3; i++) {
+                const uint8_t *row = buf[i] + (y - y0 / 2) * stride[i];
+                CHECK(memcmp(row, full_buf[i] + y * full_stride[i] + x0 / 2, (x1 + 1) / 2 - x0 / 2) == 0);
+                CHECK(row[stride[i] - 1] == 0xA5);
+            }
+        }
+    }
+    free(out);
+    free(full);
+}
+
+// A region of interest decodes the same pixels as the whole image, on the pictures and on frames
+// with a restart interval per MCU row, where the rows above the region are skipped unparsed
+static void test_decoder_roi(void) {
+    static const char *names[] = { "test_inside.jpeg", "test_outside.jpeg", "testimg.jpeg" };
+    static const jpge::subsampling_t subsamplings[] = { jpge::H1V1, jpge::H2V2 };
+    static uint8_t jpeg[256 * 1024];
+
+    for (size_t n = 0; n < sizeof(names) / sizeof(names[0]); n++) {
+        size_t length = read_picture(names[n], jpeg, sizeof(jpeg));
+        picture_t picture;
+        CHECK(length && load_picture(names[n], &picture));
+        free(picture.bgr);
+        check_regions(jpeg, length, picture.width, picture.height);
+    }
+
+    const int width = 322, height = 237;
+    uint8_t *yuyv = make_yuyv(width, height);
+    for (size_t m = 0; m < sizeof(subsamplings) / sizeof(subsamplings[0]); m++) {
+        for (int restart_rows = 0; restart_rows <= 1; restart_rows++) {
+            jpge::params params;
+            params.m_quality = 90;
+            params.m_subsampling = subsamplings[m];
+            params.m_restart_rows = restart_rows;
+            buffer_stream stream;
+            CHECK(encode_params(yuyv, width, height, params, &stream));
+            check_regions(stream.data, stream.size, width, height);
+        }
+    }
+    free(yuyv);
+
+    size_t length = read_picture(names[0], jpeg, sizeof(jpeg));
+    uint8_t row[320 * 3];
+    uint8_t *buf[3] = { row, NULL, NULL };
+    size_t stride[3] = { sizeof(row), 0, 0 };
+    const jpg_rect_t outside = { 320, 0, 0, 0 }, too_wide = { 100, 0, 221, 1 }, too_high = { 0, 200, 1, 41 };
+    CHECK(decode_region(jpeg, length, JPG_OUTPUT_RGB888, JPG_SCALE_NONE, outside, buf, stride) == ESP_ERR_INVALID_ARG);
+    CHECK(decode_region(jpeg, length, JPG_OUTPUT_RGB888, JPG_SCALE_NONE, too_wide, buf, stride) == ESP_ERR_INVALID_ARG);
+    CHECK(decode_region(jpeg, length, JPG_OUTPUT_RGB888, JPG_SCALE_NONE, too_high, buf, stride) == ESP_ERR_INVALID_ARG);
+}
+
+// The luminance map is the mean of the decoded luma of every MCU, give or take the rounding
+// of the IDCT. MCUs on the right and bottom edges also hold the padding, they are left out.
+static void test_decoder_luma_map(void) {
+    static const char *names[] = { "test_inside.jpeg", "test_outside.jpeg", "testimg.jpeg" };
+    static uint8_t jpeg[256 * 1024];
+    static uint64_t work[JPG_DECODER_WORK_SIZE / 8];
+
+    for (size_t n = 0; n < sizeof(names) / sizeof(names[0]); n++) {
+        size_t length = read_picture(names[n], jpeg, sizeof(jpeg));
+        picture_t picture;
+        CHECK(length && load_picture(names[n], &picture));
+        free(picture.bgr);
+        int width = picture.width, height = picture.height;
+        size_t chroma_size = ((width + 1) / 2) * ((height + 1) / 2);
+        uint8_t *planes = (uint8_t *)malloc(width * height + 2 * chroma_size);
+        uint8_t *buf[3] = { planes, planes + width * height, planes + width * height + chroma_size };
+        size_t stride[3] = { (size_t)width, (size_t)(width + 1) / 2, (size_t)(width + 1) / 2 };
+        const jpg_rect_t whole = { 0, 0, 0, 0 };
+        CHECK(decode_region(jpeg, length, JPG_OUTPUT_YUV420P, JPG_SCALE_NONE, whole, buf, stride) == ESP_OK);
+
+        jpg_decoder_t *decoder;
+        uint16_t cols, rows;
+        uint8_t map[40 * 30];
+        CHECK(esp_jpg_decoder_open(work, sizeof(work), jpeg, length, &decoder, NULL, NULL) == ESP_OK);
+        CHECK(esp_jpg_decoder_luma_map(decoder, NULL, 0, &cols, &rows) == ESP_ERR_INVALID_SIZE);
+        CHECK(cols * rows <= sizeof(map));
+        CHECK(esp_jpg_decoder_luma_map(decoder, map, sizeof(map), NULL, NULL) == ESP_OK);
+        const int mx = 16, my = 16; // All pictures are 4:2:0
+        CHECK(cols == (width + mx - 1) / mx && rows == (height + my - 1) / my);
+        for (int row = 0; row < height / my; row++) {
+            for (int col = 0; col < width / mx; col++) {
+                int sum = 0;
+                for (int y = 0; y < my; y++) {
+                    for (int x = 0; x < mx; x++) {
+                        sum += planes[(row * my + y) * width + col * mx + x];
+                    }
+                }
+                CHECK(abs(sum / (mx * my) - map[row * cols + col]) <= 2);
+            }
+        }
+        free(planes);
+
+        CHECK(esp_jpg_decoder_open(work, sizeof(work), jpeg, length, &decoder, NULL, NULL) == ESP_OK);
+        CHECK(esp_jpg_decoder_luma_map(decoder, map, cols * rows - 1, NULL, NULL) == ESP_ERR_INVALID_SIZE);
+    }
+}
+
+// Pans a window across each test picture, switching pictures like a scene cut: after a frame or
+// two to settle, rate control keeps every frame of a scene close to the target
+static void test_rate_control(void) {
+    static const char *names[] = { "test_inside.jpeg", "test_outside.jpeg", "testimg.jpeg" };
+    static const size_t targets[] = { 2500, 5000, 8000 };
+    const int width = 208, height = 144, frames = 8;
+    uint8_t *window = (uint8_t *)malloc(width * height * 3), *decoded = (uint8_t *)malloc(width * height * 3);
+
+    for (size_t t = 0; t < sizeof(targets) / sizeof(targets[0]); t++) {
+        jpg_rate_control_t rate;
+        memset(&rate, 0, sizeof(rate));
+        rate.target_size = targets[t];
+        rate.quality = 80;
+        printf("  target %5zu B:", targets[t]);
+        for (size_t n = 0; n < sizeof(names) / sizeof(names[0]); n++) {
+            picture_t picture;
+            CHECK(load_picture(names[n], &picture));
+            for (int frame = 0; frame < frames; frame++) {
+                for (int y = 0; y < height; y++) {
+                    memcpy(window + y * width * 3, picture.bgr + (y * picture.width + frame * 2) * 3, width * 3);
+                }
+                uint8_t *jpeg = NULL;
+                size_t length = 0;
+                CHECK(fmt2jpg_rate(window, width * height * 3, width, height, PIXFORMAT_RGB888, &rate, &jpeg, &length));
+                printf(" %zu", length);
+                CHECK(rate.last_size == length);
+                CHECK(fmt2rgb888(jpeg, length, PIXFORMAT_JPEG, decoded));
+                free(jpeg);
+                CHECK(length < targets[t] * 2);
+                if (frame >= 2) {
+                    CHECK(length <= targets[t] * 1.1 && length >= targets[t] * 0.85);
+                }
+            }
+            free(picture.bgr);
+            printf(" |");
+        }
+        printf("\n");
+    }
+
+    jpg_rate_control_t rate;
+    memset(&rate, 0, sizeof(rate));
+    uint8_t *jpeg = NULL;
+    size_t length = 0;
+    CHECK(!fmt2jpg_rate(window, width * height * 3, width, height, PIXFORMAT_RGB888, &rate, &jpeg, &length));
+
+    free(window);
+    free(decoded);
+}
+
+// Time per MCU of the RGB path fmt2jpg() takes for RGB888 frames, on the pictures the
+// camera tests use
+static void bench_pictures(void) {
+    static const char *names[] = { "test_inside.jpeg", "test_outside.jpeg", "testimg.jpeg" };
+    static const int qualities[] = { 50, 80, 95 };
+
+    printf("RGB888 to JPEG, H2V2:\n");
+    for (size_t n = 0; n < sizeof(names) / sizeof(names[0]); n++) {
+        picture_t picture;
+        if (!load_picture(names[n], &picture)) {
+            printf("  %s: unable to load\n", names[n]);
+            continue;
+        }
+        int mcus = ((picture.width + 15) / 16) * ((picture.height + 15) / 16);
+        for (size_t q = 0; q < sizeof(qualities) / sizeof(qualities[0]); q++) {
+            const int rounds = 50;
+            uint8_t *jpeg = NULL;
+            size_t length = 0;
+            double start = now_s();
+            for (int round = 0; round < rounds; round++) {
+                free(jpeg);
+                fmt2jpg(picture.bgr, picture.width * picture.height * 3, picture.width, picture.height,
+                        PIXFORMAT_RGB888, qualities[q], &jpeg, &length);
+            }
+            double elapsed = now_s() - start;
+            uint8_t *optimized = NULL;
+            size_t optimized_length = 0;
+            fmt2jpg_optimized(picture.bgr, picture.width * picture.height * 3, picture.width, picture.height,
+                              PIXFORMAT_RGB888, qualities[q], &optimized, &optimized_length);
+            printf("  %-18s %dx%d q%-3d %8.3f us/MCU %7zu B %6.2f dB, optimized %7zu B %5.1f%%\n", names[n],
+                   picture.width, picture.height, qualities[q], elapsed / rounds / mcus * 1e6, length,
+                   decoded_psnr(jpeg, length, picture.bgr, picture.width, picture.height), optimized_length,
+                   100.0 * optimized_length / length - 100);
+            free(jpeg);
+            free(optimized);
+        }
+        free(picture.bgr);
+    }
+}
+
+// Best of a few batches, the host is shared and the first batch also warms the caches
+static double decode_mpix(jpg_output_format_t format, const uint8_t *jpeg, size_t length, uint8_t *out, int width,
+                          int height) {
+    const int batches = 5, rounds = 10;
+    static uint64_t work[JPG_DECODER_WORK_SIZE / 8];
+    jpg_output_t output;
+    memset(&output, 0, sizeof(output));
+    output.format = JPG_OUTPUT_YUV420P;
+    output.buf[0] = out;
+    output.buf[1] = out + width * height;
+    output.buf[2] = output.buf[1] + width * height / 4;
+    output.stride[0] = width;
+    output.stride[1] = output.stride[2] = (width + 1) / 2;
+
+    double best = 0;
+    for (int batch = 0; batch < batches; batch++) {
+        double start = now_s();
+        for (int round = 0; round < rounds; round++) {
+            jpg_decoder_t *decoder;
+            if (format == JPG_OUTPUT_RGB565) {
+                jpg2rgb565(jpeg, length, out, JPG_SCALE_NONE);
+            } else if (format == JPG_OUTPUT_RGB888) {
+                fmt2rgb888(jpeg, length, PIXFORMAT_JPEG, out);
+            } else if (esp_jpg_decoder_open(work, sizeof(work), jpeg, length, &decoder, NULL, NULL) == ESP_OK) {
+                esp_jpg_decoder_run(decoder, &output);
+            }
+        }
+        double mpix = rounds * width * height / (now_s() - start) / 1e6;
+        best = mpix > best ? mpix : best;
+    }
+    return best;
+}
+
+static void bench_decode_one(const char *name, const uint8_t *jpeg, size_t length, int width, int height) {
+    uint8_t *out = (uint8_t *)malloc(width * height * 3);
+    printf("  %-18s %dx%d %7zu B %8.2f MPix/s RGB888 %8.2f MPix/s RGB565 %8.2f MPix/s YUV420P\n", name, width,
+           height, length, decode_mpix(JPG_OUTPUT_RGB888, jpeg, length, out, width, height),
+           decode_mpix(JPG_OUTPUT_RGB565, jpeg, length, out, width, height),
+           decode_mpix(JPG_OUTPUT_YUV420P, jpeg, length, out, width, height));
+    free(out);
+}
+
+// Decode speed of fmt2rgb888(), jpg2rgb565() and the decoder context into YUV420P on the pictures the camera tests use, and on a
+// VGA frame as the camera would send it
+static void bench_decode(void) {
+    static const char *names[] = { "test_inside.jpeg", "test_outside.jpeg", "testimg.jpeg" };
+    static uint8_t jpeg[256 * 1024];
+
+    printf("JPEG decode:\n");
+    for (size_t n = 0; n < sizeof(names) / sizeof(names[0]); n++) {
+        picture_t picture;
+        size_t length = read_picture(names[n], jpeg, sizeof(jpeg));
+        if (!length || !load_picture(names[n], &picture)) {
+            printf("  %s: unable to load\n", names[n]);
+            continue;
+        }
+        free(picture.bgr);
+        bench_decode_one(names[n], jpeg, length, picture.width, picture.height);
+    }
+
+    const int width = 640, height = 480;
+    uint8_t *yuyv = make_yuyv(width, height);
+    uint8_t *frame = NULL;
+    size_t length = 0;
+    if (fmt2jpg(yuyv, width * height * 2, width, height, PIXFORMAT_YUV422, 80, &frame, &length)) {
+        bench_decode_one("VGA YUV422 q80", frame, length, width, height);
+    }
+    free(frame);
+    free(yuyv);
+}
+
+// A tenth of an XGA frame against the whole of it, as motion detection or a zoomed view would decode
+static void bench_roi(void) {
+    const int width = 1024, height = 768, batches = 5, rounds = 10;
+    const jpg_rect_t whole = { 0, 0, 0, 0 }, centre = { 350, 262, 324, 243 };
+    uint8_t *yuyv = make_yuyv(width, height);
+    uint8_t *out = (uint8_t *)malloc(width * height * 3);
+    uint8_t *buf[3] = { out, NULL, NULL };
+    size_t stride[3] = { (size_t)width * 3, 0, 0 };
+
+    printf("JPEG region of interest decode, XGA q80 H2V2, 324x243 centre:\n");
+    for (int restart_rows = 0; restart_rows <= 1; restart_rows++) {
+        jpge::params params;
+        params.m_quality = 80;
+        params.m_restart_rows = restart_rows;
+        buffer_stream stream;
+        if (!encode_params(yuyv, width, height, params, &stream)) {
+            continue;
+        }
+        double best[2] = { 1e9, 1e9 };
+        for (int batch = 0; batch < batches; batch++) {
+            for (int r = 0; r < 2; r++) {
+                double start = now_s();
+                for (int round = 0; round < rounds; round++) {
+                    decode_region(stream.data, stream.size, JPG_OUTPUT_RGB888, JPG_SCALE_NONE, r ? centre : whole, buf,
+                                  stride);
+                }
+                double ms = (now_s() - start) * 1e3 / rounds;
+                best[r] = ms < best[r] ? ms : best[r];
+            }
+        }
+        printf("  %-18s %8.2f ms whole %8.2f ms region %5.1f%%\n",
+               restart_rows ? "restart per row" : "no restart", best[0], best[1], 100 * best[1] / best[0]);
+    }
+    free(out);
+    free(yuyv);
+}
+
+// The luminance map of an XGA frame against decoding it, as the motion detector of every stream runs it
+static void bench_luma_map(void) {
+    const int width = 1024, height = 768, batches = 5, rounds = 10;
+    static uint64_t work[JPG_DECODER_WORK_SIZE / 8];
+    static uint8_t map[64 * 96];
+    uint8_t *yuyv = make_yuyv(width, height);
+    uint8_t *out = (uint8_t *)malloc(width * height * 3);
+    uint8_t *buf[3] = { out, NULL, NULL };
+    size_t stride[3] = { (size_t)width * 3, 0, 0 };
+    const jpg_rect_t whole = { 0, 0, 0, 0 };
+
+    printf("JPEG luminance map, XGA q80:\n");
+    for (int m = jpge::H2V1; m <= jpge::H2V2; m++) {
+        jpge::params params;
+        params.m_quality = 80;
+        params.m_subsampling = (jpge::subsampling_t)m;
+        buffer_stream stream;
+        if (!encode_params(yuyv, width, height, params, &stream)) {
+            continue;
+        }
+        double best[2] = { 1e9, 1e9 };
+        for (int batch = 0; batch < batches; batch++) {
+            double start = now_s();
+            for (int round = 0; round < rounds; round++) {
+                decode_region(stream.data, stream.size, JPG_OUTPUT_RGB888, JPG_SCALE_NONE, whole, buf, stride);
+            }
+            double ms = (now_s() - start) * 1e3 / rounds;
+            best[0] = ms < best[0] ? ms : best[0];
+
+            start = now_s();
+            for (int round = 0; round < rounds; round++) {
+                jpg_decoder_t *decoder;
+                if (esp_jpg_decoder_open(work, sizeof(work), stream.data, stream.size, &decoder, NULL, NULL) == ESP_OK) {
+                    esp_jpg_decoder_luma_map(decoder, map, sizeof(map), NULL, NULL);
+                }
+            }
+            ms = (now_s() - start) * 1e3 / rounds;
+            best[1] = ms < best[1] ? ms : best[1];
+        }
+        printf("  %-18s %7zu B %8.2f ms decode %8.3f ms luminance map\n", m == jpge::H2V1 ? "H2V1" : "H2V2",
+               stream.size, best[0], best[1]);
+    }
+    free(out);
+    free(yuyv);
+}
+
+static void bench_strips(void) {
+    const int width = 1280, height = 720, rounds = 10;
+    uint8_t *yuyv = make_yuyv(width, height);
+
+    printf("YUV422 to JPEG in strips, 720p, quality 80:\n");
+    for (int strips = 1; strips <= 4; strips *= 2) {
+        double start = now_s();
+        size_t length = 0;
+        for (int round = 0; round < rounds; round++) {
+            uint8_t *jpeg = NULL;
+            fmt2jpg_strips(yuyv, width * height * 2, width, height, PIXFORMAT_YUV422, 80, strips, &jpeg, &length);
+            free(jpeg);
+        }
+        printf("  %d strip(s)  %8.2f ms/frame %7zu B\n", strips, (now_s() - start) / rounds * 1e3, length);
+    }
+    free(yuyv);
+}
+
+static void bench_vga(void) {
+    const int width = 640, height = 480;
+    uint8_t *yuyv = make_yuyv(width, height);
+
+    printf("YUV422 to JPEG, VGA, quality 90:\n");
+    bench("RGB path, H2V2", encode_rgb, yuyv, width, height, jpge::H2V2);
+    bench("RGB path, H2V1", encode_rgb, yuyv, width, height, jpge::H2V1);
+    bench("YUYV input, H2V1", encode_yuyv, yuyv, width, height, jpge::H2V1);
+    bench("YUYV input, H2V2", encode_yuyv, yuyv, width, height, jpge::H2V2);
+
+    free(yuyv);
+}
+
+int main(int argc, char **argv) {
+    RUN(test_yuyv_round_trip);
+    RUN(test_yuv420p_round_trip);
+    RUN(test_invalid_init);
+    RUN(test_fmt2jpg_yuv422);
+    RUN(test_fmt2jpg_cb_write_failure);
+    RUN(test_strips);
+    RUN(test_two_pass);
+    RUN(test_rate_control);
+    RUN(test_decode_golden);
+    RUN(test_decoder_context);
+    RUN(test_decoder_parallel);
+    RUN(test_decoder_roi);
+    RUN(test_decoder_luma_map);
+
+    bench_vga();
+    bench_pictures();
+    bench_decode();
+    bench_roi();
+    bench_luma_map();
+    bench_strips();
+
+    printf("%d failure(s)\n", failures);
+    return failures ? 1 : 0;
+}
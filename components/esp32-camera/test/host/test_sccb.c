@@ -0,0 +1,277 @@
+//
+// Tests and benchmark of the batched register writes of sccb.c and of the
+// register shadow of sccb_shadow.c against the simulated sensor of mock_i2c.c.
+//
+// Built once per sensor, SENSOR_SETTINGS names its settings header and
+// SENSOR_REGS the init table in it. The batched writes must leave the
+// sensor exactly as writing the registers one by one does, in the same
+// order around the delays, with fewer transactions on the bus.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "sccb.h"
+#include "sccb_shadow.h"
+#include "sensor.h"
+#include "mock_i2c.h"
+#include SENSOR_SETTINGS
+
+static int failures;
+
+#define CHECK(cond) do {                                                    \
+        if (!(cond)) {                                                      \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++;                                                     \
+            return;                                                         \
+        }                                                                   \
+    } while(0)
+
+#define RUN(test) do {                                                      \
+        int before = failures;                                              \
+        test();                                                             \
+        printf("%s %s\n", failures == before ? "PASS" : "FAIL", #test);     \
+    } while(0)
+
+#define SENSOR_MOCK_FLAGS (((SENSOR_FLAGS) & SCCB_REG_ADDR16 ? MOCK_I2C_ADDR16 : 0) | MOCK_I2C_AUTO_INCREMENT)
+
+// What the sensor drivers did before SCCB_Write_Regs()
+static int write_regs_one_by_one(uint8_t slv_addr, const uint16_t (*regs)[2], int flags) {
+    int ret = 0;
+    for (int i = 0; !ret && regs[i][0] != REGLIST_TAIL; i++) {
+        if (regs[i][0] == REG_DLY) {
+            vTaskDelay(regs[i][1] / portTICK_PERIOD_MS);
+        } else if (flags & SCCB_REG_ADDR16) {
+            ret = SCCB_Write16(slv_addr, regs[i][0], regs[i][1]);
+        } else {
+            ret = SCCB_Write(slv_addr, regs[i][0], regs[i][1]);
+        }
+    }
+    return ret;
+}
+
+static void test_init_table(void) {
+    static uint8_t expected_regs[0x10000];
+    static uint32_t expected_log[4096];
+
+    mock_i2c_reset(SENSOR_ADDR, SENSOR_MOCK_FLAGS);
+    CHECK(write_regs_one_by_one(SENSOR_ADDR, SENSOR_REGS, SENSOR_FLAGS) == 0);
+    const uint32_t *log;
+    size_t expected_count = mock_i2c_log(&log);
+    CHECK(expected_count <= sizeof(expected_log) / sizeof(expected_log[0]));
+    memcpy(expected_log, log, expected_count * sizeof(uint32_t));
+    memcpy(expected_regs, mock_i2c_registers(), sizeof(expected_regs));
+    mock_i2c_stats_t one_by_one = mock_i2c_stats();
+    double one_by_one_ms = mock_i2c_bus_ms();
+
+    mock_i2c_reset(SENSOR_ADDR, SENSOR_MOCK_FLAGS);
+    CHECK(SCCB_Write_Regs(SENSOR_ADDR, SENSOR_REGS, REG_DLY, REGLIST_TAIL, SENSOR_FLAGS) == 0);
+    mock_i2c_stats_t batched = mock_i2c_stats();
+    CHECK(mock_i2c_log(&log) == expected_count);
+    CHECK(memcmp(log, expected_log, expected_count * sizeof(uint32_t)) == 0);
+    CHECK(memcmp(mock_i2c_registers(), expected_regs, sizeof(expected_regs)) == 0);
+    CHECK(batched.delays == one_by_one.delays && batched.delay_ms == one_by_one.delay_ms);
+    CHECK(batched.transactions <= batched.delays + 1 + batched.bytes / 128);
+    CHECK(batched.bytes <= one_by_one.bytes);
+
+    printf("%s init: %u registers, %u ms of delays\n", SENSOR_NAME, one_by_one.transactions, one_by_one.delay_ms);
+    printf("  one by one: %5u transactions %6u bytes %7.1f ms on the bus\n",
+           one_by_one.transactions, one_by_one.bytes, one_by_one_ms);
+    printf("  batched:    %5u transactions %6u bytes %7.1f ms on the bus\n",
+           batched.transactions, batched.bytes, mock_i2c_bus_ms());
+}
+
+// A delay waits for everything before it, and nothing after it goes out early
+static void test_delay_order(void) {
+    static const uint16_t regs[][2] = {
+            {0x3008, 0x82}, {0x3009, 0x01}, {REG_DLY, 10}, {0x300a, 0x02}, {0x3010, 0x03}, {REGLIST_TAIL, 0x00}
+    };
+    mock_i2c_reset(SENSOR_ADDR, MOCK_I2C_ADDR16 | MOCK_I2C_AUTO_INCREMENT);
+    CHECK(SCCB_Write_Regs(SENSOR_ADDR, regs, REG_DLY, REGLIST_TAIL, SCCB_REG_ADDR16 | SCCB_AUTO_INCREMENT) == 0);
+
+    const uint32_t *log;
+    CHECK(mock_i2c_log(&log) == 5);
+    CHECK(log[0] == 0x300882 && log[1] == 0x300901);
+    CHECK(log[2] == (MOCK_I2C_LOG_DELAY | 10));
+    CHECK(log[3] == 0x300a02 && log[4] == 0x301003);
+
+    // The burst of two before the delay, the burst and the single write after it
+    mock_i2c_stats_t stats = mock_i2c_stats();
+    CHECK(stats.transactions == 2);
+    CHECK(stats.starts == 3);
+    CHECK(stats.bytes == 5 + 4 + 4);
+}
+
+// Runs of registers longer than a transaction are split across transactions
+static void test_long_burst(void) {
+    static uint16_t regs[301][2];
+    for (int i = 0; i < 300; i++) {
+        regs[i][0] = 0x5000 + i;
+        regs[i][1] = i * 7;
+    }
+    regs[300][0] = REGLIST_TAIL;
+
+    mock_i2c_reset(SENSOR_ADDR, MOCK_I2C_ADDR16 | MOCK_I2C_AUTO_INCREMENT);
+    CHECK(SCCB_Write_Regs(SENSOR_ADDR, (const uint16_t (*)[2]) regs, REG_DLY, REGLIST_TAIL,
+                          SCCB_REG_ADDR16 | SCCB_AUTO_INCREMENT) == 0);
+    for (int i = 0; i < 300; i++) {
+        CHECK(mock_i2c_registers()[0x5000 + i] == (uint8_t) (i * 7));
+    }
+    mock_i2c_stats_t stats = mock_i2c_stats();
+    CHECK(stats.transactions == 3);
+    CHECK(stats.bytes == 300 + stats.starts * 3);
+
+    // A sensor without auto increment gets a message per register
+    mock_i2c_reset(SENSOR_ADDR, MOCK_I2C_ADDR16);
+    CHECK(SCCB_Write_Regs(SENSOR_ADDR, (const uint16_t (*)[2]) regs, REG_DLY, REGLIST_TAIL, SCCB_REG_ADDR16) == 0);
+    stats = mock_i2c_stats();
+    CHECK(stats.starts == 300);
+    CHECK(stats.bytes == 300 * 4);
+    CHECK(stats.transactions == (300 * 4 + 127) / 128);
+}
+
+// A missing acknowledge fails the write and stops the table
+static void test_nack(void) {
+    static const uint16_t regs[][2] = {
+            {0x10, 0x01}, {REG_DLY, 1}, {0x11, 0x02}, {REG_DLY, 1}, {0x12, 0x03}, {REGLIST_TAIL, 0x00}
+    };
+    mock_i2c_reset(SENSOR_ADDR, 0);
+    mock_i2c_nack_after(1);
+    CHECK(SCCB_Write_Regs(SENSOR_ADDR, regs, REG_DLY, REGLIST_TAIL, 0) == -1);
+    CHECK(mock_i2c_stats().transactions == 2);
+    CHECK(mock_i2c_registers()[0x10] == 0x01);
+    CHECK(mock_i2c_registers()[0x12] == 0x00);
+
+    // A different sensor at the address does not acknowledge either
+    mock_i2c_reset(SENSOR_ADDR + 1, 0);
+    CHECK(SCCB_Write_Regs(SENSOR_ADDR, regs, REG_DLY, REGLIST_TAIL, 0) == -1);
+    CHECK(mock_i2c_stats().transactions == 1);
+
+    // An empty table writes nothing
+    mock_i2c_reset(SENSOR_ADDR, 0);
+    CHECK(SCCB_Write_Regs(SENSOR_ADDR, &regs[5], REG_DLY, REGLIST_TAIL, 0) == 0);
+    CHECK(mock_i2c_stats().transactions == 0);
+}
+
+static void test_shadow(void) {
+    static const sccb_shadow_range_t volatile_regs[] = {{0x3500, 0x3502}};
+    sccb_shadow_t *shadow = sccb_shadow_create(volatile_regs, 1);
+    CHECK(shadow);
+    uint8_t value;
+    CHECK(!sccb_shadow_get(shadow, 0x4407, &value));
+    sccb_shadow_set(shadow, 0x4407, 0x0c);
+    CHECK(sccb_shadow_get(shadow, 0x4407, &value) && value == 0x0c);
+    CHECK(sccb_shadow_unchanged(shadow, 0x4407, 0x0c));
+    CHECK(!sccb_shadow_unchanged(shadow, 0x4407, 0x0d));
+    CHECK(!sccb_shadow_unchanged(shadow, 0x4408, 0x00));
+
+    // Volatile registers are never known
+    sccb_shadow_set(shadow, 0x3501, 0x10);
+    CHECK(!sccb_shadow_get(shadow, 0x3501, &value));
+    CHECK(!sccb_shadow_unchanged(shadow, 0x3501, 0x10));
+
+    sccb_shadow_invalidate(shadow, 0x4407);
+    CHECK(!sccb_shadow_get(shadow, 0x4407, &value));
+
+    // A register taking over the slot of another, the other is not mistaken for it
+    sccb_shadow_set(shadow, 0x4407, 0x0c);
+    uint16_t other = 0x4408;
+    while (sccb_shadow_set(shadow, other, 0x55), sccb_shadow_get(shadow, 0x4407, &value)) {
+        other++;
+    }
+    CHECK(sccb_shadow_get(shadow, other, &value) && value == 0x55);
+    CHECK(!sccb_shadow_unchanged(shadow, 0x4407, 0x55));
+
+    static const uint16_t regs[][2] = {
+            {0x3008, 0x82}, {REG_DLY, 10}, {0x3501, 0x02}, {0x3103, 0x11}, {0x3103, 0x13}, {REGLIST_TAIL, 0x00}
+    };
+    sccb_shadow_clear(shadow);
+    sccb_shadow_set_regs(shadow, regs, REG_DLY, REGLIST_TAIL);
+    CHECK(sccb_shadow_get(shadow, 0x3008, &value) && value == 0x82);
+    CHECK(sccb_shadow_get(shadow, 0x3103, &value) && value == 0x13);
+    CHECK(!sccb_shadow_get(shadow, 0x3501, &value));
+    CHECK(!sccb_shadow_get(shadow, REG_DLY, &value));
+    sccb_shadow_delete(shadow);
+
+    // Without a shadow nothing is known
+    sccb_shadow_set(NULL, 0x4407, 0x0c);
+    CHECK(!sccb_shadow_get(NULL, 0x4407, &value));
+    CHECK(!sccb_shadow_unchanged(NULL, 0x4407, 0x0c));
+}
+
+// The read-modify-write of the sensor drivers, going to the bus on a miss
+static int set_reg_bits(sccb_shadow_t *shadow, uint16_t reg, uint8_t mask, int enable) {
+    uint8_t value;
+    if (!sccb_shadow_get(shadow, reg, &value)) {
+        value = SCCB_Read16(SENSOR_ADDR, reg);
+        sccb_shadow_set(shadow, reg, value);
+    }
+    value = enable ? value | mask : value & ~mask;
+    if (sccb_shadow_unchanged(shadow, reg, value)) {
+        return 0;
+    }
+    int ret = SCCB_Write16(SENSOR_ADDR, reg, value);
+    if (!ret) {
+        sccb_shadow_set(shadow, reg, value);
+    }
+    return ret;
+}
+
+// A controller adjusting every frame: flipping a bit, and setting one that is set already
+static void test_shadow_read_modify_write(void) {
+    sccb_shadow_t *shadow = sccb_shadow_create(NULL, 0);
+    CHECK(shadow);
+    mock_i2c_stats_t stats[2];
+    for (int cached = 0; cached < 2; cached++) {
+        mock_i2c_reset(SENSOR_ADDR, MOCK_I2C_ADDR16 | MOCK_I2C_AUTO_INCREMENT);
+        for (int frame = 0; frame < 100; frame++) {
+            CHECK(set_reg_bits(cached ? shadow : NULL, 0x3821, 0x06, frame & 1) == 0);
+            CHECK(set_reg_bits(cached ? shadow : NULL, 0x5000, 0x80, 1) == 0);
+        }
+        CHECK(mock_i2c_registers()[0x3821] == 0x06 && mock_i2c_registers()[0x5000] == 0x80);
+        stats[cached] = mock_i2c_stats();
+    }
+    sccb_shadow_delete(shadow);
+
+    // One read per register, then a write only when the value changes
+    CHECK(stats[1].transactions == 2 * 2 + 100);
+    printf("200 bit updates: %u transactions uncached, %u with the shadow\n",
+           stats[0].transactions, stats[1].transactions);
+}
+
+// The address of the most common sensor is tried first, every address only once
+static void test_probe(void) {
+    mock_i2c_reset(SENSOR_ADDR, 0);
+    CHECK(SCCB_Probe() == SENSOR_ADDR);
+    CHECK(SCCB_Probe_Addr(SENSOR_ADDR) == 0);
+    CHECK(SCCB_Probe_Addr(SENSOR_ADDR + 1) != 0);
+
+    mock_i2c_reset(OV2640_SCCB_ADDR, 0);
+    CHECK(SCCB_Probe() == OV2640_SCCB_ADDR);
+    CHECK(mock_i2c_stats().transactions == 1);
+
+    mock_i2c_reset(0x7f, 0);
+    CHECK(SCCB_Probe() == 0);
+    CHECK(mock_i2c_stats().transactions == 6);
+}
+
+int main(void) {
+    if (SCCB_Init(21, 22) != 0) {
+        fprintf(stderr, "SCCB_Init failed\n");
+        return 1;
+    }
+
+    RUN(test_init_table);
+    RUN(test_delay_order);
+    RUN(test_long_burst);
+    RUN(test_nack);
+    RUN(test_shadow);
+    RUN(test_shadow_read_modify_write);
+    RUN(test_probe);
+
+    SCCB_Deinit();
+    return failures ? 1 : 0;
+}
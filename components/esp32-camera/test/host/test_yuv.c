@@ -0,0 +1,161 @@
+//
+// Golden tests and benchmark for the YUV422 conversion kernels in yuv.c.
+//
+// With SSSE3 or NEON the kernels compute yuv_table instead of looking it up,
+// so they are checked against yuv2rgb() for every possible Y, U and V.
+// test_yuv_table runs the same checks on the table path of the ESP32 targets.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "yuv.h"
+
+static int failures;
+
+#define CHECK(cond) do {                                                    \
+        if (!(cond)) {                                                      \
+            fprintf(stderr, "%s:%d: check failed: %s\n", __FILE__, __LINE__, #cond); \
+            failures++;                                                     \
+            return;                                                         \
+        }                                                                   \
+    } while(0)
+
+#define RUN(test) do {                                                      \
+        int before = failures;                                              \
+        test();                                                             \
+        printf("%s %s\n", failures == before ? "PASS" : "FAIL", #test);     \
+    } while(0)
+
+static double now_s(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Values taken from yuv_table, guards the table itself
+static void test_yuv2rgb_golden(void) {
+    static const uint8_t golden[][6] = {
+            //  Y    U    V    R    G    B
+            {   0, 128, 128,   0,   0,   0 },
+            { 255, 128, 128, 255, 255, 255 },
+            { 128, 128, 128, 130, 130, 130 },
+            {  81,  90, 240, 253,  62,   0 },
+            { 145,  54,  34,   0, 246,   1 },
+            {  41, 240, 110,   1,   0, 255 },
+            { 200,  10, 200, 255, 255,   0 },
+    };
+
+    for (size_t i = 0; i < sizeof(golden) / sizeof(golden[0]); i++) {
+        uint8_t r, g, b;
+        yuv2rgb(golden[i][0], golden[i][1], golden[i][2], &r, &g, &b);
+        CHECK(r == golden[i][3] && g == golden[i][4] && b == golden[i][5]);
+    }
+}
+
+// One line per U/V pair holding every Y value
+static void fill_line(uint8_t *yuyv, uint8_t u, uint8_t v) {
+    for (int i = 0; i < 256; i += 2) {
+        yuyv[2 * i] = i;
+        yuyv[2 * i + 1] = u;
+        yuyv[2 * i + 2] = i + 1;
+        yuyv[2 * i + 3] = v;
+    }
+}
+
+static void test_kernels_exhaustive(void) {
+    uint8_t yuyv[512];
+    uint8_t rgb[768], bgr[768], rgb565[512];
+
+    for (int u = 0; u < 256; u++) {
+        for (int v = 0; v < 256; v++) {
+            fill_line(yuyv, u, v);
+            yuv422_to_rgb888(yuyv, rgb, 256);
+            yuv422_to_bgr888(yuyv, bgr, 256);
+            yuv422_to_rgb565(yuyv, rgb565, 256);
+
+            for (int y = 0; y < 256; y++) {
+                uint8_t r, g, b;
+                yuv2rgb(y, u, v, &r, &g, &b);
+                CHECK(rgb[3 * y] == r && rgb[3 * y + 1] == g && rgb[3 * y + 2] == b);
+                CHECK(bgr[3 * y] == b && bgr[3 * y + 1] == g && bgr[3 * y + 2] == r);
+                CHECK(rgb565[2 * y] == ((r & 0xF8) | (g >> 5)));
+                CHECK(rgb565[2 * y + 1] == (((g << 3) & 0xE0) | (b >> 3)));
+            }
+        }
+    }
+}
+
+// Lengths that are not a multiple of the block size go through the pair loop
+static void test_kernels_tail(void) {
+    uint8_t yuyv[2 * 40];
+    uint8_t expected[3 * 40 + 3], rgb[3 * 40 + 3];
+    for (size_t i = 0; i < sizeof(yuyv); i++) {
+        yuyv[i] = rand();
+    }
+
+    for (size_t count = 0; count <= 40; count += 2) {
+        memset(rgb, 0xA5, sizeof(rgb));
+        memset(expected, 0xA5, sizeof(expected));
+        for (size_t i = 0; i < count; i++) {
+            const uint8_t *pair = yuyv + 4 * (i / 2);
+            yuv2rgb(pair[2 * (i & 1)], pair[1], pair[3], &expected[3 * i], &expected[3 * i + 1], &expected[3 * i + 2]);
+        }
+        yuv422_to_rgb888(yuyv, rgb, count);
+        CHECK(memcmp(rgb, expected, sizeof(rgb)) == 0); // Nothing written past the end either
+    }
+}
+
+// The per pixel loop the converters used before the kernels
+static void reference_to_rgb888(const uint8_t *src, uint8_t *dst, size_t pixel_count) {
+    for (size_t i = 0; i < pixel_count; i += 2) {
+        uint8_t y0 = src[0], u = src[1], y1 = src[2], v = src[3];
+        yuv2rgb(y0, u, v, &dst[0], &dst[1], &dst[2]);
+        yuv2rgb(y1, u, v, &dst[3], &dst[4], &dst[5]);
+        src += 4;
+        dst += 6;
+    }
+}
+
+static void bench(const char *name, void (*convert)(const uint8_t *, uint8_t *, size_t),
+                  const uint8_t *src, uint8_t *dst, size_t width, size_t height) {
+    const int rounds = 20;
+    double start = now_s();
+    for (int round = 0; round < rounds; round++) {
+        for (size_t line = 0; line < height; line++) {
+            convert(src + 2 * width * line, dst + 3 * width * line, width);
+        }
+    }
+    double elapsed = now_s() - start;
+    printf("  %-18s %8.1f MPix/s\n", name, rounds * width * height / elapsed / 1e6);
+}
+
+static void bench_vga(void) {
+    const size_t width = 640, height = 480;
+    uint8_t *src = malloc(width * height * 2);
+    uint8_t *dst = malloc(width * height * 3);
+    for (size_t i = 0; i < width * height * 2; i++) {
+        src[i] = rand();
+    }
+
+    printf("YUV422 to RGB888, VGA:\n");
+    bench("per pixel", reference_to_rgb888, src, dst, width, height);
+    bench("yuv422_to_rgb888", yuv422_to_rgb888, src, dst, width, height);
+    bench("yuv422_to_rgb565", yuv422_to_rgb565, src, dst, width, height);
+
+    free(src);
+    free(dst);
+}
+
+int main(int argc, char **argv) {
+    RUN(test_yuv2rgb_golden);
+    RUN(test_kernels_exhaustive);
+    RUN(test_kernels_tail);
+
+    bench_vga();
+
+    printf("%d failure(s)\n", failures);
+    return failures ? 1 : 0;
+}
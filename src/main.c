@@ -13,12 +13,15 @@
 #include "esp_event.h"
 #include "esp_log.h"
 #include "esp_vfs_fat.h"
+#include "esp_spiffs.h"
 #include "driver/sdmmc_host.h"
 #include  <lwip/apps/sntp.h>
 #include "nvs.h"
 #include "nvs_flash.h"
 #include "sdkconfig.h"
+#include "esp_camera.h"
 #include "esp-rtsp.h"
+#include "esp-recorder.h"
 #include "common.h" 
 
 #define TAG "main"
@@ -27,7 +30,72 @@
 #define WIFI_PASSWORD ""
 
 static app_config_t app_config;
- 
+static esp_recorder_t *recorder;
+
+// Records on motion to the SD card, or to the SPIFFS partition when there is no card
+static void recorder_init(void) {
+    esp_recorder_config_t config = ESP_RECORDER_CONFIG_DEFAULT();
+    esp_motion_config_t motion = ESP_MOTION_CONFIG_DEFAULT();
+    config.motion = &motion;
+
+    esp_vfs_fat_sdmmc_mount_config_t mount_config = {
+            .format_if_mount_failed = false,
+            .max_files = 4,
+            .allocation_unit_size = config.cluster_size,
+    };
+    sdmmc_host_t host = SDMMC_HOST_DEFAULT();
+    sdmmc_slot_config_t slot = SDMMC_SLOT_CONFIG_DEFAULT();
+    slot.width = 1; // The other data lines are camera or LED pins on most boards
+#if CONFIG_IDF_TARGET_ESP32S3
+    slot.clk = GPIO_NUM_39;
+    slot.cmd = GPIO_NUM_38;
+    slot.d0 = GPIO_NUM_40;
+#endif
+    sdmmc_card_t *card;
+    if (esp_vfs_fat_sdmmc_mount("/sdcard", &host, &slot, &mount_config, &card) != ESP_OK) {
+        esp_vfs_spiffs_conf_t spiffs = {
+                .base_path = "/spiffs",
+                .partition_label = NULL,
+                .max_files = 4,
+                .format_if_mount_failed = true,
+        };
+        if (esp_vfs_spiffs_register(&spiffs) != ESP_OK) {
+            ESP_LOGW(TAG, "No SD card and no SPIFFS, not recording");
+            return;
+        }
+        // A few seconds in the 896 KB partition, in small buffers
+        config.directory = "/spiffs";
+        config.cluster_size = 4096;
+        config.buffer_size = 64 * 1024;
+        config.max_file_bytes = 640 * 1024;
+    }
+
+    esp_err_t err = esp_recorder_create(&config, &recorder);
+    if (err != ESP_OK) {
+        ESP_LOGW(TAG, "Recorder not started: %s", esp_err_to_name(err));
+    }
+}
+
+// Brings the camera up while the main task waits for the network, the RTSP server
+// holds DESCRIBE until this is done
+static void camera_boot_task(void *arg) {
+    ESP_LOGD(TAG, "[PRE esp32cam_camera_init] Free internal heap  %d bytes", esp_get_free_internal_heap_size());
+    ESP_ERROR_CHECK(esp32cam_camera_init());
+    esp_timeline_mark("camera ready");
+    ESP_LOGD(TAG, "[POST esp32cam_camera_init] Free internal heap  %d bytes", esp_get_free_internal_heap_size());
+
+    // The first frame is the one the sensor needs the longest for, take it before any client waits on it
+    camera_fb_t *fb = esp_camera_fb_get();
+    if (fb) {
+        esp_timeline_mark(ESP_TIMELINE_FIRST_FRAME);
+        esp_camera_fb_return(fb);
+    }
+
+    esp_rtsp_server_set_source_ready(true);
+    recorder_init();
+    vTaskDelete(NULL);
+}
+
 void app_main() {
     ESP_LOGI(TAG, "[APP] Startup..");
     ESP_LOGI(TAG, "[APP] Free heap memory: %d bytes (%d internal)", esp_get_free_heap_size(), esp_get_free_internal_heap_size());
@@ -40,30 +108,34 @@ void app_main() {
         err = nvs_flash_init();
     }
     ESP_ERROR_CHECK( err );
+    esp_timeline_mark("nvs");
 
-    esp_log_level_set("*", ESP_LOG_VERBOSE);
+    // Streaming health is in the metrics, see esp-metrics.h, the log stays quiet while streaming
+    esp_log_level_set("*", ESP_LOG_INFO);
 
     // Initialize Event Loop
     ESP_ERROR_CHECK(esp_event_loop_create_default());
 
+    // The camera comes up in parallel to the network, clients that are quicker wait for it
+    esp_rtsp_server_set_source_ready(false);
+    xTaskCreate(camera_boot_task, "camera_boot", 4096, NULL, 5, NULL);
+
     // Call our own init functions
     ESP_LOGD(TAG, "[PRE esp32cam_wifi_init] Free internal heap  %d bytes", esp_get_free_internal_heap_size());
     app_config.wifi_config.essid = (unsigned char *)WIFI_NAME;
     app_config.wifi_config.essid_secret = (unsigned char *)WIFI_PASSWORD;
 
     ESP_ERROR_CHECK(esp32cam_wifi_init(&app_config.wifi_config));
+    esp_timeline_mark("network up");
     ESP_LOGD(TAG, "[POST esp32cam_wifi_init] Free internal heap  %d bytes", esp_get_free_internal_heap_size());
 
     ESP_ERROR_CHECK(esp32cam_sntp_init());
     ESP_LOGD(TAG, "[POST esp32cam_sntp_init] Free internal heap  %d bytes", esp_get_free_internal_heap_size());
 
-    ESP_LOGD(TAG, "[PRE esp32cam_camera_init] Free internal heap  %d bytes", esp_get_free_internal_heap_size());
-    ESP_ERROR_CHECK(esp32cam_camera_init());
-    ESP_LOGD(TAG, "[POST esp32cam_camera_init] Free internal heap  %d bytes", esp_get_free_internal_heap_size());
-     
     esp_rtsp_server_handle_t rtsp_server_handle;
     ESP_ERROR_CHECK(esp_rtsp_server_start(&rtsp_server_handle));
     ESP_LOGD(TAG, "[POST esp_rtsp_server_start] Free internal heap  %d bytes", esp_get_free_internal_heap_size());
+    esp_timeline_log();
 }
 
 // pio run -t menuconfig